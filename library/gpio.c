@@ -46,6 +46,11 @@ void gpio_init(void) {
   intc0 = arm_shared_init(&intc0_handle, axi_intc_0, 4096);
 }
 
+void gpio_init_registers(volatile uint32_t *registers) {
+  pynq_info("Initialize on memory");
+  gpio = registers;
+}
+
 void gpio_destroy(void) {
   pynq_info("Destroy");
   arm_shared_close(&gpio_handle);
@@ -111,6 +111,13 @@ extern void gpio_init(void);
  * This releases the memory map and memory allocated by gpio_init.
  */
 extern void gpio_destroy(void);
+/**
+ * Initializes the GPIO library on the given memory instead of the hardware,
+ * so code that uses GPIO runs on a machine without it, e.g. in a host test.
+ * Do not call gpio_destroy afterwards.
+ * @param registers At least 4 words: levels and directions of both banks.
+ */
+extern void gpio_init_registers(volatile uint32_t *registers);
 
 /**
  * @brief Function is currently a no-op placeholder for arduino compatibility.
@@ -21,15 +21,22 @@ SOFTWARE.
 */
 #include "iic.h"
 
+#include <fcntl.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
 #include <platform.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <time.h>
 #include <unistd.h>
 #include <xiic_l.h>
 
 #include "arm_shared_memory_system.h"
+#include "gpio.h"
 #include "log.h"
+#include "switchbox.h"
 
 #define IIC_TIMEOUT 5
 typedef enum {
@@ -106,29 +113,260 @@ static IICHandle iic_handles[NUM_IICS] = {
 #define IIC_REG_SOFT_RESET (0x40)
 #define IIC_SR_MSTR_RDING_SLAVE_MASK 0x00000008
 
-void iic_init(const iic_index_t iic) {
-  if (!(iic >= IIC0 && iic < NUM_IICS)) {
-    pynq_error("invalid IIC %d, must be 0..%d\n", iic, NUM_IICS);
+static const iic_backend_t *selected_backends[NUM_IICS];
+static const iic_backend_t *active_backends[NUM_IICS];
+static XIic_WaitStats wait_stats[NUM_IICS];
+static uint32_t recoveries[NUM_IICS];
+
+#define IIC_RECOVERY_CLOCKS 9       // a slave stuck in a byte lets go of SDA within 9 clocks
+#define IIC_RECOVERY_HALF_CLOCK_US 5  // 100 kHz
+
+/* Open drain by hand: low is driven, high is left to the pull-up */
+static void iic_release_line(const io_t pin) { gpio_set_direction(pin, GPIO_DIR_INPUT); }
+
+static void iic_drive_low(const io_t pin) {
+  gpio_set_direction(pin, GPIO_DIR_OUTPUT);
+  gpio_set_level(pin, GPIO_LEVEL_LOW);
+}
+
+/* Clocks SCL until the slave that holds SDA low lets go, then sends a STOP */
+static void iic_pulse_scl(const iic_index_t iic) {
+  const io_configuration_t scl_function = iic == IIC0 ? SWB_IIC0_SCL : SWB_IIC1_SCL;
+  const io_configuration_t sda_function = iic == IIC0 ? SWB_IIC0_SDA : SWB_IIC1_SDA;
+  io_t scl = IO_NUM_PINS, sda = IO_NUM_PINS;
+  for (io_t pin = 0; pin < IO_NUM_PINS; pin++) {
+    io_configuration_t function = switchbox_get_pin(pin);
+    if (function == scl_function) {
+      scl = pin;
+    } else if (function == sda_function) {
+      sda = pin;
+    }
   }
+  if (scl == IO_NUM_PINS || sda == IO_NUM_PINS || !gpio_is_initialized()) {
+    pynq_warning("IIC%d: SCL and SDA are not routed to pins, only resetting the core\n", iic);
+    return;
+  }
+
+  switchbox_set_pin(scl, SWB_GPIO);
+  switchbox_set_pin(sda, SWB_GPIO);
+  iic_release_line(sda);
+  for (int i = 0; i < IIC_RECOVERY_CLOCKS && gpio_get_level(sda) == GPIO_LEVEL_LOW; i++) {
+    iic_drive_low(scl);
+    usleep(IIC_RECOVERY_HALF_CLOCK_US);
+    iic_release_line(scl);
+    usleep(IIC_RECOVERY_HALF_CLOCK_US);
+  }
+  // STOP: SDA goes high while SCL is high
+  iic_drive_low(scl);
+  iic_drive_low(sda);
+  usleep(IIC_RECOVERY_HALF_CLOCK_US);
+  iic_release_line(scl);
+  usleep(IIC_RECOVERY_HALF_CLOCK_US);
+  iic_release_line(sda);
+  usleep(IIC_RECOVERY_HALF_CLOCK_US);
+  switchbox_set_pin(scl, scl_function);
+  switchbox_set_pin(sda, sda_function);
+}
+
+static bool mmio_init(const iic_index_t iic) {
   if (iic == IIC0) {
     iic_handles[iic].ptr = arm_shared_init(&((iic_handles[iic].mem_handle)), axi_iic_0, 4096);
   } else if (iic == IIC1) {
     iic_handles[iic].ptr = arm_shared_init(&((iic_handles[iic].mem_handle)), axi_iic_1, 4096);
   }
+  if (iic_handles[iic].ptr == NULL) {
+    return 1;
+  }
   // Reset
   (iic_handles[iic].ptr[IIC_REG_SOFT_RESET / 4]) = 0xA;
   usleep(1000);
+  XIic_SetWaitStats((UINTPTR)iic_handles[iic].ptr, &wait_stats[iic]);
+  return 0;
+}
+
+static void mmio_destroy(const iic_index_t iic) {
+  XIic_SetWaitStats((UINTPTR)iic_handles[iic].ptr, NULL);
+  arm_shared_close(&((iic_handles[iic].mem_handle)));
+  iic_handles[iic].ptr = NULL;
+}
+
+/* A missing slave only NAKs, a bus that stays busy after a failed transfer is held by a stuck slave */
+static void mmio_recover_if_stuck(const iic_index_t iic) {
+  if (XIic_CheckIsBusBusy((UINTPTR)iic_handles[iic].ptr) && XIic_WaitBusFree((UINTPTR)iic_handles[iic].ptr) != XST_SUCCESS) {
+    iic_recover(iic);
+  }
+}
+
+/* Index just behind the message that starts at segment first */
+static uint8_t iic_message_end(const iic_segment_t *segments, const uint8_t count, const uint8_t first) {
+  const uint8_t direction = segments[first].flags & IIC_SEGMENT_READ;
+  uint8_t end = first + 1;
+  while (end < count && !(segments[end].flags & IIC_SEGMENT_RESTART) && (segments[end].flags & IIC_SEGMENT_READ) == direction) {
+    end++;
+  }
+  return end;
+}
+
+/* Every message goes to the core straight from the segments, writes are gathered byte by byte into the TX FIFO */
+static bool mmio_transfer(const iic_index_t iic, const uint8_t addr, const iic_segment_t *segments, const uint8_t count) {
+  const UINTPTR base = (UINTPTR)iic_handles[iic].ptr;
+  for (uint8_t first = 0; first < count;) {
+    const uint8_t end = iic_message_end(segments, count, first);
+    const u8 option = end == count ? XIIC_STOP : XIIC_REPEATED_START;
+    XIic_Vec vec[IIC_MAX_SEGMENTS];
+    unsigned length = 0;
+    for (uint8_t i = first; i < end; i++) {
+      vec[i - first] = (XIic_Vec){segments[i].data, segments[i].length};
+      length += segments[i].length;
+    }
+    unsigned done = (segments[first].flags & IIC_SEGMENT_READ)
+                        ? XIic_Recv(base, addr, segments[first].data, length, option)
+                        : XIic_SendVec(base, addr, vec, end - first, option);
+    if (done != length) {
+      mmio_recover_if_stuck(iic);
+      return 1;
+    }
+    first = end;
+  }
+  return 0;
+}
+
+const iic_backend_t iic_backend_mmio = {
+    .name = "mmio",
+    .init = mmio_init,
+    .destroy = mmio_destroy,
+    .transfer = mmio_transfer,
+};
+
+#define I2CDEV_GATHER_MAX 260  // a register byte and a full bank of 256 registers, with room to spare
+static int i2cdev_fds[NUM_IICS] = {-1, -1};
+static bool i2cdev_nostart[NUM_IICS];
+static const char *i2cdev_paths[NUM_IICS];
+
+void iic_set_device(const iic_index_t iic, const char *path) {
+  if (!(iic >= IIC0 && iic < NUM_IICS)) {
+    pynq_error("invalid IIC %d, must be 0..%d-1\n", iic, NUM_IICS);
+  }
+  i2cdev_paths[iic] = path;
+}
+
+static bool i2cdev_init(const iic_index_t iic) {
+  char path[32];
+  const char *configured = i2cdev_paths[iic];
+  if (configured == NULL) {
+    snprintf(path, sizeof(path), "PYNQ_IIC%d_DEVICE", iic);
+    configured = getenv(path);
+  }
+  if (configured == NULL) {
+    snprintf(path, sizeof(path), "/dev/i2c-%d", iic);
+    configured = path;
+  }
+  i2cdev_fds[iic] = open(configured, O_RDWR);
+  if (i2cdev_fds[iic] < 0) {
+    pynq_warning("IIC%d: cannot open %s\n", iic, configured);
+    return 1;
+  }
+  unsigned long functions = 0;
+  i2cdev_nostart[iic] = ioctl(i2cdev_fds[iic], I2C_FUNCS, &functions) == 0 && (functions & I2C_FUNC_NOSTART);
+  return 0;
+}
+
+static void i2cdev_destroy(const iic_index_t iic) {
+  close(i2cdev_fds[iic]);
+  i2cdev_fds[iic] = -1;
+}
+
+/*
+ * All messages go to the kernel as one combined transfer. A message of several segments becomes one i2c_msg per
+ * segment chained with I2C_M_NOSTART when the adapter can do that, and is gathered into a buffer on the stack when it
+ * cannot, at most I2CDEV_GATHER_MAX bytes for all gathered messages together.
+ */
+static bool i2cdev_transfer(const iic_index_t iic, const uint8_t addr, const iic_segment_t *segments, const uint8_t count) {
+  struct i2c_msg messages[IIC_MAX_SEGMENTS];
+  uint8_t gathered[I2CDEV_GATHER_MAX];
+  size_t gathered_length = 0;
+  uint8_t message_count = 0;
+  for (uint8_t first = 0; first < count;) {
+    const uint8_t end = iic_message_end(segments, count, first);
+    const uint16_t flags = (segments[first].flags & IIC_SEGMENT_READ) ? I2C_M_RD : 0;
+    if (end - first == 1 || i2cdev_nostart[iic]) {
+      for (uint8_t i = first; i < end; i++) {
+        messages[message_count++] = (struct i2c_msg){
+            .addr = addr, .flags = flags | (i > first ? I2C_M_NOSTART : 0), .len = segments[i].length, .buf = segments[i].data};
+      }
+    } else {
+      uint8_t *buffer = &gathered[gathered_length];
+      for (uint8_t i = first; i < end; i++) {
+        if (gathered_length + segments[i].length > sizeof(gathered)) {
+          pynq_warning("IIC%d: message to 0x%02x is longer than %d bytes\n", iic, addr, I2CDEV_GATHER_MAX);
+          return 1;
+        }
+        memcpy(&gathered[gathered_length], segments[i].data, segments[i].length);
+        gathered_length += segments[i].length;
+      }
+      messages[message_count++] =
+          (struct i2c_msg){.addr = addr, .flags = flags, .len = &gathered[gathered_length] - buffer, .buf = buffer};
+    }
+    first = end;
+  }
+  struct i2c_rdwr_ioctl_data transfer = {.msgs = messages, .nmsgs = message_count};
+  return ioctl(i2cdev_fds[iic], I2C_RDWR, &transfer) != message_count;
+}
+
+const iic_backend_t iic_backend_i2cdev = {
+    .name = "i2cdev",
+    .init = i2cdev_init,
+    .destroy = i2cdev_destroy,
+    .transfer = i2cdev_transfer,
+};
+
+const iic_backend_t *iic_backend_by_name(const char *name) {
+  const iic_backend_t *backends[] = {&iic_backend_mmio, &iic_backend_i2cdev};
+  for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+    if (strcmp(name, backends[i]->name) == 0) {
+      return backends[i];
+    }
+  }
+  return NULL;
+}
+
+void iic_set_backend(const iic_index_t iic, const iic_backend_t *backend) {
+  if (!(iic >= IIC0 && iic < NUM_IICS)) {
+    pynq_error("invalid IIC %d, must be 0..%d-1\n", iic, NUM_IICS);
+  }
+  if (active_backends[iic] != NULL) {
+    pynq_error("IIC%d is initialized, select its backend before iic_init.\n", iic);
+  }
+  selected_backends[iic] = backend;
+}
+
+void iic_init(const iic_index_t iic) {
+  if (!(iic >= IIC0 && iic < NUM_IICS)) {
+    pynq_error("invalid IIC %d, must be 0..%d\n", iic, NUM_IICS);
+  }
+  const iic_backend_t *backend = selected_backends[iic];
+  if (backend == NULL) {
+    const char *name = getenv("PYNQ_IIC_BACKEND");
+    backend = name != NULL ? iic_backend_by_name(name) : &iic_backend_mmio;
+    if (backend == NULL) {
+      pynq_error("unknown IIC backend %s, must be mmio or i2cdev\n", name);
+    }
+  }
+  if (backend->init(iic)) {
+    pynq_error("IIC%d: initializing the %s backend failed\n", iic, backend->name);
+  }
+  active_backends[iic] = backend;
 }
 
 void iic_destroy(const iic_index_t iic) {
   if (!(iic >= IIC0 && iic < NUM_IICS)) {
     pynq_error("invalid IIC %d, must be 0..%d-1\n", iic, NUM_IICS);
   }
-  if (iic_handles[iic].ptr == NULL) {
+  if (active_backends[iic] == NULL) {
     pynq_error("IIC%d has not been initialized.\n", iic);
   }
-  arm_shared_close(&((iic_handles[iic].mem_handle)));
-  iic_handles[iic].ptr = NULL;
+  active_backends[iic]->destroy(iic);
+  active_backends[iic] = NULL;
 }
 
 bool iic_set_slave_mode(const iic_index_t iic, const uint8_t addr, uint32_t *register_map, const uint32_t rm_length) {
@@ -206,12 +444,13 @@ static void iic_slave_master_read(const iic_index_t iic) {
   }
 };
 static void iic_interrupt_handle(const iic_index_t iic) {
-  time_t start = time(NULL);
   IICHandle *handle = &(iic_handles[iic]);
+  // The timeout counts from the last byte exchanged with the master
+  XIic_Wait wait;
+  XIic_WaitStart((UINTPTR)handle->ptr, &wait, IIC_TIMEOUT * 1000000);
   int loop = 1;
   uint32_t sr_reg = (handle->ptr[IIC_SR_REG_OFFSET / 4]);
   do {
-    time_t now = time(NULL);
     uint32_t nisr = (handle->ptr[IIC_IISR_OFFSET / 4]);
     uint32_t clear = 0;
     uint32_t isr = 0;
@@ -241,7 +480,7 @@ static void iic_interrupt_handle(const iic_index_t iic) {
           // FALLTHROUGH
         case IIC_WRITE:
           iic_slave_master_write(iic, d);
-          start = now;
+          XIic_WaitStart((UINTPTR)handle->ptr, &wait, IIC_TIMEOUT * 1000000);
           break;
         default:
           pynq_warning("unhandled");
@@ -264,13 +503,14 @@ static void iic_interrupt_handle(const iic_index_t iic) {
       if (handle->state == IIC_ADDRESS || handle->state == IIC_WRITE) {
         if (sr_reg & IIC_SR_MSTR_RDING_SLAVE_MASK) {
           iic_slave_master_read(iic);
-          start = now;
+          XIic_WaitStart((UINTPTR)handle->ptr, &wait, IIC_TIMEOUT * 1000000);
         }
       }
       clear = isr & (IIC_INTR_TX_EMPTY_MASK | IIC_INTR_TX_HALF_MASK);
     }
 
-    if ((now - start) > IIC_TIMEOUT) {
+    // Nothing to handle: spin, then back off, until the timeout
+    if (clear == 0 && !XIic_WaitPoll(&wait)) {
       pynq_warning("IIC timeout, resetting bus.");
       iic_reset(iic);
       iic_clear_isr_mask(iic, 0xFF);
@@ -313,30 +553,100 @@ void iic_reset(const iic_index_t iic) {
   iic_handles[iic].ptr[IIC_CR_REG_OFFSET / 4] = reg & ~IIC_CR_REPEATED_START_MASK;
 }
 
-bool iic_read_register(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+static void iic_check_active(const iic_index_t iic) {
   if (!(iic >= IIC0 && iic < NUM_IICS)) {
     pynq_error("invalid IIC %d, must be 0..%d-1\n", iic, NUM_IICS);
   }
-  if (iic_handles[iic].ptr == NULL) {
+  if (active_backends[iic] == NULL) {
     pynq_error("IIC%d has not been initialized.\n", iic);
   }
-  if (XIic_Send((UINTPTR)iic_handles[iic].ptr, addr, (u8 *)&reg, 1, XIIC_REPEATED_START) != 1) {
-    return 1;
+}
+
+bool iic_read_register(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  iic_check_active(iic);
+  const iic_backend_t *backend = active_backends[iic];
+  if (backend->transfer == NULL) {
+    return backend->read_register(iic, addr, reg, data, data_length);
   }
-  uint8_t ByteCount = XIic_Recv((UINTPTR)iic_handles[iic].ptr, addr, data, data_length, XIIC_STOP);
-  return (ByteCount == data_length) ? 0 : 1;
+  uint8_t reg_byte = reg;
+  const iic_segment_t segments[2] = {{&reg_byte, 1, IIC_SEGMENT_WRITE}, {data, data_length, IIC_SEGMENT_READ}};
+  return backend->transfer(iic, addr, segments, 2);
 }
 
 bool iic_write_register(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  iic_check_active(iic);
+  const iic_backend_t *backend = active_backends[iic];
+  if (backend->transfer == NULL) {
+    return backend->write_register(iic, addr, reg, data, data_length);
+  }
+  uint8_t reg_byte = reg;
+  const iic_segment_t segments[2] = {{&reg_byte, 1, IIC_SEGMENT_WRITE}, {data, data_length, IIC_SEGMENT_WRITE}};
+  return backend->transfer(iic, addr, segments, data_length > 0 ? 2 : 1);
+}
+
+bool iic_transfer(const iic_index_t iic, const uint8_t addr, const iic_segment_t *segments, const uint8_t count) {
+  iic_check_active(iic);
+  if (count == 0 || count > IIC_MAX_SEGMENTS) {
+    pynq_warning("IIC%d: %d segments, must be 1..%d\n", iic, count, IIC_MAX_SEGMENTS);
+    return 1;
+  }
+  for (uint8_t first = 0; first < count;) {
+    const uint8_t end = iic_message_end(segments, count, first);
+    uint32_t length = 0;
+    for (uint8_t i = first; i < end; i++) {
+      length += segments[i].length;
+    }
+    if (length == 0 || ((segments[first].flags & IIC_SEGMENT_READ) && end - first > 1)) {
+      pynq_warning("IIC%d: the message at segment %d is empty or a read split over segments\n", iic, first);
+      return 1;
+    }
+    first = end;
+  }
+
+  const iic_backend_t *backend = active_backends[iic];
+  if (backend->transfer != NULL) {
+    return backend->transfer(iic, addr, segments, count);
+  }
+  // Register accesses are all a backend without transfer knows
+  const iic_segment_t *reg = &segments[0];
+  if (reg->flags & IIC_SEGMENT_READ) {
+    return 1;
+  }
+  if (count == 1) {
+    return backend->write_register(iic, addr, reg->data[0], reg->data + 1, reg->length - 1);
+  }
+  if (count == 2 && reg->length == 1) {
+    const iic_segment_t *data = &segments[1];
+    if (data->flags & IIC_SEGMENT_READ) {
+      return backend->read_register(iic, addr, reg->data[0], data->data, data->length);
+    }
+    if (!(data->flags & IIC_SEGMENT_RESTART)) {
+      return backend->write_register(iic, addr, reg->data[0], data->data, data->length);
+    }
+  }
+  return 1;
+}
+
+bool iic_recover(const iic_index_t iic) {
   if (!(iic >= IIC0 && iic < NUM_IICS)) {
     pynq_error("invalid IIC %d, must be 0..%d-1\n", iic, NUM_IICS);
   }
-  if (iic_handles[iic].ptr == NULL) {
-    pynq_error("IIC%d has not been initialized.\n", iic);
+  if (active_backends[iic] != &iic_backend_mmio) {
+    return 1;
+  }
+  pynq_warning("IIC%d: bus stuck, recovering\n", iic);
+  iic_pulse_scl(iic);
+  iic_reset(iic);
+  recoveries[iic]++;
+  return XIic_CheckIsBusBusy((UINTPTR)iic_handles[iic].ptr) ? 1 : 0;
+}
+
+iic_stats_t iic_get_stats(const iic_index_t iic) {
+  if (!(iic >= IIC0 && iic < NUM_IICS)) {
+    pynq_error("invalid IIC %d, must be 0..%d-1\n", iic, NUM_IICS);
   }
-  uint8_t buffer[1 + data_length];
-  buffer[0] = reg;
-  memcpy(&(buffer[1]), data, data_length);
-  uint8_t ByteCount = XIic_Send((UINTPTR)iic_handles[iic].ptr, addr, &(buffer[0]), 1 + data_length, XIIC_STOP);
-  return (ByteCount == (data_length + 1)) ? 0 : 1;
+  return (iic_stats_t){.spins = wait_stats[iic].Spins,
+                       .backoffs = wait_stats[iic].Backoffs,
+                       .timeouts = wait_stats[iic].Timeouts,
+                       .recoveries = recoveries[iic]};
 }
@@ -113,9 +113,85 @@ SOFTWARE.
  */
 typedef enum { IIC0 = 0, IIC1 = 1, NUM_IICS = 2 } iic_index_t;
 
+/**
+ * @brief One buffer of an iic_transfer.
+ *
+ * Consecutive segments in the same direction form one message, the buffers are
+ * sent or filled back to back. A segment with IIC_SEGMENT_RESTART, or one that
+ * changes direction, starts a new message behind a repeated start. The last
+ * message ends with a STOP. A read message is a single segment.
+ */
+typedef struct {
+  uint8_t *data;    ///< bytes to send, or room for the bytes read
+  uint16_t length;  ///< amount of bytes
+  uint8_t flags;    ///< IIC_SEGMENT_WRITE or IIC_SEGMENT_READ, optionally | IIC_SEGMENT_RESTART
+} iic_segment_t;
+
+#define IIC_SEGMENT_WRITE 0x00
+#define IIC_SEGMENT_READ 0x01
+#define IIC_SEGMENT_RESTART 0x02
+#define IIC_MAX_SEGMENTS 8
+
+/**
+ * @brief Implementation behind iic_init, iic_destroy, iic_read_register,
+ * iic_write_register and iic_transfer. Slave mode and iic_reset only exist for the MMIO backend.
+ *
+ * A host program can pass its own, e.g. an in-memory register file, to
+ * iic_set_backend and use the IIC functions without any hardware.
+ */
+typedef struct {
+  const char *name;
+  /** @return 0 if successful, 1 on error */
+  bool (*init)(const iic_index_t iic);
+  void (*destroy)(const iic_index_t iic);
+  bool (*read_register)(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t length);
+  bool (*write_register)(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t length);
+  /** Optional, when set it also carries iic_read_register and iic_write_register and those two may be NULL */
+  bool (*transfer)(const iic_index_t iic, const uint8_t addr, const iic_segment_t *segments, const uint8_t count);
+} iic_backend_t;
+
+/**
+ * @brief The AXI IIC core through /dev/mem, the CPU polls the FIFOs during a
+ * transfer. The default.
+ */
+extern const iic_backend_t iic_backend_mmio;
+
+/**
+ * @brief The Linux i2c-dev driver: every transfer is one I2C_RDWR ioctl and
+ * the CPU sleeps while the kernel drives the bus.
+ */
+extern const iic_backend_t iic_backend_i2cdev;
+
+/**
+ * @param name "mmio" or "i2cdev".
+ * @brief Looks up a built-in backend.
+ * @return The backend, NULL if there is none with that name.
+ */
+extern const iic_backend_t *iic_backend_by_name(const char *name);
+
+/**
+ * @param iic The IIC index.
+ * @param backend The backend to use from the next iic_init on.
+ * @brief Selects the backend of an IIC. Without a call the environment
+ * variable PYNQ_IIC_BACKEND ("mmio" or "i2cdev") decides, and otherwise the
+ * MMIO backend is used.
+ * @warning Fails with program exit if the IIC channel is outside valid range
+ * or when the IIC is initialized.
+ */
+extern void iic_set_backend(const iic_index_t iic, const iic_backend_t *backend);
+
+/**
+ * @param iic The IIC index.
+ * @param path The i2c-dev device node of the IIC, e.g. "/dev/i2c-1".
+ * @brief Sets the device node the i2c-dev backend opens. Without a call the
+ * environment variable PYNQ_IIC0_DEVICE or PYNQ_IIC1_DEVICE decides, and
+ * otherwise /dev/i2c-<iic>.
+ */
+extern void iic_set_device(const iic_index_t iic, const char *path);
+
 /**
  * @param uart The IIC index to initialize.
- * @brief Initialize the IIC specified by the index with a shared memory handle
+ * @brief Initialize the IIC specified by the index with its backend, for MMIO a shared memory handle
  * and a buffer size of 4096 bytes.
  * @warning Fails with program exit if the IIC channel is outside valid range
  * or when the shared memory system has not been instantiated.
@@ -155,6 +231,26 @@ extern bool iic_read_register(const iic_index_t iic, const uint8_t addr, const u
  */
 extern bool iic_write_register(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t length);
 
+/**
+ * @param iic The IIC index of the hardware to use.
+ * @param addr The IIC address of the client to access.
+ * @param segments The buffers to send and receive, see iic_segment_t.
+ * @param count The amount of segments, 1..IIC_MAX_SEGMENTS.
+ *
+ * Runs the segments as one bus transaction, straight from and into the
+ * caller's buffers. E.g. a register write is the register address followed by
+ * the payload, a register read the register address followed by a read:
+ * @code
+ * uint8_t reg = 0x80;
+ * iic_segment_t segments[] = {{&reg, 1, IIC_SEGMENT_WRITE}, {data, 16, IIC_SEGMENT_READ}};
+ * iic_transfer(IIC0, 0x29, segments, 2);
+ * @endcode
+ * Backends without a transfer function only take these two shapes.
+ *
+ * @return 0 if successful, 1 on error
+ */
+extern bool iic_transfer(const iic_index_t iic, const uint8_t addr, const iic_segment_t *segments, const uint8_t count);
+
 extern bool iic_set_slave_mode(const iic_index_t iic, const uint8_t addr, uint32_t *register_map, const uint32_t rm_length);
 
 /**
@@ -165,6 +261,33 @@ extern bool iic_set_slave_mode(const iic_index_t iic, const uint8_t addr, uint32
  */
 extern void iic_slave_mode_handler(const iic_index_t iic);
 
+/**
+ * @brief Health counters of an IIC.
+ */
+typedef struct {
+  uint32_t spins;       ///< status polls that did not show the awaited state yet
+  uint32_t backoffs;    ///< sleeps after spinning, slow slaves or clock stretching
+  uint32_t timeouts;    ///< waits abandoned at their deadline
+  uint32_t recoveries;  ///< times iic_recover ran
+} iic_stats_t;
+
+/**
+ * @param iic The IIC index of the hardware to use.
+ * @brief Frees a bus that a slave holds down: SCL is clocked as GPIO until SDA
+ * is released, a STOP is sent and the core is reset with iic_reset. Runs by
+ * itself when a transfer fails and the bus stays busy. Only the MMIO backend
+ * needs it, the kernel driver recovers its own bus.
+ * @return 0 if the bus is free afterwards, 1 otherwise
+ */
+extern bool iic_recover(const iic_index_t iic);
+
+/**
+ * @param iic The IIC index of the hardware to use.
+ * @brief Counters of the MMIO backend waits since iic_init, all 0 for the
+ * other backends.
+ */
+extern iic_stats_t iic_get_stats(const iic_index_t iic);
+
 /**
  * @param iic The IIC index of the hardware to use.
  * Return the IIC module into its default mode.
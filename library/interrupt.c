@@ -58,6 +58,11 @@ int gpio_interrupt_init(void) {
   return fd;
 }
 
+void gpio_interrupt_init_registers(volatile uint32_t *registers) {
+  intc0 = (uint32_t *)registers;
+  gpio_initialized = true;
+}
+
 void gpio_enable_interrupt(const io_t pin) {
   check_initialization();
   int pin_bank = pin % 32;
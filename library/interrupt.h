@@ -71,6 +71,14 @@ SOFTWARE.
 
 extern int gpio_interrupt_init(void);
 
+/**
+ * @brief Enables interrupts on the given memory instead of the interrupt
+ * controller, see gpio_init_registers.
+ * @param registers At least 4 words: the enabled pins and the interrupt words
+ * of both banks.
+ */
+extern void gpio_interrupt_init_registers(volatile uint32_t *registers);
+
 /**
  * @brief acknowledges the raised interrupts and resets the interrupt word.
  * Allows new interrupts to occur on the previously triggered pins.
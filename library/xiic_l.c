@@ -63,6 +63,8 @@
  * 3.3   als  06/27/16 Added low-level XIic_WaitBusFree API.
  * 3.4	nk   16/11/16 Reduced sleeping time in Bus-busy check.
  * 3.5   sd   08/29/18 Fix bus busy check for the NACK case.
+ *            Every status poll goes through a timed wait with backoff and a
+ *            deadline, so a stuck slave cannot hang the caller.
  * </pre>
  *
  ****************************************************************************/
@@ -73,8 +75,6 @@
 #include <time.h>
 #include <unistd.h>
 
-#define IIC_TIMEOUT 5
-
 #include "xiic_l.h"
 #include "xil_types.h"
 
@@ -87,10 +87,136 @@
 /************************** Function Prototypes ****************************/
 
 static unsigned RecvData(UINTPTR BaseAddress, u8 *BufferPtr, unsigned ByteCount, u8 Option);
-static unsigned SendData(UINTPTR BaseAddress, u8 *BufferPtr, unsigned ByteCount, u8 Option);
+static unsigned SendData(UINTPTR BaseAddress, const XIic_Vec *Vec, unsigned VecCount, u8 Option);
 
 /************************** Variable Definitions **************************/
 
+static struct {
+  UINTPTR BaseAddress;
+  XIic_WaitStats *Stats;
+} WaitStatsTable[XIIC_MAX_WAIT_STATS];
+
+/****************************************************************************/
+/**
+ * Counts the waits of the IIC core at BaseAddress in Stats. Call before the
+ * core is used, it is not synchronised with running transfers.
+ *
+ * @param	BaseAddress contains the base address of the IIC device.
+ * @param	Stats points to the counters, NULL to stop counting.
+ *
+ * @return	None.
+ *
+ ******************************************************************************/
+void XIic_SetWaitStats(UINTPTR BaseAddress, XIic_WaitStats *Stats) {
+  int Free = -1;
+  for (int i = 0; i < XIIC_MAX_WAIT_STATS; i++) {
+    if (WaitStatsTable[i].BaseAddress == BaseAddress) {
+      WaitStatsTable[i].Stats = Stats;
+      return;
+    }
+    if (Free < 0 && WaitStatsTable[i].Stats == NULL) {
+      Free = i;
+    }
+  }
+  if (Free >= 0) {
+    WaitStatsTable[Free].BaseAddress = BaseAddress;
+    WaitStatsTable[Free].Stats = Stats;
+  }
+}
+
+/****************************************************************************/
+/**
+ * Starts a timed wait, poll with XIic_WaitPoll until the awaited state shows.
+ * Only fills in Wait, a wait that is over before it has to sleep costs no
+ * more than its polls.
+ *
+ * @param	BaseAddress contains the base address of the IIC device.
+ * @param	Wait points to the state of the wait.
+ * @param	TimeoutUs is the deadline in microseconds, counted from the
+ *		end of the spins.
+ *
+ * @return	None.
+ *
+ ******************************************************************************/
+void XIic_WaitStart(UINTPTR BaseAddress, XIic_Wait *Wait, u32 TimeoutUs) {
+  Wait->BaseAddress = BaseAddress;
+  Wait->TimeoutUs = TimeoutUs;
+  Wait->Polls = 0;
+  Wait->SleepNs = XIIC_WAIT_BACKOFF_MIN_NS;
+  Wait->Stats = NULL;
+}
+
+static XIic_WaitStats *WaitStatsOf(UINTPTR BaseAddress) {
+  for (int i = 0; i < XIIC_MAX_WAIT_STATS; i++) {
+    if (WaitStatsTable[i].BaseAddress == BaseAddress) {
+      return WaitStatsTable[i].Stats;
+    }
+  }
+  return NULL;
+}
+
+static void WaitSetDeadline(XIic_Wait *Wait) {
+  clock_gettime(CLOCK_MONOTONIC, &Wait->Deadline);
+  Wait->Deadline.tv_sec += Wait->TimeoutUs / 1000000;
+  Wait->Deadline.tv_nsec += (Wait->TimeoutUs % 1000000) * 1000L;
+  if (Wait->Deadline.tv_nsec >= 1000000000L) {
+    Wait->Deadline.tv_sec++;
+    Wait->Deadline.tv_nsec -= 1000000000L;
+  }
+}
+
+/****************************************************************************/
+/**
+ * Call after every poll that did not show the awaited state yet. Returns at
+ * once for the first XIIC_WAIT_SPINS polls, then sleeps with exponential
+ * backoff. The clock is only read once sleeping, so a healthy transfer
+ * never reads it.
+ *
+ * @param	Wait points to the state of the wait.
+ *
+ * @return
+ *		- TRUE if the caller should poll again.
+ *		- FALSE once the deadline passed.
+ *
+ ******************************************************************************/
+int XIic_WaitPoll(XIic_Wait *Wait) {
+  if (Wait->Polls == 0) {
+    Wait->Stats = WaitStatsOf(Wait->BaseAddress);
+  }
+  if (Wait->Polls < XIIC_WAIT_SPINS) {
+    Wait->Polls++;
+    if (Wait->Stats != NULL) {
+      Wait->Stats->Spins++;
+    }
+    return TRUE;
+  }
+  if (Wait->Polls == XIIC_WAIT_SPINS) {
+    Wait->Polls++;
+    WaitSetDeadline(Wait);
+  }
+  struct timespec Now;
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  if (Now.tv_sec > Wait->Deadline.tv_sec ||
+      (Now.tv_sec == Wait->Deadline.tv_sec && Now.tv_nsec >= Wait->Deadline.tv_nsec)) {
+    if (Wait->Stats != NULL) {
+      Wait->Stats->Timeouts++;
+    }
+    return FALSE;
+  }
+  struct timespec Sleep = {.tv_sec = 0, .tv_nsec = Wait->SleepNs};
+  nanosleep(&Sleep, NULL);
+  if (Wait->SleepNs < XIIC_WAIT_BACKOFF_MAX_NS) {
+    Wait->SleepNs *= 2;
+    if (Wait->SleepNs > XIIC_WAIT_BACKOFF_MAX_NS) {
+      Wait->SleepNs = XIIC_WAIT_BACKOFF_MAX_NS;
+    }
+  }
+  if (Wait->Stats != NULL) {
+    Wait->Stats->Backoffs++;
+  }
+  return TRUE;
+}
+
 /****************************************************************************/
 /**
  * Receive data as a master on the IIC bus.  This function receives the data
@@ -158,9 +284,15 @@ unsigned XIic_Recv(UINTPTR BaseAddress, u8 Address, u8 *BufferPtr, unsigned Byte
     /* Clear the latched interrupt status for the bus not busy bit
      * which must be done while the bus is busy
      */
+    XIic_Wait Wait;
+    XIic_WaitStart(BaseAddress, &Wait, XIIC_BYTE_TIMEOUT_US);
     StatusReg = XIic_ReadReg(BaseAddress, XIIC_SR_REG_OFFSET);
 
     while ((StatusReg & XIIC_SR_BUS_BUSY_MASK) == 0) {
+      if (!XIic_WaitPoll(&Wait)) {
+        XIic_WriteReg(BaseAddress, XIIC_CR_REG_OFFSET, 0);
+        return 0;
+      }
       StatusReg = XIic_ReadReg(BaseAddress, XIIC_SR_REG_OFFSET);
     }
 
@@ -222,8 +354,8 @@ unsigned XIic_Recv(UINTPTR BaseAddress, u8 Address, u8 *BufferPtr, unsigned Byte
  * @note
  *
  * This function does not take advantage of the receive FIFO because it is
- * designed for minimal code space and complexity.  It contains loops that
- * that could cause the function not to return if the hardware is not working.
+ * designed for minimal code space and complexity.  Its loops give up after
+ * XIIC_BYTE_TIMEOUT_US per byte if the hardware is not working.
  *
  * This function assumes that the calling function will disable the IIC device
  * after this function returns.
@@ -233,6 +365,7 @@ static unsigned RecvData(UINTPTR BaseAddress, u8 *BufferPtr, unsigned ByteCount,
   u32 CntlReg;
   u32 IntrStatusMask;
   u32 IntrStatus;
+  XIic_Wait Wait;
 
   /* Attempt to receive the specified number of bytes on the IIC bus */
 
@@ -252,6 +385,7 @@ static unsigned RecvData(UINTPTR BaseAddress, u8 *BufferPtr, unsigned ByteCount,
      * complete by checking the interrupt status register of the
      * IPIF
      */
+    XIic_WaitStart(BaseAddress, &Wait, XIIC_BYTE_TIMEOUT_US);
     while (1) {
       IntrStatus = XIic_ReadIisr(BaseAddress);
       if (IntrStatus & XIIC_INTR_RX_FULL_MASK) {
@@ -262,7 +396,7 @@ static unsigned RecvData(UINTPTR BaseAddress, u8 *BufferPtr, unsigned ByteCount,
        * will occur because of the no ack to indicate the end
        * of the data
        */
-      if (IntrStatus & IntrStatusMask) {
+      if ((IntrStatus & IntrStatusMask) || !XIic_WaitPoll(&Wait)) {
         return ByteCount;
       }
     }
@@ -324,10 +458,12 @@ static unsigned RecvData(UINTPTR BaseAddress, u8 *BufferPtr, unsigned ByteCount,
      * wait for the bus to transition to not busy before returning,
      * the IIC device cannot be disabled until this occurs. It
      * should transition as the MSMS bit of the control register was
-     * cleared before the last byte was read from the FIFO
+     * cleared before the last byte was read from the FIFO. A bus
+     * that stays busy is caught by XIic_WaitBusFree in XIic_Recv.
      */
-    while (1) {
-      if (XIic_ReadIisr(BaseAddress) & XIIC_INTR_BNB_MASK) {
+    XIic_WaitStart(BaseAddress, &Wait, XIIC_BYTE_TIMEOUT_US);
+    while ((XIic_ReadIisr(BaseAddress) & XIIC_INTR_BNB_MASK) == 0) {
+      if (!XIic_WaitPoll(&Wait)) {
         break;
       }
     }
@@ -357,10 +493,39 @@ static unsigned RecvData(UINTPTR BaseAddress, u8 *BufferPtr, unsigned ByteCount,
  *
  ******************************************************************************/
 unsigned XIic_Send(UINTPTR BaseAddress, u8 Address, u8 *BufferPtr, unsigned ByteCount, u8 Option) {
+  XIic_Vec Vec = {BufferPtr, ByteCount};
+
+  return XIic_SendVec(BaseAddress, Address, &Vec, 1, Option);
+}
+
+/****************************************************************************/
+/**
+ * Send data gathered from several buffers as a master on the IIC bus, as one
+ * message. This avoids copying e.g. a register address and its payload into
+ * one buffer first. Otherwise the same as XIic_Send.
+ *
+ * @param	BaseAddress contains the base address of the IIC device.
+ * @param	Address contains the 7 bit IIC address of the device to send the
+ *		specified data to.
+ * @param	Vec points to the buffers to be sent, in order.
+ * @param	VecCount is the number of buffers.
+ * @param	Option indicates whether to hold or free the bus after
+ * 		transmitting the data.
+ *
+ * @return	The number of bytes sent.
+ *
+ * @note		None.
+ *
+ ******************************************************************************/
+unsigned XIic_SendVec(UINTPTR BaseAddress, u8 Address, const XIic_Vec *Vec, unsigned VecCount, u8 Option) {
   unsigned RemainingByteCount;
+  unsigned ByteCount = 0;
   u32 ControlReg;
   volatile u32 StatusReg;
 
+  for (unsigned Index = 0; Index < VecCount; Index++) {
+    ByteCount += Vec[Index].ByteCount;
+  }
   /* Wait until I2C bus is freed, exit if timed out. */
   if (XIic_WaitBusFree(BaseAddress) != XST_SUCCESS) {
     return 0;
@@ -396,15 +561,15 @@ unsigned XIic_Send(UINTPTR BaseAddress, u8 Address, u8 *BufferPtr, unsigned Byte
      * status for the bus not busy bit which must be done while
      * the bus is busy
      */
-    time_t s = time(NULL);
+    XIic_Wait Wait;
+    XIic_WaitStart(BaseAddress, &Wait, XIIC_BYTE_TIMEOUT_US);
     StatusReg = XIic_ReadReg(BaseAddress, XIIC_SR_REG_OFFSET);
     while ((StatusReg & XIIC_SR_BUS_BUSY_MASK) == 0) {
-      StatusReg = XIic_ReadReg(BaseAddress, XIIC_SR_REG_OFFSET);
-      time_t n = time(NULL);
-      if ((n - s) > IIC_TIMEOUT) {
-        printf("IIC timeout bus not busy.\n");
+      if (!XIic_WaitPoll(&Wait)) {
+        XIic_WriteReg(BaseAddress, XIIC_CR_REG_OFFSET, 0);
         return 0;
       }
+      StatusReg = XIic_ReadReg(BaseAddress, XIIC_SR_REG_OFFSET);
     }
 
     XIic_ClearIisr(BaseAddress, XIIC_INTR_BNB_MASK);
@@ -421,7 +586,7 @@ unsigned XIic_Send(UINTPTR BaseAddress, u8 Address, u8 *BufferPtr, unsigned Byte
   /* Send the specified data to the device on the IIC bus specified by the
    * the address
    */
-  RemainingByteCount = SendData(BaseAddress, BufferPtr, ByteCount, Option);
+  RemainingByteCount = SendData(BaseAddress, Vec, VecCount, Option);
 
   ControlReg = XIic_ReadReg(BaseAddress, XIIC_CR_REG_OFFSET);
   if ((ControlReg & XIIC_CR_REPEATED_START_MASK) == 0) {
@@ -439,8 +604,13 @@ unsigned XIic_Send(UINTPTR BaseAddress, u8 Address, u8 *BufferPtr, unsigned Byte
     if ((XIic_ReadReg(BaseAddress, XIIC_SR_REG_OFFSET) & XIIC_SR_ADDR_AS_SLAVE_MASK) != 0) {
       XIic_WriteReg(BaseAddress, XIIC_CR_REG_OFFSET, 0);
     } else {
+      XIic_Wait Wait;
+      XIic_WaitStart(BaseAddress, &Wait, XIIC_BYTE_TIMEOUT_US);
       StatusReg = XIic_ReadReg(BaseAddress, XIIC_SR_REG_OFFSET);
       while ((StatusReg & XIIC_SR_BUS_BUSY_MASK) != 0) {
+        if (!XIic_WaitPoll(&Wait)) {
+          return 0;
+        }
         StatusReg = XIic_ReadReg(BaseAddress, XIIC_SR_REG_OFFSET);
       }
     }
@@ -451,13 +621,13 @@ unsigned XIic_Send(UINTPTR BaseAddress, u8 Address, u8 *BufferPtr, unsigned Byte
 
 /******************************************************************************
  *
- * Send the specified buffer to the device that has been previously addressed
+ * Send the specified buffers to the device that has been previously addressed
  * on the IIC bus.  This function assumes that the 7 bit address has been sent
  * and it should wait for the transmit of the address to complete.
  *
  * @param	BaseAddress contains the base address of the IIC device.
- * @param	BufferPtr points to the data to be sent.
- * @param	ByteCount is the number of bytes to be sent.
+ * @param	Vec points to the buffers to be sent, in order.
+ * @param	VecCount is the number of buffers.
  * @param	Option indicates whether to hold or free the bus after
  *		transmitting the data.
  *
@@ -466,12 +636,21 @@ unsigned XIic_Send(UINTPTR BaseAddress, u8 Address, u8 *BufferPtr, unsigned Byte
  * @note
  *
  * This function does not take advantage of the transmit FIFO because it is
- * designed for minimal code space and complexity.  It contains loops that
- * that could cause the function not to return if the hardware is not working.
+ * designed for minimal code space and complexity.  Its loops give up after
+ * XIIC_BYTE_TIMEOUT_US per byte if the hardware is not working.
  *
  ******************************************************************************/
-static unsigned SendData(UINTPTR BaseAddress, u8 *BufferPtr, unsigned ByteCount, u8 Option) {
+static unsigned SendData(UINTPTR BaseAddress, const XIic_Vec *Vec, unsigned VecCount, u8 Option) {
   u32 IntrStatus;
+  XIic_Wait Wait;
+  unsigned ByteCount = 0;
+  unsigned Index = 0;
+  unsigned Offset = 0;
+  u8 Byte;
+
+  for (unsigned i = 0; i < VecCount; i++) {
+    ByteCount += Vec[i].ByteCount;
+  }
 
   /*
    * Send the specified number of bytes in the specified buffer by polling
@@ -482,6 +661,7 @@ static unsigned SendData(UINTPTR BaseAddress, u8 *BufferPtr, unsigned ByteCount,
      * Wait for the transmit to be empty before sending any more
      * data by polling the interrupt status register
      */
+    XIic_WaitStart(BaseAddress, &Wait, XIIC_BYTE_TIMEOUT_US);
     while (1) {
       IntrStatus = XIic_ReadIisr(BaseAddress);
 
@@ -492,12 +672,23 @@ static unsigned SendData(UINTPTR BaseAddress, u8 *BufferPtr, unsigned ByteCount,
       if (IntrStatus & XIIC_INTR_TX_EMPTY_MASK) {
         break;
       }
+
+      if (!XIic_WaitPoll(&Wait)) {
+        return ByteCount;
+      }
     }
+    /* Next byte to send, skipping buffers that are used up or empty */
+    while (Offset == Vec[Index].ByteCount) {
+      Index++;
+      Offset = 0;
+    }
+    Byte = Vec[Index].BufferPtr[Offset++];
+
     /* If there is more than one byte to send then put the
      * next byte to send into the transmit FIFO
      */
     if (ByteCount > 1) {
-      XIic_WriteReg(BaseAddress, XIIC_DTR_REG_OFFSET, *BufferPtr++);
+      XIic_WriteReg(BaseAddress, XIIC_DTR_REG_OFFSET, Byte);
     } else {
       if (Option == XIIC_STOP) {
         /*
@@ -515,7 +706,7 @@ static unsigned SendData(UINTPTR BaseAddress, u8 *BufferPtr, unsigned ByteCount,
       /*
        * Put the last byte to send in the transmit FIFO
        */
-      XIic_WriteReg(BaseAddress, XIIC_DTR_REG_OFFSET, *BufferPtr++);
+      XIic_WriteReg(BaseAddress, XIIC_DTR_REG_OFFSET, Byte);
 
       if (Option == XIIC_REPEATED_START) {
         XIic_ClearIisr(BaseAddress, XIIC_INTR_TX_EMPTY_MASK);
@@ -523,6 +714,7 @@ static unsigned SendData(UINTPTR BaseAddress, u8 *BufferPtr, unsigned ByteCount,
          * Wait for the transmit to be empty before
          * setting RSTA bit.
          */
+        XIic_WaitStart(BaseAddress, &Wait, XIIC_BYTE_TIMEOUT_US);
         while (1) {
           IntrStatus = XIic_ReadIisr(BaseAddress);
           if (IntrStatus & XIIC_INTR_TX_EMPTY_MASK) {
@@ -535,6 +727,9 @@ static unsigned SendData(UINTPTR BaseAddress, u8 *BufferPtr, unsigned ByteCount,
                           XIIC_CR_REPEATED_START_MASK | XIIC_CR_ENABLE_DEVICE_MASK | XIIC_CR_DIR_IS_TX_MASK | XIIC_CR_MSMS_MASK);
             break;
           }
+          if (!XIic_WaitPoll(&Wait)) {
+            return ByteCount;
+          }
         }
       }
     }
@@ -562,9 +757,10 @@ static unsigned SendData(UINTPTR BaseAddress, u8 *BufferPtr, unsigned ByteCount,
      * occurs. Note that this is different from a receive operation
      * because the stop Option causes the bus to go not busy.
      */
-    while (1) {
-      if (XIic_ReadIisr(BaseAddress) & XIIC_INTR_BNB_MASK) {
-        break;
+    XIic_WaitStart(BaseAddress, &Wait, XIIC_BYTE_TIMEOUT_US);
+    while ((XIic_ReadIisr(BaseAddress) & XIIC_INTR_BNB_MASK) == 0) {
+      if (!XIic_WaitPoll(&Wait)) {
+        return 1;
       }
     }
   }
@@ -598,7 +794,8 @@ u32 XIic_CheckIsBusBusy(UINTPTR BaseAddress) {
 
 /******************************************************************************/
 /**
- * This function will wait until the I2C bus is free or timeout.
+ * This function will wait until the I2C bus is free or XIIC_BUS_FREE_TIMEOUT_US
+ * passed.
  *
  * @param	BaseAddress contains the base address of the I2C device.
  *
@@ -610,13 +807,13 @@ u32 XIic_CheckIsBusBusy(UINTPTR BaseAddress) {
  *
  *******************************************************************************/
 u32 XIic_WaitBusFree(UINTPTR BaseAddress) {
-  u32 BusyCount = 0;
+  XIic_Wait Wait;
 
+  XIic_WaitStart(BaseAddress, &Wait, XIIC_BUS_FREE_TIMEOUT_US);
   while (XIic_CheckIsBusBusy(BaseAddress)) {
-    if (BusyCount++ > 10000) {
+    if (!XIic_WaitPoll(&Wait)) {
       return XST_FAILURE;
     }
-    usleep(100);
   }
 
   return XST_SUCCESS;
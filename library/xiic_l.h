@@ -66,6 +66,8 @@ extern "C" {
 
 /***************************** Include Files ********************************/
 
+#include <time.h>
+
 #include "xil_io.h"
 #include "xil_types.h"
 
@@ -518,12 +520,65 @@ extern "C" {
 #define XIic_DynSendStop(BaseAddress, ByteCount) \
   { XIic_WriteReg(BaseAddress, XIIC_DTR_REG_OFFSET, XIIC_TX_DYN_STOP_MASK | ByteCount); }
 
+/**
+ * @name Timed waits
+ * Every wait for the IIC core polls the status registers XIIC_WAIT_SPINS
+ * times, then sleeps between polls starting at XIIC_WAIT_BACKOFF_MIN_NS and
+ * doubling up to XIIC_WAIT_BACKOFF_MAX_NS, and gives up at its deadline.
+ * @{
+ */
+#define XIIC_WAIT_SPINS 200               /**< Polls before sleeping */
+#define XIIC_WAIT_BACKOFF_MIN_NS 20000    /**< First sleep, a byte at 400 kHz */
+#define XIIC_WAIT_BACKOFF_MAX_NS 100000   /**< Longest sleep, a byte at 100 kHz */
+#define XIIC_BYTE_TIMEOUT_US 10000        /**< Deadline for one byte or condition */
+#define XIIC_BUS_FREE_TIMEOUT_US 20000    /**< Deadline for another master to finish */
+#define XIIC_MAX_WAIT_STATS 2             /**< Cores that can have counters */
+/* @} */
+
+/**
+ * Counters of the timed waits of one IIC core.
+ */
+typedef struct {
+  u32 Spins;    /**< Polls that did not show the awaited state yet */
+  u32 Backoffs; /**< Sleeps after spinning */
+  u32 Timeouts; /**< Waits abandoned at their deadline */
+} XIic_WaitStats;
+
+/**
+ * State of one timed wait, see XIic_WaitStart.
+ */
+typedef struct {
+  UINTPTR BaseAddress;
+  u32 TimeoutUs;
+  struct timespec Deadline; /**< Set once the spins run out */
+  u32 Polls;
+  long SleepNs;
+  XIic_WaitStats *Stats; /**< Looked up at the first poll */
+} XIic_Wait;
+
+/**
+ * One piece of a message sent with XIic_SendVec, the pieces go out back to
+ * back as if they were one buffer.
+ */
+typedef struct {
+  u8 *BufferPtr;
+  unsigned ByteCount;
+} XIic_Vec;
+
 /************************** Function Prototypes *****************************/
 
+void XIic_SetWaitStats(UINTPTR BaseAddress, XIic_WaitStats *Stats);
+
+void XIic_WaitStart(UINTPTR BaseAddress, XIic_Wait *Wait, u32 TimeoutUs);
+
+int XIic_WaitPoll(XIic_Wait *Wait);
+
 unsigned XIic_Recv(UINTPTR BaseAddress, u8 Address, u8 *BufferPtr, unsigned ByteCount, u8 Option);
 
 unsigned XIic_Send(UINTPTR BaseAddress, u8 Address, u8 *BufferPtr, unsigned ByteCount, u8 Option);
 
+unsigned XIic_SendVec(UINTPTR BaseAddress, u8 Address, const XIic_Vec *Vec, unsigned VecCount, u8 Option);
+
 unsigned XIic_DynRecv(UINTPTR BaseAddress, u8 Address, u8 *BufferPtr, u8 ByteCount);
 
 unsigned XIic_DynSend(UINTPTR BaseAddress, u16 Address, u8 *BufferPtr, u8 ByteCount, u8 Option);
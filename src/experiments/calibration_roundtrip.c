@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../libs/calibration.h"
+#include "../libs/measurements.h"
+#include "../settings.h"
+#include "check.h"
+
+#define STORE_PATH "/tmp/calibration_roundtrip"
+
+/*
+ * Saves a calibration store, loads it back and checks that damaged or outdated files are refused.
+ * Runs on the host, no sensors needed.
+ */
+
+static void corrupt(size_t offset) {
+  FILE *f = fopen(STORE_PATH, "r+b");
+  fseek(f, offset, SEEK_SET);
+  int byte = fgetc(f);
+  fseek(f, offset, SEEK_SET);
+  fputc(byte ^ 0xFF, f);
+  fclose(f);
+}
+
+int main(void) {
+  vl53l0x_t distance[VL53L0X_SENSOR_COUNT] = {0};
+  vl53l0x_t *distance_sensors[VL53L0X_SENSOR_COUNT];
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    distance[i] = (vl53l0x_t){.address = INITIAL_ADDRESS - i, .offset_mm = distance_sensor_offsets[i], .a = 1.01 * i, .b = -3.5};
+    distance_sensors[i] = &distance[i];
+  }
+  tcs3472_t color[2] = {{.iic = IIC0, .calibration = color_default_calibration(IIC0)},
+                        {.iic = IIC1, .calibration = color_default_calibration(IIC1)}};
+  tcs3472_t *color_sensors[] = {&color[0], &color[1]};
+
+  calibration_store_t saved, loaded;
+  calibration_capture(&saved, distance_sensors, VL53L0X_SENSOR_COUNT, color_sensors, 2);
+  check(!calibration_save(STORE_PATH, &saved), "save");
+
+  uint64_t start = get_time_usec();
+  bool err = calibration_load(STORE_PATH, &loaded);
+  uint64_t load_us = get_time_usec() - start;
+  check(!err, "load");
+  printf("      load took %llu us\n", (unsigned long long)load_us);
+  check(memcmp(&saved, &loaded, sizeof(saved)) == 0, "loaded store equals saved store");
+  check(!calibration_is_stale(&loaded, CALIBRATION_MAX_AGE_S), "fresh store is not stale");
+
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    distance[i].offset_mm = 0;
+    distance[i].a = distance[i].b = 0;
+  }
+  color[0].calibration = color[1].calibration = NULL;
+  check(!calibration_apply(&loaded, distance_sensors, VL53L0X_SENSOR_COUNT, color_sensors, 2), "apply");
+  check(distance[VL53L0X_HIGH].offset_mm == distance_sensor_offsets[VL53L0X_HIGH] && distance[VL53L0X_HIGH].b == -3.5f,
+        "distance calibration restored");
+  check(memcmp(color[1].calibration, color_default_calibration(IIC1), sizeof(color_calibration_t)) == 0,
+        "color calibration restored");
+
+  /* The color sensors point into the store now, capturing into it again must not wipe what they point at */
+  calibration_capture(&loaded, distance_sensors, VL53L0X_SENSOR_COUNT, color_sensors, 2);
+  check(memcmp(&loaded.color[IIC1], color_default_calibration(IIC1), sizeof(color_calibration_t)) == 0,
+        "capture into the store the color sensors use keeps their calibration");
+
+  vl53l0x_t stranger = {.address = 0x30};
+  vl53l0x_t *strangers[] = {&stranger};
+  check(calibration_apply(&loaded, strangers, 1, color_sensors, 0), "unknown sensor is reported");
+
+  loaded.saved_at_s -= CALIBRATION_MAX_AGE_S + 1;
+  check(calibration_is_stale(&loaded, CALIBRATION_MAX_AGE_S), "old store is stale");
+
+  corrupt(offsetof(calibration_store_t, distance) + 1);
+  check(calibration_load(STORE_PATH, &loaded), "corrupt store is refused");
+
+  calibration_save(STORE_PATH, &saved);
+  corrupt(offsetof(calibration_store_t, version));
+  check(calibration_load(STORE_PATH, &loaded), "other version is refused");
+
+  check(calibration_load(STORE_PATH ".missing", &loaded), "missing store is refused");
+
+  remove(STORE_PATH);
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
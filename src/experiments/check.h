@@ -0,0 +1,15 @@
+#ifndef CHECK_H_
+#define CHECK_H_
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Checks of the host benches, each bench ends with printf("%d failures\n", failures) and returns failures != 0 */
+
+static int failures = 0;
+
+static inline void check(bool ok, const char *what) {
+  printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+  failures += !ok;
+}
+
+#endif
@@ -30,6 +30,8 @@ int main(void) {
     }
     color_t color = tcs3472_determine_color(sensor);
     LOG("%s\n", COLOR_NAME(color));
+    // Same format color_classifier_bench reads recorded samples in
+    printf("%d %u %u %u %u %s\n", sensor->iic, sensor->c, sensor->r, sensor->g, sensor->b, COLOR_NAME(color));
 
     printf("========================\n");
     getchar();
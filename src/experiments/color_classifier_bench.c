@@ -0,0 +1,113 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../libs/TCS3472.h"
+#include "../libs/color_classifier.h"
+#include "../libs/measurements.h"
+#include "../settings.h"
+
+#define RANDOM_SAMPLES 1000000
+
+/*
+ * Checks the fixed point classifier on the host, no sensor needed.
+ * Without arguments random readings are compared against the old floating point HSV thresholds.
+ * With a file of recorded samples, one "<iic> <c> <r> <g> <b> <COLOR>" per line, every sample is checked
+ * against the color it was recorded on.
+ */
+
+static color_t hsv_classify(tcs3472_t sensor) {
+  hsv_t hsv = rgb2hsv(sensor);
+  // Exact band edges (hue 100.0 computed as 99.99..) would otherwise count as mismatches
+  hsv.h = floor(hsv.h + 1e-9);
+  if (sensor.iic != IIC0) {
+    return hsv.v < 0.15 ? BLACK : WHITE;
+  }
+  if (hsv.v < 0.05) return BLACK;
+  if (hsv.v > 0.178) return WHITE;
+  if (hsv.h >= 10 && hsv.h < 25) return RED;
+  if (hsv.h >= 90 && hsv.h < 100) return GREEN;
+  if (hsv.h >= 175 && hsv.h < 200) return BLUE;
+  return WHITE;
+}
+
+static color_t color_from_name(const char *name) {
+  for (size_t i = 0; i < COLOR_COUNT; ++i) {
+    if (strcmp(name, COLOR_NAME(i)) == 0) {
+      return i;
+    }
+  }
+  return COLOR_COUNT;
+}
+
+static int check_recorded(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror(path);
+    return 1;
+  }
+  int iic;
+  unsigned c, r, g, b;
+  char name[16];
+  size_t total = 0, wrong = 0;
+  while (fscanf(file, "%d %u %u %u %u %15s", &iic, &c, &r, &g, &b, name) == 6) {
+    color_t expected = color_from_name(name);
+    color_t got = color_classify(color_default_calibration(iic), c, r, g, b);
+    total++;
+    if (got != expected) {
+      wrong++;
+      printf("IIC%d c %u r %u g %u b %u: expected %s, got %s\n", iic, c, r, g, b, name, color_names[got]);
+    }
+  }
+  fclose(file);
+  printf("%zu of %zu recorded samples classified correctly\n", total - wrong, total);
+  return wrong != 0;
+}
+
+static int compare_random(void) {
+  static uint16_t samples[RANDOM_SAMPLES][4];
+  srand(1);
+  for (size_t i = 0; i < RANDOM_SAMPLES; ++i) {
+    uint16_t r = rand() % 8000, g = rand() % 8000, b = rand() % 8000;
+    samples[i][0] = r + g + b > UINT16_MAX ? UINT16_MAX : r + g + b;
+    samples[i][1] = r;
+    samples[i][2] = g;
+    samples[i][3] = b;
+  }
+
+  size_t mismatches = 0;
+  for (int iic = IIC0; iic <= IIC1; ++iic) {
+    const color_calibration_t *calibration = color_default_calibration(iic);
+    for (size_t i = 0; i < RANDOM_SAMPLES; ++i) {
+      tcs3472_t sensor = {.iic = iic, .c = samples[i][0], .r = samples[i][1], .g = samples[i][2], .b = samples[i][3]};
+      mismatches += color_classify(calibration, sensor.c, sensor.r, sensor.g, sensor.b) != hsv_classify(sensor);
+    }
+  }
+  printf("%zu of %d readings differ from the HSV thresholds\n", mismatches, 2 * RANDOM_SAMPLES);
+
+  volatile color_t sink;
+  const color_calibration_t *calibration = color_default_calibration(IIC0);
+  uint64_t start = get_time_usec();
+  for (size_t i = 0; i < RANDOM_SAMPLES; ++i) {
+    sink = color_classify(calibration, samples[i][0], samples[i][1], samples[i][2], samples[i][3]);
+  }
+  uint64_t fixed = get_time_usec() - start;
+  start = get_time_usec();
+  for (size_t i = 0; i < RANDOM_SAMPLES; ++i) {
+    tcs3472_t sensor = {.iic = IIC0, .c = samples[i][0], .r = samples[i][1], .g = samples[i][2], .b = samples[i][3]};
+    sink = hsv_classify(sensor);
+  }
+  uint64_t floating = get_time_usec() - start;
+  (void)sink;
+  printf("Fixed point: %.1f ns per reading\n", fixed * 1000.0 / RANDOM_SAMPLES);
+  printf("HSV:         %.1f ns per reading\n", floating * 1000.0 / RANDOM_SAMPLES);
+  return mismatches != 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    return check_recorded(argv[1]);
+  }
+  return compare_random();
+}
@@ -0,0 +1,65 @@
+#ifndef FAKE_BUS_H_
+#define FAKE_BUS_H_
+#include <libpynq.h>
+#include <stdint.h>
+
+/*
+ * In-memory devices for the IIC backends of the host benches. Each bench keeps its own devices and decides which one
+ * answers on an address, these only move the bytes of a burst in and out of their registers.
+ */
+
+/* A VL53L0X keeps page 0, page 1 (0xFF = 1) and the 0x80 registers, the two selects themselves are always on page 0 */
+#define FAKE_VL53L0X_PAGES 3
+
+static inline uint8_t *fake_vl53l0x_register(uint8_t (*pages)[256], uint8_t reg) {
+  if (reg == 0xFF || reg == 0x80) {
+    return &pages[0][reg];
+  }
+  return &pages[pages[0][0xFF] ? 1 : pages[0][0x80] ? 2 : 0][reg];
+}
+
+static inline bool fake_vl53l0x_on_page0(uint8_t (*pages)[256]) { return pages[0][0xFF] == 0 && pages[0][0x80] == 0; }
+
+static inline void fake_vl53l0x_read(uint8_t (*pages)[256], uint8_t reg, uint8_t *data, uint16_t length) {
+  for (uint16_t i = 0; i < length; ++i) {
+    data[i] = *fake_vl53l0x_register(pages, reg + i);
+  }
+}
+
+/* In order, so a page select early in a burst decides where the bytes after it go */
+static inline void fake_vl53l0x_write(uint8_t (*pages)[256], uint8_t reg, const uint8_t *data, uint16_t length) {
+  for (uint16_t i = 0; i < length; ++i) {
+    *fake_vl53l0x_register(pages, reg + i) = data[i];
+  }
+}
+
+/* A plain register file of mask + 1 registers, the address wraps within it and the bits outside mask are commands */
+static inline void fake_registers_read(const uint8_t *registers, uint8_t mask, uint8_t reg, uint8_t *data,
+                                       uint16_t length) {
+  for (uint16_t i = 0; i < length; ++i) {
+    data[i] = registers[((reg & mask) + i) & mask];
+  }
+}
+
+static inline void fake_registers_write(uint8_t *registers, uint8_t mask, uint8_t reg, const uint8_t *data,
+                                        uint16_t length) {
+  for (uint16_t i = 0; i < length; ++i) {
+    registers[((reg & mask) + i) & mask] = data[i];
+  }
+}
+
+static inline bool fake_bus_init(const iic_index_t iic) {
+  (void)iic;
+  return 0;
+}
+
+static inline void fake_bus_destroy(const iic_index_t iic) { (void)iic; }
+
+/* A backend with nothing to set up or tear down, over register read and write functions */
+#define FAKE_BUS_BACKEND(backend_name, read, write)                                                          \
+  {                                                                                                          \
+    .name = (backend_name), .init = fake_bus_init, .destroy = fake_bus_destroy, .read_register = (read),     \
+    .write_register = (write)                                                                                \
+  }
+
+#endif
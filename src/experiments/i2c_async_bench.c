@@ -0,0 +1,177 @@
+#include <libpynq.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../libs/TCS3472.h"
+#include "../libs/i2c.h"
+#include "../libs/i2c_async.h"
+#include "../libs/measurements.h"
+#include "check.h"
+
+/*
+ * Exercises the async I2C queue on the host. The IIC controller is replaced by a register file that takes as long
+ * as a 100 kHz bus would, and a TCS3472 that finishes a conversion every INTEGRATION_US after its interrupt is
+ * cleared. No pynq_init, so it runs without a board.
+ */
+
+#define DEVICE 0x50
+#define TRANSFERS 30
+#define PRODUCERS 4
+#define INTEGRATION_US 24000
+#define SAMPLE_TIME_US 500000
+
+static uint8_t registers[128][256];
+static uint64_t last_clear_us;
+
+/* 9 clocks per byte at 10 us, address + register + data */
+static void bus_time(uint16_t length) { usleep((2 + length) * 9 * 10); }
+
+bool iic_read_register(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  (void)iic;
+  bus_time(data_length + 1);
+  uint8_t first = addr == TCS3472_ADDR ? reg & 0x1F : reg;
+  if (addr == TCS3472_ADDR && first == TCS3472_STATUS) {
+    registers[addr][first] = get_time_usec() - last_clear_us >= INTEGRATION_US ? TCS3472_STATUS_AINT : 0;
+  }
+  for (uint16_t i = 0; i < data_length; ++i) {
+    data[i] = registers[addr][(uint8_t)(first + i)];
+  }
+  return 0;
+}
+
+bool iic_write_register(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  (void)iic;
+  bus_time(data_length);
+  if (addr == TCS3472_ADDR && reg == TCS3472_CLEAR_INTERRUPT) {
+    last_clear_us = get_time_usec();
+    return 0;
+  }
+  for (uint16_t i = 0; i < data_length; ++i) {
+    registers[addr][(uint8_t)(reg + i)] = data[i];
+  }
+  return 0;
+}
+
+static _Atomic int callbacks;
+
+/* Slow on purpose, a wait that returns before the callback is over would see it uncounted */
+static void count_callback(i2c_transfer_t *transfer, bool err) {
+  usleep(1000);
+  callbacks += !err && transfer->state == I2C_TRANSFER_PENDING;
+}
+
+/* Writes TRANSFERS registers, then reads them back, while the caller keeps "watching the steppers" */
+static void order_and_overlap(void) {
+  uint8_t values[TRANSFERS], read_back[TRANSFERS];
+  i2c_transfer_t writes[TRANSFERS], reads[TRANSFERS];
+  for (size_t i = 0; i < TRANSFERS; ++i) {
+    values[i] = i * 7 + 1;
+    writes[i] = (i2c_transfer_t){.op = I2C_TRANSFER_WRITE, .address = DEVICE, .reg = i, .data = &values[i], .length = 1};
+    reads[i] = (i2c_transfer_t){
+        .op = I2C_TRANSFER_READ, .address = DEVICE, .reg = i, .data = &read_back[i], .length = 1, .done = count_callback};
+  }
+
+  uint64_t start = get_time_usec();
+  for (size_t i = 0; i < TRANSFERS; ++i) {
+    i2c_read8(DEVICE, i, &read_back[i], IIC0);
+  }
+  uint64_t sync_us = get_time_usec() - start;
+
+  bool submitted = true;
+  start = get_time_usec();
+  for (size_t i = 0; i < TRANSFERS; ++i) {
+    submitted &= !i2c_async_submit(IIC0, &writes[i]);
+  }
+  size_t checks = 0;
+  while (!i2c_transfer_done(&writes[TRANSFERS - 1])) {
+    checks++;  // stands in for stepper_steps_done()
+    usleep(100);
+  }
+  uint64_t async_us = get_time_usec() - start;
+
+  memset(read_back, 0, sizeof(read_back));
+  callbacks = 0;
+  for (size_t i = 0; i < TRANSFERS; ++i) {
+    submitted &= !i2c_async_submit(IIC0, &reads[i]);
+  }
+  bool ok = true;
+  for (size_t i = 0; i < TRANSFERS; ++i) {
+    ok &= !i2c_transfer_wait(&reads[i]) && read_back[i] == values[i];
+  }
+  check(submitted, "all transfers accepted");
+  check(ok, "reads queued after writes see the written values");
+  check(callbacks == TRANSFERS, "every transfer called back before its wait returned");
+  check(checks > 0, "caller kept running while the bus was busy");
+  printf("      %d sync reads: %llu us blocked, %d async writes: %llu us with %zu checks in between\n", TRANSFERS,
+         (unsigned long long)sync_us, TRANSFERS, (unsigned long long)async_us, checks);
+}
+
+typedef struct {
+  uint8_t reg;
+  uint8_t value;
+  i2c_transfer_t transfers[TRANSFERS];
+} producer_t;
+
+static void *produce(void *arg) {
+  producer_t *producer = arg;
+  for (size_t i = 0; i < TRANSFERS; ++i) {
+    producer->transfers[i] = (i2c_transfer_t){
+        .op = I2C_TRANSFER_WRITE, .address = DEVICE, .reg = producer->reg, .data = &producer->value, .length = 1};
+    while (i2c_async_submit(IIC0, &producer->transfers[i])) {
+      usleep(100);  // queue full
+    }
+  }
+  return NULL;
+}
+
+static void producers(void) {
+  producer_t producers[PRODUCERS];
+  pthread_t threads[PRODUCERS];
+  for (size_t i = 0; i < PRODUCERS; ++i) {
+    producers[i].reg = 0x80 + i;
+    producers[i].value = 0xA0 + i;
+    pthread_create(&threads[i], NULL, produce, &producers[i]);
+  }
+  bool ok = true;
+  for (size_t i = 0; i < PRODUCERS; ++i) {
+    pthread_join(threads[i], NULL);
+    for (size_t j = 0; j < TRANSFERS; ++j) {
+      ok &= !i2c_transfer_wait(&producers[i].transfers[j]);
+    }
+    ok &= registers[DEVICE][producers[i].reg] == producers[i].value;
+  }
+  check(ok, "concurrent producers all complete");
+}
+
+static void sampler(void) {
+  tcs3472_t sensor = {.iic = IIC0, .enable = true, .integration_time_us = INTEGRATION_US};
+  const uint8_t crgb[8] = {0x00, 0x10, 0x00, 0x04, 0x00, 0x05, 0x00, 0x06};
+  memcpy(&registers[TCS3472_ADDR][TCS3472_REG_C], crgb, sizeof(crgb));
+
+  tcs3472_sampler_t sampler;
+  check(!tcs3472_sampler_start(&sampler, &sensor), "sampler starts");
+  size_t conversions = 0, checks = 0;
+  uint64_t start = get_time_usec();
+  while (get_time_usec() - start < SAMPLE_TIME_US) {
+    conversions += tcs3472_sampler_poll(&sampler);
+    checks++;
+    usleep(1000);
+  }
+  tcs3472_sampler_stop(&sampler);
+  size_t expected = SAMPLE_TIME_US / INTEGRATION_US;
+  check(conversions >= expected / 2 && conversions <= expected, "sampler returns every conversion once");
+  check(sensor.c == 0x1000 && sensor.r == 0x0400 && sensor.b == 0x0600, "sampler stores the colors");
+  printf("      %zu conversions of at most %zu in %d ms, %zu checks in between\n", conversions, expected,
+         SAMPLE_TIME_US / 1000, checks);
+}
+
+int main(void) {
+  order_and_overlap();
+  producers();
+  sampler();
+  i2c_async_stop(IIC0);
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
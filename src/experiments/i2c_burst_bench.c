@@ -0,0 +1,93 @@
+#include <libpynq.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../libs/TCS3472.h"
+#include "../libs/VL53L0X.h"
+#include "../libs/i2c.h"
+
+/*
+ * Counts the I2C transactions of register blocks read one register at a time against one burst.
+ * Runs on the host: the IIC controller is replaced by a register file, so it does not call pynq_init.
+ */
+
+static uint8_t registers[128][256];
+
+bool iic_read_register(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  (void)iic;
+  /* The TCS3472 command byte carries the auto increment bits, the register is in the low 5 bits */
+  uint8_t first = addr == TCS3472_ADDR ? reg & 0x1F : reg;
+  for (uint16_t i = 0; i < data_length; ++i) {
+    data[i] = registers[addr][(uint8_t)(first + i)];
+  }
+  return 0;
+}
+
+bool iic_write_register(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  (void)iic;
+  for (uint16_t i = 0; i < data_length; ++i) {
+    registers[addr][(uint8_t)(reg + i)] = data[i];
+  }
+  return 0;
+}
+
+static int failures = 0;
+
+static void report(const char *what, uint32_t single, uint32_t burst, bool correct) {
+  printf("%-36s %3u -> %u transactions%s\n", what, single, burst, correct ? "" : "  WRONG DATA");
+  failures += !correct;
+}
+
+int main(void) {
+  const uint8_t vl53l0x = 0x69;
+  uint32_t start;
+
+  /* TCS3472 clear, red, green and blue */
+  const uint8_t crgb[8] = {0x34, 0x12, 0x78, 0x56, 0xBC, 0x9A, 0xF0, 0xDE};
+  memcpy(&registers[TCS3472_ADDR][TCS3472_REG_C], crgb, sizeof(crgb));
+  tcs3472_t color = {.iic = IIC0, .enable = true};
+  start = i2c_transaction_count(IIC0);
+  uint8_t bytes[8];
+  for (size_t i = 0; i < sizeof(bytes); ++i) {
+    i2c_read8(TCS3472_ADDR, (TCS3472_REG_C + i) | TCS3472_COMMAND_BIT, &bytes[i], IIC0);
+  }
+  uint32_t single = i2c_transaction_count(IIC0) - start;
+  start = i2c_transaction_count(IIC0);
+  tcs3472_read_colors(&color);
+  uint32_t burst = i2c_transaction_count(IIC0) - start;
+  report("TCS3472 CRGB", single, burst,
+         color.c == 0x1234 && color.r == 0x5678 && color.g == 0x9ABC && color.b == 0xDEF0 && !memcmp(bytes, crgb, 8));
+
+  /* VL53L0X range, a big endian word */
+  registers[vl53l0x][VL53L0X_RESULT_RANGE_STATUS + 10] = 0x01;
+  registers[vl53l0x][VL53L0X_RESULT_RANGE_STATUS + 11] = 0x2C;
+  start = i2c_transaction_count(IIC0);
+  uint8_t hi, lo;
+  i2c_read8(vl53l0x, VL53L0X_RESULT_RANGE_STATUS + 10, &hi, IIC0);
+  i2c_read8(vl53l0x, VL53L0X_RESULT_RANGE_STATUS + 11, &lo, IIC0);
+  single = i2c_transaction_count(IIC0) - start;
+  start = i2c_transaction_count(IIC0);
+  uint16_t range;
+  i2c_read16_inv(vl53l0x, VL53L0X_RESULT_RANGE_STATUS + 10, &range, IIC0);
+  burst = i2c_transaction_count(IIC0) - start;
+  report("VL53L0X range", single, burst, range == 300 && ((hi << 8) | lo) == 300);
+
+  /* VL53L0X inter-measurement period, a big endian 32 bit value */
+  const uint32_t period = 0x00012345;
+  start = i2c_transaction_count(IIC0);
+  for (uint8_t i = 0; i < 4; ++i) {
+    i2c_write8(vl53l0x, VL53L0X_SYSTEM_INTERMEASUREMENT_PERIOD + i, period >> (24 - 8 * i), IIC0);
+  }
+  single = i2c_transaction_count(IIC0) - start;
+  memset(&registers[vl53l0x][VL53L0X_SYSTEM_INTERMEASUREMENT_PERIOD], 0, 4);
+  start = i2c_transaction_count(IIC0);
+  uint16_t words[2] = {period >> 16, period & 0xFFFF};
+  i2c_write_burst(vl53l0x, VL53L0X_SYSTEM_INTERMEASUREMENT_PERIOD, words, sizeof(words), I2C_WORDS_BE, IIC0);
+  burst = i2c_transaction_count(IIC0) - start;
+  const uint8_t *written = &registers[vl53l0x][VL53L0X_SYSTEM_INTERMEASUREMENT_PERIOD];
+  report("VL53L0X inter-measurement period", single, burst,
+         written[0] == 0x00 && written[1] == 0x01 && written[2] == 0x23 && written[3] == 0x45);
+
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
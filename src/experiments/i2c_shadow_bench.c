@@ -0,0 +1,140 @@
+#include <libpynq.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../libs/TCS3472.h"
+#include "../libs/VL53L0X.h"
+#include "../libs/i2c.h"
+#include "../settings.h"
+#include "check.h"
+#include "fake_bus.h"
+
+/*
+ * Counts the transfers the register shadows save while the drivers bring up and reconfigure a VL53L0X and a
+ * TCS3472, then checks every shadowed register against the device. Runs on the host: both IICs use an in-memory
+ * backend with register files, the VL53L0X one with separate pages behind 0xFF and 0x80 like the real sensor.
+ */
+
+#define DISTANCE_ADDRESS 0x30
+#define PLAIN_ADDRESS 0x50  // a register file without banks, to burst across 0xFF
+
+static uint8_t pages[FAKE_VL53L0X_PAGES][256];  // the VL53L0X
+static uint8_t tcs_registers[32];
+static uint8_t plain_registers[256];
+
+static bool fake_read(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  if (iic == IIC0 && addr == DISTANCE_ADDRESS) {
+    fake_vl53l0x_read(pages, reg, data, data_length);
+  } else if (iic == IIC1 && addr == TCS3472_ADDR) {
+    fake_registers_read(tcs_registers, 0x1F, reg, data, data_length);
+  } else if (iic == IIC1 && addr == PLAIN_ADDRESS) {
+    fake_registers_read(plain_registers, 0xFF, reg, data, data_length);
+  } else {
+    return 1;
+  }
+  return 0;
+}
+
+static bool fake_write(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  if (iic == IIC0 && addr == DISTANCE_ADDRESS) {
+    fake_vl53l0x_write(pages, reg, data, data_length);
+    pages[0][VL53L0X_SYSRANGE_START] = 0;  // ranging "finishes" at once
+  } else if (iic == IIC1 && addr == TCS3472_ADDR) {
+    fake_registers_write(tcs_registers, 0x1F, reg, data, data_length);
+  } else if (iic == IIC1 && addr == PLAIN_ADDRESS) {
+    fake_registers_write(plain_registers, 0xFF, reg, data, data_length);
+  } else {
+    return 1;
+  }
+  return 0;
+}
+
+static const iic_backend_t fake_backend = FAKE_BUS_BACKEND("fake", fake_read, fake_write);
+
+static void report(const char *name, uint8_t address, iic_index_t iic, uint32_t transactions) {
+  i2c_shadow_stats_t stats = i2c_shadow_stats(address, iic);
+  uint32_t reads = stats.read_hits + stats.read_misses, writes = stats.writes_elided + stats.writes;
+  uint32_t saved = stats.read_hits + stats.writes_elided;
+  printf("      %s: %u/%u reads hit, %u/%u writes elided, %u of %u transfers saved (%.0f%%)\n", name, stats.read_hits,
+         reads, stats.writes_elided, writes, saved, transactions + saved, 100.0 * saved / (transactions + saved));
+}
+
+/* Reads every shadowed register and compares it with the device */
+static bool coherent(uint8_t address, iic_index_t iic, uint8_t last_reg, const uint8_t *device) {
+  bool ok = true;
+  for (uint16_t reg = 0; reg <= last_reg; ++reg) {
+    uint8_t value;
+    ok &= !i2c_read8(address, reg, &value, iic) && value == device[reg];
+  }
+  return ok;
+}
+
+static void distance_sensor(void) {
+  pages[0][VL53L0X_IDENTIFICATION_MODEL_ID] = VL53L0X_EXPECTED_DEVICE_ID;
+  pages[0][VL53L0X_RESULT_INTERRUPT_STATUS] = 0x04;
+  uint32_t start = i2c_transaction_count(IIC0);
+
+  vl53l0x_t *sensor = vl53l0x_init_at(DISTANCE_ADDRESS, IIC0);
+  check(sensor != NULL, "VL53L0X initialises through the shadow");
+  if (sensor == NULL) {
+    return;
+  }
+  /* What navigation does between scans and approaches */
+  for (int i = 0; i < 3; ++i) {
+    vl53l0x_set_timing_budget_us(sensor, SCAN_TIMING_BUDGET_US);
+    vl53l0x_start_continuous(sensor, 0);
+    vl53l0x_stop_continuous(sensor);
+    vl53l0x_set_timing_budget_us(sensor, APPROACH_TIMING_BUDGET_US);
+    vl53l0x_get_single_optimal_range(sensor);
+  }
+  report("VL53L0X", DISTANCE_ADDRESS, IIC0, i2c_transaction_count(IIC0) - start);
+  check(coherent(DISTANCE_ADDRESS, IIC0, 0xFE, pages[0]), "VL53L0X page 0 matches the shadow");
+  vl53l0x_destroy(sensor);
+}
+
+static void color_sensor(void) {
+  tcs_registers[TCS3472_ID] = 0x4D;
+  uint32_t start = i2c_transaction_count(IIC1);
+
+  tcs3472_t *sensor = tcs3472_init(IIC1);
+  check(sensor != NULL, "TCS3472 initialises through the shadow");
+  if (sensor == NULL) {
+    return;
+  }
+  for (int i = 0; i < 3; ++i) {
+    tcs3472_enable(sensor);
+    tcs3472_set_integration_time_us(sensor, TCS3472_INTEGRATION_TIME_US);
+    tcs3472_read_colors(sensor);
+    tcs3472_disable(sensor);
+  }
+  report("TCS3472", TCS3472_ADDR, IIC1, i2c_transaction_count(IIC1) - start);
+  check(coherent(TCS3472_ADDR, IIC1, 0x1F, tcs_registers), "TCS3472 registers match the shadow");
+  tcs3472_destroy(sensor);
+}
+
+/* A burst that runs past 0xFF continues at 0x00, also when the shadow serves it */
+static void wrapping_burst(void) {
+  i2c_shadow_config_t config = {.register_mask = 0xFF};
+  i2c_shadow_enable(PLAIN_ADDRESS, &config, IIC1);
+  uint8_t written[4] = {0x11, 0x22, 0x33, 0x44}, read[4] = {0};
+  bool err = i2c_write_burst(PLAIN_ADDRESS, 0xFE, written, sizeof(written), I2C_BYTES, IIC1);
+  err |= i2c_read_burst(PLAIN_ADDRESS, 0xFE, read, sizeof(read), I2C_BYTES, IIC1);
+  i2c_shadow_stats_t stats = i2c_shadow_stats(PLAIN_ADDRESS, IIC1);
+  check(!err && stats.read_hits == 1 && memcmp(read, written, sizeof(read)) == 0,
+        "a burst across 0xFF is served from the registers it wrapped to");
+  i2c_shadow_disable(PLAIN_ADDRESS, IIC1);
+}
+
+int main(void) {
+  for (iic_index_t iic = IIC0; iic < NUM_IICS; ++iic) {
+    iic_set_backend(iic, &fake_backend);
+    iic_init(iic);
+  }
+  distance_sensor();
+  color_sensor();
+  wrapping_burst();
+  iic_destroy(IIC0);
+  iic_destroy(IIC1);
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,90 @@
+#include <libpynq.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include "../libs/i2c.h"
+#include "../libs/i2c_trace.h"
+#include "../libs/measurements.h"
+#include "check.h"
+
+/*
+ * Measures what tracing adds to a transaction, on a host bus that answers instantly so only the software path is
+ * timed. Then checks that records from concurrent producers come out whole and that the dump is written.
+ */
+
+#define TRANSACTIONS 1000000
+#define PRODUCERS 4
+#define DUMP_PATH "/tmp/i2c_trace_bench.csv"
+
+bool iic_read_register(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  (void)iic, (void)addr, (void)reg;
+  for (uint16_t i = 0; i < data_length; ++i) {
+    data[i] = 0;
+  }
+  return 0;
+}
+
+bool iic_write_register(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  (void)iic, (void)addr, (void)reg, (void)data, (void)data_length;
+  return 0;
+}
+
+static double ns_per_read(void) {
+  uint8_t value;
+  uint64_t start = get_time_usec();
+  for (int i = 0; i < TRANSACTIONS; ++i) {
+    i2c_read8(0x29, i & 0xFF, &value, IIC0);
+  }
+  return (get_time_usec() - start) * 1000.0 / TRANSACTIONS;
+}
+
+/* Every producer writes its own address, with the register and length derived from it */
+static void *produce(void *arg) {
+  uint8_t address = (uintptr_t)arg;
+  for (int i = 0; i < TRANSACTIONS / PRODUCERS; ++i) {
+    i2c_trace_record(IIC1, address, address ^ 0x55, address, i & 1, i, address, 0);
+  }
+  return NULL;
+}
+
+int main(void) {
+  double disabled = ns_per_read();
+  i2c_trace_enable(true);
+  double enabled = ns_per_read();
+  i2c_trace_enable(false);
+  printf("      i2c_read8: %.1f ns untraced, %.1f ns traced, %.1f ns per record\n", disabled, enabled,
+         enabled - disabled);
+
+  uint32_t buckets[I2C_TRACE_BUCKETS], total = 0;
+  i2c_trace_histogram(IIC0, 0x29, buckets);
+  for (size_t i = 0; i < I2C_TRACE_BUCKETS; ++i) {
+    total += buckets[i];
+  }
+  check(total == TRANSACTIONS, "histogram counts every traced transaction");
+
+  i2c_trace_reset();
+  pthread_t threads[PRODUCERS];
+  for (uintptr_t i = 0; i < PRODUCERS; ++i) {
+    pthread_create(&threads[i], NULL, produce, (void *)(0x30 + i));
+  }
+  static i2c_trace_record_t records[I2C_TRACE_LENGTH];
+  size_t snapshots = 0, torn = 0;
+  for (int round = 0; round < 200; ++round) {
+    size_t count = i2c_trace_snapshot(records, I2C_TRACE_LENGTH);
+    for (size_t i = 0; i < count; ++i) {
+      const i2c_trace_record_t *r = &records[i];
+      torn += r->reg != (r->address ^ 0x55) || r->length != r->address || r->duration_us != r->address;
+    }
+    snapshots += count;
+  }
+  for (size_t i = 0; i < PRODUCERS; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  printf("      %zu records read while %d threads were writing\n", snapshots, PRODUCERS);
+  check(torn == 0, "no torn records");
+  check(i2c_trace_snapshot(records, I2C_TRACE_LENGTH) == I2C_TRACE_LENGTH, "ring keeps the last I2C_TRACE_LENGTH");
+  check(!i2c_trace_dump(DUMP_PATH), "dump written to " DUMP_PATH);
+
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,103 @@
+#include <libpynq.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../libs/i2c.h"
+#include "check.h"
+#include "fake_bus.h"
+
+/*
+ * Checks that register accesses reach the backend as segments that point into the caller's buffers, so nothing is
+ * copied on the way, and that iic_transfer still works on a backend that only knows register reads and writes.
+ * Runs on the host: IIC0 gets a backend that records the segments, IIC1 one without a transfer function.
+ */
+
+#define DEVICE 0x29
+
+static iic_segment_t seen[IIC_MAX_SEGMENTS];
+static uint8_t seen_count;
+static uint8_t registers[256];
+
+static bool recording_transfer(const iic_index_t iic, const uint8_t addr, const iic_segment_t *segments,
+                               const uint8_t count) {
+  (void)iic;
+  (void)addr;
+  memcpy(seen, segments, count * sizeof(segments[0]));
+  seen_count = count;
+  for (uint8_t i = 0; i < count; i++) {
+    if (segments[i].flags & IIC_SEGMENT_READ) {
+      memset(segments[i].data, 0xA5, segments[i].length);
+    }
+  }
+  return 0;
+}
+
+static bool register_read(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t length) {
+  (void)iic;
+  (void)addr;
+  fake_registers_read(registers, 0xFF, reg, data, length);
+  return 0;
+}
+
+static bool register_write(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t length) {
+  (void)iic;
+  (void)addr;
+  fake_registers_write(registers, 0xFF, reg, data, length);
+  return 0;
+}
+
+static const iic_backend_t recording_backend = {
+    .name = "recording", .init = fake_bus_init, .destroy = fake_bus_destroy, .transfer = recording_transfer};
+static const iic_backend_t register_backend = FAKE_BUS_BACKEND("registers", register_read, register_write);
+
+static void zero_copy(void) {
+  uint8_t payload[64];
+  for (size_t i = 0; i < sizeof(payload); i++) {
+    payload[i] = i;
+  }
+  check(!iic_write_register(IIC0, DEVICE, 0x10, payload, sizeof(payload)) && seen_count == 2 &&
+            seen[0].length == 1 && seen[0].data[0] == 0x10 && seen[1].data == payload &&
+            seen[1].length == sizeof(payload) && seen[1].flags == IIC_SEGMENT_WRITE,
+        "register write sends the payload from the caller's buffer");
+
+  check(!i2c_write_burst(DEVICE, 0x20, payload, sizeof(payload), I2C_BYTES, IIC0) && seen[1].data == payload,
+        "byte burst sends the payload from the caller's buffer");
+
+  uint8_t data[16];
+  check(!iic_read_register(IIC0, DEVICE, 0xC0, data, sizeof(data)) && seen_count == 2 && seen[1].data == data &&
+            seen[1].flags == IIC_SEGMENT_READ && data[15] == 0xA5,
+        "register read fills the caller's buffer");
+
+  uint8_t reg = 0xB0, more[4] = {1, 2, 3, 4};
+  iic_segment_t gather[] = {{&reg, 1, IIC_SEGMENT_WRITE}, {payload, 6, IIC_SEGMENT_WRITE}, {more, 4, IIC_SEGMENT_WRITE}};
+  check(!iic_transfer(IIC0, DEVICE, gather, 3) && seen_count == 3 && seen[2].data == more,
+        "gathered write reaches the backend unchanged");
+
+  iic_segment_t bad_read[] = {{&reg, 1, IIC_SEGMENT_WRITE}, {data, 4, IIC_SEGMENT_READ}, {data + 4, 4, IIC_SEGMENT_READ}};
+  iic_segment_t empty[] = {{&reg, 0, IIC_SEGMENT_WRITE}};
+  check(iic_transfer(IIC0, DEVICE, bad_read, 3) && iic_transfer(IIC0, DEVICE, empty, 1),
+        "split reads and empty messages are refused");
+}
+
+static void fallback(void) {
+  uint8_t reg = 0x40, payload[3] = {7, 8, 9}, data[3] = {0};
+  iic_segment_t write[] = {{&reg, 1, IIC_SEGMENT_WRITE}, {payload, 3, IIC_SEGMENT_WRITE}};
+  iic_segment_t read[] = {{&reg, 1, IIC_SEGMENT_WRITE}, {data, 3, IIC_SEGMENT_READ}};
+  check(!iic_transfer(IIC1, DEVICE, write, 2) && registers[0x42] == 9, "register write through a plain backend");
+  check(!iic_transfer(IIC1, DEVICE, read, 2) && memcmp(data, payload, 3) == 0, "register read through a plain backend");
+  iic_segment_t two_messages[] = {{&reg, 1, IIC_SEGMENT_WRITE}, {payload, 3, IIC_SEGMENT_WRITE | IIC_SEGMENT_RESTART}};
+  check(iic_transfer(IIC1, DEVICE, two_messages, 2), "other shapes are refused by a plain backend");
+}
+
+int main(void) {
+  iic_set_backend(IIC0, &recording_backend);
+  iic_set_backend(IIC1, &register_backend);
+  iic_init(IIC0);
+  iic_init(IIC1);
+  zero_copy();
+  fallback();
+  iic_destroy(IIC0);
+  iic_destroy(IIC1);
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,139 @@
+#include <cJSON.h>
+#include <libpynq.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../libs/comms.h"
+#include "../libs/json_writer.h"
+#include "../libs/measurements.h"
+#include "check.h"
+
+/*
+ * Compares encoding a status message with the JSON writer against the cJSON tree it replaced, in time and heap
+ * allocations per message, and checks that cJSON reads back what the writer wrote. Runs on the host. Allocations are
+ * counted by putting malloc and friends of this program in front of the ones of the C library.
+ */
+
+#define ROUNDS 100000
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+extern void __libc_free(void *pointer);
+
+static size_t allocations = 0;
+
+void *malloc(size_t size) {
+  allocations++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  allocations++;
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+  allocations++;
+  return __libc_realloc(pointer, size);
+}
+
+void free(void *pointer) { __libc_free(pointer); }
+
+/* What comms.c did before */
+static char *encode_cjson(obstacle_t obstacle, robot_t robot) {
+  cJSON *root = cJSON_CreateObject();
+  cJSON_AddNumberToObject(root, "robot_x", robot.x);
+  cJSON_AddNumberToObject(root, "robot_y", robot.y);
+  cJSON_AddNumberToObject(root, "robot_status", robot.status);
+  cJSON_AddNumberToObject(root, "obstacle_x", obstacle.x);
+  cJSON_AddNumberToObject(root, "obstacle_y", obstacle.y);
+  cJSON_AddNumberToObject(root, "obstacle_type", obstacle.type);
+  cJSON_AddNumberToObject(root, "obstacle_color", obstacle.color);
+  char *json = cJSON_PrintUnformatted(root);
+  cJSON_Delete(root);
+  return json;
+}
+
+static bool number_is(cJSON *root, const char *key, double value) {
+  cJSON *item = cJSON_GetObjectItem(root, key);
+  return cJSON_IsNumber(item) && fabs(item->valuedouble - value) <= 0.5 / 100;
+}
+
+static bool reads_back(obstacle_t obstacle, robot_t robot) {
+  char json[JSON_BUFFER_SIZE];
+  if (encode_json(json, sizeof(json), obstacle, robot) == 0) {
+    return false;
+  }
+  cJSON *root = cJSON_Parse(json);
+  bool ok = root != NULL && number_is(root, "robot_x", robot.x) && number_is(root, "robot_y", robot.y) &&
+            number_is(root, "robot_status", robot.status) && number_is(root, "obstacle_x", obstacle.x) &&
+            number_is(root, "obstacle_y", obstacle.y) && number_is(root, "obstacle_type", obstacle.type) &&
+            number_is(root, "obstacle_color", obstacle.color);
+  cJSON_Delete(root);
+  return ok;
+}
+
+static void correctness(void) {
+  check(reads_back((obstacle_t){130.0, -48.25, BLUE, SMALL_ROCK}, (robot_t){123.4, -56.7, SCANNED}),
+        "cJSON reads back a status");
+  check(reads_back((obstacle_t){NONE, NONE, NONE, NONE}, (robot_t){NONE, NONE, READY}), "cJSON reads back NONE");
+  check(reads_back((obstacle_t){10 * cos(1.0), -0.004, RED, WALL}, (robot_t){1e-9, 9.995, MOVING}),
+        "cJSON reads back rounded values");
+
+  char json[64];
+  json_writer_t writer;
+  json_begin(&writer, json, sizeof(json));
+  json_add_number(&writer, "a", -0.5);
+  json_add_number(&writer, "b", 2.05);
+  json_add_number(&writer, "c", NAN);
+  json_add_string(&writer, "d", "x\"\\\n");
+  json_end(&writer);
+  check(strcmp(json, "{\"a\":-0.5,\"b\":2.05,\"c\":null,\"d\":\"x\\\"\\\\\\u000a\"}") == 0, "numbers and escapes");
+
+  json_begin(&writer, json, 8);
+  json_add_int(&writer, "long", 1234567);
+  check(json_end(&writer) == 0 && json[0] == '\0', "what does not fit is refused");
+}
+
+static void benchmark(void) {
+  obstacle_t obstacle = {130.0, -48.0, BLUE, SMALL_ROCK};
+  robot_t robot = {10 * cos(0.3), 10 * sin(0.3), SCANNED};
+  char json[JSON_BUFFER_SIZE];
+  volatile size_t sink = 0;
+
+  size_t before = allocations;
+  uint64_t start = get_time_usec();
+  for (int i = 0; i < ROUNDS; ++i) {
+    char *text = encode_cjson(obstacle, robot);
+    sink += text[0];
+    free(text);
+  }
+  double cjson_ns = (get_time_usec() - start) * 1000.0 / ROUNDS;
+  double cjson_allocations = (double)(allocations - before) / ROUNDS;
+
+  before = allocations;
+  start = get_time_usec();
+  for (int i = 0; i < ROUNDS; ++i) {
+    sink += encode_json(json, sizeof(json), obstacle, robot);
+  }
+  double writer_ns = (get_time_usec() - start) * 1000.0 / ROUNDS;
+  double writer_allocations = (double)(allocations - before) / ROUNDS;
+
+  char *text = encode_cjson(obstacle, robot);
+  printf("      cJSON:  %6.0f ns/message, %4.1f allocations/message, %zu bytes\n", cjson_ns, cjson_allocations,
+         strlen(text));
+  printf("      writer: %6.0f ns/message, %4.1f allocations/message, %zu bytes\n", writer_ns, writer_allocations,
+         strlen(json));
+  free(text);
+  check(writer_allocations == 0, "the writer does not allocate");
+  check(writer_ns < cjson_ns, "the writer is faster");
+}
+
+int main(void) {
+  correctness();
+  benchmark();
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,365 @@
+#include <libpynq.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../libs/comms.h"
+#include "../libs/publisher.h"
+#include "../libs/telemetry.h"
+#include "../libs/vtypes.h"
+#include "check.h"
+
+/*
+ * Replays a mission through the telemetry publisher and counts the bytes that go to the bridge: every update as JSON
+ * and as a full frame like before, then through the publisher as JSON and as frames with deltas. Checks that the
+ * receiver of the deltas ends with the same snapshot, that no obstacle is lost and that the budgets hold. Runs on the
+ * host. Without arguments the mission is simulated like the loop in rover.c, or pass a file recorded with
+ * TELEMETRY_RECORD in settings.h.
+ */
+
+#define MAX_EVENTS 20000
+#define SCAN_RANGE 50.0  // cm, closer scan points are sent like scanScope does
+#define SCOPE 15.0       // cm, closer than this ends the scan with a classified obstacle
+
+typedef struct {
+  uint64_t time_us;
+  obstacle_t obstacle;
+  robot_t robot;
+} event_t;
+
+static event_t events[MAX_EVENTS];
+static size_t event_count;
+
+static void add(uint64_t time_us, obstacle_t obstacle, robot_t robot) {
+  if (event_count < MAX_EVENTS) {
+    events[event_count++] = (event_t){time_us, obstacle, robot};
+  }
+}
+
+typedef struct {
+  double x, y, radius;
+  obs_types type;
+  color_t color;
+} rock_t;
+
+static const rock_t rocks[] = {{40, 60, 6, SMALL_ROCK, RED}, {-50, -30, 10, BIG_ROCK, BLUE}, {70, -60, 8, HILL, GREEN}};
+#define ARENA 120.0  // cm, walls around the origin
+
+/* Distance to the first wall or rock along the heading, and what it is */
+static double ray(double x, double y, double heading, const rock_t **hit) {
+  double dx = cos(heading * M_PI / 180), dy = sin(heading * M_PI / 180);
+  double best = INFINITY;
+  *hit = NULL;
+  best = dx > 0 ? fmin(best, (ARENA - x) / dx) : dx < 0 ? fmin(best, (-ARENA - x) / dx) : best;
+  best = dy > 0 ? fmin(best, (ARENA - y) / dy) : dy < 0 ? fmin(best, (-ARENA - y) / dy) : best;
+  for (size_t i = 0; i < sizeof(rocks) / sizeof(rocks[0]); ++i) {
+    double ox = rocks[i].x - x, oy = rocks[i].y - y;
+    double along = ox * dx + oy * dy;
+    double across = ox * dy - oy * dx;
+    if (along > 0 && fabs(across) < rocks[i].radius) {
+      double distance = along - sqrt(rocks[i].radius * rocks[i].radius - across * across);
+      if (distance < best) {
+        best = distance;
+        *hit = &rocks[i];
+      }
+    }
+  }
+  return best;
+}
+
+/* Sends what the loop in rover.c and scanScope send, with their timing */
+static void simulate(size_t loops) {
+  double x = 0, y = 0, heading = 90;
+  uint64_t now = 0;
+  obstacle_t obstacle = {0, 0, COLOR_COUNT, NO_OBSTACLE};
+  for (size_t loop = 0; loop < loops; ++loop) {
+    add(now, obstacle, (robot_t){obstacle.x, obstacle.y, IDLE});
+    now += 1000000;  // both color sensors
+
+    heading += 60;
+    double nearest = INFINITY;
+    const rock_t *nearest_hit = NULL;
+    for (int step = 0; step <= 12; ++step) {
+      const rock_t *hit;
+      double distance = ray(x, y, heading, &hit) + (rand() % 21 - 10) / 10.0;
+      if (distance < nearest) {
+        nearest = distance;
+        nearest_hit = hit;
+      }
+      if (step < 12 && distance < SCAN_RANGE) {
+        obstacle_t point = {x + (distance + 0.7) * cos(heading * M_PI / 180),
+                            y + (distance + 0.7) * sin(heading * M_PI / 180), NONE, NONE};
+        add(now, point, (robot_t){x, y, IDLE});
+      }
+      now += 400000;  // a reading and a 10 degree turn
+      heading -= step < 12 ? 10 : 0;
+    }
+    heading += 60;
+
+    obstacle = (obstacle_t){x, y, COLOR_COUNT, NONE};
+    if (nearest < SCOPE) {
+      obstacle.type = nearest_hit != NULL ? nearest_hit->type : WALL;
+      obstacle.color = nearest_hit != NULL ? nearest_hit->color : NONE;
+      x -= 6 * cos(heading * M_PI / 180);
+      y -= 6 * sin(heading * M_PI / 180);
+      heading += 150 + rand() % 60;
+      now += 3000000;  // driving up to it, back and turning
+    } else {
+      x += 10 * cos(heading * M_PI / 180);
+      y += 10 * sin(heading * M_PI / 180);
+      now += 1500000;
+    }
+  }
+}
+
+static bool load(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return false;
+  }
+  char line[256];
+  unsigned long long time_ms;
+  int status, type, color;
+  obstacle_t obstacle;
+  robot_t robot;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (sscanf(line, "%llu,%lf,%lf,%d,%lf,%lf,%d,%d", &time_ms, &robot.x, &robot.y, &status, &obstacle.x, &obstacle.y,
+               &type, &color) == 8) {
+      robot.status = status;
+      obstacle.type = type;
+      obstacle.color = color;
+      add(time_ms * 1000, obstacle, robot);
+    }
+  }
+  fclose(file);
+  return event_count > 0;
+}
+
+static uint8_t to_byte(int value) { return value == NONE ? TELEMETRY_NONE_BYTE : value; }
+
+static telemetry_status_t to_status(obstacle_t obstacle, robot_t robot) {
+  return (telemetry_status_t){.robot_x = telemetry_position(robot.x, NONE),
+                              .robot_y = telemetry_position(robot.y, NONE),
+                              .robot_status = to_byte(robot.status),
+                              .obstacle_x = telemetry_position(obstacle.x, NONE),
+                              .obstacle_y = telemetry_position(obstacle.y, NONE),
+                              .obstacle_type = to_byte(obstacle.type),
+                              .obstacle_color = to_byte(obstacle.color)};
+}
+
+static bool same(const telemetry_status_t *a, const telemetry_status_t *b) {
+  return a->robot_x == b->robot_x && a->robot_y == b->robot_y && a->robot_status == b->robot_status &&
+         a->obstacle_x == b->obstacle_x && a->obstacle_y == b->obstacle_y && a->obstacle_type == b->obstacle_type &&
+         a->obstacle_color == b->obstacle_color;
+}
+
+static size_t json_bytes(obstacle_t obstacle, robot_t robot) {
+  char json[JSON_BUFFER_SIZE];
+  return 4 + encode_json(json, sizeof(json), obstacle, robot);  // length prefix
+}
+
+/* What the bridge ends up with after applying every frame */
+static telemetry_status_t received;
+static telemetry_decoder_t decoder;
+static obstacle_t seen[MAX_EVENTS];
+static size_t seen_count;
+
+static void receive(const uint8_t *frame, size_t length) {
+  telemetry_frame_t decoded;
+  for (size_t i = 0; i < length; ++i) {
+    if (telemetry_decoder_push(&decoder, frame[i], &decoded) && !telemetry_apply(&decoded, &received)) {
+      bool at_robot = received.obstacle_x == received.robot_x && received.obstacle_y == received.robot_y;
+      bool classified = received.obstacle_type != NO_OBSTACLE && received.obstacle_type != TELEMETRY_NONE_BYTE;
+      if (received.obstacle_x != TELEMETRY_NONE_POSITION && (classified || !at_robot)) {
+        seen[seen_count++] = (obstacle_t){(double)received.obstacle_x / TELEMETRY_POSITION_SCALE,
+                                          (double)received.obstacle_y / TELEMETRY_POSITION_SCALE, received.obstacle_color,
+                                          received.obstacle_type};
+      }
+    }
+  }
+}
+
+static size_t transmit(const publish_update_t *update, bool frames, uint8_t *sequence) {
+  if (!frames) {
+    return json_bytes(update->obstacle, update->robot);
+  }
+  uint8_t frame[TELEMETRY_MAX_FRAME];
+  telemetry_status_t status = to_status(update->obstacle, update->robot);
+  size_t length = update->fields == TELEMETRY_FIELDS_ALL ? telemetry_encode_status(frame, (*sequence)++, &status)
+                                                         : telemetry_encode_delta(frame, (*sequence)++, update->fields, &status);
+  receive(frame, length);
+  return length;
+}
+
+static size_t publish(bool frames, publisher_t *publisher) {
+  publisher_config_t config = PUBLISHER_DEFAULTS;
+  config.deltas = frames;
+  publisher_init(publisher, &config, events[0].time_us);
+  memset(&received, 0, sizeof(received));
+  memset(&decoder, 0, sizeof(decoder));
+  seen_count = 0;
+  uint8_t sequence = 0;
+  size_t bytes = 0;
+  publish_update_t update;
+  for (size_t i = 0; i < event_count; ++i) {
+    if (publisher_offer(publisher, events[i].obstacle, events[i].robot, events[i].time_us, &update)) {
+      size_t length = transmit(&update, frames, &sequence);
+      publisher_charge(publisher, &update, length);
+      bytes += length;
+    }
+    while (publisher_pending(publisher, events[i].time_us, &update)) {
+      size_t length = transmit(&update, frames, &sequence);
+      publisher_charge(publisher, &update, length);
+      bytes += length;
+    }
+  }
+  return bytes;
+}
+
+/* Whether every obstacle of the mission has a received one close by, a classified one of the same type and color */
+static bool nothing_lost(double tolerance) {
+  for (size_t i = 0; i < event_count; ++i) {
+    obstacle_t obstacle = events[i].obstacle;
+    robot_t robot = events[i].robot;
+    bool classified = obstacle.type != NO_OBSTACLE && obstacle.type != NONE;
+    if (obstacle.x == NONE || (!classified && obstacle.x == robot.x && obstacle.y == robot.y)) {
+      continue;
+    }
+    bool found = false;
+    for (size_t j = 0; j < seen_count && !found; ++j) {
+      bool same = !classified || (seen[j].type == obstacle.type && (seen[j].color == obstacle.color ||
+                                                                    (obstacle.color == NONE && seen[j].color == TELEMETRY_NONE_BYTE)));
+      found = same && hypot(seen[j].x - obstacle.x, seen[j].y - obstacle.y) < tolerance;
+    }
+    if (!found) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Each budget may be exceeded by its burst and one message */
+static bool within_budget(const publisher_t *publisher, double seconds) {
+  for (size_t class = 0; class < PUBLISH_CLASSES; ++class) {
+    uint32_t rate = publisher->config.rate[class];
+    if (rate != 0 && publisher->stats.bytes[class] > rate * seconds + publisher->config.burst[class] + 4 + JSON_BUFFER_SIZE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Offers more distinct obstacle points than may wait while the budget is spent, scan points and classified obstacles
+ * in turn, and counts the classified ones that come out now or later.
+ */
+static bool classified_survive(void) {
+  publisher_config_t config = PUBLISHER_DEFAULTS;
+  config.burst[PUBLISH_OBSTACLE] = 1;
+  publisher_t publisher;
+  publisher_init(&publisher, &config, 0);
+  robot_t robot = {.x = 0, .y = 0, .status = MOVING};
+  publish_update_t update;
+  size_t offered = 0, reported = 0, points = 0;
+  for (size_t i = 0; i < 4 * PUBLISHER_PENDING; ++i) {
+    bool rock = i % 2 == 1;
+    obstacle_t obstacle = {.x = 20.0 * i, .y = 30, .type = rock ? SMALL_ROCK : NO_OBSTACLE, .color = rock ? RED : NONE};
+    offered += rock;
+    points += !rock;
+    if (publisher_offer(&publisher, obstacle, robot, 0, &update)) {
+      reported += update.obstacle.type == SMALL_ROCK;
+      publisher_charge(&publisher, &update, TELEMETRY_HEADER_SIZE + TELEMETRY_STATUS_SIZE + TELEMETRY_CRC_SIZE);
+    }
+  }
+  for (uint64_t now_us = 0; now_us < 60000000; now_us += 100000) {
+    while (publisher_pending(&publisher, now_us, &update)) {
+      reported += update.obstacle.type == SMALL_ROCK;
+      publisher_charge(&publisher, &update, TELEMETRY_HEADER_SIZE + TELEMETRY_STATUS_SIZE + TELEMETRY_CRC_SIZE);
+    }
+  }
+  printf("      %zu classified obstacles and %zu scan points offered at once: %u dropped, %u over the budget\n", offered,
+         points, publisher.stats.dropped, publisher.stats.overdrawn);
+  return reported == offered && publisher.stats.dropped > 0 && publisher.stats.overdrawn > 0;
+}
+
+/*
+ * Lets more scan points wait than fit, so the oldest is dropped, then offers it again at the same spot. It was never
+ * sent, so it has to wait again and come out later instead of being merged into itself.
+ */
+static bool dropped_offered_again(void) {
+  publisher_config_t config = PUBLISHER_DEFAULTS;
+  config.burst[PUBLISH_OBSTACLE] = 1;
+  publisher_t publisher;
+  publisher_init(&publisher, &config, 0);
+  robot_t robot = {.x = 0, .y = 0, .status = MOVING};
+  publish_update_t update;
+  for (size_t i = 0; i <= PUBLISHER_PENDING + 1; ++i) {
+    obstacle_t point = {.x = 20.0 * i, .y = 30, .type = NO_OBSTACLE, .color = NONE};
+    if (publisher_offer(&publisher, point, robot, 0, &update)) {
+      publisher_charge(&publisher, &update, TELEMETRY_HEADER_SIZE + TELEMETRY_STATUS_SIZE + TELEMETRY_CRC_SIZE);
+    }
+  }
+  obstacle_t dropped = {.x = 20.0, .y = 30, .type = NO_OBSTACLE, .color = NONE};
+  uint32_t merged = publisher.stats.merged;
+  publisher_offer(&publisher, dropped, robot, 0, &update);
+  bool queued = publisher.stats.merged == merged;
+  bool reported = false;
+  for (uint64_t now_us = 0; now_us < 60000000; now_us += 100000) {
+    while (publisher_pending(&publisher, now_us, &update)) {
+      reported |= update.obstacle.x == dropped.x && update.obstacle.y == dropped.y;
+      publisher_charge(&publisher, &update, TELEMETRY_HEADER_SIZE + TELEMETRY_STATUS_SIZE + TELEMETRY_CRC_SIZE);
+    }
+  }
+  return publisher.stats.dropped >= 2 && queued && reported;
+}
+
+static void print(const char *name, size_t bytes, size_t baseline, const publisher_t *publisher) {
+  printf("      %-22s %7zu bytes, %5.1fx less", name, bytes, (double)baseline / bytes);
+  if (publisher != NULL) {
+    const publisher_stats_t *stats = &publisher->stats;
+    printf(": %u state, %u position, %u obstacle updates, %u unchanged, %u merged, %u deferred, %u queued, %u dropped, %u over",
+           stats->sent[PUBLISH_STATE], stats->sent[PUBLISH_POSITION], stats->sent[PUBLISH_OBSTACLE], stats->unchanged,
+           stats->merged, stats->deferred, stats->queued, stats->dropped, stats->overdrawn);
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  srand(25);
+  if (argc < 2) {
+    simulate(300);
+  } else if (!load(argv[1])) {
+    fprintf(stderr, "Could not replay %s\n", argv[1]);
+    return 1;
+  }
+  double seconds = (events[event_count - 1].time_us - events[0].time_us) / 1e6;
+  printf("      %zu updates over %.0f s\n", event_count, seconds);
+
+  size_t json = 0, frames = 0;
+  for (size_t i = 0; i < event_count; ++i) {
+    json += json_bytes(events[i].obstacle, events[i].robot);
+    frames += TELEMETRY_HEADER_SIZE + TELEMETRY_STATUS_SIZE + TELEMETRY_CRC_SIZE;
+  }
+  print("JSON, every update", json, json, NULL);
+  print("frames, every update", frames, json, NULL);
+
+  publisher_t publisher;
+  size_t published_json = publish(false, &publisher);
+  print("JSON, published", published_json, json, &publisher);
+  check(within_budget(&publisher, seconds), "JSON stays within the budgets");
+
+  size_t published_frames = publish(true, &publisher);
+  print("frames with deltas", published_frames, json, &publisher);
+  check(within_budget(&publisher, seconds), "frames stay within the budgets");
+  check(decoder.crc_errors == 0 && decoder.lost == 0, "every frame decodes");
+  telemetry_status_t sent = to_status(publisher.obstacle, publisher.robot);
+  check(same(&sent, &received), "the receiver ends with the last snapshot sent");
+  check(publisher.stats.dropped == 0 && nothing_lost(publisher.config.merge_distance + publisher.config.resolution),
+        "every obstacle has a reported one close by");
+  check(classified_survive(), "classified obstacles are never dropped when too many points wait");
+  check(dropped_offered_again(), "a dropped scan point offered again at the same spot is reported");
+  check(published_frames * 10 < json, "at least 10x fewer bytes than JSON for every update");
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,355 @@
+#include <libpynq.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../libs/TCS3472.h"
+#include "../libs/VL53L0X.h"
+#include "../libs/i2c.h"
+#include "../libs/measurements.h"
+#include "../libs/navigation.h"
+#include "../libs/sensor_manager.h"
+#include "../libs/sensor_recovery.h"
+#include "../settings.h"
+#include "check.h"
+#include "fake_bus.h"
+
+/*
+ * Unplugs, replugs and browns out sensors under the sensor manager, with the rover's recovery callbacks: a sensor
+ * that fails now and then stays in service, one that is gone is quarantined after SENSOR_MAX_ERRORS reads, re-probed
+ * with backoff, and back in service soon after it answers again, settings and all. Runs on the host with a
+ * fault-injecting backend and the rover's wiring from settings.h: the VL53L0Xs and the forward TCS3472 on IIC0, the
+ * down TCS3472 on IIC1, and XSHUT pins in fake GPIO registers. A VL53L0X that powers up comes back on 0x29, the
+ * address of the forward TCS3472.
+ */
+
+#define BUDGET_US 50000
+
+typedef struct {
+  uint8_t pages[FAKE_VL53L0X_PAGES][256];
+  uint8_t address;
+  bool on;  // powered and out of reset at the last transfer
+  bool unplugged;
+  unsigned boots;
+} fake_vl53l0x_t;
+
+typedef struct {
+  uint8_t registers[32];
+  bool on;
+  bool unplugged;
+} fake_tcs3472_t;
+
+static fake_vl53l0x_t distance_devices[VL53L0X_SENSOR_COUNT];
+static fake_tcs3472_t color_devices[2];  // by FORWARD_LOOKING and DOWN_LOOKING
+static pthread_mutex_t devices_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile uint32_t gpio_registers[4];
+static unsigned fail_every[NUM_IICS];  // every nth transfer fails, 0 for none
+static unsigned transfers[NUM_IICS];
+
+/* What the sensors look like after power-on */
+static void boot_distance(fake_vl53l0x_t *device) {
+  memset(device->pages, 0, sizeof(device->pages));
+  device->pages[0][VL53L0X_IDENTIFICATION_MODEL_ID] = VL53L0X_EXPECTED_DEVICE_ID;
+  device->pages[0][VL53L0X_RESULT_INTERRUPT_STATUS] = 0x04;  // a sample is always ready
+  device->address = VL53L0X_DEFAULT_ADDRESS;
+  device->boots++;
+}
+
+static void boot_color(fake_tcs3472_t *device) {
+  memset(device->registers, 0, sizeof(device->registers));
+  device->registers[TCS3472_ID] = 0x4D;
+  device->registers[TCS3472_STATUS] = TCS3472_STATUS_AINT;  // a conversion always just finished
+}
+
+static bool power(bool *on, bool powered) {
+  bool booted = powered && !*on;
+  *on = powered;
+  return booted;
+}
+
+/* Sensors boot when they are plugged in and their XSHUT pin is high */
+static void follow_power(void) {
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    fake_vl53l0x_t *device = &distance_devices[i];
+    if (power(&device->on, !device->unplugged && gpio_get_level(distance_sensor_x_pins[i]) == GPIO_LEVEL_HIGH)) {
+      boot_distance(device);
+    }
+  }
+  fake_tcs3472_t *forward = &color_devices[FORWARD_LOOKING], *down = &color_devices[DOWN_LOOKING];
+  if (power(&forward->on, !forward->unplugged && gpio_get_level(COLOR_SENSOR_X_PIN) == GPIO_LEVEL_HIGH)) {
+    boot_color(forward);
+  }
+  if (power(&down->on, !down->unplugged)) {
+    boot_color(down);
+  }
+}
+
+/* Finds the one device that answers on addr, two that answer garble each other and fail the transfer */
+static bool find(iic_index_t iic, uint8_t addr, fake_vl53l0x_t **distance, fake_tcs3472_t **color) {
+  int found = 0;
+  *distance = NULL;
+  *color = NULL;
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    fake_vl53l0x_t *device = &distance_devices[i];
+    if (distance_sensor_buses[i] == iic && device->on && device->address == addr) {
+      *distance = device;
+      found++;
+    }
+  }
+  for (size_t i = 0; i < 2; ++i) {
+    if (color_sensor_buses[i] == iic && color_devices[i].on && addr == TCS3472_ADDR) {
+      *color = &color_devices[i];
+      found++;
+    }
+  }
+  return found != 1;
+}
+
+static bool fault(const iic_index_t iic) {
+  transfers[iic]++;
+  return fail_every[iic] != 0 && transfers[iic] % fail_every[iic] == 0;
+}
+
+static bool fake_read(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  pthread_mutex_lock(&devices_lock);
+  follow_power();
+  fake_vl53l0x_t *distance;
+  fake_tcs3472_t *color;
+  bool err = fault(iic) || find(iic, addr, &distance, &color);
+  if (!err && distance != NULL) {
+    fake_vl53l0x_read(distance->pages, reg, data, data_length);
+  } else if (!err) {
+    fake_registers_read(color->registers, 0x1F, reg, data, data_length);
+  }
+  pthread_mutex_unlock(&devices_lock);
+  return err;
+}
+
+static bool fake_write(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  pthread_mutex_lock(&devices_lock);
+  follow_power();
+  fake_vl53l0x_t *distance;
+  fake_tcs3472_t *color;
+  bool err = fault(iic) || find(iic, addr, &distance, &color);
+  if (!err && distance != NULL) {
+    fake_vl53l0x_write(distance->pages, reg, data, data_length);
+    uint8_t *page0 = distance->pages[0];
+    if (page0[VL53L0X_SLAVE_DEVICE_ADDRESS] != 0) {
+      distance->address = page0[VL53L0X_SLAVE_DEVICE_ADDRESS] & 0x7F;
+      page0[VL53L0X_SLAVE_DEVICE_ADDRESS] = 0;
+    }
+    if (page0[VL53L0X_SYSRANGE_START] & VL53L0X_SYSRANGE_MODE_SINGLESHOT) {
+      page0[VL53L0X_SYSRANGE_START] = 0;  // a single measurement "finishes" at once
+    }
+  } else if (!err) {
+    fake_registers_write(color->registers, 0x1F, reg, data, data_length);
+  }
+  pthread_mutex_unlock(&devices_lock);
+  return err;
+}
+
+static const iic_backend_t fake_backend = FAKE_BUS_BACKEND("faulty", fake_read, fake_write);
+
+static void set_unplugged(bool *unplugged, bool value) {
+  pthread_mutex_lock(&devices_lock);
+  *unplugged = value;
+  pthread_mutex_unlock(&devices_lock);
+}
+
+/* Resets the sensor while its XSHUT pin stays high, it comes back on the default address */
+static void brown_out(size_t index) {
+  pthread_mutex_lock(&devices_lock);
+  boot_distance(&distance_devices[index]);
+  pthread_mutex_unlock(&devices_lock);
+}
+
+static vl53l0x_t *distance[VL53L0X_SENSOR_COUNT];
+static tcs3472_t *color[2];
+static size_t distance_ids[VL53L0X_SENSOR_COUNT], color_ids[2];
+static const uint32_t distance_capabilities[] = {NAV_RANGE_LOW, NAV_RANGE_MIDDLE, NAV_RANGE_HIGH};
+
+static bool read_distance(void *device) { return vl53l0x_read_range(device); }
+static bool read_color(void *device) { return tcs3472_sample_fresh(device, 1) != 1; }
+
+/* Waits until the sensor is back, at most timeout_ms, and returns how long it took */
+static uint64_t wait_back(sensor_health_t *health, uint32_t timeout_ms) {
+  uint64_t start = get_time_usec();
+  while (!sensor_health_usable(health) && get_time_usec() - start < timeout_ms * 1000ull) {
+    sleep_msec(5);
+  }
+  return (get_time_usec() - start) / 1000;
+}
+
+/* Ranging again on the device itself, on its own address and with its timing budget */
+static bool distance_restored(size_t index) {
+  pthread_mutex_lock(&devices_lock);
+  fake_vl53l0x_t *device = &distance_devices[index];
+  bool ok = device->on && device->address == INITIAL_ADDRESS - index &&
+            device->pages[0][VL53L0X_SYSRANGE_START] == VL53L0X_SYSRANGE_MODE_BACKTOBACK;
+  pthread_mutex_unlock(&devices_lock);
+  return ok && distance[index]->address == INITIAL_ADDRESS - index && distance[index]->continuous &&
+         distance[index]->timing_budget_us == BUDGET_US;
+}
+
+static bool color_restored(tcs3472_t *sensor) {
+  return sensor->enable && sensor->integration_time_us == TCS3472_INTEGRATION_TIME_US &&
+         i2c_shadow_stats(TCS3472_ADDR, sensor->iic).writes > 0;
+}
+
+static void unplug_and_replug(const char *name, iic_index_t iic, size_t id, sensor_health_t *health, uint32_t capability,
+                              bool (*read)(void *device), void *device, bool *unplugged) {
+  char what[128];
+  fail_every[iic] = 50;
+  bool err = false;
+  for (int i = 0; i < 40; ++i) {
+    err |= read(device);
+  }
+  fail_every[iic] = 0;
+  snprintf(what, sizeof(what), "%s stays in service with a failing transfer now and then", name);
+  check(err && sensor_health_usable(health) && sensor_manager_stats(id).errors > 0, what);
+
+  set_unplugged(unplugged, true);
+  for (int i = 0; i < SENSOR_MAX_ERRORS; ++i) {
+    snprintf(what, sizeof(what), "%s usable after %d failed reads", name, i);
+    check(sensor_health_usable(health) && (sensor_manager_capabilities() & capability), what);
+    read(device);
+  }
+  snprintf(what, sizeof(what), "%s quarantined after %d failed reads, capability gone", name, SENSOR_MAX_ERRORS);
+  check(!sensor_health_usable(health) && !(sensor_manager_capabilities() & capability), what);
+
+  /* Probes after 100, 300, 700 and 1500 ms, instead of every period */
+  uint32_t away_ms = 8 * SENSOR_PROBE_MIN_MS;
+  sleep_msec(away_ms);
+  sensor_stats_t stats = sensor_manager_stats(id);
+  printf("      %u probes while away for %u ms\n", stats.probes, away_ms);
+  snprintf(what, sizeof(what), "%s re-probed with backoff", name);
+  check(stats.probes >= 2 && stats.probes <= 4 && stats.recoveries == 0, what);
+
+  set_unplugged(unplugged, false);
+  uint64_t back_ms = wait_back(health, 2 * SENSOR_PROBE_MAX_MS);
+  printf("      back %llu ms after replugging\n", (unsigned long long)back_ms);
+  snprintf(what, sizeof(what), "%s back within the probe interval, capability restored", name);
+  check(sensor_health_usable(health) && back_ms <= 16 * SENSOR_PROBE_MIN_MS &&
+            (sensor_manager_capabilities() & capability) && sensor_manager_stats(id).recoveries == 1,
+        what);
+  snprintf(what, sizeof(what), "%s reads again", name);
+  check(!read(device), what);
+}
+
+/* The forward color sensor is held in reset while distance sensors are readdressed, and recovered after */
+static void forward_color_back(const char *when) {
+  char what[128];
+  tcs3472_t *forward = color[FORWARD_LOOKING];
+  wait_back(&forward->health, 2 * SENSOR_PROBE_MAX_MS);
+  snprintf(what, sizeof(what), "forward TCS3472 back %s, enabled, integration time and register shadow restored", when);
+  check(sensor_health_usable(&forward->health) && color_restored(forward) && !read_color(forward), what);
+}
+
+static void unplug_distance(void) {
+  unsigned boots[VL53L0X_SENSOR_COUNT];
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    boots[i] = distance_devices[i].boots;
+  }
+  unplug_and_replug("VL53L0X", IIC0, distance_ids[0], &distance[0]->health, NAV_RANGE_LOW, read_distance, distance[0],
+                    &distance_devices[0].unplugged);
+  check(distance_restored(0), "VL53L0X moved back from 0x29, ranging continuously with its timing budget");
+  check(distance_devices[1].boots == boots[1] && distance_devices[2].boots == boots[2],
+        "the other distance sensors were left alone");
+  forward_color_back("after the readdress");
+}
+
+/* Two sensors reset by the same dip come back on 0x29 together, next to the forward color sensor */
+static void brown_out_two(void) {
+  unsigned color_recoveries = sensor_manager_stats(color_ids[FORWARD_LOOKING]).recoveries;
+  brown_out(0);
+  brown_out(1);
+  for (int i = 0; i < SENSOR_MAX_ERRORS; ++i) {
+    read_distance(distance[0]);
+  }
+  check(!sensor_health_usable(&distance[0]->health), "browned-out VL53L0X 0 quarantined");
+
+  sleep_msec(4 * SENSOR_PROBE_MIN_MS);
+  pthread_mutex_lock(&devices_lock);
+  bool untouched = distance_devices[0].address == VL53L0X_DEFAULT_ADDRESS &&
+                   distance_devices[1].address == VL53L0X_DEFAULT_ADDRESS;
+  pthread_mutex_unlock(&devices_lock);
+  check(untouched && !sensor_health_usable(&distance[0]->health) && sensor_health_usable(&distance[1]->health) &&
+            sensor_manager_stats(color_ids[FORWARD_LOOKING]).recoveries == color_recoveries,
+        "nothing moved while VL53L0X 1 does not answer but is still in use");
+
+  for (int i = 0; i < SENSOR_MAX_ERRORS; ++i) {
+    read_distance(distance[1]);
+  }
+  check(!sensor_health_usable(&distance[1]->health), "browned-out VL53L0X 1 quarantined");
+  wait_back(&distance[0]->health, 2 * SENSOR_PROBE_MAX_MS);
+  wait_back(&distance[1]->health, 2 * SENSOR_PROBE_MAX_MS);
+  check(sensor_health_usable(&distance[0]->health) && sensor_health_usable(&distance[1]->health) &&
+            distance_restored(0) && distance_restored(1),
+        "both VL53L0Xs moved back and ranging continuously with their timing budget");
+  check(!read_distance(distance[0]) && !read_distance(distance[1]), "both VL53L0Xs read again");
+  forward_color_back("after both were readdressed");
+}
+
+int main(void) {
+  gpio_init_registers(gpio_registers);
+  for (iic_index_t iic = IIC0; iic < NUM_IICS; ++iic) {
+    iic_set_backend(iic, &fake_backend);
+    iic_init(iic);
+  }
+
+  /* Brought up like the rover does: distance sensors readdressed one by one, then the forward color sensor */
+  vl53l0x_slot_t slots[VL53L0X_SENSOR_COUNT];
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    gpio_set_direction(distance_sensor_x_pins[i], GPIO_DIR_OUTPUT);
+    gpio_set_level(distance_sensor_x_pins[i], GPIO_LEVEL_LOW);
+    slots[i] = (vl53l0x_slot_t){.xshut_pin = distance_sensor_x_pins[i], .address = INITIAL_ADDRESS - i,
+                                .iic = distance_sensor_buses[i]};
+  }
+  gpio_set_direction(COLOR_SENSOR_X_PIN, GPIO_DIR_OUTPUT);
+  gpio_set_level(COLOR_SENSOR_X_PIN, GPIO_LEVEL_LOW);
+  bool err = vl53l0x_assign_addresses(slots, VL53L0X_SENSOR_COUNT, NULL, NULL);
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    distance[i] = vl53l0x_init_at(INITIAL_ADDRESS - i, distance_sensor_buses[i]);
+    err |= distance[i] == NULL || vl53l0x_set_timing_budget_us(distance[i], BUDGET_US) ||
+           vl53l0x_start_continuous(distance[i], 0);
+  }
+  gpio_set_level(COLOR_SENSOR_X_PIN, GPIO_LEVEL_HIGH);
+  for (size_t i = 0; i < 2; ++i) {
+    color[i] = tcs3472_init(color_sensor_buses[i]);
+    err |= color[i] == NULL || tcs3472_enable(color[i]) ||
+           tcs3472_set_integration_time_us(color[i], TCS3472_INTEGRATION_TIME_US);
+  }
+  check(!err, "sensors initialise");
+  if (err) {
+    return 1;
+  }
+
+  sensor_recovery_init(distance, color);
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    distance_ids[i] = sensor_manager_add("distance", &distance[i]->health, sensor_recovery_distance, distance[i],
+                                         distance_capabilities[i]);
+  }
+  color_ids[FORWARD_LOOKING] = sensor_manager_add("forward color", &color[FORWARD_LOOKING]->health,
+                                                  sensor_recovery_color, color[FORWARD_LOOKING], NAV_COLOR_FRONT);
+  color_ids[DOWN_LOOKING] =
+      sensor_manager_add("down color", &color[DOWN_LOOKING]->health, sensor_recovery_color, color[DOWN_LOOKING],
+                                               NAV_COLOR_DOWN);
+  check(!sensor_manager_start() && sensor_manager_capabilities() == (NAV_RANGE_ALL | NAV_COLOR_FRONT | NAV_COLOR_DOWN), "manager starts with everything usable");
+
+  unplug_distance();
+  brown_out_two();
+  unplug_and_replug("down TCS3472", IIC1, color_ids[DOWN_LOOKING], &color[DOWN_LOOKING]->health, NAV_COLOR_DOWN, read_color,
+                    color[DOWN_LOOKING], &color_devices[DOWN_LOOKING].unplugged);
+  check(color_restored(color[DOWN_LOOKING]), "down TCS3472 enabled, integration time and register shadow restored");
+
+  sensor_manager_stop();
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    vl53l0x_destroy(distance[i]);
+  }
+  tcs3472_destroy(color[FORWARD_LOOKING]);
+  tcs3472_destroy(color[DOWN_LOOKING]);
+  iic_destroy(IIC0);
+  iic_destroy(IIC1);
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,123 @@
+#include <libpynq.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../libs/TCS3472.h"
+#include "../libs/VL53L0X.h"
+#include "../libs/i2c.h"
+#include "../libs/measurements.h"
+#include "../libs/scheduler.h"
+#include "../settings.h"
+
+/*
+ * Times a full sensor sweep (all distance sensors plus both color sensors) run one job after the other against
+ * the bus-aware scheduler, and reports how busy each bus was. Runs on the host: both IIC controllers are replaced
+ * by simulated 100 kHz buses with a TCS3472 each and the distance sensors on the buses given in settings.h.
+ */
+
+#define SWEEPS 3
+#define INTEGRATION_US 24000  // shorter than on the rover to keep the benchmark quick
+#define RANGING_US 20000
+
+static uint8_t registers[NUM_IICS][128][256];
+static uint64_t last_clear_us[NUM_IICS][128];
+
+static void bus_time(uint16_t bytes) { usleep((2 + bytes) * 9 * 10); }
+
+static bool is_tcs(uint8_t addr) { return addr == TCS3472_ADDR; }
+
+bool iic_read_register(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  bus_time(data_length + 1);
+  uint8_t first = is_tcs(addr) ? reg & 0x1F : reg;
+  uint64_t since_clear = get_time_usec() - last_clear_us[iic][addr];
+  if (is_tcs(addr) && first == TCS3472_STATUS) {
+    registers[iic][addr][first] = since_clear >= INTEGRATION_US ? TCS3472_STATUS_AINT : 0;
+  } else if (!is_tcs(addr) && first == VL53L0X_RESULT_INTERRUPT_STATUS) {
+    registers[iic][addr][first] = since_clear >= RANGING_US ? 0x04 : 0;
+  }
+  for (uint16_t i = 0; i < data_length; ++i) {
+    data[i] = registers[iic][addr][(uint8_t)(first + i)];
+  }
+  return 0;
+}
+
+bool iic_write_register(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  bus_time(data_length);
+  if ((is_tcs(addr) && reg == TCS3472_CLEAR_INTERRUPT) || (!is_tcs(addr) && reg == VL53L0X_SYSTEM_INTERRUPT_CLEAR)) {
+    last_clear_us[iic][addr] = get_time_usec();
+  }
+  for (uint16_t i = 0; i < data_length; ++i) {
+    registers[iic][addr][(uint8_t)(reg + i)] = data[i];
+  }
+  return 0;
+}
+
+typedef struct {
+  uint64_t latency_us;
+  uint64_t busy_us[NUM_IICS];
+} sweep_stats_t;
+
+static void print_stats(const char *what, const sweep_stats_t *stats) {
+  printf("%-28s %7.1f ms per sweep, bus utilisation IIC0 %3.0f%% IIC1 %3.0f%%\n", what, stats->latency_us / 1000.0,
+         100.0 * stats->busy_us[IIC0] / stats->latency_us, 100.0 * stats->busy_us[IIC1] / stats->latency_us);
+}
+
+static sweep_stats_t sweep(sensor_job_t *jobs, size_t count, bool scheduled) {
+  sweep_stats_t stats = {0};
+  uint64_t busy[NUM_IICS] = {i2c_busy_usec(IIC0), i2c_busy_usec(IIC1)};
+  uint64_t start = get_time_usec();
+  for (int s = 0; s < SWEEPS; ++s) {
+    if (scheduled) {
+      scheduler_run(jobs, count);
+    } else {
+      for (size_t i = 0; i < count; ++i) {
+        jobs[i].err = jobs[i].run(jobs[i].arg);
+      }
+    }
+  }
+  stats.latency_us = (get_time_usec() - start) / SWEEPS;
+  for (iic_index_t iic = IIC0; iic < NUM_IICS; ++iic) {
+    stats.busy_us[iic] = (i2c_busy_usec(iic) - busy[iic]) / SWEEPS;
+  }
+  return stats;
+}
+
+static void run_layout(const char *name, const iic_index_t *distance_buses) {
+  vl53l0x_t distance[VL53L0X_SENSOR_COUNT];
+  vl53l0x_t *distance_sensors[VL53L0X_SENSOR_COUNT];
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    distance[i] = (vl53l0x_t){.address = INITIAL_ADDRESS - i, .iic = distance_buses[i], .continuous = true};
+    distance_sensors[i] = &distance[i];
+  }
+  tcs3472_t color[2];
+  for (size_t i = 0; i < 2; ++i) {
+    color[i] = (tcs3472_t){.iic = color_sensor_buses[i],
+                           .enable = true,
+                           .integration_time_us = INTEGRATION_US,
+                           .calibration = color_default_calibration(color_sensor_buses[i])};
+  }
+
+  distance_read_t distances = {.sensors = distance_sensors, .count = VL53L0X_SENSOR_COUNT};
+  color_read_t front = {.sensor = &color[FORWARD_LOOKING]}, down = {.sensor = &color[DOWN_LOOKING]};
+  sensor_job_t jobs[] = {scheduler_distance_job(&distances), scheduler_color_job(&front), scheduler_color_job(&down)};
+
+  printf("%s: distance sensors on IIC%d, forward color on IIC%d, down color on IIC%d\n", name, distance_buses[0],
+         color_sensor_buses[FORWARD_LOOKING], color_sensor_buses[DOWN_LOOKING]);
+  sweep_stats_t serial = sweep(jobs, 3, false);
+  print_stats("  one job after the other", &serial);
+  sweep_stats_t scheduled = sweep(jobs, 3, true);
+  print_stats("  bus-aware scheduler", &scheduled);
+  bool err = false;
+  for (size_t i = 0; i < 3; ++i) {
+    err |= jobs[i].err;
+  }
+  printf("  %s, %.2fx faster\n", err ? "JOBS FAILED" : "all jobs succeeded", (double)serial.latency_us / scheduled.latency_us);
+}
+
+int main(void) {
+  run_layout("settings.h", distance_sensor_buses);
+  const iic_index_t rebalanced[VL53L0X_SENSOR_COUNT] = {IIC1, IIC1, IIC1};
+  run_layout("rebalanced", rebalanced);
+  return 0;
+}
@@ -0,0 +1,109 @@
+#include <libpynq.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../libs/comms.h"
+#include "../libs/measurements.h"
+#include "../libs/telemetry.h"
+#include "../libs/vtypes.h"
+#include "check.h"
+
+/*
+ * Compares the binary telemetry frames with the JSON messages they replace, in bytes on the wire and encode time,
+ * and checks that the decoder gets every frame through garbage, bit errors and lost frames. Runs on the host.
+ */
+
+#define ROUNDS 100000
+
+static const telemetry_status_t sample = {
+    .robot_x = 1234, .robot_y = -567, .robot_status = 2, .obstacle_x = 1300, .obstacle_y = -480, .obstacle_type = 4, .obstacle_color = 3};
+
+static bool same(const telemetry_status_t *a, const telemetry_status_t *b) {
+  return a->robot_x == b->robot_x && a->robot_y == b->robot_y && a->robot_status == b->robot_status &&
+         a->obstacle_x == b->obstacle_x && a->obstacle_y == b->obstacle_y && a->obstacle_type == b->obstacle_type &&
+         a->obstacle_color == b->obstacle_color;
+}
+
+/* Feeds bytes and returns the status frames that came out */
+static size_t feed(telemetry_decoder_t *decoder, const uint8_t *bytes, size_t length, telemetry_status_t *out, size_t max) {
+  size_t count = 0;
+  telemetry_frame_t frame;
+  for (size_t i = 0; i < length; ++i) {
+    if (telemetry_decoder_push(decoder, bytes[i], &frame) && count < max && !telemetry_decode_status(&frame, &out[count])) {
+      count++;
+    }
+  }
+  return count;
+}
+
+static void sizes(void) {
+  robot_t robot = {123.4, -56.7, SCANNED};
+  obstacle_t obstacle = {130.0, -48.0, BLUE, SMALL_ROCK};
+  char json[JSON_BUFFER_SIZE];
+  size_t json_bytes = 4 + encode_json(json, sizeof(json), obstacle, robot);  // length prefix
+  uint8_t frame[TELEMETRY_MAX_FRAME];
+  size_t frame_bytes = telemetry_encode_status(frame, 0, &sample);
+  printf("      JSON %zu bytes, frame %zu bytes, %.1fx smaller\n", json_bytes, frame_bytes, (double)json_bytes / frame_bytes);
+  check(json_bytes >= 5 * frame_bytes, "frames are at least 5x smaller than JSON");
+
+  uint64_t start = get_time_usec();
+  for (int i = 0; i < ROUNDS; ++i) {
+    encode_json(json, sizeof(json), obstacle, robot);
+  }
+  double json_us = (double)(get_time_usec() - start) / ROUNDS;
+  volatile size_t sink = 0;
+  start = get_time_usec();
+  for (int i = 0; i < ROUNDS; ++i) {
+    sink += telemetry_encode_status(frame, i, &sample);
+  }
+  double frame_us = (double)(get_time_usec() - start) / ROUNDS;
+  printf("      encode: JSON %.2f us, frame %.3f us\n", json_us, frame_us);
+}
+
+static void decoding(void) {
+  uint8_t stream[8 * TELEMETRY_MAX_FRAME];
+  size_t length = 0;
+  telemetry_status_t none = {TELEMETRY_NONE_POSITION, TELEMETRY_NONE_POSITION, TELEMETRY_NONE_BYTE,
+                             TELEMETRY_NONE_POSITION, TELEMETRY_NONE_POSITION, TELEMETRY_NONE_BYTE, TELEMETRY_NONE_BYTE};
+  const uint8_t garbage[] = {0x00, TELEMETRY_SYNC, 0x13, TELEMETRY_SYNC, TELEMETRY_VERSION, 1, 0, 30, 0x42};
+  memcpy(stream, garbage, sizeof(garbage));
+  length += sizeof(garbage);
+  length += telemetry_encode_status(stream + length, 7, &sample);
+  length += telemetry_encode_status(stream + length, 8, &none);
+
+  telemetry_decoder_t decoder = {0};
+  telemetry_status_t out[4];
+  size_t count = feed(&decoder, stream, length, out, 4);
+  check(count == 2 && same(&out[0], &sample) && same(&out[1], &none), "frames found after garbage and false syncs");
+  check(decoder.lost == 0 && decoder.frames == 2, "consecutive sequence numbers, nothing lost");
+
+  uint8_t frame[TELEMETRY_MAX_FRAME];
+  size_t frame_length = telemetry_encode_status(frame, 9, &sample);
+  frame[6] ^= 0x10;
+  uint32_t crc_errors = decoder.crc_errors;
+  count = feed(&decoder, frame, frame_length, out, 4);
+  frame_length = telemetry_encode_status(frame, 10, &sample);
+  count += feed(&decoder, frame, frame_length, out, 4);
+  check(count == 1 && decoder.crc_errors > crc_errors, "a bit error drops the frame, the next one arrives");
+
+  frame_length = telemetry_encode_status(frame, 14, &sample);
+  feed(&decoder, frame, frame_length, out, 4);
+  check(decoder.lost == 4, "lost frames counted from the sequence numbers");
+
+  frame[1] = TELEMETRY_VERSION + 1;
+  uint32_t bad = decoder.bad_frames;
+  check(feed(&decoder, frame, frame_length, out, 4) == 0 && decoder.bad_frames > bad, "other versions are refused");
+
+  const uint8_t check_string[] = "123456789";
+  check(telemetry_crc16(check_string, 9) == 0x29B1, "CRC-16/CCITT-FALSE check value");
+  check(telemetry_position(NONE, NONE) == TELEMETRY_NONE_POSITION && telemetry_position(12.34, NONE) == 123 &&
+            telemetry_position(1e6, NONE) == INT16_MAX && telemetry_position(-1e6, NONE) == INT16_MIN + 1,
+        "positions keep none apart and saturate");
+}
+
+int main(void) {
+  sizes();
+  decoding();
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,142 @@
+#include <libpynq.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../libs/measurements.h"
+#include "../libs/uart_rx.h"
+#include "check.h"
+
+/*
+ * Feeds the UART receive parser byte streams in random splits: whole messages, garbage, impossible lengths, a
+ * message cut off by the bridge and one with a bad end. Every split has to give the same messages. Runs on the host.
+ */
+
+#define SPLITS 1000
+
+static char seen[16][UART_RX_MAX_JSON + 1];
+static size_t seen_count;
+static uint8_t seen_frames[16];
+static size_t seen_frame_count;
+
+static void on_json(const char *json, size_t length, void *arg) {
+  (void)arg;
+  if (seen_count < 16 && strlen(json) == length) {
+    strcpy(seen[seen_count++], json);
+  }
+}
+
+static void on_frame(const telemetry_frame_t *frame, void *arg) {
+  (void)arg;
+  if (seen_frame_count < 16) {
+    seen_frames[seen_frame_count++] = frame->sequence;
+  }
+}
+
+static size_t put_json(uint8_t *stream, const char *json, uint32_t length) {
+  for (int i = 0; i < UART_RX_PREFIX; ++i) {
+    stream[i] = length >> (8 * i);
+  }
+  memcpy(stream + UART_RX_PREFIX, json, strlen(json));
+  return UART_RX_PREFIX + strlen(json);
+}
+
+/* Feeds the stream in random pieces, and once more after the end for a message left over from a resync */
+static void feed_split(uart_rx_t *rx, const uint8_t *stream, size_t length) {
+  size_t offset = 0;
+  while (offset < length) {
+    size_t piece = 1 + rand() % 40;
+    piece = piece > length - offset ? length - offset : piece;
+    size_t end = offset + piece;
+    while (offset < end) {
+      offset += uart_rx_feed(rx, stream + offset, end - offset);
+    }
+  }
+  uint32_t messages;
+  do {
+    messages = rx->stats.messages;
+    uart_rx_feed(rx, NULL, 0);
+  } while (rx->stats.messages != messages);
+}
+
+static const char *expected[] = {"{\"a\":1}", "{\"robot_status\":5,\"proto\":1}", "{\"b\":2}", "{\"c\":3}", "{\"d\":4}"};
+
+static size_t json_stream(uint8_t *stream) {
+  size_t length = 0;
+  length += put_json(stream + length, expected[0], strlen(expected[0]));
+  stream[length++] = 0x00;  // garbage between messages
+  stream[length++] = 0x7B;
+  length += put_json(stream + length, expected[1], strlen(expected[1]));
+  length += put_json(stream + length, "", 0xFFFFFFF0);  // a length that would have been a huge malloc
+  length += put_json(stream + length, "{\"cut\":", 20);  // the bridge gave up on this one, the next ones fill it up
+  length += put_json(stream + length, expected[2], strlen(expected[2]));
+  length += put_json(stream + length, "{\"e\":5]", 7);  // does not end like an object
+  length += put_json(stream + length, expected[3], strlen(expected[3]));
+  length += put_json(stream + length, expected[4], strlen(expected[4]));
+  return length;
+}
+
+static void json(void) {
+  uint8_t stream[512];
+  size_t length = json_stream(stream);
+  uart_rx_t rx;
+  bool all = true;
+  uint32_t invalid = 0;
+  for (int split = 0; split < SPLITS; ++split) {
+    uart_rx_init(&rx, UART_RX_JSON);
+    uart_rx_on_json(&rx, on_json, NULL);
+    seen_count = 0;
+    feed_split(&rx, stream, length);
+    bool same = seen_count == 5;
+    for (size_t i = 0; same && i < 5; ++i) {
+      same = strcmp(seen[i], expected[i]) == 0;
+    }
+    all &= same;
+    invalid = rx.stats.invalid;
+  }
+  printf("      %u times out of sync, %u bytes skipped\n", invalid, rx.stats.skipped);
+  check(all, "every split gives the same five messages through the corruption");
+
+  uart_rx_init(&rx, UART_RX_JSON);
+  uart_rx_on_json(&rx, on_json, NULL);
+  seen_count = 0;
+  uint8_t partial[16];
+  size_t partial_length = put_json(partial, "{\"cut", 40);
+  uart_rx_feed(&rx, partial, partial_length);
+  check(!uart_rx_expire(&rx, get_time_usec()), "a partial message is kept while it may still arrive");
+  check(uart_rx_expire(&rx, get_time_usec() + 2 * UART_RX_TIMEOUT_MS * 1000) && rx.received == 0,
+        "a partial message is dropped after the timeout");
+  size_t message_length = put_json(stream, expected[0], strlen(expected[0]));
+  uart_rx_feed(&rx, stream, message_length);
+  check(seen_count == 1 && strcmp(seen[0], expected[0]) == 0, "the next message is received whole");
+}
+
+static void frames(void) {
+  uint8_t stream[8 * TELEMETRY_MAX_FRAME];
+  size_t length = 0;
+  uint8_t payload[4] = {1, 2, 3, 4};
+  for (uint8_t sequence = 0; sequence < 6; ++sequence) {
+    length += telemetry_encode(stream + length, TELEMETRY_STATUS, sequence, payload, sizeof(payload));
+    if (sequence == 2) {
+      stream[length - 1] ^= 0xFF;  // bad CRC
+    }
+  }
+  uart_rx_t rx;
+  bool all = true;
+  for (int split = 0; split < SPLITS; ++split) {
+    uart_rx_init(&rx, UART_RX_FRAMES);
+    uart_rx_on_frame(&rx, TELEMETRY_STATUS, on_frame, NULL);
+    seen_frame_count = 0;
+    feed_split(&rx, stream, length);
+    all &= seen_frame_count == 5 && seen_frames[2] == 3 && rx.frames.crc_errors == 1;
+  }
+  check(all, "every split gives the same frames, the corrupted one left out");
+}
+
+int main(void) {
+  srand(29);
+  json();
+  frames();
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
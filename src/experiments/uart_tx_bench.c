@@ -0,0 +1,178 @@
+#include <libpynq.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../libs/measurements.h"
+#include "../libs/uart_tx.h"
+#include "check.h"
+
+/*
+ * Measures how long a sender is held up by the UART TX queue compared to sending byte by byte, and checks that
+ * messages arrive whole and in order, that waiting position updates are replaced, and that kept messages are never
+ * dropped when the ring fills up. Runs on the host: the port is a 16 byte FIFO that drains at 115200 baud.
+ */
+
+#define BYTE_US 87  // 10 bits at 115200 baud
+#define MESSAGE 125
+
+static uint8_t captured[16384];
+static size_t captured_length;
+static size_t fifo_level;
+static uint64_t last_drain_us;
+static bool blocked;
+
+static bool fake_has_space(const int uart) {
+  (void)uart;
+  uint64_t now = get_time_usec();
+  size_t drained = (now - last_drain_us) / BYTE_US;
+  if (drained > 0) {
+    fifo_level = drained >= fifo_level ? 0 : fifo_level - drained;
+    last_drain_us += drained * BYTE_US;
+  }
+  return !blocked && fifo_level < UART_TX_FIFO_DEPTH;
+}
+
+static void fake_send(const int uart, const uint8_t data) {
+  (void)uart;
+  if (fifo_level == 0) {
+    last_drain_us = get_time_usec();
+  }
+  fifo_level++;
+  if (captured_length < sizeof(captured)) {
+    captured[captured_length++] = data;
+  }
+}
+
+static const uart_tx_port_t fake_port = {.has_space = fake_has_space, .send = fake_send};
+
+static void message(uint8_t *data, uint8_t id) {
+  for (size_t i = 0; i < MESSAGE; ++i) {
+    data[i] = id + i;
+  }
+}
+
+/* Whether the captured bytes are exactly the messages with these ids, in this order */
+static bool captured_is(const uint8_t *ids, size_t count) {
+  if (captured_length != count * MESSAGE) {
+    return false;
+  }
+  uint8_t data[MESSAGE];
+  for (size_t i = 0; i < count; ++i) {
+    message(data, ids[i]);
+    if (memcmp(captured + i * MESSAGE, data, MESSAGE) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void reset(bool background) {
+  captured_length = 0;
+  fifo_level = 0;
+  blocked = false;
+  uart_tx_set_port(UART0, &fake_port);
+  uart_tx_init(UART0, background);
+}
+
+static void latency(void) {
+  uint8_t data[MESSAGE];
+  uint8_t ids[10];
+
+  /* Not initialised, so byte by byte like before */
+  reset(false);
+  uart_tx_destroy(UART0);
+  uint64_t start = get_time_usec();
+  message(data, 0);
+  uart_tx_send(UART0, data, MESSAGE, UART_TX_KEEP);
+  uint64_t direct_us = get_time_usec() - start;
+
+  reset(true);
+  uint64_t worst_us = 0;
+  for (uint8_t i = 0; i < 10; ++i) {
+    ids[i] = i * 3;
+    message(data, ids[i]);
+    start = get_time_usec();
+    uart_tx_send(UART0, data, MESSAGE, UART_TX_KEEP);
+    uint64_t took = get_time_usec() - start;
+    worst_us = took > worst_us ? took : worst_us;
+  }
+  uart_tx_stats_t stats = uart_tx_stats(UART0);
+  uart_tx_flush(UART0);
+  uart_tx_destroy(UART0);
+  printf("      byte by byte: %llu us per message, queued: %llu us at worst, %zu bytes queued at most\n",
+         (unsigned long long)direct_us, (unsigned long long)worst_us, stats.max_depth);
+  check(worst_us * 20 < direct_us, "queueing a message takes a fraction of sending it");
+  check(captured_is(ids, 10), "messages arrive whole and in order");
+}
+
+static void replace(void) {
+  uint8_t data[MESSAGE];
+  reset(false);
+  blocked = true;
+  message(data, 1);
+  uart_tx_send(UART0, data, MESSAGE, UART_TX_KEEP);
+  for (uint8_t id = 100; id < 105; ++id) {
+    message(data, id);
+    uart_tx_send(UART0, data, MESSAGE, UART_TX_REPLACE);
+  }
+  message(data, 2);
+  uart_tx_send(UART0, data, MESSAGE, UART_TX_KEEP);
+  uart_tx_stats_t stats = uart_tx_stats(UART0);
+  check(stats.depth == 3 * MESSAGE + 4 && stats.replaced == 4, "four waiting position updates replaced");
+  blocked = false;
+  uart_tx_flush(UART0);
+  uart_tx_destroy(UART0);
+  check(captured_is((const uint8_t[]){1, 2, 104}, 3), "kept messages first, then the newest position");
+
+  /* One that is on the wire already is finished, not replaced */
+  reset(true);
+  message(data, 50);
+  uart_tx_send(UART0, data, MESSAGE, UART_TX_REPLACE);
+  sleep_msec(2);
+  message(data, 51);
+  uart_tx_send(UART0, data, MESSAGE, UART_TX_REPLACE);
+  uart_tx_flush(UART0);
+  uart_tx_destroy(UART0);
+  check(captured_is((const uint8_t[]){50, 51}, 2), "a position on the wire is not cut off");
+}
+
+static void back_pressure(void) {
+  uint8_t data[MESSAGE];
+  uint8_t ids[40];
+  reset(true);
+  for (uint8_t i = 0; i < 40; ++i) {
+    ids[i] = i * 5;
+    message(data, ids[i]);
+    uart_tx_send(UART0, data, MESSAGE, UART_TX_KEEP);
+  }
+  uart_tx_flush(UART0);
+  uart_tx_stats_t stats = uart_tx_stats(UART0);
+  uart_tx_destroy(UART0);
+  printf("      %u of 40 sends waited, %zu bytes queued at most\n", stats.waits, stats.max_depth);
+  check(stats.waits > 0 && stats.max_depth <= UART_TX_RING_SIZE, "a full ring holds up the sender");
+  check(captured_is(ids, 40), "nothing kept is dropped");
+
+  reset(false);
+  for (uint8_t i = 0; i < 3; ++i) {
+    message(data, ids[i]);
+    uart_tx_send(UART0, data, MESSAGE, UART_TX_KEEP);
+  }
+  uint32_t pumps = 0;
+  while (uart_tx_pump(UART0) != 0) {
+    pumps++;
+    usleep(UART_TX_POLL_US);
+  }
+  uart_tx_destroy(UART0);
+  printf("      %u pumps for 3 messages\n", pumps);
+  check(captured_is(ids, 3), "uart_tx_pump drains without a thread");
+}
+
+int main(void) {
+  latency();
+  replace();
+  back_pressure();
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,67 @@
+#include <libpynq.h>
+#include <stdio.h>
+
+#include "../libs/VL53L0X.h"
+#include "../libs/measurements.h"
+#include "../settings.h"
+
+#define ROUNDS 10
+
+/*
+ * Times giving all distance sensors their own address from reset, and giving it back to one that was reset on
+ * its own like a brown-out would. The forward color sensor is held in reset, it shares the default address.
+ */
+
+static double assign(const vl53l0x_slot_t *slots, bool *err) {
+  uint64_t start = get_time_usec();
+  *err = vl53l0x_assign_addresses(slots, VL53L0X_SENSOR_COUNT, NULL, NULL);
+  return (get_time_usec() - start) / 1000.0;
+}
+
+int main(void) {
+  pynq_init();
+  switchbox_set_pin(IO_AR_SCL, SWB_IIC0_SCL);
+  switchbox_set_pin(IO_AR_SDA, SWB_IIC0_SDA);
+  iic_init(IIC0);
+
+  gpio_set_direction(COLOR_SENSOR_X_PIN, GPIO_DIR_OUTPUT);
+  gpio_set_level(COLOR_SENSOR_X_PIN, GPIO_LEVEL_LOW);
+  vl53l0x_slot_t slots[VL53L0X_SENSOR_COUNT];
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    gpio_set_direction(distance_sensor_x_pins[i], GPIO_DIR_OUTPUT);
+    gpio_set_level(distance_sensor_x_pins[i], GPIO_LEVEL_LOW);
+    slots[i] = (vl53l0x_slot_t){
+        .xshut_pin = distance_sensor_x_pins[i], .address = INITIAL_ADDRESS - i, .iic = distance_sensor_buses[i]};
+  }
+
+  double from_reset = 0, nothing_lost = 0, one_lost = 0;
+  bool err = false, failed = false;
+  for (int r = 0; r < ROUNDS; ++r) {
+    for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+      gpio_set_level(distance_sensor_x_pins[i], GPIO_LEVEL_LOW);
+    }
+    sleep_msec(XSHUT_HOLD_MS);
+    from_reset += assign(slots, &err);
+    failed |= err;
+    nothing_lost += assign(slots, &err);
+    failed |= err;
+
+    size_t lost = r % VL53L0X_SENSOR_COUNT;
+    gpio_set_level(distance_sensor_x_pins[lost], GPIO_LEVEL_LOW);
+    sleep_msec(XSHUT_HOLD_MS);
+    gpio_set_level(distance_sensor_x_pins[lost], GPIO_LEVEL_HIGH);
+    one_lost += assign(slots, &err);
+    failed |= err;
+  }
+
+  printf("%d sensors from reset:  %.1f ms\n", VL53L0X_SENSOR_COUNT, from_reset / ROUNDS);
+  printf("nothing lost:          %.1f ms\n", nothing_lost / ROUNDS);
+  printf("one sensor reset:      %.1f ms\n", one_lost / ROUNDS);
+  printf("%s\n", failed ? "SOME ASSIGNMENTS FAILED" : "all assignments succeeded");
+
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    gpio_set_level(distance_sensor_x_pins[i], GPIO_LEVEL_LOW);
+  }
+  pynq_destroy();
+  return failed;
+}
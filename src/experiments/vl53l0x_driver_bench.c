@@ -0,0 +1,301 @@
+#include <libpynq.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../libs/VL53L0X.h"
+#include "../libs/i2c.h"
+#include "../libs/measurements.h"
+#include "../settings.h"
+#include "check.h"
+#include "fake_bus.h"
+
+/*
+ * Runs the VL53L0X driver against a register file and checks what goes over the bus:
+ *  - bring-up writes its register sequences in bursts that never cross the page select,
+ *  - timing budgets end up in the final range timeout as the datasheet computes it, the pre-range stays as tuned,
+ *  - continuous ranging starts back-to-back or timed, hands out each sample once and gives up without one,
+ *  - with GPIO1 wired up samples are taken on its interrupt or level, without asking over I2C,
+ *  - a sensor that browned out is missed by the presence check, even with its registers shadowed.
+ * Runs on the host, the IIC controller is replaced by a backend that keeps the registers of one sensor like in
+ * sensor_manager_bench, GPIO and the interrupt controller by plain memory.
+ */
+
+#define ADDRESS 0x30
+
+static uint8_t pages[FAKE_VL53L0X_PAGES][256];
+static bool ranging;           // in continuous mode, samples come from sample()
+static bool browned_out;       // back on the default address, nothing answers on ADDRESS
+static pthread_mutex_t registers_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned writes, registers_written, longest_burst, page_bursts, status_reads, id_reads;
+static volatile uint32_t gpio_registers[4], interrupt_registers[4];
+
+/* What the sensor does by itself after a register was written */
+static void written(uint8_t reg, uint8_t value) {
+  if (!fake_vl53l0x_on_page0(pages)) {
+    return;
+  }
+  if (reg == VL53L0X_SYSRANGE_START && (value & (VL53L0X_SYSRANGE_MODE_BACKTOBACK | VL53L0X_SYSRANGE_MODE_TIMED))) {
+    ranging = true;
+  } else if (reg == VL53L0X_SYSRANGE_START && (value & VL53L0X_SYSRANGE_MODE_SINGLESHOT)) {
+    /* Stops continuous ranging, a single measurement or calibration finishes at once */
+    pages[0][VL53L0X_SYSRANGE_START] = 0;
+    pages[0][VL53L0X_RESULT_INTERRUPT_STATUS] = ranging ? pages[0][VL53L0X_RESULT_INTERRUPT_STATUS] : 0x04;
+    ranging = false;
+  } else if (reg == VL53L0X_SYSTEM_INTERRUPT_CLEAR && (value & 0x01)) {
+    pages[0][VL53L0X_RESULT_INTERRUPT_STATUS] = 0;
+  }
+}
+
+static bool fake_read(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  (void)iic;
+  if (addr != ADDRESS || browned_out) {
+    return 1;
+  }
+  pthread_mutex_lock(&registers_lock);
+  status_reads += reg == VL53L0X_RESULT_INTERRUPT_STATUS;
+  id_reads += reg == VL53L0X_IDENTIFICATION_MODEL_ID;
+  fake_vl53l0x_read(pages, reg, data, data_length);
+  pthread_mutex_unlock(&registers_lock);
+  return 0;
+}
+
+static bool fake_write(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  (void)iic;
+  if (addr != ADDRESS || browned_out) {
+    return 1;
+  }
+  writes++;
+  registers_written += data_length;
+  longest_burst = data_length > longest_burst ? data_length : longest_burst;
+  page_bursts += data_length > 1 && reg + data_length > 0xFF;
+  pthread_mutex_lock(&registers_lock);
+  for (uint16_t i = 0; i < data_length; ++i) {
+    *fake_vl53l0x_register(pages, reg + i) = data[i];
+    written(reg + i, data[i]);
+  }
+  pthread_mutex_unlock(&registers_lock);
+  return 0;
+}
+
+static const iic_backend_t fake_backend = FAKE_BUS_BACKEND("register file", fake_read, fake_write);
+
+/* A continuous measurement finishes, GPIO1 would go low now */
+static void sample(uint16_t range) {
+  pthread_mutex_lock(&registers_lock);
+  pages[0][VL53L0X_RESULT_RANGE_STATUS + 10] = range >> 8;
+  pages[0][VL53L0X_RESULT_RANGE_STATUS + 11] = range & 0xFF;
+  pages[0][VL53L0X_RESULT_INTERRUPT_STATUS] = 0x04;
+  pthread_mutex_unlock(&registers_lock);
+}
+
+/* What a sensor looks like after power-on */
+static void power_on(void) {
+  ranging = false;
+  memset(pages, 0, sizeof(pages));
+  pages[0][VL53L0X_IDENTIFICATION_MODEL_ID] = VL53L0X_EXPECTED_DEVICE_ID;
+}
+
+static vl53l0x_t *bring_up(void) {
+  power_on();
+  writes = registers_written = longest_burst = page_bursts = 0;
+  uint32_t start = i2c_transaction_count(IIC0);
+  vl53l0x_t *sensor = vl53l0x_init_at(ADDRESS, IIC0);
+  printf("      bring-up: %u registers written in %u writes, %u transactions in all\n", registers_written, writes,
+         i2c_transaction_count(IIC0) - start);
+  check(sensor != NULL, "sensor comes up");
+  check(writes < registers_written, "consecutive registers go out as one burst");
+  check(page_bursts == 0 && longest_burst <= VL53L0X_MAX_BURST, "no burst runs into the page select or past VL53L0X_MAX_BURST");
+  check(pages[0][0x66] == 0xA0 && pages[1][0x4D] == 0x04 && pages[0][0x48] == 0x28 && fake_vl53l0x_on_page0(pages),
+        "tuning settings land on their pages, back on page 0");
+  return sensor;
+}
+
+/* Macro period in microseconds for a VCSEL period register, from the datasheet */
+static double macro_period_us(uint8_t vcsel_period) { return 2304 * ((vcsel_period + 1) * 2) * 1.655 / 1000; }
+
+static double timeout_mclks(const uint8_t *timeout) { return (timeout[1] << timeout[0]) + 1; }
+
+/*
+ * The final range gets what is left of the budget after the fixed overheads and the DSS and pre-range steps that
+ * bring-up enables, and includes the pre-range timeout
+ */
+static double expected_final_mclks(uint32_t budget_us) {
+  const uint8_t *page = pages[0];
+  double pre_period_us = macro_period_us(page[VL53L0X_PRE_RANGE_CONFIG_VCSEL_PERIOD]);
+  double dss_us = (page[VL53L0X_MSRC_CONFIG_TIMEOUT_MACROP] + 1) * pre_period_us;
+  double pre_range_mclks = timeout_mclks(&page[VL53L0X_PRE_RANGE_CONFIG_TIMEOUT_MACROP_HI]);
+  double used_us = 1910 + 960 + 2 * (dss_us + 690) + pre_range_mclks * pre_period_us + 660 + 550;
+  return (budget_us - used_us) / macro_period_us(page[VL53L0X_FINAL_RANGE_CONFIG_VCSEL_PERIOD]) + pre_range_mclks;
+}
+
+static void timing_budgets(vl53l0x_t *sensor) {
+  const uint32_t budgets[] = {VL53L0X_TIMING_BUDGET_FAST, VL53L0X_TIMING_BUDGET_DEFAULT, VL53L0X_TIMING_BUDGET_ACCURATE};
+  const char *names[] = {"FAST", "DEFAULT", "ACCURATE"};
+  uint8_t pre_range[4];
+  memcpy(pre_range, &pages[0][VL53L0X_PRE_RANGE_CONFIG_VCSEL_PERIOD], sizeof(pre_range));
+  check(pages[0][VL53L0X_SYSTEM_SEQUENCE_CONFIG] == (VL53L0X_RANGE_SEQUENCE_STEP_DSS + VL53L0X_RANGE_SEQUENCE_STEP_PRE_RANGE +
+                                                     VL53L0X_RANGE_SEQUENCE_STEP_FINAL_RANGE) &&
+            pre_range[0] == 0x06 && pre_range[1] == 0x00 && pre_range[2] == 0x96,
+        "bring-up enables DSS, pre-range and final range with the tuned pre-range");
+
+  char what[96];
+  double previous = 0;
+  for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); ++i) {
+    bool err = vl53l0x_set_timing_budget_us(sensor, budgets[i]);
+    const uint8_t *final = &pages[0][VL53L0X_FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI];
+    double expected = expected_final_mclks(budgets[i]);
+    double written = timeout_mclks(final);
+    printf("      %-8s %6u us: final range timeout 0x%02X%02X, %.0f MCLKs for %.1f\n", names[i], budgets[i], final[0],
+           final[1], written, expected);
+    /* The encoding keeps 8 significant bits, the rest is cut off */
+    snprintf(what, sizeof(what), "%s final range timeout as the datasheet computes it", names[i]);
+    check(!err && fabs(written - expected) <= (1 << final[0]) + 1 && written > previous, what);
+    snprintf(what, sizeof(what), "%s leaves the pre-range as tuned", names[i]);
+    check(!memcmp(pre_range, &pages[0][VL53L0X_PRE_RANGE_CONFIG_VCSEL_PERIOD], sizeof(pre_range)) &&
+              sensor->timing_budget_us == budgets[i],
+          what);
+    previous = written;
+  }
+
+  uint8_t final[2];
+  memcpy(final, &pages[0][VL53L0X_FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI], sizeof(final));
+  check(vl53l0x_set_timing_budget_us(sensor, VL53L0X_TIMING_BUDGET_MIN - 1) &&
+            !memcmp(final, &pages[0][VL53L0X_FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI], sizeof(final)),
+        "a budget below the minimum is refused and changes nothing");
+}
+
+static void *sample_later(void *arg) {
+  sleep_msec(30);
+  sample(*(uint16_t *)arg);
+  return NULL;
+}
+
+/* Reads the latest sample and returns how long that took in milliseconds */
+static double read_latest(vl53l0x_t *sensor, bool *err) {
+  uint64_t start = get_time_usec();
+  *err = vl53l0x_read_latest(sensor);
+  return (get_time_usec() - start) / 1000.0;
+}
+
+static void continuous(vl53l0x_t *sensor) {
+  bool err = vl53l0x_start_continuous(sensor, 0);
+  check(!err && ranging && sensor->continuous && pages[0][VL53L0X_SYSRANGE_START] == VL53L0X_SYSRANGE_MODE_BACKTOBACK,
+        "back-to-back ranging starts");
+
+  sample(321);
+  double ms = read_latest(sensor, &err);
+  check(!err && sensor->range == 321 && ms < VL53L0X_POLL_MS, "a waiting sample is read at once");
+  check(pages[0][VL53L0X_RESULT_INTERRUPT_STATUS] == 0, "reading it clears the interrupt for the next one");
+
+  uint16_t next = 654;
+  pthread_t thread;
+  pthread_create(&thread, NULL, sample_later, &next);
+  ms = read_latest(sensor, &err);
+  pthread_join(thread, NULL);
+  printf("      next sample read after %.1f ms\n", ms);
+  check(!err && sensor->range == 654 && ms >= 29 && ms < 30 + 5 * VL53L0X_POLL_MS, "the next sample is waited for");
+
+  uint32_t errors = sensor->health.errors;
+  ms = read_latest(sensor, &err);
+  printf("      gave up after %.1f ms\n", ms);
+  check(err && sensor->range == 654 && ms >= VL53L0X_TIMEOUT_MS && ms < VL53L0X_TIMEOUT_MS + 50,
+        "without a sample it gives up after VL53L0X_TIMEOUT_MS, keeping the last range");
+  check(sensor->health.errors == errors + 1, "the timeout counts against the sensor's health");
+
+  err = vl53l0x_stop_continuous(sensor);
+  check(!err && !ranging && !sensor->continuous && pages[0][VL53L0X_SYSRANGE_START] == 0, "ranging stops");
+
+  /* The period counts in oscillator ticks */
+  pages[0][VL53L0X_OSC_CALIBRATE_VAL] = 0x01;
+  pages[0][VL53L0X_OSC_CALIBRATE_VAL + 1] = 0x00;
+  err = vl53l0x_start_continuous(sensor, 50);
+  const uint8_t *period = &pages[0][VL53L0X_SYSTEM_INTERMEASUREMENT_PERIOD];
+  check(!err && ranging && sensor->period_ms == 50 && pages[0][VL53L0X_SYSRANGE_START] == VL53L0X_SYSRANGE_MODE_TIMED &&
+            period[0] == 0x00 && period[1] == 0x00 && period[2] == 0x32 && period[3] == 0x00,
+        "timed ranging starts with the period in oscillator ticks");
+  sample(987);
+  check(!vl53l0x_read_range(sensor) && sensor->range == 987, "vl53l0x_read_range takes the latest sample");
+  check(!vl53l0x_stop_continuous(sensor) && !ranging, "timed ranging stops");
+}
+
+static uint32_t pin_bit(uint8_t pin) { return 1u << (pin % 32); }
+
+/* GPIO1 is active low, it stays low until the interrupt is cleared */
+static void set_gpio1(uint8_t pin, bool low) {
+  volatile uint32_t *level = &gpio_registers[pin < 32 ? 0 : 2];
+  *level = low ? *level & ~pin_bit(pin) : *level | pin_bit(pin);
+}
+
+static void *interrupt_later(void *arg) {
+  sleep_msec(30);
+  sample(555);
+  uint8_t pin = *(uint8_t *)arg;
+  interrupt_registers[pin < 32 ? 2 : 3] |= pin_bit(pin);
+  return NULL;
+}
+
+static void interrupt(vl53l0x_t *sensor) {
+  uint8_t pin = distance_sensor_gpio1_pins[0];
+  set_gpio1(pin, false);
+  vl53l0x_use_interrupt(sensor, pin);
+  check((gpio_registers[pin < 32 ? 1 : 3] & pin_bit(pin)) && (interrupt_registers[pin < 32 ? 0 : 1] & pin_bit(pin)),
+        "GPIO1 is an input with its interrupt enabled");
+  bool err = vl53l0x_start_continuous(sensor, 0);
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, interrupt_later, &pin);
+  status_reads = 0;
+  double ms = read_latest(sensor, &err);
+  pthread_join(thread, NULL);
+  printf("      sample on the interrupt read after %.2f ms\n", ms);
+  check(!err && sensor->range == 555 && ms >= 29 && ms < 30 + VL53L0X_POLL_MS && status_reads == 0,
+        "a sample is read as soon as the interrupt comes, without polling the status");
+  check(!(interrupt_registers[pin < 32 ? 2 : 3] & pin_bit(pin)), "the interrupt is acknowledged");
+
+  /* The interrupt word was acknowledged while waiting for another pin, GPIO1 is still low */
+  sample(444);
+  set_gpio1(pin, true);
+  ms = read_latest(sensor, &err);
+  set_gpio1(pin, false);
+  check(!err && sensor->range == 444 && ms < 1 && status_reads == 0, "a sample is read when GPIO1 is low");
+
+  ms = read_latest(sensor, &err);
+  printf("      gave up after %.1f ms\n", ms);
+  check(err && ms >= VL53L0X_TIMEOUT_MS && ms < VL53L0X_TIMEOUT_MS + 50 && status_reads == 0,
+        "without an interrupt it gives up after VL53L0X_TIMEOUT_MS, without polling the status");
+  check(!vl53l0x_stop_continuous(sensor), "ranging stops");
+}
+
+static void presence(vl53l0x_t *sensor) {
+  id_reads = 0;
+  bool err = vl53l0x_wait_ready(ADDRESS, 0, IIC0);
+  err |= vl53l0x_wait_ready(ADDRESS, 0, IIC0);
+  check(!err && id_reads == 2, "the presence check asks the sensor, not the shadow");
+  browned_out = true;
+  check(vl53l0x_wait_ready(ADDRESS, 0, IIC0), "a sensor that browned out is missed");
+  check(vl53l0x_read_range(sensor), "and so are its reads");
+  browned_out = false;
+}
+
+int main(void) {
+  gpio_init_registers(gpio_registers);
+  gpio_interrupt_init_registers(interrupt_registers);
+  iic_set_backend(IIC0, &fake_backend);
+  iic_init(IIC0);
+
+  vl53l0x_t *sensor = bring_up();
+  if (sensor == NULL) {
+    return 1;
+  }
+  timing_budgets(sensor);
+  continuous(sensor);
+  interrupt(sensor);
+  presence(sensor);
+
+  vl53l0x_destroy(sensor);
+  iic_destroy(IIC0);
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
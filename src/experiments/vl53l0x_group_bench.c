@@ -0,0 +1,163 @@
+#include <libpynq.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../libs/VL53L0X.h"
+#include "../libs/i2c.h"
+#include "../libs/measurements.h"
+#include "../settings.h"
+#include "check.h"
+#include "fake_bus.h"
+
+/*
+ * Compares reading the three distance sensors one after another with reading them as one group. Runs on the host:
+ * IIC0 is replaced by a backend that takes as long as a 100 kHz bus would, with the distance sensors on their
+ * addresses from settings.h. Each sensor needs RANGING_US for a measurement, single-shot or back-to-back.
+ */
+
+#define ROUNDS 20
+#define RANGING_US 33000  // the default timing budget
+
+typedef enum { IDLE, SINGLE_SHOT, BACK_TO_BACK } ranging_t;
+
+typedef struct {
+  uint8_t pages[FAKE_VL53L0X_PAGES][256];
+  ranging_t ranging;
+  uint64_t started_us;  // of the single shot or of continuous ranging
+  uint64_t ready_us;    // when the next sample is there
+} fake_vl53l0x_t;
+
+static fake_vl53l0x_t devices[VL53L0X_SENSOR_COUNT];
+
+/* 9 clocks per byte at 10 us, address + register + data */
+static void bus_time(uint16_t length) { usleep((2 + length) * 9 * 10); }
+
+static fake_vl53l0x_t *device_at(uint8_t addr) {
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    if (addr == INITIAL_ADDRESS - i) {
+      return &devices[i];
+    }
+  }
+  return NULL;
+}
+
+/* What the sensor does by itself after a register was written */
+static void written(fake_vl53l0x_t *device, uint8_t reg, uint8_t value) {
+  uint64_t now = get_time_usec();
+  if (!fake_vl53l0x_on_page0(device->pages)) {
+    return;
+  }
+  if (reg == VL53L0X_SYSRANGE_START && (value & (VL53L0X_SYSRANGE_MODE_BACKTOBACK | VL53L0X_SYSRANGE_MODE_TIMED))) {
+    device->ranging = BACK_TO_BACK;
+    device->started_us = now;
+    device->ready_us = now + RANGING_US;
+  } else if (reg == VL53L0X_SYSRANGE_START && (value & VL53L0X_SYSRANGE_MODE_SINGLESHOT)) {
+    device->pages[0][VL53L0X_SYSRANGE_START] = 0;  // started, the measurement takes RANGING_US
+    device->ranging = SINGLE_SHOT;
+    device->ready_us = now + RANGING_US;
+  } else if (reg == VL53L0X_SYSTEM_INTERRUPT_CLEAR && (value & 0x01)) {
+    if (device->ranging == BACK_TO_BACK) {
+      /* The sensor kept ranging, the next sample is the first one that finishes from now on */
+      uint64_t samples = (now - device->started_us) / RANGING_US + 1;
+      device->ready_us = device->started_us + samples * RANGING_US;
+    } else {
+      device->ranging = IDLE;
+    }
+  }
+}
+
+static bool fake_read(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  (void)iic;
+  bus_time(data_length + 1);
+  fake_vl53l0x_t *device = device_at(addr);
+  if (device == NULL) {
+    return 1;
+  }
+  if (fake_vl53l0x_on_page0(device->pages)) {
+    bool ready = device->ranging != IDLE && get_time_usec() >= device->ready_us;
+    device->pages[0][VL53L0X_RESULT_INTERRUPT_STATUS] = ready ? 0x04 : 0;
+  }
+  fake_vl53l0x_read(device->pages, reg, data, data_length);
+  return 0;
+}
+
+static bool fake_write(const iic_index_t iic, const uint8_t addr, const uint8_t reg, uint8_t *data, uint16_t data_length) {
+  (void)iic;
+  bus_time(data_length);
+  fake_vl53l0x_t *device = device_at(addr);
+  if (device == NULL) {
+    return 1;
+  }
+  for (uint16_t i = 0; i < data_length; ++i) {
+    *fake_vl53l0x_register(device->pages, reg + i) = data[i];
+    written(device, reg + i, data[i]);
+  }
+  return 0;
+}
+
+static const iic_backend_t timed_backend = FAKE_BUS_BACKEND("100 kHz", fake_read, fake_write);
+
+/* Measures 130, 230 and 330 mm before the driver's 30 mm correction */
+static void power_on(size_t index) {
+  uint16_t range = 130 + 100 * index;
+  fake_vl53l0x_t *device = &devices[index];
+  memset(device, 0, sizeof(*device));
+  device->pages[0][VL53L0X_IDENTIFICATION_MODEL_ID] = VL53L0X_EXPECTED_DEVICE_ID;
+  device->pages[0][VL53L0X_RESULT_RANGE_STATUS + 10] = range >> 8;
+  device->pages[0][VL53L0X_RESULT_RANGE_STATUS + 11] = range & 0xFF;
+}
+
+int main(void) {
+  iic_set_backend(IIC0, &timed_backend);
+  iic_init(IIC0);
+
+  vl53l0x_t *sensors[VL53L0X_SENSOR_COUNT] = {0};
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    power_on(i);
+    sensors[i] = vl53l0x_init_at(INITIAL_ADDRESS - i, IIC0);
+    if (sensors[i] == NULL) {
+      printf("Could not initialise sensor %zu\n", i);
+      return 1;
+    }
+  }
+
+  bool err = false;
+  uint16_t single[VL53L0X_SENSOR_COUNT];
+  uint64_t start = get_time_usec();
+  for (int r = 0; r < ROUNDS; ++r) {
+    for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+      err |= vl53l0x_read_range(sensors[i]);
+      single[i] = sensors[i]->range;
+    }
+  }
+  uint64_t sequential = (get_time_usec() - start) / ROUNDS;
+
+  err |= vl53l0x_group_start(sensors, VL53L0X_SENSOR_COUNT);
+  vl53l0x_group_reading_t reading;
+  start = get_time_usec();
+  for (int r = 0; r < ROUNDS; ++r) {
+    err |= vl53l0x_group_read(sensors, VL53L0X_SENSOR_COUNT, &reading);
+  }
+  uint64_t group = (get_time_usec() - start) / ROUNDS;
+
+  printf("Sequential single-shot: %llu us per triple\n", (unsigned long long)sequential);
+  printf("Group continuous:       %llu us per triple\n", (unsigned long long)group);
+  printf("Last triple: %d %d %d mm\n", reading.range[VL53L0X_LOW], reading.range[VL53L0X_MIDDLE], reading.range[VL53L0X_HIGH]);
+
+  check(!err, "all reads succeed");
+  bool same = true;
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    same &= single[i] == 130 + 100 * i && reading.range[i] == 100 + 100 * i;
+  }
+  check(same, "both ways read each sensor's own range");
+  check(sequential >= VL53L0X_SENSOR_COUNT * RANGING_US, "one after another costs a measurement per sensor");
+  check(group < 3 * RANGING_US / 2, "the group costs about one measurement for all sensors");
+
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    vl53l0x_destroy(sensors[i]);
+  }
+  iic_destroy(IIC0);
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
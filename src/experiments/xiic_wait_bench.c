@@ -0,0 +1,66 @@
+#include <libpynq.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <xiic_l.h>
+
+#include "../libs/measurements.h"
+#include "check.h"
+
+/*
+ * Points the XIic low-level driver at plain memory standing in for a broken IIC core, and checks that every
+ * transfer gives up at its deadline instead of hanging, without keeping the CPU busy, while a wait that is over
+ * before it has to sleep does not read the clock. Runs on the host.
+ */
+
+static u32 core[0x200 / 4];  // register file of the fake core, nothing in it ever changes by itself
+static XIic_WaitStats stats;
+static double cpu_usec(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+  return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+static void stuck(const char *name, u32 status, u32 expected_timeout_us) {
+  memset(core, 0, sizeof(core));
+  core[XIIC_SR_REG_OFFSET / 4] = status;
+  memset(&stats, 0, sizeof(stats));
+  u8 byte = 0x42;
+
+  uint64_t start = get_time_usec();
+  double cpu_start = cpu_usec();
+  unsigned sent = XIic_Send((UINTPTR)core, 0x29, &byte, 1, XIIC_STOP);
+  double wall_us = get_time_usec() - start, cpu_us = cpu_usec() - cpu_start;
+
+  printf("%s: %.1f ms, %.0f%% CPU, %u spins, %u backoffs, %u timeouts\n", name, wall_us / 1000, 100 * cpu_us / wall_us,
+         stats.Spins, stats.Backoffs, stats.Timeouts);
+  check(sent == 0, "transfer fails");
+  check(wall_us >= expected_timeout_us && wall_us < expected_timeout_us + 5000, "gives up at the deadline");
+  check(stats.Timeouts == 1 && stats.Spins == XIIC_WAIT_SPINS && stats.Backoffs > 0, "counters add up");
+  check(cpu_us < wall_us / 2, "sleeps most of the wait");
+}
+
+/* A wait that is over while spinning never reads the clock, so it never gets a deadline */
+static void healthy(void) {
+  XIic_Wait wait;
+  memset(&wait, 0, sizeof(wait));
+  memset(&stats, 0, sizeof(stats));
+  XIic_WaitStart((UINTPTR)core, &wait, XIIC_BYTE_TIMEOUT_US);
+  bool polled = true;
+  for (int i = 0; i < XIIC_WAIT_SPINS; i++) {
+    polled &= XIic_WaitPoll(&wait);
+  }
+  check(polled && wait.Deadline.tv_sec == 0 && wait.Deadline.tv_nsec == 0 && stats.Spins == XIIC_WAIT_SPINS,
+        "spinning does not read the clock, spins counted");
+  polled = XIic_WaitPoll(&wait);
+  check(polled && wait.Deadline.tv_sec != 0 && stats.Backoffs == 1, "the deadline is set once the spins run out");
+}
+
+int main(void) {
+  XIic_SetWaitStats((UINTPTR)core, &stats);
+  healthy();
+  stuck("bus never starts", 0, XIIC_BYTE_TIMEOUT_US);
+  stuck("bus held by a slave", XIIC_SR_BUS_BUSY_MASK, XIIC_BUS_FREE_TIMEOUT_US);
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
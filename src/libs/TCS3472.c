@@ -6,12 +6,23 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "../libs/measurements.h"
 #include "i2c.h"
 
 // https://github.com/adafruit/Adafruit_TCS34725/tree/master
 
+/* Only the status and the color data change by themselves, the rest is configuration written by this driver */
+static const uint8_t volatile_registers[] = {TCS3472_STATUS,    TCS3472_REG_C,     TCS3472_REG_C + 1, TCS3472_REG_R,
+                                             TCS3472_REG_R + 1, TCS3472_REG_G,     TCS3472_REG_G + 1, TCS3472_REG_B,
+                                             TCS3472_REG_B + 1};
+static const i2c_shadow_config_t shadow_config = {
+    .register_mask = 0x1F,  // the rest is the command byte
+    .volatile_registers = volatile_registers,
+    .volatile_count = sizeof(volatile_registers),
+};
+
 hsv_t rgb2hsv(tcs3472_t sensor) {
   rgb_t in;
   in.r = (double)sensor.r / 30000;
@@ -57,73 +68,61 @@ hsv_t rgb2hsv(tcs3472_t sensor) {
   return out;
 }
 
-bool set_integration_time(tcs3472_t *sensor) {
-  bool err = i2c_write8(TCS3472_ADDR, TC3472_REG_ATIME | TCS3472_COMMAND_BIT, 60, sensor->iic);
+bool tcs3472_set_integration_time_us(tcs3472_t *sensor, uint32_t integration_time_us) {
+  uint32_t steps = (integration_time_us + TCS3472_ATIME_STEP_US / 2) / TCS3472_ATIME_STEP_US;
+  steps = clamp(steps, 1, TCS3472_MAX_INTEGRATION_STEPS);
+  bool err = i2c_write8(TCS3472_ADDR, TC3472_REG_ATIME | TCS3472_COMMAND_BIT, TCS3472_MAX_INTEGRATION_STEPS - steps,
+                        sensor->iic);
   if (!err) {
-    sensor->integration_time_ns = 60;
+    sensor->integration_time_us = steps * TCS3472_ATIME_STEP_US;
   }
   return err;
 }
 
-hsl_t rgb_to_hsl(tcs3472_t *sensor) {
-  hsl_t hsl_color;
-  uint8_t ur = (sensor->r >> 4);
-  uint8_t ug = (sensor->g >> 4);
-  uint8_t ub = (sensor->b >> 4);
-
-  float nr = ((float)ur / 255);
-  float ng = ((float)ug / 255);
-  float nb = ((float)ub / 255);
-
-  float c_max = MAX(nr, MAX(ng, nb));
-  float c_min = MIN(nr, MIN(ng, nb));
-
-  float delta = c_max - c_min;
-
-  hsl_color.l = (c_max + c_min) / 2;
-
-  if (delta == 0) {
-    hsl_color.h = 0;
-  } else if (c_max == nr) {
-    hsl_color.h = (((ng - nb) / delta));
-  } else if (c_max == ng) {
-    hsl_color.h = (((nb - nr) / delta + 2));
-  } else {
-    hsl_color.h = (((nr - ng) / delta + 4));
-  }
-
-  if (delta == 0) {
-    hsl_color.s = 0;
-  } else {
-    hsl_color.s = delta / (1 - fabsf(2 * hsl_color.l - 1));
-  }
-  while (hsl_color.h > 1) {
-    hsl_color.h -= 1;
-  }
-  if (hsl_color.h < 0) {
-    hsl_color.h = -hsl_color.h;
-  }
-  LOG("h:%f, s:%f, l:%f", hsl_color.h, hsl_color.s, hsl_color.l);
-  return hsl_color;
-}
-
-tcs3472_t *tcs3472_init(int iic) {
+tcs3472_t *tcs3472_create(int iic) {
   tcs3472_t *sensor = malloc(sizeof(*sensor));
   if (sensor == NULL) {
     ERROR();
     exit(1);
   }
   memset(sensor, 0, sizeof(*sensor));
+  sensor->iic = iic;
+  sensor->calibration = color_default_calibration(iic);
+  return sensor;
+}
+
+static bool identify(tcs3472_t *sensor) {
   uint8_t x;
-  bool err = i2c_read8(TCS3472_ADDR, TCS3472_ID | TCS3472_COMMAND_BIT, &x, iic);
+  bool err = i2c_read8(TCS3472_ADDR, TCS3472_ID | TCS3472_COMMAND_BIT, &x, sensor->iic);
   if (err || x != 0x4d) {
-    return NULL;
+    return 1;
   }
-  sensor->iic = iic;
+  if (i2c_shadow_enable(TCS3472_ADDR, &shadow_config, sensor->iic)) {
+    LOG("No register shadow for the TCS3472 on IIC%d", sensor->iic);
+  }
+  return 0;
+}
 
+tcs3472_t *tcs3472_init(int iic) {
+  tcs3472_t *sensor = tcs3472_create(iic);
+  if (identify(sensor)) {
+    free(sensor);
+    return NULL;
+  }
   return sensor;
 }
 
+bool tcs3472_reinit(tcs3472_t *sensor) {
+  uint32_t integration_time_us = sensor->integration_time_us;
+  /* The registers may have been reset behind the shadow's back */
+  i2c_shadow_disable(TCS3472_ADDR, sensor->iic);
+  sensor->enable = false;
+  if (identify(sensor) || tcs3472_enable(sensor)) {
+    return 1;
+  }
+  return integration_time_us != 0 && tcs3472_set_integration_time_us(sensor, integration_time_us);
+}
+
 bool set_gain(tcs3472_t *sensor, uint8_t gain) {
   bool err = 1;
   if (sensor->enable == 1) {
@@ -139,37 +138,185 @@ bool tcs3472_enable(tcs3472_t *sensor) {
   }
   uint8_t x;
   i2c_read8(TCS3472_ADDR, TCS3472_COMMAND_BIT | TCS3472_ENABLE, &x, sensor->iic);
-  x = x | TCS3472_ENABLE_AEN | TCS3472_ENABLE_PON;
+  /* AINT is used to tell fresh conversions apart, AVALID stays set after the first one */
+  x = x | TCS3472_ENABLE_AEN | TCS3472_ENABLE_PON | TCS3472_ENABLE_AIEN;
   if (i2c_write8(TCS3472_ADDR, TCS3472_COMMAND_BIT | TCS3472_ENABLE, x, sensor->iic)) {
     return 1;
   }
   sensor->enable = true;
   set_gain(sensor, 1);
-  set_integration_time(sensor);
+  tcs3472_set_integration_time_us(sensor, TCS3472_INTEGRATION_TIME_US);
+  /* Persistence 0: every integration cycle raises the interrupt */
+  i2c_write8(TCS3472_ADDR, TCS3472_PERS | TCS3472_COMMAND_BIT, 0, sensor->iic);
   return false;
 }
 
+static bool read_colors(tcs3472_t *sensor) {
+  /* C, R, G and B are 4 consecutive little endian words */
+  uint16_t crgb[4];
+  if (i2c_read_burst(TCS3472_ADDR, TCS3472_REG_C, crgb, sizeof(crgb),
+                     I2C_WORDS_LE | I2C_INCREMENT(TCS3472_COMMAND_BIT | TCS3472_AUTO_INCREMENT), sensor->iic)) {
+    return 1;
+  }
+  sensor->c = crgb[0];
+  sensor->r = crgb[1];
+  sensor->g = crgb[2];
+  sensor->b = crgb[3];
+  return 0;
+}
+
 void tcs3472_read_colors(tcs3472_t *sensor) {
   if (sensor == NULL || !sensor->enable) {
     return;
   }
-  bool err;
-  err = i2c_read16(TCS3472_ADDR, TCS3472_REG_C | TCS3472_COMMAND_BIT, &sensor->c, sensor->iic);
-  if (err) {
-    ERROR("Could not read clear color reg ");
+  if (read_colors(sensor)) {
+    ERROR("Could not read color regs ");
+  }
+}
+
+static bool clear_interrupt(tcs3472_t *sensor) {
+  /* Command byte only, no data follows */
+  uint8_t none = 0;
+  return i2c_write_burst(TCS3472_ADDR, TCS3472_CLEAR_INTERRUPT, &none, 0, I2C_BYTES, sensor->iic);
+}
+
+/* Asking every 1/16th of a cycle keeps the bus mostly free and adds little latency */
+static uint32_t poll_interval_us(tcs3472_t *sensor) {
+  uint32_t poll_us = clamp(sensor->integration_time_us / 16, 1000, 30000);
+  return poll_us;
+}
+
+/* Waits for the end of the integration cycle that is running now */
+static bool wait_conversion(tcs3472_t *sensor) {
+  uint64_t deadline = get_time_usec() + 2 * sensor->integration_time_us + TCS3472_TIMEOUT_MARGIN_US;
+  uint32_t poll_us = poll_interval_us(sensor);
+  uint8_t status = 0;
+  while (true) {
+    if (i2c_read8(TCS3472_ADDR, TCS3472_STATUS | TCS3472_COMMAND_BIT, &status, sensor->iic)) {
+      return 1;
+    }
+    if (status & TCS3472_STATUS_AINT) {
+      return 0;
+    }
+    if (get_time_usec() > deadline) {
+      ERROR("Timeout waiting for conversion on IIC%d", sensor->iic);
+      return 1;
+    }
+    usleep(poll_us);
+  }
+}
+
+size_t tcs3472_sample_fresh(tcs3472_t *sensor, size_t samples) {
+  if (sensor == NULL || !sensor->enable) {
+    return 0;
+  }
+  uint32_t c = 0, r = 0, g = 0, b = 0;
+  size_t used = 0;
+  /* Whatever is in the result registers now may already have been read before */
+  if (clear_interrupt(sensor)) {
+    ERROR("Could not clear interrupt on IIC%d", sensor->iic);
+    sensor_health_record(&sensor->health, 1);
+    return 0;
+  }
+  while (used < samples) {
+    if (wait_conversion(sensor) || read_colors(sensor) || clear_interrupt(sensor)) {
+      break;
+    }
+    c += sensor->c;
+    r += sensor->r;
+    g += sensor->g;
+    b += sensor->b;
+    used++;
+  }
+  sensor_health_record(&sensor->health, used < samples);
+  if (used > 0) {
+    sensor->c = c / used;
+    sensor->r = r / used;
+    sensor->g = g / used;
+    sensor->b = b / used;
   }
+  sensor->conversions_used = used;
+  return used;
+}
+
+bool tcs3472_sampler_start(tcs3472_sampler_t *sampler, tcs3472_t *sensor) {
+  if (sensor == NULL || !sensor->enable) {
+    return 1;
+  }
+  memset(sampler, 0, sizeof(*sampler));
+  sampler->sensor = sensor;
+  sampler->status = (i2c_transfer_t){.op = I2C_TRANSFER_READ,
+                                     .address = TCS3472_ADDR,
+                                     .reg = TCS3472_STATUS | TCS3472_COMMAND_BIT,
+                                     .data = &sampler->status_value,
+                                     .length = 1};
+  sampler->colors = (i2c_transfer_t){.op = I2C_TRANSFER_READ,
+                                     .address = TCS3472_ADDR,
+                                     .reg = TCS3472_REG_C,
+                                     .data = sampler->crgb,
+                                     .length = sizeof(sampler->crgb),
+                                     .flags = I2C_WORDS_LE | I2C_INCREMENT(TCS3472_COMMAND_BIT | TCS3472_AUTO_INCREMENT)};
+  sampler->clear = (i2c_transfer_t){
+      .op = I2C_TRANSFER_WRITE, .address = TCS3472_ADDR, .reg = TCS3472_CLEAR_INTERRUPT, .data = &sampler->none};
+  /* Same as tcs3472_sample_fresh: the conversion in the result registers now may be an old one */
+  if (i2c_async_submit(sensor->iic, &sampler->clear) || i2c_async_submit(sensor->iic, &sampler->status)) {
+    tcs3472_sampler_stop(sampler);
+    return 1;
+  }
+  sampler->next_poll_us = get_time_usec() + poll_interval_us(sensor);
+  return 0;
+}
 
-  i2c_read16(TCS3472_ADDR, TCS3472_REG_R | TCS3472_COMMAND_BIT, &sensor->r, sensor->iic);
-  if (err) {
-    ERROR("Could not read red color reg ");
+bool tcs3472_sampler_poll(tcs3472_sampler_t *sampler) {
+  tcs3472_t *sensor = sampler->sensor;
+  uint64_t now = get_time_usec();
+  if (sampler->reading) {
+    if (!i2c_transfer_done(&sampler->colors)) {
+      return false;
+    }
+    sampler->reading = false;
+    /* Queued behind the interrupt clear, so it only sees the next conversion */
+    i2c_async_submit(sensor->iic, &sampler->status);
+    sampler->next_poll_us = now + poll_interval_us(sensor);
+    bool err = atomic_load(&sampler->colors.state) != I2C_TRANSFER_DONE;
+    sensor_health_record(&sensor->health, err);
+    if (err) {
+      ERROR("Could not read color regs on IIC%d", sensor->iic);
+      return false;
+    }
+    sensor->c = sampler->crgb[0];
+    sensor->r = sampler->crgb[1];
+    sensor->g = sampler->crgb[2];
+    sensor->b = sampler->crgb[3];
+    return true;
   }
-  i2c_read16(TCS3472_ADDR, TCS3472_REG_G | TCS3472_COMMAND_BIT, &sensor->g, sensor->iic);
-  if (err) {
-    ERROR("Could not read green color reg ");
+  if (!i2c_transfer_done(&sampler->status)) {
+    return false;
+  }
+  if (atomic_load(&sampler->status.state) == I2C_TRANSFER_DONE && (sampler->status_value & TCS3472_STATUS_AINT)) {
+    sampler->status_value = 0;
+    if (!i2c_async_submit(sensor->iic, &sampler->colors)) {
+      i2c_async_submit(sensor->iic, &sampler->clear);
+      sampler->reading = true;
+      return false;
+    }
   }
-  i2c_read16(TCS3472_ADDR, TCS3472_REG_B | TCS3472_COMMAND_BIT, &sensor->b, sensor->iic);
-  if (err) {
-    ERROR("Could not read blue color reg ");
+  if (now >= sampler->next_poll_us) {
+    if (atomic_load(&sampler->status.state) == I2C_TRANSFER_FAILED) {
+      sensor_health_record(&sensor->health, 1);
+    }
+    i2c_async_submit(sensor->iic, &sampler->status);
+    sampler->next_poll_us = now + poll_interval_us(sensor);
+  }
+  return false;
+}
+
+void tcs3472_sampler_stop(tcs3472_sampler_t *sampler) {
+  i2c_transfer_t *transfers[] = {&sampler->status, &sampler->colors, &sampler->clear};
+  for (size_t i = 0; i < sizeof(transfers) / sizeof(transfers[0]); ++i) {
+    if (atomic_load(&transfers[i]->state) != I2C_TRANSFER_IDLE) {
+      i2c_transfer_wait(transfers[i]);
+    }
   }
 }
 
@@ -189,61 +336,14 @@ void print_colors(tcs3472_t *sensor) { LOG("c: %d, r: %d, g: %d, b: %d\n", senso
 
 color_t tcs3472_determine_single_color(tcs3472_t *sensor) {
   tcs3472_read_colors(sensor);
-  hsl_t hsl_colors = rgb_to_hsl(sensor);
-
-  if (hsl_colors.l < 0.05) {
-    return BLACK;
-  }
-  if (hsl_colors.l > 0.2) {
-    return WHITE;
-  }
-  if (hsl_colors.h >= 10 && hsl_colors.h < 25) {
-    return RED;
-  }
-  if (hsl_colors.h >= 90 && hsl_colors.h < 100) {
-    return GREEN;
-  }
-  if (hsl_colors.h >= 175 && hsl_colors.h < 200) {
-    return BLUE;
-  }
-  return COLOR_COUNT;
+  return color_classify(sensor->calibration, sensor->c, sensor->r, sensor->g, sensor->b);
 }
 
 color_t tcs3472_determine_color(tcs3472_t *sensor) {
-  hsv_t hsv_colors = {0};
-  for (size_t i = 0; i < 30; ++i) {
-    tcs3472_read_colors(sensor);
-    hsv_t t = rgb2hsv(*sensor);
-    hsv_colors.h = incremental_mean(t.h, hsv_colors.h, i);
-    hsv_colors.s = incremental_mean(t.s, hsv_colors.s, i);
-    hsv_colors.v = incremental_mean(t.v, hsv_colors.v, i);
-  }
-
-  if (sensor->iic == IIC0) {
-    if (hsv_colors.v < 0.05) {
-      return BLACK;
-    }
-    if (hsv_colors.v > 0.178) {
-      return WHITE;
-    }
-    if (hsv_colors.h >= 10 && hsv_colors.h < 25) {
-      return RED;
-    }
-    if (hsv_colors.h >= 90 && hsv_colors.h < 100) {
-      return GREEN;
-    }
-    if (hsv_colors.h >= 175 && hsv_colors.h < 200) {
-      return BLUE;
-    }
-    return WHITE;
-  } else {
-    LOG("Bottom color: %f", hsv_colors.v);
-    if (hsv_colors.v < 0.15) {
-    
-      return BLACK;
-    }
-    return WHITE;
+  if (tcs3472_sample_fresh(sensor, TCS3472_READING_COUNT) < TCS3472_READING_COUNT) {
+    ERROR("Only %zu of %d conversions on IIC%d", sensor->conversions_used, TCS3472_READING_COUNT, sensor->iic);
   }
+  return color_classify(sensor->calibration, sensor->c, sensor->r, sensor->g, sensor->b);
 }
 
 const char *COLOR_NAME(size_t index) {
@@ -256,6 +356,7 @@ const char *COLOR_NAME(size_t index) {
 
 void tcs3472_destroy(tcs3472_t *sensor) {
   if (sensor != NULL) {
+    i2c_shadow_disable(TCS3472_ADDR, sensor->iic);
     free(sensor);
   }
 }
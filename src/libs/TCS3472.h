@@ -4,9 +4,14 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "color_classifier.h"
+#include "i2c_async.h"
+#include "sensor_manager.h"
+
 #define TCS3472_ADDR 0x29
 #define TCS3472_ID 0x12
 #define TCS3472_COMMAND_BIT 0x80
+#define TCS3472_AUTO_INCREMENT 0x20
 #define TCS3472_ENABLE 0x00
 #define TCS3472_ENABLE_PON 0x1
 #define TCS3472_ENABLE_AEN 0x2
@@ -17,9 +22,17 @@
 #define TCS3472_REG_G 0x18
 #define TCS3472_REG_B 0x1A
 #define TC3472_REG_ATIME 0x01
+#define TCS3472_PERS 0x0C
 #define TCS3472_CONTROL_REG 0x0F
+#define TCS3472_STATUS 0x13
+#define TCS3472_STATUS_AVALID 0x01
+#define TCS3472_STATUS_AINT 0x10
+/* Special function command: clear the RGBC interrupt */
+#define TCS3472_CLEAR_INTERRUPT 0xE6
 
-typedef enum { RED, GREEN, BLUE, WHITE, BLACK, COLOR_COUNT } color_t;
+/* Every ATIME step integrates for 2.4 ms, ATIME = 256 - steps */
+#define TCS3472_ATIME_STEP_US 2400
+#define TCS3472_MAX_INTEGRATION_STEPS 256
 
 typedef struct {
   float h;
@@ -34,9 +47,23 @@ typedef struct {
   uint16_t iic;
   bool enable;
   uint16_t c, r, g, b;
-  size_t integration_time_ns;
+  uint32_t integration_time_us;
+  size_t conversions_used;  // unique conversions behind the last tcs3472_sample_fresh
+  const color_calibration_t *calibration;
+  sensor_health_t health;  // every color read counts
 } tcs3472_t;
 
+/* Samples a sensor through the bus worker, see tcs3472_sampler_poll */
+typedef struct {
+  tcs3472_t *sensor;
+  i2c_transfer_t status, colors, clear;
+  uint8_t status_value;
+  uint8_t none;
+  uint16_t crgb[4];
+  uint64_t next_poll_us;
+  bool reading;
+} tcs3472_sampler_t;
+
 typedef struct {
   double h;  // angle in degrees
   double s;  // a fraction between 0 and 1
@@ -62,22 +89,60 @@ color_t tcs3472_determine_single_color(tcs3472_t *sensor);
  */
 tcs3472_t *tcs3472_init(int iic);
 
+/**
+ * @brief A sensor on the IIC that has not been talked to yet, tcs3472_reinit brings it up.
+ */
+tcs3472_t *tcs3472_create(int iic);
+
+/**
+ * @brief Checks the ID and enables the sensor again after it was reset or lost, with the integration time it had.
+ * @return 0 if successful, 1 on error
+ */
+bool tcs3472_reinit(tcs3472_t *sensor);
+
 /*
  * @brief Enables sensor
  * @return 0 if successful, 1 on error
  */
 bool tcs3472_enable(tcs3472_t *sensor);
 /*
- * @brief Reads sensed values
- * @param c The pointer to clear value
- * @param r The pointer to red value
- * @param g The pointer to green value
- * @param b The pointer to blue value
- *
- * @return 0 if successful, 1 on error
+ * @brief Reads clear, red, green and blue in a single burst, so all four come from the same integration cycle.
+ * Values are left untouched on error.
  */
 void tcs3472_read_colors(tcs3472_t *sensor);
 
+/*
+ * @brief Sets the integration time, rounded to a multiple of TCS3472_ATIME_STEP_US.
+ * Longer integration means higher counts, so color thresholds depend on it.
+ * @return 0 if successful, 1 on error
+ */
+bool tcs3472_set_integration_time_us(tcs3472_t *sensor, uint32_t integration_time_us);
+
+/*
+ * @brief Averages the next `samples` conversions into c, r, g and b. Every sample waits for the sensor to
+ * finish a new integration cycle, so no conversion is counted twice.
+ * @param samples Amount of conversions to average.
+ * @return Unique conversions actually used (also stored in conversions_used), less than samples on error
+ */
+size_t tcs3472_sample_fresh(tcs3472_t *sensor, size_t samples);
+
+/*
+ * @brief Starts sampling fresh conversions in the background, for loops that have to keep watching something else.
+ * @return 0 if successful, 1 on error
+ */
+bool tcs3472_sampler_start(tcs3472_sampler_t *sampler, tcs3472_t *sensor);
+
+/*
+ * @brief Never blocks. Moves the sampler along and stores a new conversion in the sensor once there is one.
+ * @return true if c, r, g and b of the sensor hold a conversion that was not returned before
+ */
+bool tcs3472_sampler_poll(tcs3472_sampler_t *sampler);
+
+/*
+ * @brief Waits for the transfers the sampler still has queued, it can go out of scope afterwards.
+ */
+void tcs3472_sampler_stop(tcs3472_sampler_t *sampler);
+
 /*
  * @brief Disables sensor
  * @return 0 if successful, 1 on error
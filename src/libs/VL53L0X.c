@@ -1,11 +1,15 @@
 #include "VL53L0X.h"
 
+#include <assert.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "gpio.h"
 #include "i2c.h"
+#include "interrupt.h"
 #include "measurements.h"
 #include "movement.h"
 #include "src/settings.h"
@@ -19,33 +23,63 @@ typedef enum { CALIBRATION_TYPE_VHV, CALIBRATION_TYPE_PHASE } calibration_type_t
 // const uint8_t address = VL53L0X_DEFAULT_ADDRESS;
 // uint8_t stop_variable = 0;
 
+typedef struct {
+  uint8_t reg;
+  uint8_t value;
+} vl53l0x_reg_value_t;
+
+/* Writing 0xFF switches the register page, so it must never be part of a burst */
+#define PAGE_SELECT_REG 0xFF
+
+/* Writes a list of register values in order. Writes to consecutive registers are sent as one burst,
+ * the sensor increments the register index by itself. */
+static bool write_sequence(vl53l0x_t *sensor, const vl53l0x_reg_value_t *sequence, size_t count) {
+  uint8_t burst[VL53L0X_MAX_BURST];
+  size_t i = 0;
+  while (i < count) {
+    size_t length = 1;
+    burst[0] = sequence[i].value;
+    while (i + length < count && length < VL53L0X_MAX_BURST && sequence[i].reg != PAGE_SELECT_REG &&
+           sequence[i + length].reg == sequence[i].reg + length && sequence[i + length].reg != PAGE_SELECT_REG) {
+      burst[length] = sequence[i + length].value;
+      length++;
+    }
+    if (i2c_write_burst(sensor->address, sequence[i].reg, burst, length, I2C_BYTES, sensor->iic)) {
+      ERROR("Failed at entry %zu (reg 0x%02x) of sequence", i, sequence[i].reg);
+      return 1;
+    }
+    i += length;
+  }
+  return 0;
+}
+
 bool data_init(vl53l0x_t *sensor) {
   bool err = 0;
 
   uint8_t vhv_config_scl_sda = 0;
 
-  if (i2c_read8(sensor->address, VL53L0X_VHV_CONFIG_PAD_SCL_SDA_EXTSUP_HV, &vhv_config_scl_sda, IIC0)) {
+  if (i2c_read8(sensor->address, VL53L0X_VHV_CONFIG_PAD_SCL_SDA_EXTSUP_HV, &vhv_config_scl_sda, sensor->iic)) {
     ERROR();
     return 1;
   }
 
   vhv_config_scl_sda |= 0x01;
 
-  if (i2c_write8(sensor->address, VL53L0X_VHV_CONFIG_PAD_SCL_SDA_EXTSUP_HV, vhv_config_scl_sda, IIC0)) {
+  if (i2c_write8(sensor->address, VL53L0X_VHV_CONFIG_PAD_SCL_SDA_EXTSUP_HV, vhv_config_scl_sda, sensor->iic)) {
     ERROR();
     return 1;
   }
 
   /* standard i2c mode */
   /* magic numbers - have no clue */
-  err &= i2c_write8(sensor->address, 0x88, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x80, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0xFF, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0x00, 0x00, IIC0);
-  err &= i2c_read8(sensor->address, 0x91, &sensor->stop_variable, IIC0);
-  err &= i2c_write8(sensor->address, 0x00, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0xFF, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x80, 0x00, IIC0);
+  err |= i2c_write8(sensor->address, 0x88, 0x00, sensor->iic);
+  err |= i2c_write8(sensor->address, 0x80, 0x01, sensor->iic);
+  err |= i2c_write8(sensor->address, 0xFF, 0x01, sensor->iic);
+  err |= i2c_write8(sensor->address, 0x00, 0x00, sensor->iic);
+  err |= i2c_read8(sensor->address, 0x91, &sensor->stop_variable, sensor->iic);
+  err |= i2c_write8(sensor->address, 0x00, 0x01, sensor->iic);
+  err |= i2c_write8(sensor->address, 0xFF, 0x00, sensor->iic);
+  err |= i2c_write8(sensor->address, 0x80, 0x00, sensor->iic);
 
   return err;
 }
@@ -54,7 +88,7 @@ bool load_default_tuning_settings(vl53l0x_t *sensor);
 
 bool ping_sensor(vl53l0x_t *sensor) {
   uint8_t id;
-  if (i2c_read8(sensor->address, VL53L0X_IDENTIFICATION_MODEL_ID, &id, IIC0)) {
+  if (i2c_read8(sensor->address, VL53L0X_IDENTIFICATION_MODEL_ID, &id, sensor->iic)) {
     ERROR();
     return 1;
   }
@@ -62,41 +96,39 @@ bool ping_sensor(vl53l0x_t *sensor) {
 }
 
 bool vl53l0x_read_default_regs(vl53l0x_t *sensor) {
-  uint8_t a;
+  uint8_t a[3];
   uint16_t b;
 
-  i2c_read8(sensor->address, 0xC0, &a, IIC0);
-  LOG("0xC0: %02x", a);
-  i2c_read8(sensor->address, 0xC1, &a, IIC0);
-  LOG("0xC1: %02x", a);
-  i2c_read8(sensor->address, 0xC2, &a, IIC0);
-  LOG("0xC2: %02x", a);
-  i2c_read16_inv(sensor->address, 0x51, &b, IIC0);
+  i2c_read_burst(sensor->address, 0xC0, a, sizeof(a), I2C_BYTES, sensor->iic);
+  LOG("0xC0: %02x", a[0]);
+  LOG("0xC1: %02x", a[1]);
+  LOG("0xC2: %02x", a[2]);
+  i2c_read16_inv(sensor->address, 0x51, &b, sensor->iic);
   LOG("0x51: %04x", b);
-  i2c_read16_inv(sensor->address, 0x61, &b, IIC0);
+  i2c_read16_inv(sensor->address, 0x61, &b, sensor->iic);
   LOG("0x61: %04x", b);
   return 0;
 }
 
 bool configure_interrupt(vl53l0x_t *sensor) {
   /* Interrupt on new sample ready */
-  if (i2c_write8(sensor->address, VL53L0X_SYSTEM_INTERRUPT_CONFIG_GPIO, 0x04, IIC0)) {
+  if (i2c_write8(sensor->address, VL53L0X_SYSTEM_INTERRUPT_CONFIG_GPIO, 0x04, sensor->iic)) {
     ERROR();
     return 1;
   }
   /* Configure active low since the pin is pulled-up on most breakout boards */
   uint8_t gpio_hv_mux_active_high = 0;
-  if (i2c_read8(sensor->address, VL53L0X_GPIO_HV_MUX_ACTIVE_HIGH, &gpio_hv_mux_active_high, IIC0)) {
+  if (i2c_read8(sensor->address, VL53L0X_GPIO_HV_MUX_ACTIVE_HIGH, &gpio_hv_mux_active_high, sensor->iic)) {
     ERROR();
     return 1;
   }
   gpio_hv_mux_active_high &= ~0x10;
-  if (i2c_write8(sensor->address, VL53L0X_GPIO_HV_MUX_ACTIVE_HIGH, gpio_hv_mux_active_high, IIC0)) {
+  if (i2c_write8(sensor->address, VL53L0X_GPIO_HV_MUX_ACTIVE_HIGH, gpio_hv_mux_active_high, sensor->iic)) {
     ERROR();
     return 1;
   }
 
-  if (i2c_write8(sensor->address, VL53L0X_SYSTEM_INTERRUPT_CLEAR, 0x01, IIC0)) {
+  if (i2c_write8(sensor->address, VL53L0X_SYSTEM_INTERRUPT_CLEAR, 0x01, sensor->iic)) {
     ERROR();
     return 1;
   }
@@ -104,7 +136,229 @@ bool configure_interrupt(vl53l0x_t *sensor) {
 }
 
 bool set_sequence_steps_enabled(vl53l0x_t *sensor, uint8_t sequence_step) {
-  return i2c_write8(sensor->address, VL53L0X_SYSTEM_SEQUENCE_CONFIG, sequence_step, IIC0);
+  return i2c_write8(sensor->address, VL53L0X_SYSTEM_SEQUENCE_CONFIG, sequence_step, sensor->iic);
+}
+
+/* GPIO1 is configured active low and stays low until SYSTEM_INTERRUPT_CLEAR, so the level is checked as
+ * well in case the interrupt word was already acknowledged while waiting for another pin */
+static bool sample_ready_pin(vl53l0x_t *sensor) {
+  if (gpio_get_interrupt() & (1ULL << sensor->interrupt_pin)) {
+    gpio_ack_interrupt();
+    return true;
+  }
+  return gpio_get_level(sensor->interrupt_pin) == GPIO_LEVEL_LOW;
+}
+
+/* Checks once, without blocking, whether the sensor has a new sample */
+static bool sample_ready(vl53l0x_t *sensor, bool *ready) {
+  if (sensor->use_interrupt) {
+    *ready = sample_ready_pin(sensor);
+    return 0;
+  }
+  uint8_t interrupt_status = 0;
+  if (i2c_read8(sensor->address, VL53L0X_RESULT_INTERRUPT_STATUS, &interrupt_status, sensor->iic)) {
+    return 1;
+  }
+  *ready = interrupt_status & 0x07;
+  return 0;
+}
+
+static void sleep_until_next_poll(bool use_interrupt) {
+  if (use_interrupt) {
+    usleep(VL53L0X_IRQ_POLL_US);
+  } else {
+    sleep_msec(VL53L0X_POLL_MS);
+  }
+}
+
+/* Waits until the sensor reports a new sample, either on its GPIO1 line or by asking over I2C */
+static bool wait_for_sample(vl53l0x_t *sensor) {
+  uint64_t deadline = get_time_usec() + VL53L0X_TIMEOUT_MS * 1000;
+  bool ready = false;
+  while (true) {
+    if (sample_ready(sensor, &ready)) {
+      return 1;
+    }
+    if (ready) {
+      return 0;
+    }
+    if (get_time_usec() > deadline) {
+      ERROR("Timeout waiting for sensor 0x%02x", sensor->address);
+      return 1;
+    }
+    sleep_until_next_poll(sensor->use_interrupt);
+  }
+}
+
+void vl53l0x_use_interrupt(vl53l0x_t *sensor, uint8_t pin) {
+  gpio_set_direction(pin, GPIO_DIR_INPUT);
+  gpio_enable_interrupt(pin);
+  sensor->interrupt_pin = pin;
+  sensor->use_interrupt = true;
+}
+
+/* Timing budget calculations, ported from the ST API (VL53L0X_SetMeasurementTimingBudgetMicroSeconds) */
+typedef struct {
+  bool tcc, msrc, dss, pre_range, final_range;
+} sequence_step_enables_t;
+
+typedef struct {
+  uint16_t pre_range_vcsel_period_pclks, final_range_vcsel_period_pclks;
+  uint16_t msrc_dss_tcc_mclks, pre_range_mclks, final_range_mclks;
+  uint32_t msrc_dss_tcc_us, pre_range_us, final_range_us;
+} sequence_step_timeouts_t;
+
+/* Overheads of every sequence step in microseconds */
+#define START_OVERHEAD 1910
+#define END_OVERHEAD 960
+#define MSRC_OVERHEAD 660
+#define TCC_OVERHEAD 590
+#define DSS_OVERHEAD 690
+#define PRE_RANGE_OVERHEAD 660
+#define FINAL_RANGE_OVERHEAD 550
+
+#define decode_vcsel_period(reg_val) (((reg_val) + 1) << 1)
+/* Macro period in nanoseconds: 2304 PLL periods of 1655 ps per VCSEL period */
+#define calc_macro_period(vcsel_period_pclks) ((((uint32_t)2304 * (vcsel_period_pclks) * 1655) + 500) / 1000)
+
+static uint16_t decode_timeout(uint16_t reg_val) {
+  /* format: (LSByte * 2^MSByte) + 1 */
+  return (uint16_t)((reg_val & 0x00FF) << (uint16_t)((reg_val & 0xFF00) >> 8)) + 1;
+}
+
+static uint16_t encode_timeout(uint32_t timeout_mclks) {
+  if (timeout_mclks == 0) {
+    return 0;
+  }
+  uint32_t ls_byte = timeout_mclks - 1;
+  uint16_t ms_byte = 0;
+  while ((ls_byte & 0xFFFFFF00) > 0) {
+    ls_byte >>= 1;
+    ms_byte++;
+  }
+  return (ms_byte << 8) | (ls_byte & 0xFF);
+}
+
+static uint32_t timeout_mclks_to_us(uint16_t timeout_mclks, uint16_t vcsel_period_pclks) {
+  uint32_t macro_period_ns = calc_macro_period(vcsel_period_pclks);
+  return ((timeout_mclks * macro_period_ns) + 500) / 1000;
+}
+
+static uint32_t timeout_us_to_mclks(uint32_t timeout_us, uint16_t vcsel_period_pclks) {
+  uint32_t macro_period_ns = calc_macro_period(vcsel_period_pclks);
+  return (((timeout_us * 1000) + (macro_period_ns / 2)) / macro_period_ns);
+}
+
+static bool get_sequence_step_enables(vl53l0x_t *sensor, sequence_step_enables_t *enables) {
+  uint8_t sequence_config = 0;
+  if (i2c_read8(sensor->address, VL53L0X_SYSTEM_SEQUENCE_CONFIG, &sequence_config, sensor->iic)) {
+    return 1;
+  }
+  enables->tcc = (sequence_config >> 4) & 0x1;
+  enables->dss = (sequence_config >> 3) & 0x1;
+  enables->msrc = (sequence_config >> 2) & 0x1;
+  enables->pre_range = (sequence_config >> 6) & 0x1;
+  enables->final_range = (sequence_config >> 7) & 0x1;
+  return 0;
+}
+
+static bool get_sequence_step_timeouts(vl53l0x_t *sensor, const sequence_step_enables_t *enables,
+                                       sequence_step_timeouts_t *timeouts) {
+  uint8_t reg = 0;
+  uint16_t reg16 = 0;
+
+  if (i2c_read8(sensor->address, VL53L0X_PRE_RANGE_CONFIG_VCSEL_PERIOD, &reg, sensor->iic)) {
+    return 1;
+  }
+  timeouts->pre_range_vcsel_period_pclks = decode_vcsel_period(reg);
+
+  if (i2c_read8(sensor->address, VL53L0X_MSRC_CONFIG_TIMEOUT_MACROP, &reg, sensor->iic)) {
+    return 1;
+  }
+  timeouts->msrc_dss_tcc_mclks = reg + 1;
+  timeouts->msrc_dss_tcc_us = timeout_mclks_to_us(timeouts->msrc_dss_tcc_mclks, timeouts->pre_range_vcsel_period_pclks);
+
+  if (i2c_read16_inv(sensor->address, VL53L0X_PRE_RANGE_CONFIG_TIMEOUT_MACROP_HI, &reg16, sensor->iic)) {
+    return 1;
+  }
+  timeouts->pre_range_mclks = decode_timeout(reg16);
+  timeouts->pre_range_us = timeout_mclks_to_us(timeouts->pre_range_mclks, timeouts->pre_range_vcsel_period_pclks);
+
+  if (i2c_read8(sensor->address, VL53L0X_FINAL_RANGE_CONFIG_VCSEL_PERIOD, &reg, sensor->iic)) {
+    return 1;
+  }
+  timeouts->final_range_vcsel_period_pclks = decode_vcsel_period(reg);
+
+  if (i2c_read16_inv(sensor->address, VL53L0X_FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI, &reg16, sensor->iic)) {
+    return 1;
+  }
+  timeouts->final_range_mclks = decode_timeout(reg16);
+  /* The final range timeout includes the pre-range one */
+  if (enables->pre_range) {
+    timeouts->final_range_mclks -= timeouts->pre_range_mclks;
+  }
+  timeouts->final_range_us = timeout_mclks_to_us(timeouts->final_range_mclks, timeouts->final_range_vcsel_period_pclks);
+  return 0;
+}
+
+bool vl53l0x_set_timing_budget_us(vl53l0x_t *sensor, uint32_t budget_us) {
+  if (budget_us < VL53L0X_TIMING_BUDGET_MIN) {
+    ERROR("Timing budget %uus is below minimum", budget_us);
+    return 1;
+  }
+  if (sensor->timing_budget_us == budget_us) {
+    return 0;
+  }
+
+  sequence_step_enables_t enables;
+  sequence_step_timeouts_t timeouts;
+  if (get_sequence_step_enables(sensor, &enables) || get_sequence_step_timeouts(sensor, &enables, &timeouts)) {
+    ERROR();
+    return 1;
+  }
+
+  uint32_t used_budget_us = START_OVERHEAD + END_OVERHEAD;
+  if (enables.tcc) {
+    used_budget_us += timeouts.msrc_dss_tcc_us + TCC_OVERHEAD;
+  }
+  if (enables.dss) {
+    used_budget_us += 2 * (timeouts.msrc_dss_tcc_us + DSS_OVERHEAD);
+  } else if (enables.msrc) {
+    used_budget_us += timeouts.msrc_dss_tcc_us + MSRC_OVERHEAD;
+  }
+  if (enables.pre_range) {
+    used_budget_us += timeouts.pre_range_us + PRE_RANGE_OVERHEAD;
+  }
+  /* Only the final range timeout can be stretched, the rest is what is left of the budget */
+  if (enables.final_range) {
+    used_budget_us += FINAL_RANGE_OVERHEAD;
+    if (used_budget_us > budget_us) {
+      ERROR("Timing budget %uus too small, need %uus", budget_us, used_budget_us);
+      return 1;
+    }
+    uint32_t final_range_timeout_mclks =
+        timeout_us_to_mclks(budget_us - used_budget_us, timeouts.final_range_vcsel_period_pclks);
+    if (enables.pre_range) {
+      final_range_timeout_mclks += timeouts.pre_range_mclks;
+    }
+
+    bool continuous = sensor->continuous;
+    if (continuous && vl53l0x_stop_continuous(sensor)) {
+      ERROR();
+      return 1;
+    }
+    if (i2c_write16_inv(sensor->address, VL53L0X_FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI,
+                        encode_timeout(final_range_timeout_mclks), sensor->iic)) {
+      ERROR();
+      return 1;
+    }
+    if (continuous && vl53l0x_start_continuous(sensor, sensor->period_ms)) {
+      ERROR();
+      return 1;
+    }
+  }
+  sensor->timing_budget_us = budget_us;
+  return 0;
 }
 
 bool perform_single_ref_calibration(vl53l0x_t *sensor, calibration_type_t calib_type) {
@@ -122,32 +376,26 @@ bool perform_single_ref_calibration(vl53l0x_t *sensor, calibration_type_t calib_
       break;
   }
 
-  if (i2c_write8(sensor->address, VL53L0X_SYSTEM_SEQUENCE_CONFIG, sequance_config, IIC0)) {
+  if (i2c_write8(sensor->address, VL53L0X_SYSTEM_SEQUENCE_CONFIG, sequance_config, sensor->iic)) {
     ERROR();
     return 1;
   }
-  if (i2c_write8(sensor->address, VL53L0X_SYSRANGE_START, sysrange_start, IIC0)) {
+  if (i2c_write8(sensor->address, VL53L0X_SYSRANGE_START, sysrange_start, sensor->iic)) {
     ERROR();
     return 1;
   }
 
-  uint8_t interrupt_status = 0;
-  bool err = 0;
-  do {
-    err = i2c_read8(sensor->address, VL53L0X_RESULT_INTERRUPT_STATUS, &interrupt_status, IIC0);
-    sleep_msec(30);
-  } while (!err && ((interrupt_status & 0x07) == 0));
-  if (err) {
+  if (wait_for_sample(sensor)) {
     ERROR();
     return 1;
   }
 
-  if (i2c_write8(sensor->address, VL53L0X_SYSTEM_INTERRUPT_CLEAR, 0x01, IIC0)) {
+  if (i2c_write8(sensor->address, VL53L0X_SYSTEM_INTERRUPT_CLEAR, 0x01, sensor->iic)) {
     ERROR();
     return 1;
   }
 
-  if (i2c_write8(sensor->address, VL53L0X_SYSRANGE_START, 0x00, IIC0)) {
+  if (i2c_write8(sensor->address, VL53L0X_SYSRANGE_START, 0x00, sensor->iic)) {
     ERROR();
     return 1;
   }
@@ -189,204 +437,459 @@ bool static_init(vl53l0x_t *sensor) {
     ERROR();
     return 1;
   }
+  /* Final range timeout has to be recalculated for the new sequence steps */
+  if (vl53l0x_set_timing_budget_us(sensor, VL53L0X_TIMING_BUDGET_DEFAULT)) {
+    ERROR();
+    return 1;
+  }
   return 0;
 }
 
-vl53l0x_t *vl53l0x_init(void) {
-  vl53l0x_t *sensor = malloc(sizeof(*sensor));
-  memset(sensor, 0, sizeof(*sensor));
-  sensor->address = VL53L0X_DEFAULT_ADDRESS;
+vl53l0x_t *vl53l0x_init(void) { return vl53l0x_init_at(VL53L0X_DEFAULT_ADDRESS, IIC0); }
+
+/*
+ * 0xFF selects the register page and 0x80 unlocks the hidden registers, the shadow only holds page 0. Ranging
+ * results change by themselves and SYSRANGE_START, the interrupt clear and the address take effect on every write.
+ * The model ID is how vl53l0x_wait_ready tells whether the sensor is still there, so it always goes to the bus.
+ */
+static const uint8_t shadow_banks[] = {PAGE_SELECT_REG, 0x80};
+static const uint8_t volatile_registers[] = {
+    VL53L0X_SYSRANGE_START,          VL53L0X_SYSTEM_INTERRUPT_CLEAR,   VL53L0X_RESULT_INTERRUPT_STATUS,
+    VL53L0X_RESULT_RANGE_STATUS,     VL53L0X_RESULT_RANGE_STATUS + 1,  VL53L0X_RESULT_RANGE_STATUS + 2,
+    VL53L0X_RESULT_RANGE_STATUS + 3, VL53L0X_RESULT_RANGE_STATUS + 4,  VL53L0X_RESULT_RANGE_STATUS + 5,
+    VL53L0X_RESULT_RANGE_STATUS + 6, VL53L0X_RESULT_RANGE_STATUS + 7,  VL53L0X_RESULT_RANGE_STATUS + 8,
+    VL53L0X_RESULT_RANGE_STATUS + 9, VL53L0X_RESULT_RANGE_STATUS + 10, VL53L0X_RESULT_RANGE_STATUS + 11,
+    VL53L0X_SLAVE_DEVICE_ADDRESS,    VL53L0X_IDENTIFICATION_MODEL_ID,
+};
+static const i2c_shadow_config_t shadow_config = {
+    .register_mask = 0xFF,
+    .banks = shadow_banks,
+    .bank_count = sizeof(shadow_banks),
+    .volatile_registers = volatile_registers,
+    .volatile_count = sizeof(volatile_registers),
+};
+
+/* Sensors that did not move off the default address yet share it with the TCS3472, those are not shadowed */
+static void shadow_registers(vl53l0x_t *sensor) {
+  if (sensor->address != VL53L0X_DEFAULT_ADDRESS && i2c_shadow_enable(sensor->address, &shadow_config, sensor->iic)) {
+    LOG("No register shadow for the VL53L0X at 0x%02X", sensor->address);
+  }
+}
 
+/* Offsets from settings.h, sensors are found by the address rover.c gives them */
+static int16_t default_offset(uint8_t address) {
+  for (size_t i = 0; i < sizeof(distance_sensor_offsets) / sizeof(distance_sensor_offsets[0]); ++i) {
+    if (address == INITIAL_ADDRESS - i) {
+      return distance_sensor_offsets[i];
+    }
+  }
+  return 0;
+}
+
+/* Everything a sensor needs after it answers on its address */
+static bool bring_up(vl53l0x_t *sensor) {
   if (ping_sensor(sensor)) {
     ERROR();
-    goto borked;
+    return 1;
   }
+  shadow_registers(sensor);
   LOG("Device connected(1/4)");
 
   if (data_init(sensor)) {
     ERROR();
-    goto borked;
+    return 1;
   }
   LOG("Data initialisesd(2/4)");
   if (static_init(sensor)) {
     ERROR();
-    goto borked;
+    return 1;
   }
   LOG("Static init done(3/4)");
   if (perform_ref_calibration(sensor)) {
     ERROR();
-    goto borked;
+    return 1;
   }
   LOG("Calibration done(4/4)");
+  return 0;
+}
+
+vl53l0x_t *vl53l0x_create(uint8_t address, iic_index_t iic) {
+  vl53l0x_t *sensor = malloc(sizeof(*sensor));
+  memset(sensor, 0, sizeof(*sensor));
+  sensor->address = address;
+  sensor->iic = iic;
+  sensor->offset_mm = default_offset(address);
+  return sensor;
+}
 
+vl53l0x_t *vl53l0x_init_at(uint8_t address, iic_index_t iic) {
+  vl53l0x_t *sensor = vl53l0x_create(address, iic);
+  if (bring_up(sensor)) {
+    i2c_shadow_disable(address, iic);
+    free(sensor);
+    return NULL;
+  }
   return sensor;
-borked:
-  free(sensor);
-  return NULL;
 }
 
+bool vl53l0x_reinit(vl53l0x_t *sensor) {
+  bool continuous = sensor->continuous;
+  uint32_t timing_budget_us = sensor->timing_budget_us;
+  /* The sensor forgot both, so nothing may be skipped as already set */
+  sensor->continuous = false;
+  sensor->timing_budget_us = 0;
+  i2c_shadow_disable(sensor->address, sensor->iic);
+  bool err = bring_up(sensor) || (timing_budget_us != 0 && vl53l0x_set_timing_budget_us(sensor, timing_budget_us)) ||
+             (continuous && vl53l0x_start_continuous(sensor, sensor->period_ms));
+  if (err) {
+    i2c_shadow_disable(sensor->address, sensor->iic);
+    // For the next attempt, a sensor that stays away is probed again and again
+    sensor->continuous = continuous;
+    sensor->timing_budget_us = timing_budget_us;
+  }
+  return err;
+}
+
+/* Tuning settings from the ST API (DefaultTuningSettings), written in this order */
+static const vl53l0x_reg_value_t default_tuning_settings[] = {
+    {0xFF, 0x01}, {0x00, 0x00}, {0xFF, 0x00}, {0x09, 0x00}, {0x10, 0x00}, {0x11, 0x00},
+    {0x24, 0x01}, {0x25, 0xFF}, {0x75, 0x00}, {0xFF, 0x01}, {0x4E, 0x2C}, {0x48, 0x00},
+    {0x30, 0x20}, {0xFF, 0x00}, {0x30, 0x09}, {0x54, 0x00}, {0x31, 0x04}, {0x32, 0x03},
+    {0x40, 0x83}, {0x46, 0x25}, {0x60, 0x00}, {0x27, 0x00}, {0x50, 0x06}, {0x51, 0x00},
+    {0x52, 0x96}, {0x56, 0x08}, {0x57, 0x30}, {0x61, 0x00}, {0x62, 0x00}, {0x64, 0x00},
+    {0x65, 0x00}, {0x66, 0xA0}, {0xFF, 0x01}, {0x22, 0x32}, {0x47, 0x14}, {0x49, 0xFF},
+    {0x4A, 0x00}, {0xFF, 0x00}, {0x7A, 0x0A}, {0x7B, 0x00}, {0x78, 0x21}, {0xFF, 0x01},
+    {0x23, 0x34}, {0x42, 0x00}, {0x44, 0xFF}, {0x45, 0x26}, {0x46, 0x05}, {0x40, 0x40},
+    {0x0E, 0x06}, {0x20, 0x1A}, {0x43, 0x40}, {0xFF, 0x00}, {0x34, 0x03}, {0x35, 0x44},
+    {0xFF, 0x01}, {0x31, 0x04}, {0x4B, 0x09}, {0x4C, 0x05}, {0x4D, 0x04}, {0xFF, 0x00},
+    {0x44, 0x00}, {0x45, 0x20}, {0x47, 0x08}, {0x48, 0x28}, {0x67, 0x00}, {0x70, 0x04},
+    {0x71, 0x01}, {0x72, 0xFE}, {0x76, 0x00}, {0x77, 0x00}, {0xFF, 0x01}, {0x0D, 0x01},
+    {0xFF, 0x00}, {0x80, 0x01}, {0x01, 0xF8}, {0xFF, 0x01}, {0x8E, 0x01}, {0x00, 0x01},
+    {0xFF, 0x00}, {0x80, 0x00},
+};
+
 bool load_default_tuning_settings(vl53l0x_t *sensor) {
-  bool err = false;
-  err &= i2c_write8(sensor->address, 0xFF, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0x00, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0xFF, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x09, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x10, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x11, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x24, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0x25, 0xFF, IIC0);
-  err &= i2c_write8(sensor->address, 0x75, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0xFF, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0x4E, 0x2C, IIC0);
-  err &= i2c_write8(sensor->address, 0x48, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x30, 0x20, IIC0);
-  err &= i2c_write8(sensor->address, 0xFF, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x30, 0x09, IIC0);
-  err &= i2c_write8(sensor->address, 0x54, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x31, 0x04, IIC0);
-  err &= i2c_write8(sensor->address, 0x32, 0x03, IIC0);
-  err &= i2c_write8(sensor->address, 0x40, 0x83, IIC0);
-  err &= i2c_write8(sensor->address, 0x46, 0x25, IIC0);
-  err &= i2c_write8(sensor->address, 0x60, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x27, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x50, 0x06, IIC0);
-  err &= i2c_write8(sensor->address, 0x51, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x52, 0x96, IIC0);
-  err &= i2c_write8(sensor->address, 0x56, 0x08, IIC0);
-  err &= i2c_write8(sensor->address, 0x57, 0x30, IIC0);
-  err &= i2c_write8(sensor->address, 0x61, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x62, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x64, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x65, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x66, 0xA0, IIC0);
-  err &= i2c_write8(sensor->address, 0xFF, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0x22, 0x32, IIC0);
-  err &= i2c_write8(sensor->address, 0x47, 0x14, IIC0);
-  err &= i2c_write8(sensor->address, 0x49, 0xFF, IIC0);
-  err &= i2c_write8(sensor->address, 0x4A, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0xFF, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x7A, 0x0A, IIC0);
-  err &= i2c_write8(sensor->address, 0x7B, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x78, 0x21, IIC0);
-  err &= i2c_write8(sensor->address, 0xFF, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0x23, 0x34, IIC0);
-  err &= i2c_write8(sensor->address, 0x42, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x44, 0xFF, IIC0);
-  err &= i2c_write8(sensor->address, 0x45, 0x26, IIC0);
-  err &= i2c_write8(sensor->address, 0x46, 0x05, IIC0);
-  err &= i2c_write8(sensor->address, 0x40, 0x40, IIC0);
-  err &= i2c_write8(sensor->address, 0x0E, 0x06, IIC0);
-  err &= i2c_write8(sensor->address, 0x20, 0x1A, IIC0);
-  err &= i2c_write8(sensor->address, 0x43, 0x40, IIC0);
-  err &= i2c_write8(sensor->address, 0xFF, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x34, 0x03, IIC0);
-  err &= i2c_write8(sensor->address, 0x35, 0x44, IIC0);
-  err &= i2c_write8(sensor->address, 0xFF, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0x31, 0x04, IIC0);
-  err &= i2c_write8(sensor->address, 0x4B, 0x09, IIC0);
-  err &= i2c_write8(sensor->address, 0x4C, 0x05, IIC0);
-  err &= i2c_write8(sensor->address, 0x4D, 0x04, IIC0);
-  err &= i2c_write8(sensor->address, 0xFF, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x44, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x45, 0x20, IIC0);
-  err &= i2c_write8(sensor->address, 0x47, 0x08, IIC0);
-  err &= i2c_write8(sensor->address, 0x48, 0x28, IIC0);
-  err &= i2c_write8(sensor->address, 0x67, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x70, 0x04, IIC0);
-  err &= i2c_write8(sensor->address, 0x71, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0x72, 0xFE, IIC0);
-  err &= i2c_write8(sensor->address, 0x76, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x77, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0xFF, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0x0D, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0xFF, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x80, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0x01, 0xF8, IIC0);
-  err &= i2c_write8(sensor->address, 0xFF, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0x8E, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0x00, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0xFF, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x80, 0x00, IIC0);
+  return write_sequence(sensor, default_tuning_settings, sizeof(default_tuning_settings) / sizeof(default_tuning_settings[0]));
+}
+
+/* Restores the stop variable read in data_init, has to be done before every (series of) measurement(s) */
+static bool write_stop_variable(vl53l0x_t *sensor) {
+  bool err = i2c_write8(sensor->address, 0x80, 0x01, sensor->iic);
+  err |= i2c_write8(sensor->address, 0xFF, 0x01, sensor->iic);
+  err |= i2c_write8(sensor->address, 0x00, 0x00, sensor->iic);
+  err |= i2c_write8(sensor->address, 0x91, sensor->stop_variable, sensor->iic);
+  err |= i2c_write8(sensor->address, 0x00, 0x01, sensor->iic);
+  err |= i2c_write8(sensor->address, 0xFF, 0x00, sensor->iic);
+  err |= i2c_write8(sensor->address, 0x80, 0x00, sensor->iic);
   return err;
 }
 
-bool vl53l0x_read_range(vl53l0x_t *sensor) {
-  bool err = i2c_write8(sensor->address, 0x80, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0xFF, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0x00, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x91, sensor->stop_variable, IIC0);
-  err &= i2c_write8(sensor->address, 0x00, 0x01, IIC0);
-  err &= i2c_write8(sensor->address, 0xFF, 0x00, IIC0);
-  err &= i2c_write8(sensor->address, 0x80, 0x00, IIC0);
-  if (err) {
+/* Reads the finished sample and clears the interrupt so the sensor can signal the next one */
+static bool collect_range(vl53l0x_t *sensor) {
+  if (i2c_read16_inv(sensor->address, VL53L0X_RESULT_RANGE_STATUS + 10, &sensor->range, sensor->iic)) {
+    return 1;
+  }
+
+  if (i2c_write8(sensor->address, VL53L0X_SYSTEM_INTERRUPT_CLEAR, 0x01, sensor->iic)) {
+    return 1;
+  }
+
+  sensor->adjusted_range = sensor->range * sensor->a + sensor->b;  // Least sqare
+
+  if (sensor->range >= 8190) {
+    sensor->range = VL53L0X_OUT_OF_RANGE;
+  }
+  return 0;
+}
+
+static bool read_single_shot(vl53l0x_t *sensor) {
+  if (write_stop_variable(sensor)) {
     return 1;
   }
-  if (i2c_write8(sensor->address, VL53L0X_SYSRANGE_START, 0x01, IIC0)) {
+  if (i2c_write8(sensor->address, VL53L0X_SYSRANGE_START, VL53L0X_SYSRANGE_MODE_SINGLESHOT, sensor->iic)) {
     return 1;
   }
   uint8_t sysrange_start = 0;
+  bool err = 0;
+  /* A sensor that dropped off can read back anything, so the start bit may never clear */
+  uint64_t deadline = get_time_usec() + VL53L0X_TIMEOUT_MS * 1000;
   do {
-    err = i2c_read8(sensor->address, VL53L0X_SYSRANGE_START, &sysrange_start, IIC0);
+    err = i2c_read8(sensor->address, VL53L0X_SYSRANGE_START, &sysrange_start, sensor->iic);
     sleep_msec(30);
-  } while (!err && (sysrange_start & 0x01));
-  if (err) {
+  } while (!err && (sysrange_start & 0x01) && get_time_usec() < deadline);
+  if (err || (sysrange_start & 0x01)) {
     return 1;
   }
 
-  if (i2c_read16_inv(sensor->address, VL53L0X_RESULT_RANGE_STATUS + 10, &sensor->range, IIC0)) {
+  return collect_range(sensor);
+}
+
+bool vl53l0x_read_range(vl53l0x_t *sensor) {
+  if (sensor->continuous) {
+    return vl53l0x_read_latest(sensor);
+  }
+  bool err = read_single_shot(sensor);
+  sensor_health_record(&sensor->health, err);
+  return err;
+}
+
+bool vl53l0x_start_continuous(vl53l0x_t *sensor, uint32_t period_ms) {
+  sensor->period_ms = period_ms;
+  if (write_stop_variable(sensor)) {
+    ERROR();
     return 1;
   }
 
-  if (i2c_write8(sensor->address, VL53L0X_SYSTEM_INTERRUPT_CLEAR, 0x01, IIC0)) {
+  if (period_ms == 0) {
+    if (i2c_write8(sensor->address, VL53L0X_SYSRANGE_START, VL53L0X_SYSRANGE_MODE_BACKTOBACK, sensor->iic)) {
+      ERROR();
+      return 1;
+    }
+    sensor->continuous = true;
+    return 0;
+  }
+
+  /* The period register counts in oscillator ticks, not milliseconds */
+  uint16_t osc_calibrate_val = 0;
+  if (i2c_read16_inv(sensor->address, VL53L0X_OSC_CALIBRATE_VAL, &osc_calibrate_val, sensor->iic)) {
+    ERROR();
     return 1;
   }
+  if (osc_calibrate_val != 0) {
+    period_ms *= osc_calibrate_val;
+  }
+  uint16_t period[2] = {period_ms >> 16, period_ms & 0xFFFF};
+  if (i2c_write_burst(sensor->address, VL53L0X_SYSTEM_INTERMEASUREMENT_PERIOD, period, sizeof(period), I2C_WORDS_BE,
+                      sensor->iic)) {
+    ERROR();
+    return 1;
+  }
+  if (i2c_write8(sensor->address, VL53L0X_SYSRANGE_START, VL53L0X_SYSRANGE_MODE_TIMED, sensor->iic)) {
+    ERROR();
+    return 1;
+  }
+  sensor->continuous = true;
+  return 0;
+}
 
-  sensor->adjusted_range = sensor->range * sensor->a + sensor->b;  // Least sqare
+bool vl53l0x_stop_continuous(vl53l0x_t *sensor) {
+  if (!sensor->continuous) {
+    return 0;
+  }
+  bool err = i2c_write8(sensor->address, VL53L0X_SYSRANGE_START, VL53L0X_SYSRANGE_MODE_SINGLESHOT, sensor->iic);
+  err |= i2c_write8(sensor->address, 0xFF, 0x01, sensor->iic);
+  err |= i2c_write8(sensor->address, 0x00, 0x00, sensor->iic);
+  err |= i2c_write8(sensor->address, 0x91, 0x00, sensor->iic);
+  err |= i2c_write8(sensor->address, 0x00, 0x01, sensor->iic);
+  err |= i2c_write8(sensor->address, 0xFF, 0x00, sensor->iic);
+  if (err) {
+    ERROR();
+    return 1;
+  }
+  sensor->continuous = false;
+  return 0;
+}
 
-  if (sensor->range >= 8190) {
-    sensor->range = VL53L0X_OUT_OF_RANGE;
+bool vl53l0x_read_latest(vl53l0x_t *sensor) {
+  bool err = wait_for_sample(sensor) || collect_range(sensor);
+  sensor_health_record(&sensor->health, err);
+  return err;
+}
+
+bool vl53l0x_wait_ready(uint8_t address, uint32_t timeout_ms, iic_index_t iic) {
+  uint64_t deadline = get_time_usec() + timeout_ms * 1000;
+  uint32_t delay_us = VL53L0X_READY_POLL_MIN_US;
+  uint8_t id = 0;
+  while (true) {
+    /* No ERROR on failure, the sensor is expected to not answer while it boots */
+    if (!i2c_read8(address, VL53L0X_IDENTIFICATION_MODEL_ID, &id, iic) && id == VL53L0X_EXPECTED_DEVICE_ID) {
+      return 0;
+    }
+    uint64_t now = get_time_usec();
+    if (now >= deadline) {
+      return 1;
+    }
+    usleep(deadline - now < delay_us ? deadline - now : delay_us);
+    delay_us = delay_us * 2 < VL53L0X_READY_POLL_MAX_US ? delay_us * 2 : VL53L0X_READY_POLL_MAX_US;
+  }
+}
+
+bool vl53l0x_set_address(uint8_t address, uint8_t new_address, iic_index_t iic) {
+  i2c_shadow_disable(address, iic);
+  if (i2c_write8(address, VL53L0X_SLAVE_DEVICE_ADDRESS, new_address & 0x7F, iic)) {
+    return true;
+  }
+  return vl53l0x_wait_ready(new_address, VL53L0X_ADDRESS_TIMEOUT_MS, iic);
+}
+
+bool vl53l0x_assign_addresses(const vl53l0x_slot_t *slots, size_t count, vl53l0x_assigned_t assigned, void *arg) {
+  bool pending[count];
+  bool any_pending = false;
+  for (size_t i = 0; i < count; ++i) {
+    assert(slots[i].address != VL53L0X_DEFAULT_ADDRESS);
+    pending[i] = vl53l0x_wait_ready(slots[i].address, 0, slots[i].iic);
+    if (pending[i]) {
+      /* Back on the default address or not up at all, either way it has to start from reset */
+      gpio_set_level(slots[i].xshut_pin, GPIO_LEVEL_LOW);
+      i2c_shadow_disable(slots[i].address, slots[i].iic);
+      any_pending = true;
+    }
+  }
+  if (!any_pending) {
+    return 0;
+  }
+  sleep_msec(XSHUT_HOLD_MS);
+
+  bool err = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (!pending[i]) {
+      continue;
+    }
+    gpio_set_level(slots[i].xshut_pin, GPIO_LEVEL_HIGH);
+    bool failed = vl53l0x_wait_ready(VL53L0X_DEFAULT_ADDRESS, VL53L0X_BOOT_TIMEOUT_MS, slots[i].iic) ||
+                  vl53l0x_set_address(VL53L0X_DEFAULT_ADDRESS, slots[i].address, slots[i].iic);
+    if (failed) {
+      /* Kept in reset, so it does not block the default address for the sensors after it */
+      gpio_set_level(slots[i].xshut_pin, GPIO_LEVEL_LOW);
+    }
+    err |= failed;
+    if (assigned != NULL) {
+      assigned(i, failed, arg);
+    }
   }
   return err;
 }
+
 bool vl53l0x_change_address(vl53l0x_t *sensor, uint8_t new_address) {
-  if (i2c_write8(sensor->address, VL53L0X_SLAVE_DEVICE_ADDRESS, new_address, IIC0)) {
+  if (vl53l0x_set_address(sensor->address, new_address, sensor->iic)) {
     return true;
   }
   sensor->address = new_address;
-  sleep_msec(500);
+  sensor->offset_mm = default_offset(new_address);
+  shadow_registers(sensor);
   return false;
 }
 
 void vl53l0x_destroy(vl53l0x_t *sensor) {
   if (sensor != NULL) {
+    vl53l0x_stop_continuous(sensor);
+    i2c_shadow_disable(sensor->address, sensor->iic);
     free(sensor);
   }
 }
 
-uint16_t vl53l0x_get_single_optimal_range(vl53l0x_t *sensor) {
-  vl53l0x_read_range(sensor);
+static uint16_t optimal_range(vl53l0x_t *sensor) {
   //return (sensor->adjusted_range) ? sensor->adjusted_range : sensor->range;
-  return sensor->range-30;
+  return sensor->range - 30;
+}
+
+static void apply_sensor_offset(vl53l0x_t *sensor, uint16_t *range) { *range += sensor->offset_mm; }
+
+uint16_t vl53l0x_get_single_optimal_range(vl53l0x_t *sensor) {
+  if (vl53l0x_read_range(sensor)) {
+    ERROR();
+  }
+  return optimal_range(sensor);
 }
 
 void vl53l0x_read_mean_range(vl53l0x_t *sensor, uint16_t *range) {
   int total = 0;
   for (int i = 0; i < VL53L0X_READING_COUNT; i++) {
-    if (vl53l0x_read_range(sensor)) {
-      ERROR();
-    }
     total += vl53l0x_get_single_optimal_range(sensor);
 
-    sleep_msec(75);
+    /* In continuous mode every read already waits for a fresh sample */
+    if (!sensor->continuous) {
+      sleep_msec(75);
+    }
   }
   *range = total / VL53L0X_READING_COUNT /*- OFFSET*/;
-  if(sensor->address == 0x69){
-    *range += 5;
-  } else if(sensor->address == 0x68){
-    *range -= 10;
-  } else if(sensor->address == 0x67){
-    *range -= 45;
-  }   //offsets of individual distance sensors. Note that 0x67 (high) is accurate but had setback because of robot angle
+  apply_sensor_offset(sensor, range);
+}
+
+bool vl53l0x_group_start(vl53l0x_t **sensors, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    if (!sensors[i]->continuous && vl53l0x_start_continuous(sensors[i], 0)) {
+      ERROR("Could not start sensor 0x%02x", sensors[i]->address);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+bool vl53l0x_group_read(vl53l0x_t **sensors, size_t count, vl53l0x_group_reading_t *reading) {
+  if (count > VL53L0X_GROUP_MAX) {
+    ERROR("Group of %zu sensors is larger than %d", count, VL53L0X_GROUP_MAX);
+    return 1;
+  }
+  if (vl53l0x_group_start(sensors, count)) {
+    return 1;
+  }
+
+  uint64_t deadline = get_time_usec() + VL53L0X_TIMEOUT_MS * 1000;
+  bool done[VL53L0X_GROUP_MAX] = {false};
+  size_t remaining = count;
+  while (remaining > 0) {
+    /* Harvest whatever sensor finished first instead of waiting for them in order */
+    bool all_use_interrupt = true;
+    for (size_t i = 0; i < count; ++i) {
+      if (done[i]) {
+        continue;
+      }
+      all_use_interrupt &= sensors[i]->use_interrupt;
+      bool ready = false;
+      if (sample_ready(sensors[i], &ready)) {
+        ERROR("Could not poll sensor 0x%02x", sensors[i]->address);
+        sensor_health_record(&sensors[i]->health, 1);
+        return 1;
+      }
+      if (!ready) {
+        continue;
+      }
+      bool err = collect_range(sensors[i]);
+      sensor_health_record(&sensors[i]->health, err);
+      if (err) {
+        ERROR("Could not read sensor 0x%02x", sensors[i]->address);
+        return 1;
+      }
+      reading->range[i] = optimal_range(sensors[i]);
+      done[i] = true;
+      remaining--;
+    }
+    if (remaining == 0) {
+      break;
+    }
+    if (get_time_usec() > deadline) {
+      ERROR("Timeout waiting for %zu sensor(s)", remaining);
+      for (size_t i = 0; i < count; ++i) {
+        if (!done[i]) {
+          sensor_health_record(&sensors[i]->health, 1);
+        }
+      }
+      return 1;
+    }
+    sleep_until_next_poll(all_use_interrupt);
+  }
+  reading->timestamp_us = get_time_usec();
+  return 0;
+}
+
+bool vl53l0x_group_read_mean(vl53l0x_t **sensors, size_t count, vl53l0x_group_reading_t *reading) {
+  int total[VL53L0X_GROUP_MAX] = {0};
+  vl53l0x_group_reading_t single;
+  for (int i = 0; i < VL53L0X_READING_COUNT; i++) {
+    if (vl53l0x_group_read(sensors, count, &single)) {
+      return 1;
+    }
+    for (size_t j = 0; j < count; ++j) {
+      total[j] += single.range[j];
+    }
+  }
+  for (size_t j = 0; j < count; ++j) {
+    reading->range[j] = total[j] / VL53L0X_READING_COUNT;
+    apply_sensor_offset(sensors[j], &reading->range[j]);
+  }
+  reading->timestamp_us = single.timestamp_us;
+  return 0;
 }
 
 void vl53l0x_calibration_dance(vl53l0x_t **distance_sensors, size_t sensor_count, const float calibration_matrix[]) {
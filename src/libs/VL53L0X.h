@@ -1,9 +1,12 @@
 #ifndef VL53L0X_H_
 #define VL53L0X_H_
+#include <libpynq.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "sensor_manager.h"
+
 #define VL53L0X_IDENTIFICATION_MODEL_ID (0xC0)
 #define VL53L0X_VHV_CONFIG_PAD_SCL_SDA_EXTSUP_HV (0x89)
 #define VL53L0X_MSRC_CONFIG_CONTROL (0x60)
@@ -20,6 +23,17 @@
 #define VL53L0X_GLOBAL_CONFIG_SPAD_ENABLES_REF_0 (0xB0)
 #define VL53L0X_RESULT_RANGE_STATUS (0x14)
 #define VL53L0X_SLAVE_DEVICE_ADDRESS (0x8A)
+#define VL53L0X_SYSTEM_INTERMEASUREMENT_PERIOD (0x04)
+#define VL53L0X_OSC_CALIBRATE_VAL (0xF8)
+#define VL53L0X_MSRC_CONFIG_TIMEOUT_MACROP (0x46)
+#define VL53L0X_PRE_RANGE_CONFIG_VCSEL_PERIOD (0x50)
+#define VL53L0X_PRE_RANGE_CONFIG_TIMEOUT_MACROP_HI (0x51)
+#define VL53L0X_FINAL_RANGE_CONFIG_VCSEL_PERIOD (0x70)
+#define VL53L0X_FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI (0x71)
+
+#define VL53L0X_SYSRANGE_MODE_SINGLESHOT (0x01)
+#define VL53L0X_SYSRANGE_MODE_BACKTOBACK (0x02)
+#define VL53L0X_SYSRANGE_MODE_TIMED (0x04)
 
 #define VL53L0X_RANGE_SEQUENCE_STEP_TCC (0x10)  /* Target CentreCheck */
 #define VL53L0X_RANGE_SEQUENCE_STEP_MSRC (0x04) /* Minimum Signal Rate Check */
@@ -52,18 +66,112 @@
 
 #define VL53L0X_OUT_OF_RANGE (8190)
 
+/* Longest run of consecutive registers written in a single I2C transaction */
+#define VL53L0X_MAX_BURST (16)
+
+/* Measurement timing budgets in microseconds. Longer budget means less noise but less samples per second.
+ * 20 ms is the minimum the sensor accepts, 33 ms is what the ST API uses after init. */
+#define VL53L0X_TIMING_BUDGET_MIN (20000)
+#define VL53L0X_TIMING_BUDGET_FAST (20000)
+#define VL53L0X_TIMING_BUDGET_DEFAULT (33000)
+#define VL53L0X_TIMING_BUDGET_ACCURATE (200000)
+
+/* The sensor boots in about 1.2 ms after XSHUT goes high */
+#define VL53L0X_BOOT_TIMEOUT_MS (100)
+/* A new address is taken at once, this only covers a slow bus */
+#define VL53L0X_ADDRESS_TIMEOUT_MS (5)
+/* Waiting for the sensor to answer starts with short polls and backs off to the longer ones */
+#define VL53L0X_READY_POLL_MIN_US (100)
+#define VL53L0X_READY_POLL_MAX_US (1000)
+
+/* How long to wait for a sample before giving up, and how often to ask the sensor in the meantime. */
+#define VL53L0X_TIMEOUT_MS (500)
+#define VL53L0X_POLL_MS (2)
+/* Checking the GPIO1 line does not touch the bus, so it can be done much more often */
+#define VL53L0X_IRQ_POLL_US (50)
+
 typedef struct {
   uint8_t address;
+  iic_index_t iic;
   uint16_t range;
   uint16_t adjusted_range;
   uint8_t stop_variable;
   float a;
   float b;
+  int16_t offset_mm;  // added to every mean range
+  bool continuous;
+  uint32_t period_ms;
+  uint32_t timing_budget_us;
+  bool use_interrupt;
+  uint8_t interrupt_pin;
+  sensor_health_t health;  // every range read counts
 } vl53l0x_t;
 
+/* Maximum amount of sensors ranged together as one group */
+#define VL53L0X_GROUP_MAX (8)
+
+typedef struct {
+  uint16_t range[VL53L0X_GROUP_MAX];  // In the order the sensors were passed
+  uint64_t timestamp_us;               // When the last sensor of the group was read, see get_time_usec()
+} vl53l0x_group_reading_t;
+
 vl53l0x_t *vl53l0x_init(void);
 bool vl53l0x_read_default_regs(vl53l0x_t *sensor);
 bool vl53l0x_change_address(vl53l0x_t *sensor, uint8_t new_address);
+
+/**
+ * @brief Initialises a sensor that already answers on a non-default address.
+ * @return The sensor, NULL on error
+ */
+vl53l0x_t *vl53l0x_init_at(uint8_t address, iic_index_t iic);
+
+/**
+ * @brief A sensor on the given address that has not been talked to yet, vl53l0x_reinit brings it up.
+ */
+vl53l0x_t *vl53l0x_create(uint8_t address, iic_index_t iic);
+
+/**
+ * @brief Polls the model ID until the sensor answers on the given address, VL53L0X_READY_POLL_MIN_US apart at
+ * first and backing off to VL53L0X_READY_POLL_MAX_US. A timeout of 0 asks once.
+ * @return 0 if the sensor answered, 1 after timeout_ms
+ */
+bool vl53l0x_wait_ready(uint8_t address, uint32_t timeout_ms, iic_index_t iic);
+
+/**
+ * @brief Moves a (not yet initialised) sensor to a new address and waits until it answers there.
+ * @return 0 if successful, 1 on error
+ */
+bool vl53l0x_set_address(uint8_t address, uint8_t new_address, iic_index_t iic);
+
+/* A sensor behind its own XSHUT line and the address it should get */
+typedef struct {
+  uint8_t xshut_pin;
+  uint8_t address;
+  iic_index_t iic;
+} vl53l0x_slot_t;
+
+/* Called for every sensor that was moved to its address, err is set when that failed */
+typedef void (*vl53l0x_assigned_t)(size_t index, bool err, void *arg);
+
+/**
+ * @brief Gives every sensor its own address. Sensors that already answer on theirs keep it, the others are put in
+ * reset and then released one at a time, moved off the default address and checked on the new one. This is also
+ * how sensors that fell back to the default address after a brown-out get their address back.
+ * @param slots The sensors, their XSHUT pins must be GPIO outputs and no address may be the default one.
+ * @param count Number of sensors.
+ * @param assigned Called right after each moved sensor answers on its address (or failed to), may be NULL.
+ * @param arg Passed to assigned.
+ * @warning Other devices on the default address, like a TCS3472, must be held off the bus meanwhile.
+ * @return 0 if all sensors answer on their address, 1 otherwise
+ */
+bool vl53l0x_assign_addresses(const vl53l0x_slot_t *slots, size_t count, vl53l0x_assigned_t assigned, void *arg);
+
+/**
+ * @brief Initialises a sensor again after it was reset, e.g. by a brown-out, and it was given its address back.
+ * Keeps the calibration, and restores the timing budget and continuous mode. Also brings up a vl53l0x_create one.
+ * @return 0 if successful, 1 on error
+ */
+bool vl53l0x_reinit(vl53l0x_t *sensor);
 void vl53l0x_destroy(vl53l0x_t *sensor);
 void vl53l0x_calibration_dance(vl53l0x_t **distance_sensors, size_t sensor_count, const float calibration_matrix[]);
 
@@ -71,4 +179,71 @@ void vl53l0x_calibration_dance(vl53l0x_t **distance_sensors, size_t sensor_count
 uint16_t vl53l0x_get_single_optimal_range(vl53l0x_t *sensor);
 
 void vl53l0x_read_mean_range(vl53l0x_t *sensor, uint16_t *range);
+
+/**
+ * @brief Waits for samples on the sensor's GPIO1 (new sample ready) line instead of polling over I2C.
+ * @param sensor The sensor to configure.
+ * @param pin The pin GPIO1 of the sensor is connected to.
+ * @warning gpio_interrupt_init() has to be called first.
+ */
+void vl53l0x_use_interrupt(vl53l0x_t *sensor, uint8_t pin);
+
+/**
+ * @brief Sets how long a single measurement may take, see VL53L0X_TIMING_BUDGET_*.
+ * Pre-range and final range timeouts are computed from the enabled sequence steps like the ST API does.
+ * If the sensor is in continuous mode it is restarted with the new budget.
+ * @param sensor The sensor to configure.
+ * @param budget_us The budget in microseconds, at least VL53L0X_TIMING_BUDGET_MIN.
+ * @return 0 if successful, 1 on error or if the budget is too small for the enabled steps
+ */
+bool vl53l0x_set_timing_budget_us(vl53l0x_t *sensor, uint32_t budget_us);
+
+/**
+ * @brief Starts continuous ranging. The sensor keeps measuring on its own, so reading a sample
+ * only costs the result registers instead of a whole single-shot sequence.
+ * @param sensor The sensor to start.
+ * @param period_ms Time between measurements, 0 for back-to-back mode (as fast as the timing budget allows).
+ * @return 0 if successful, 1 on error
+ */
+bool vl53l0x_start_continuous(vl53l0x_t *sensor, uint32_t period_ms);
+
+/**
+ * @brief Stops continuous ranging, sensor goes back to single-shot mode.
+ * @return 0 if successful, 1 on error
+ */
+bool vl53l0x_stop_continuous(vl53l0x_t *sensor);
+
+/**
+ * @brief Waits for the next sample of a sensor in continuous mode and stores it in sensor->range.
+ * @return 0 if successful, 1 on error or after VL53L0X_TIMEOUT_MS without a sample
+ */
+bool vl53l0x_read_latest(vl53l0x_t *sensor);
+
+/**
+ * @brief Measures once, or takes the next sample in continuous mode, and stores it in sensor->range.
+ * @return 0 if successful, 1 on error or timeout
+ */
+bool vl53l0x_read_range(vl53l0x_t *sensor);
+
+/**
+ * @brief Puts every sensor of a group in continuous mode so they all range at the same time.
+ * @return 0 if successful, 1 on error
+ */
+bool vl53l0x_group_start(vl53l0x_t **sensors, size_t count);
+
+/**
+ * @brief Reads one sample of every sensor in a group. Sensors are read as soon as each one has a
+ * sample, so the group costs about as much as the slowest sensor instead of the sum of all of them.
+ * @param sensors The sensors, every one with its own address.
+ * @param count Number of sensors, at most VL53L0X_GROUP_MAX.
+ * @param reading Where to store the ranges and the timestamp. [out]
+ * @return 0 if successful, 1 on error or timeout
+ */
+bool vl53l0x_group_read(vl53l0x_t **sensors, size_t count, vl53l0x_group_reading_t *reading);
+
+/**
+ * @brief Same as vl53l0x_read_mean_range, but for a whole group at once.
+ * @return 0 if successful, 1 on error or timeout
+ */
+bool vl53l0x_group_read_mean(vl53l0x_t **sensors, size_t count, vl53l0x_group_reading_t *reading);
 #endif
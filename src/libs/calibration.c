@@ -0,0 +1,123 @@
+#include "calibration.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "measurements.h"
+
+static uint32_t checksum(const calibration_store_t *store) {
+  const uint8_t *bytes = (const uint8_t *)store;
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < offsetof(calibration_store_t, checksum); ++i) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+bool calibration_load(const char *path, calibration_store_t *store) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return 1;
+  }
+  size_t read = fread(store, sizeof(*store), 1, f);
+  fclose(f);
+  if (read != 1) {
+    ERROR("Calibration %s is truncated", path);
+    return 1;
+  }
+  if (store->magic != CALIBRATION_MAGIC || store->version != CALIBRATION_VERSION || store->size != sizeof(*store)) {
+    ERROR("Calibration %s has version %d, expected %d", path, store->version, CALIBRATION_VERSION);
+    return 1;
+  }
+  if (store->checksum != checksum(store) || store->distance_count > VL53L0X_GROUP_MAX ||
+      store->color_count > CALIBRATION_MAX_COLOR) {
+    ERROR("Calibration %s is corrupt", path);
+    return 1;
+  }
+  return 0;
+}
+
+bool calibration_save(const char *path, calibration_store_t *store) {
+  store->magic = CALIBRATION_MAGIC;
+  store->version = CALIBRATION_VERSION;
+  store->size = sizeof(*store);
+  store->saved_at_s = time(NULL);
+  store->checksum = checksum(store);
+
+  /* Write next to the old file and rename, a crash halfway never leaves a broken store behind */
+  char tmp_path[strlen(path) + 5];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  FILE *f = fopen(tmp_path, "wb");
+  if (f == NULL) {
+    ERROR("Could not open %s", tmp_path);
+    return 1;
+  }
+  bool err = fwrite(store, sizeof(*store), 1, f) != 1;
+  err |= fclose(f) != 0;
+  if (err || rename(tmp_path, path)) {
+    ERROR("Could not save calibration to %s", path);
+    remove(tmp_path);
+    return 1;
+  }
+  return 0;
+}
+
+bool calibration_is_stale(const calibration_store_t *store, uint64_t max_age_s) {
+  uint64_t now = time(NULL);
+  return store->saved_at_s > now || now - store->saved_at_s > max_age_s;
+}
+
+void calibration_capture(calibration_store_t *store, vl53l0x_t **distance_sensors, size_t distance_count,
+                         tcs3472_t **color_sensors, size_t color_count) {
+  /* After calibration_apply the color sensors point into the store itself */
+  color_calibration_t color[CALIBRATION_MAX_COLOR];
+  for (size_t i = 0; i < color_count; ++i) {
+    if (color_sensors[i]->iic < CALIBRATION_MAX_COLOR) {
+      color[color_sensors[i]->iic] = *color_sensors[i]->calibration;
+    }
+  }
+  memset(store, 0, sizeof(*store));
+  for (size_t i = 0; i < distance_count && i < VL53L0X_GROUP_MAX; ++i) {
+    vl53l0x_t *sensor = distance_sensors[i];
+    store->distance[i] = (distance_calibration_t){
+        .address = sensor->address, .offset_mm = sensor->offset_mm, .a = sensor->a, .b = sensor->b};
+    store->distance_count++;
+  }
+  for (size_t i = 0; i < color_count; ++i) {
+    uint16_t iic = color_sensors[i]->iic;
+    if (iic < CALIBRATION_MAX_COLOR) {
+      store->color[iic] = color[iic];
+      store->color_count = MAX(store->color_count, iic + 1u);
+    }
+  }
+}
+
+bool calibration_apply(calibration_store_t *store, vl53l0x_t **distance_sensors, size_t distance_count,
+                       tcs3472_t **color_sensors, size_t color_count) {
+  bool err = 0;
+  for (size_t i = 0; i < distance_count; ++i) {
+    vl53l0x_t *sensor = distance_sensors[i];
+    size_t j = 0;
+    while (j < store->distance_count && store->distance[j].address != sensor->address) {
+      j++;
+    }
+    if (j == store->distance_count) {
+      ERROR("No calibration for distance sensor 0x%02x", sensor->address);
+      err = 1;
+      continue;
+    }
+    sensor->offset_mm = store->distance[j].offset_mm;
+    sensor->a = store->distance[j].a;
+    sensor->b = store->distance[j].b;
+  }
+  for (size_t i = 0; i < color_count; ++i) {
+    if (color_sensors[i]->iic >= store->color_count) {
+      ERROR("No calibration for color sensor on IIC%d", color_sensors[i]->iic);
+      err = 1;
+      continue;
+    }
+    color_sensors[i]->calibration = &store->color[color_sensors[i]->iic];
+  }
+  return err;
+}
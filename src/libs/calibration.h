@@ -0,0 +1,65 @@
+#ifndef CALIBRATION_H_
+#define CALIBRATION_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "TCS3472.h"
+#include "VL53L0X.h"
+
+#define CALIBRATION_MAGIC 0x42494c43  // "CLIB"
+/* Bump whenever calibration_store_t changes, older files are then ignored */
+#define CALIBRATION_VERSION 2
+#define CALIBRATION_MAX_COLOR 2
+
+typedef struct {
+  uint8_t address;  // the sensor this entry belongs to
+  int16_t offset_mm;
+  float a;  // least squares fit of the calibration dance
+  float b;
+} distance_calibration_t;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;        // sizeof(calibration_store_t), catches layout changes without a version bump
+  uint64_t saved_at_s;  // wall clock seconds
+  uint32_t distance_count;
+  distance_calibration_t distance[VL53L0X_GROUP_MAX];
+  uint32_t color_count;
+  color_calibration_t color[CALIBRATION_MAX_COLOR];  // by IIC bus
+  uint32_t checksum;  // FNV-1a of everything before it
+} calibration_store_t;
+
+/**
+ * @brief Reads a calibration store written by calibration_save.
+ * @return 0 if successful, 1 if the file is missing, corrupt or of another version
+ */
+bool calibration_load(const char *path, calibration_store_t *store);
+
+/**
+ * @brief Stamps the store with the current time and replaces the file at path atomically.
+ * @return 0 if successful, 1 on error
+ */
+bool calibration_save(const char *path, calibration_store_t *store);
+
+/**
+ * @return true if the store was saved more than max_age_s seconds ago (or in the future)
+ */
+bool calibration_is_stale(const calibration_store_t *store, uint64_t max_age_s);
+
+/**
+ * @brief Copies the calibration of the given sensors into the store.
+ */
+void calibration_capture(calibration_store_t *store, vl53l0x_t **distance_sensors, size_t distance_count,
+                         tcs3472_t **color_sensors, size_t color_count);
+
+/**
+ * @brief Applies the store to the given sensors. Color sensors point into the store afterwards, so it has to
+ * outlive them.
+ * @return 0 if every sensor had an entry, 1 otherwise
+ */
+bool calibration_apply(calibration_store_t *store, vl53l0x_t **distance_sensors, size_t distance_count,
+                       tcs3472_t **color_sensors, size_t color_count);
+
+#endif
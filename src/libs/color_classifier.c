@@ -0,0 +1,90 @@
+#include "color_classifier.h"
+
+#include <libpynq.h>
+
+#include "../settings.h"
+
+/* floor(base + 60 * num / delta), num may be negative */
+static int32_t hue_sector(int32_t base, int32_t num, int32_t delta) {
+  if (num >= 0) {
+    return base + 60 * num / delta;
+  }
+  return base - (60 * -num + delta - 1) / delta;
+}
+
+static uint16_t hue(uint16_t r, uint16_t g, uint16_t b, uint16_t max) {
+  uint16_t min = r < g ? r : g;
+  min = min < b ? min : b;
+  int32_t delta = max - min;
+  if (delta == 0) {
+    return 0;
+  }
+  int32_t h;
+  if (r >= max) {
+    h = hue_sector(0, g - b, delta);
+  } else if (g >= max) {
+    h = hue_sector(120, b - r, delta);
+  } else {
+    h = hue_sector(240, r - g, delta);
+  }
+  return h < 0 ? h + 360 : h;
+}
+
+static uint16_t limit(uint32_t value) { return value > COLOR_FEATURE_MAX ? COLOR_FEATURE_MAX : value; }
+
+color_features_t color_features(const color_calibration_t *calibration, uint16_t c, uint16_t r, uint16_t g, uint16_t b) {
+  color_features_t features = {0};
+  features.max = r > g ? r : g;
+  features.max = features.max > b ? features.max : b;
+  features.hue = hue(r, g, b, features.max);
+  features.brightness = limit(c >> calibration->brightness_shift);
+  if (c > 0) {
+    /* One division for all three channels, the ARM core has no hardware divider */
+    uint32_t inverse = (1u << (16 + COLOR_CHROMA_SHIFT)) / c;
+    features.r = limit(((uint64_t)r * inverse) >> 16);
+    features.g = limit(((uint64_t)g * inverse) >> 16);
+    features.b = limit(((uint64_t)b * inverse) >> 16);
+  }
+  return features;
+}
+
+static uint32_t squared(int32_t x) { return x * x; }
+
+static color_t nearest_centroid(const color_calibration_t *calibration, const color_features_t *features) {
+  color_t color = COLOR_COUNT;
+  uint32_t best = UINT32_MAX;
+  for (size_t i = 0; i < calibration->centroid_count; ++i) {
+    const color_centroid_t *centroid = &calibration->centroids[i];
+    uint32_t distance = squared(features->r - centroid->r) + squared(features->g - centroid->g) +
+                        squared(features->b - centroid->b) + squared(features->brightness - centroid->brightness);
+    if (distance < best) {
+      best = distance;
+      color = centroid->color;
+    }
+  }
+  return color;
+}
+
+color_t color_classify(const color_calibration_t *calibration, uint16_t c, uint16_t r, uint16_t g, uint16_t b) {
+  color_features_t features = color_features(calibration, c, r, g, b);
+  if (calibration->mode == COLOR_MODE_CENTROID) {
+    return nearest_centroid(calibration, &features);
+  }
+  if (features.max < calibration->black_below) {
+    return BLACK;
+  }
+  if (calibration->white_above != 0 && features.max > calibration->white_above) {
+    return WHITE;
+  }
+  for (size_t i = 0; i < calibration->band_count; ++i) {
+    const color_band_t *band = &calibration->bands[i];
+    if (features.hue >= band->hue_min && features.hue < band->hue_max) {
+      return band->color;
+    }
+  }
+  return calibration->fallback;
+}
+
+const color_calibration_t *color_default_calibration(int iic) {
+  return iic == IIC0 ? &COLOR_CALIBRATION[FORWARD_LOOKING] : &COLOR_CALIBRATION[DOWN_LOOKING];
+}
@@ -0,0 +1,70 @@
+#ifndef COLOR_CLASSIFIER_H_
+#define COLOR_CLASSIFIER_H_
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum { RED, GREEN, BLUE, WHITE, BLACK, COLOR_COUNT } color_t;
+
+/* Chroma is stored as a fraction of the clear channel with this many fractional bits */
+#define COLOR_CHROMA_SHIFT 10
+/* Chroma and brightness are clamped to this, so squared distances of 4 features fit in 32 bits */
+#define COLOR_FEATURE_MAX 4095
+#define COLOR_MAX_BANDS 6
+#define COLOR_MAX_CENTROIDS 12
+
+typedef enum { COLOR_MODE_THRESHOLDS, COLOR_MODE_CENTROID } color_mode_t;
+
+/* Hue band in whole degrees, min inclusive and max exclusive */
+typedef struct {
+  uint16_t hue_min;
+  uint16_t hue_max;
+  color_t color;
+} color_band_t;
+
+/* Calibrated reference color, as produced by color_features */
+typedef struct {
+  color_t color;
+  uint16_t r, g, b;
+  uint16_t brightness;
+} color_centroid_t;
+
+/*
+ * Per sensor calibration. In threshold mode the brightest of r, g and b decides black and white, then the hue
+ * bands are tried in order. In centroid mode the closest centroid wins.
+ */
+typedef struct {
+  color_mode_t mode;
+  uint16_t black_below;  // brightest channel count under which the surface is black
+  uint16_t white_above;  // brightest channel count above which the surface is white, 0 disables
+  size_t band_count;
+  color_band_t bands[COLOR_MAX_BANDS];
+  color_t fallback;          // when no band matches
+  uint8_t brightness_shift;  // centroid brightness is the clear count shifted right by this
+  size_t centroid_count;
+  color_centroid_t centroids[COLOR_MAX_CENTROIDS];
+} color_calibration_t;
+
+typedef struct {
+  uint16_t r, g, b;       // fraction of clear, COLOR_CHROMA_SHIFT fractional bits
+  uint16_t brightness;    // clear >> brightness_shift
+  uint16_t max;           // brightest of the raw r, g and b counts
+  uint16_t hue;           // whole degrees, 0..359
+} color_features_t;
+
+/*
+ * @brief Computes the classifier features of a raw CRGB reading using integer math only.
+ */
+color_features_t color_features(const color_calibration_t *calibration, uint16_t c, uint16_t r, uint16_t g, uint16_t b);
+
+/*
+ * @brief Classifies a raw CRGB reading with the given calibration.
+ * @return The color, COLOR_COUNT if centroid mode has no centroids
+ */
+color_t color_classify(const color_calibration_t *calibration, uint16_t c, uint16_t r, uint16_t g, uint16_t b);
+
+/*
+ * @brief Calibration from settings.h for the color sensor on the given bus.
+ */
+const color_calibration_t *color_default_calibration(int iic);
+
+#endif
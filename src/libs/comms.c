@@ -3,12 +3,41 @@
 #include <cJSON.h>
 #include <libpynq.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "json_writer.h"
+#include "measurements.h"
+#include "publisher.h"
+#include "telemetry.h"
 #include "uart.h"
+#include "uart_rx.h"
+#include "uart_tx.h"
 
 // json variable
 char* json;
 
+/* JSON until the bridge acknowledges the start with our TELEMETRY_VERSION in "proto", telemetry frames after that */
+static bool binary = false;
+static uint8_t sequence = 0;
+/* Frames leave out unchanged fields once the bridge acknowledged TELEMETRY_PROTO_DELTA */
+static bool deltas = false;
+
+/* Decides what of every send_msg goes out */
+static publisher_t publisher;
+static bool publishing = false;
+
+/* What the bridge sent last, until it is picked up. Filled by the handlers of rx. */
+static uart_rx_t rx;
+static bool receiving = false;
+static char inbox_json[UART_RX_MAX_JSON + 1];
+static bool inbox_has_json = false;
+static telemetry_status_t inbox_status;
+static bool inbox_has_status = false;
+
+// JSON goes out behind its length as 4 little endian bytes
+#define JSON_PREFIX 4
+_Static_assert(JSON_PREFIX + JSON_BUFFER_SIZE <= UART_TX_MAX_MESSAGE, "a JSON message has to fit the UART TX queue");
+
 // number of items in JSON objects
 #define JSON_SIZE 7
 
@@ -31,25 +60,25 @@ const char* JSON_LABELS[JSON_SIZE] = {
 /**
  * Inline function that adds robot information to a json object
  *
- * @param rob the robot
- * @param root the json object
+ * @param writer the json writer
+ * @param robot the robot
  */
-#define encode_robot(root, robot)                        \
-  cJSON_AddNumberToObject((root), "robot_x", (robot).x); \
-  cJSON_AddNumberToObject((root), "robot_y", (robot).y); \
-  cJSON_AddNumberToObject((root), "robot_status", (robot).status);
+#define encode_robot(writer, robot)                      \
+  json_add_number((writer), "robot_x", (robot).x); \
+  json_add_number((writer), "robot_y", (robot).y); \
+  json_add_int((writer), "robot_status", (robot).status);
 
 /**
  * Inline function that adds obstacle information to a json object
  *
- * @param obs the obstacle
- * @param root the json object
+ * @param writer the json writer
+ * @param obstacle the obstacle
  */
-#define encode_obstacle(root, obstacle)                              \
-  cJSON_AddNumberToObject((root), "obstacle_x", (obstacle).x);       \
-  cJSON_AddNumberToObject((root), "obstacle_y", (obstacle).y);       \
-  cJSON_AddNumberToObject((root), "obstacle_type", (obstacle).type); \
-  cJSON_AddNumberToObject((root), "obstacle_color", (obstacle).color);
+#define encode_obstacle(writer, obstacle)                      \
+  json_add_number((writer), "obstacle_x", (obstacle).x);       \
+  json_add_number((writer), "obstacle_y", (obstacle).y);       \
+  json_add_int((writer), "obstacle_type", (obstacle).type); \
+  json_add_int((writer), "obstacle_color", (obstacle).color);
 
 /**
  * Inline function for extracting one number item from a json object
@@ -65,47 +94,22 @@ const char* JSON_LABELS[JSON_SIZE] = {
   (temp) = cJSON_GetObjectItem((root), (label));    \
   if (!cJSON_IsNumber((temp))) {                    \
     fprintf(stderr, "JSON item is not a number\n"); \
+    cJSON_Delete((root));                           \
     return 1;                                       \
   } else if (temp == NULL) {                        \
     fprintf(stderr, "JSON variable NULL\n");        \
+    cJSON_Delete((root));                           \
     return 1;                                       \
   } else {                                          \
     (item) = (temp)->valuedouble;                   \
   }
 
 // private function definitions
-/**
- * Encodes information regarding robot status and detected obstacles in a JSON format.
- *
- * @param obs the detected obstacle
- * @param rob the robot that detected
- * @return pointer to a JSON string which encodes the given information.
- */
-char* encode_json(obstacle_t obstacle, robot_t robot) {
-  // initialize json object
-  cJSON* root = cJSON_CreateObject();
-
-  // add all information to the object
-  encode_robot(root, robot);
-  encode_obstacle(root, obstacle);
-
-  // create the json string
-  char* json_string = cJSON_PrintUnformatted(root);
-
-  // release the memory for the json object
-  cJSON_Delete(root);
-  return json_string;
-}
-
-char* encode_string(char* string) {
-  cJSON* root = cJSON_CreateObject();
-  cJSON_AddStringToObject(root, "name", string);
-
-  char* json_string = cJSON_PrintUnformatted(root);
-
-  // release the memory for the json object
-  cJSON_Delete(root);
-  return json_string;
+static size_t encode_string(char* buffer, size_t size, const char* string) {
+  json_writer_t writer;
+  json_begin(&writer, buffer, size);
+  json_add_string(&writer, "name", string);
+  return json_end(&writer);
 }
 
 /**
@@ -143,80 +147,223 @@ int decode_json(obstacle_t* obstacle, robot_t* rob, char* json_string) {
 
 // Function to send message(Idea: color is one of six colors(?) so its 1-6 interger)(object- 0- nothing, 1- cliff, 2-hill, 3-
 // small block, 4 big block)
-void send_json(char message[]) {
-  uint32_t length = strlen(message);
-  uint8_t* len_bytes = (uint8_t*)&length;
-
-  for (int i = 0; i < 4; i++) {
-    uart_send(UART0, len_bytes[i]);
+void send_json(uint8_t* message, uint32_t length, uart_tx_policy_t policy) {
+  for (int i = 0; i < JSON_PREFIX; i++) {
+    message[i] = length >> (8 * i);
   }
+  uart_tx_send(UART0, message, JSON_PREFIX + length, policy);
+}
 
-  for (uint32_t i = 0; i < length; i++) {
-    uart_send(UART0, message[i]);
+static void on_json(const char* json, size_t length, void* arg) {
+  (void)arg;
+  memcpy(inbox_json, json, length + 1);
+  inbox_has_json = true;
+}
+
+static void on_status(const telemetry_frame_t* frame, void* arg) {
+  (void)arg;
+  inbox_has_status = !telemetry_decode_status(frame, &inbox_status);
+}
+
+static void start_receiving(void) {
+  if (receiving) {
+    return;
   }
+  uart_rx_init(&rx, binary ? UART_RX_FRAMES : UART_RX_JSON);
+  uart_rx_on_json(&rx, on_json, NULL);
+  uart_rx_on_frame(&rx, TELEMETRY_STATUS, on_status, NULL);
+  receiving = true;
 }
 
-// function to receive message
-char* receive_json() {
-  uint8_t read_len[4];
-  for (int i = 0; i < 4; i++) {
-    read_len[i] = uart_recv(UART0);
+/* Takes the JSON message that arrived, if any. Callers poll it in a loop, so it sleeps a moment when there is none. */
+static bool take_json(void) {
+  start_receiving();
+  if (!inbox_has_json) {
+    uart_rx_poll(&rx, UART0);
   }
-  uint32_t length = *((uint32_t*)read_len);
+  bool taken = inbox_has_json;
+  inbox_has_json = false;
+  if (!taken) {
+    sleep_msec(1);
+  }
+  return taken;
+}
+
+static uint8_t to_byte(int value) { return value == NONE ? TELEMETRY_NONE_BYTE : value; }
 
-  char* json_string = (char*)malloc(length + 1);
-  for (uint32_t i = 0; i < length; i++) {
-    json_string[i] = uart_recv(UART0);
+static int from_byte(uint8_t value) { return value == TELEMETRY_NONE_BYTE ? NONE : value; }
+
+static double from_position(int16_t value) {
+  return value == TELEMETRY_NONE_POSITION ? NONE : (double)value / TELEMETRY_POSITION_SCALE;
+}
+
+static void start_publishing(bool use_deltas) {
+  publisher_config_t config = PUBLISHER_DEFAULTS;
+  config.deltas = use_deltas;
+  publisher_init(&publisher, &config, get_time_usec());
+  deltas = use_deltas;
+  publishing = true;
+}
+
+/* Fixed size frame on the stack, nothing allocated. With deltas only the changed fields, a keyframe is a full status. */
+static size_t send_frame(const publish_update_t* update, uart_tx_policy_t policy) {
+  telemetry_status_t status = {.robot_x = telemetry_position(update->robot.x, NONE),
+                               .robot_y = telemetry_position(update->robot.y, NONE),
+                               .robot_status = to_byte(update->robot.status),
+                               .obstacle_x = telemetry_position(update->obstacle.x, NONE),
+                               .obstacle_y = telemetry_position(update->obstacle.y, NONE),
+                               .obstacle_type = to_byte(update->obstacle.type),
+                               .obstacle_color = to_byte(update->obstacle.color)};
+  uint8_t frame[TELEMETRY_MAX_FRAME];
+  size_t length = update->fields == TELEMETRY_FIELDS_ALL ? telemetry_encode_status(frame, sequence++, &status)
+                                                         : telemetry_encode_delta(frame, sequence++, update->fields, &status);
+  uart_tx_send(UART0, frame, length, policy);
+  return length;
+}
+
+/*
+ * Position updates may be replaced by newer ones while they wait for the UART, as long as every update is whole.
+ * Deltas build on the one before, so then nothing is replaced and the position budget of the publisher keeps up.
+ */
+static void transmit(const publish_update_t* update) {
+  uart_tx_policy_t policy = update->class == PUBLISH_POSITION && !deltas ? UART_TX_REPLACE : UART_TX_KEEP;
+  size_t bytes = 0;
+  if (binary) {
+    bytes = send_frame(update, policy);
+  } else {
+    uint8_t message[JSON_PREFIX + JSON_BUFFER_SIZE];
+    size_t length = encode_json((char*)message + JSON_PREFIX, JSON_BUFFER_SIZE, update->obstacle, update->robot);
+    if (length == 0) {
+      ERROR("Status does not fit in %d bytes of JSON", JSON_BUFFER_SIZE);
+      return;
+    }
+    send_json(message, length, policy);
+    bytes = JSON_PREFIX + length;
   }
+  publisher_charge(&publisher, update, bytes);
+}
 
-  json_string[length] = '\0';
-  return json_string;
+#ifdef TELEMETRY_RECORD
+/* One line per send_msg, publisher_bench replays them */
+static void record(obstacle_t obstacle, robot_t robot) {
+  static FILE* file = NULL;
+  if (file == NULL) {
+    file = fopen(TELEMETRY_RECORD_PATH, "w");
+    if (file == NULL) {
+      return;
+    }
+    fprintf(file, "time_ms,robot_x,robot_y,robot_status,obstacle_x,obstacle_y,obstacle_type,obstacle_color\n");
+  }
+  fprintf(file, "%llu,%.2f,%.2f,%d,%.2f,%.2f,%d,%d\n", (unsigned long long)(get_time_usec() / 1000), robot.x, robot.y,
+          robot.status, obstacle.x, obstacle.y, obstacle.type, obstacle.color);
+  fflush(file);
+}
+#endif
+
+/* Blocks until a status frame arrived, other frames are skipped */
+static void receive_frame(obstacle_t* obstacle, robot_t* robot) {
+  start_receiving();
+  while (!inbox_has_status) {
+    if (!uart_rx_poll(&rx, UART0)) {
+      sleep_msec(1);
+    }
+  }
+  inbox_has_status = false;
+  telemetry_status_t status = inbox_status;
+  set_robot_data(robot, from_position(status.robot_x), from_position(status.robot_y), from_byte(status.robot_status), ->);
+  set_obstacle_data(obstacle, from_position(status.obstacle_x), from_position(status.obstacle_y),
+                    from_byte(status.obstacle_type), from_byte(status.obstacle_color), ->);
 }
 
 // public function definitions
-void send_msg(obstacle_t obstacle, robot_t robot) {
-  char* json = encode_json(obstacle, robot);
-  send_json(json);
+size_t encode_json(char* buffer, size_t size, obstacle_t obstacle, robot_t robot) {
+  json_writer_t writer;
+  json_begin(&writer, buffer, size);
+  encode_robot(&writer, robot);
+  encode_obstacle(&writer, obstacle);
+  return json_end(&writer);
+}
 
-  free(json);
+/* Obstacle points that waited for their budget go out here as well, every loop of the rover sends at least once */
+void send_msg(obstacle_t obstacle, robot_t robot) {
+#ifdef TELEMETRY_RECORD
+  record(obstacle, robot);
+#endif
+  if (!publishing) {
+    start_publishing(false);
+  }
+  uint64_t now = get_time_usec();
+  publish_update_t update;
+  if (publisher_offer(&publisher, obstacle, robot, now, &update)) {
+    transmit(&update);
+  }
+  while (publisher_pending(&publisher, now, &update)) {
+    transmit(&update);
+  }
 }
 
-void recv_msg(obstacle_t* obstacle, robot_t* robot) {
-  char* json = receive_json();
-  decode_json(obstacle, robot, json);
+publisher_stats_t send_stats(void) { return publisher.stats; }
 
-  free(json);
+void recv_msg(obstacle_t* obstacle, robot_t* robot) {
+  if (binary) {
+    receive_frame(obstacle, robot);
+    return;
+  }
+  while (!take_json()) {
+  }
+  decode_json(obstacle, robot, inbox_json);
 }
 
 void send_ready_message(char* name) {
-  char* json = encode_string(name);
-  send_json(json);
-
-  free(json);
+  uint8_t message[JSON_PREFIX + JSON_BUFFER_SIZE];
+  size_t length = encode_string((char*)message + JSON_PREFIX, JSON_BUFFER_SIZE, name);
+  if (length == 0) {
+    ERROR("Name does not fit in %d bytes of JSON", JSON_BUFFER_SIZE);
+    return;
+  }
+  send_json(message, length, UART_TX_KEEP);
 }
 
+/*
+ * Always JSON, and offers the telemetry frames with deltas to the bridge. A bridge that does not know them ignores
+ * "proto", one that knows the frames but not the deltas acknowledges TELEMETRY_VERSION.
+ */
 void send_ready_status() {
   robot_t robot = {NONE, NONE, READY};
   obstacle_t obstacle = {NONE, NONE, NONE, NONE};
-  send_msg(obstacle, robot);
+  binary = false;
+  deltas = false;
+  if (receiving) {
+    uart_rx_set_format(&rx, UART_RX_JSON);
+  }
+  uint8_t message[JSON_PREFIX + JSON_BUFFER_SIZE];
+  json_writer_t writer;
+  json_begin(&writer, (char*)message + JSON_PREFIX, JSON_BUFFER_SIZE);
+  encode_robot(&writer, robot);
+  encode_obstacle(&writer, obstacle);
+  json_add_int(&writer, "proto", TELEMETRY_PROTO_DELTA);
+  send_json(message, json_end(&writer), UART_TX_KEEP);
 }
 
 bool recv_start_status(void) {
   robot_t robot = {0};
   obstacle_t obstacle = {0};
-  if (uart_has_data(UART0)) {
-    recv_msg(&obstacle, &robot);
+  if (!take_json()) {
+    return false;
+  }
+  decode_json(&obstacle, &robot, inbox_json);
+  if (robot.status == ACKNOWLEDGED) {
+    cJSON* root = cJSON_Parse(inbox_json);
+    cJSON* proto = cJSON_GetObjectItem(root, "proto");
+    int version = cJSON_IsNumber(proto) ? proto->valueint : 0;
+    cJSON_Delete(root);
+    binary = version == TELEMETRY_VERSION || version == TELEMETRY_PROTO_DELTA;
+    sequence = 0;
+    uart_rx_set_format(&rx, binary ? UART_RX_FRAMES : UART_RX_JSON);
+    start_publishing(version == TELEMETRY_PROTO_DELTA);
+    LOG("Telemetry as %s", binary ? deltas ? "binary frames with deltas" : "binary frames" : "JSON");
   }
   return robot.status == ACKNOWLEDGED;
-
 }
 
-bool recv_start_message(void) {
-  if (uart_has_data(UART0)) {
-    char* string = receive_json();
-    bool returnable = string[0] != 0;
-    free(string);
-    return returnable;
-  } 
-  return false;
-}
+bool recv_start_message(void) { return take_json() && inbox_json[0] != 0; }
@@ -1,7 +1,17 @@
 #ifndef COMMS_H
 #define COMMS_H
+#include "publisher.h"
 #include "vtypes.h"
 
+#define JSON_BUFFER_SIZE 256  // fits a status message, and a ready message with a name of up to 200 characters
+
+/**
+ * Encodes robot status and detected obstacle as JSON into buffer, without allocating.
+ *
+ * @return the length of the JSON, 0 if it does not fit
+ */
+size_t encode_json(char* buffer, size_t size, obstacle_t obstacle, robot_t robot);
+
 /**
  * Sends information regarding robot status and detected obstacles
  * from a robot to the server.
@@ -12,6 +22,11 @@
 
 void send_msg(obstacle_t obstacle, robot_t robot);
 
+/**
+ * @return What send_msg sent and what it left out so far
+ */
+publisher_stats_t send_stats(void);
+
 /**
  * Retrieves information regarding robot status and detected obstacles
  * from the server and stores it in the robot.
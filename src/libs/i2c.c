@@ -1,14 +1,148 @@
 #include <libpynq.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 #include "i2c.h"
+#include "i2c_trace.h"
+#include "measurements.h"
 
+/* The IIC controllers are driven by polling their registers, so only one transaction per bus at a time */
+static pthread_mutex_t bus_locks[NUM_IICS] = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER};
+static uint32_t transactions[NUM_IICS];
+static uint64_t busy_us[NUM_IICS];
+
+typedef struct {
+  bool used;
+  uint8_t address;
+  uint8_t register_mask;
+  uint8_t banks[I2C_SHADOW_MAX_BANKS];
+  size_t bank_count;
+  uint8_t is_volatile[32];  // bitmaps by register
+  uint8_t valid[32];
+  uint8_t values[256];
+  i2c_shadow_stats_t stats;
+} shadow_t;
+
+/* Guarded by the bus lock, like the transfers that keep them up to date */
+static shadow_t shadows[NUM_IICS][I2C_SHADOW_DEVICES];
+
+static bool test_bit(const uint8_t *bitmap, uint8_t reg) { return bitmap[reg >> 3] & (1 << (reg & 7)); }
+
+static void assign_bit(uint8_t *bitmap, uint8_t reg, bool value) {
+  if (value) {
+    bitmap[reg >> 3] |= 1 << (reg & 7);
+  } else {
+    bitmap[reg >> 3] &= ~(1 << (reg & 7));
+  }
+}
+
+static shadow_t *find_shadow(iic_index_t iic, uint8_t address) {
+  for (size_t i = 0; i < I2C_SHADOW_DEVICES; ++i) {
+    if (shadows[iic][i].used && shadows[iic][i].address == address) {
+      return &shadows[iic][i];
+    }
+  }
+  return NULL;
+}
+
+/* Whether reg can be served from and kept in the shadow right now */
+static bool cacheable(const shadow_t *shadow, uint8_t reg) {
+  if (test_bit(shadow->is_volatile, reg)) {
+    return false;
+  }
+  bool banks_at_zero = true;
+  for (size_t i = 0; i < shadow->bank_count; ++i) {
+    if (reg == shadow->banks[i]) {
+      return true;
+    }
+    uint8_t bank = shadow->banks[i];
+    banks_at_zero &= test_bit(shadow->valid, bank) && shadow->values[bank] == 0;
+  }
+  return banks_at_zero;
+}
+
+/* All length registers from reg are cached and hold data */
+static bool shadow_holds(const shadow_t *shadow, uint8_t reg, const uint8_t *data, uint16_t length) {
+  for (uint16_t i = 0; i < length; ++i) {
+    uint8_t r = reg + i;
+    if (!cacheable(shadow, r) || !test_bit(shadow->valid, r) || (data != NULL && shadow->values[r] != data[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* In order, so a bank select early in a burst decides about the registers after it */
+static void shadow_store(shadow_t *shadow, uint8_t reg, const uint8_t *data, uint16_t length, bool err) {
+  for (uint16_t i = 0; i < length; ++i) {
+    uint8_t r = reg + i;
+    bool keep = !err && cacheable(shadow, r);
+    if (keep) {
+      shadow->values[r] = data[i];
+    }
+    assign_bit(shadow->valid, r, keep);
+  }
+}
+
+static bool locked_read(iic_index_t iic, uint8_t address, uint8_t reg, uint8_t *data, uint16_t length) {
+  pthread_mutex_lock(&bus_locks[iic]);
+  shadow_t *shadow = length > 0 ? find_shadow(iic, address) : NULL;
+  uint8_t key = shadow != NULL ? reg & shadow->register_mask : 0;
+  if (shadow != NULL && shadow_holds(shadow, key, NULL, length)) {
+    for (uint16_t i = 0; i < length; ++i) {
+      data[i] = shadow->values[(uint8_t)(key + i)];  // wraps past 0xFF like shadow_holds
+    }
+    shadow->stats.read_hits++;
+    pthread_mutex_unlock(&bus_locks[iic]);
+    return 0;
+  }
+  uint64_t start = get_time_usec();
+  bool err = iic_read_register(iic, address, reg, data, length);
+  uint64_t duration = get_time_usec() - start;
+  busy_us[iic] += duration;
+  transactions[iic]++;
+  if (i2c_trace_enabled()) {
+    i2c_trace_record(iic, address, reg, length, false, start, duration, err);
+  }
+  if (shadow != NULL) {
+    shadow_store(shadow, key, data, length, err);
+    shadow->stats.read_misses++;
+  }
+  pthread_mutex_unlock(&bus_locks[iic]);
+  return err;
+}
+
+static bool locked_write(iic_index_t iic, uint8_t address, uint8_t reg, uint8_t *data, uint16_t length) {
+  pthread_mutex_lock(&bus_locks[iic]);
+  shadow_t *shadow = length > 0 ? find_shadow(iic, address) : NULL;
+  uint8_t key = shadow != NULL ? reg & shadow->register_mask : 0;
+  if (shadow != NULL && shadow_holds(shadow, key, data, length)) {
+    shadow->stats.writes_elided++;
+    pthread_mutex_unlock(&bus_locks[iic]);
+    return 0;
+  }
+  uint64_t start = get_time_usec();
+  bool err = iic_write_register(iic, address, reg, data, length);
+  uint64_t duration = get_time_usec() - start;
+  busy_us[iic] += duration;
+  transactions[iic]++;
+  if (i2c_trace_enabled()) {
+    i2c_trace_record(iic, address, reg, length, true, start, duration, err);
+  }
+  if (shadow != NULL) {
+    shadow_store(shadow, key, data, length, err);
+    shadow->stats.writes++;
+  }
+  pthread_mutex_unlock(&bus_locks[iic]);
+  return err;
+}
 
 bool i2c_read8(uint8_t adress, uint16_t reg, uint8_t *a, iic_index_t iic) {
   if (iic > 1 || iic < 0) {
     fprintf(stderr, "[ERROR] Wrong IIC number: %d\n", iic);
     return 1;
   }
-  bool err = iic_read_register(iic, adress, reg, a, 1);
+  bool err = locked_read(iic, adress, reg, a, 1);
   return err;
 }
 
@@ -17,8 +151,7 @@ bool i2c_read16(uint8_t adress, uint16_t reg, uint16_t *a, iic_index_t iic) {
     fprintf(stderr, "[ERROR] Wrong IIC number: %d\n", iic);
     return 1;
   }
-  bool err = iic_read_register(iic, adress, reg, (uint8_t *)a, 2);
-  return err;
+  return i2c_read_burst(adress, reg, a, 2, I2C_WORDS_LE, iic);
 }
 
 bool i2c_write8(uint8_t adress, uint16_t reg, uint8_t a, iic_index_t iic) {
@@ -26,7 +159,7 @@ bool i2c_write8(uint8_t adress, uint16_t reg, uint8_t a, iic_index_t iic) {
     fprintf(stderr, "[ERROR] Wrong IIC number: %d\n", iic);
     return 1;
   }
-  bool err = iic_write_register(iic, adress, reg, &a, 1);
+  bool err = locked_write(iic, adress, reg, &a, 1);
   return err;
 }
 
@@ -35,17 +168,135 @@ bool i2c_write16(uint8_t adress, uint16_t reg, uint16_t a, iic_index_t iic) {
     fprintf(stderr, "[ERROR] Wrong IIC number: %d\n", iic);
     return 1;
   }
-  bool err = iic_write_register(iic, adress, reg, (uint8_t *)&a, 2);
-  return err;
+  return i2c_write_burst(adress, reg, &a, 2, I2C_WORDS_LE, iic);
 }
 
 bool i2c_read16_inv(uint8_t address, uint16_t reg, uint16_t *a, iic_index_t iic) {
-  bool err;
-  uint8_t c, d;
-  err = i2c_read8(address, reg+1, &c, iic);
-  err = i2c_read8(address, reg, &d, iic);
+  return i2c_read_burst(address, reg, a, 2, I2C_WORDS_BE, iic);
+}
+
+bool i2c_write16_inv(uint8_t address, uint16_t reg, uint16_t a, iic_index_t iic) {
+  return i2c_write_burst(address, reg, &a, 2, I2C_WORDS_BE, iic);
+}
+
+/* Host uint16_t words to the byte order on the bus */
+static void words_to_bus(uint8_t *bytes, uint16_t length, uint16_t flags) {
+  for (uint16_t i = 0; i + 1 < length; i += 2) {
+    uint16_t word;
+    memcpy(&word, &bytes[i], 2);
+    if (flags & I2C_WORDS_BE) {
+      bytes[i] = word >> 8;
+      bytes[i + 1] = word & 0xFF;
+    } else {
+      bytes[i] = word & 0xFF;
+      bytes[i + 1] = word >> 8;
+    }
+  }
+}
 
-  *a = (d << 8) | c;
+/* Byte order on the bus to host uint16_t words, in place */
+static void bus_to_words(uint8_t *bytes, uint16_t length, uint16_t flags) {
+  for (uint16_t i = 0; i + 1 < length; i += 2) {
+    uint16_t word = (flags & I2C_WORDS_BE) ? (bytes[i] << 8) | bytes[i + 1] : bytes[i] | (bytes[i + 1] << 8);
+    memcpy(&bytes[i], &word, 2);
+  }
+}
+
+bool i2c_write_burst(uint8_t address, uint16_t reg, const void *data, uint16_t length, uint16_t flags, iic_index_t iic) {
+  if (iic > 1 || iic < 0) {
+    fprintf(stderr, "[ERROR] Wrong IIC number: %d\n", iic);
+    return 1;
+  }
+  if (!(flags & (I2C_WORDS_BE | I2C_WORDS_LE))) {
+    // Goes out straight from the caller's buffer, the backends only read it
+    return locked_write(iic, address, reg | (flags & 0xFF), (uint8_t *)data, length);
+  }
+  uint8_t bytes[length > 0 ? length : 1];
+  memcpy(bytes, data, length);
+  words_to_bus(bytes, length, flags);
+  bool err = locked_write(iic, address, reg | (flags & 0xFF), bytes, length);
   return err;
+}
+
+bool i2c_read_burst(uint8_t address, uint16_t reg, void *data, uint16_t length, uint16_t flags, iic_index_t iic) {
+  if (iic > 1 || iic < 0) {
+    fprintf(stderr, "[ERROR] Wrong IIC number: %d\n", iic);
+    return 1;
+  }
+  bool err = locked_read(iic, address, reg | (flags & 0xFF), data, length);
+  if (!err && (flags & (I2C_WORDS_BE | I2C_WORDS_LE))) {
+    bus_to_words(data, length, flags);
+  }
+  return err;
+}
+
+uint32_t i2c_transaction_count(iic_index_t iic) {
+  pthread_mutex_lock(&bus_locks[iic]);
+  uint32_t count = transactions[iic];
+  pthread_mutex_unlock(&bus_locks[iic]);
+  return count;
+}
+
+uint64_t i2c_busy_usec(iic_index_t iic) {
+  pthread_mutex_lock(&bus_locks[iic]);
+  uint64_t busy = busy_us[iic];
+  pthread_mutex_unlock(&bus_locks[iic]);
+  return busy;
+}
+
+bool i2c_shadow_enable(uint8_t address, const i2c_shadow_config_t *config, iic_index_t iic) {
+  if (iic > 1 || iic < 0) {
+    fprintf(stderr, "[ERROR] Wrong IIC number: %d\n", iic);
+    return 1;
+  }
+  if (config->bank_count > I2C_SHADOW_MAX_BANKS) {
+    fprintf(stderr, "[ERROR] A shadow takes at most %d bank registers\n", I2C_SHADOW_MAX_BANKS);
+    return 1;
+  }
+  pthread_mutex_lock(&bus_locks[iic]);
+  shadow_t *shadow = find_shadow(iic, address);
+  for (size_t i = 0; shadow == NULL && i < I2C_SHADOW_DEVICES; ++i) {
+    if (!shadows[iic][i].used) {
+      shadow = &shadows[iic][i];
+    }
+  }
+  if (shadow != NULL) {
+    memset(shadow, 0, sizeof(*shadow));
+    shadow->used = true;
+    shadow->address = address;
+    shadow->register_mask = config->register_mask;
+    memcpy(shadow->banks, config->banks, config->bank_count);
+    shadow->bank_count = config->bank_count;
+    for (size_t i = 0; i < config->volatile_count; ++i) {
+      assign_bit(shadow->is_volatile, config->volatile_registers[i], true);
+    }
+  }
+  pthread_mutex_unlock(&bus_locks[iic]);
+  return shadow == NULL;
+}
+
+void i2c_shadow_disable(uint8_t address, iic_index_t iic) {
+  pthread_mutex_lock(&bus_locks[iic]);
+  shadow_t *shadow = find_shadow(iic, address);
+  if (shadow != NULL) {
+    shadow->used = false;
+  }
+  pthread_mutex_unlock(&bus_locks[iic]);
+}
+
+void i2c_shadow_invalidate(uint8_t address, iic_index_t iic) {
+  pthread_mutex_lock(&bus_locks[iic]);
+  shadow_t *shadow = find_shadow(iic, address);
+  if (shadow != NULL) {
+    memset(shadow->valid, 0, sizeof(shadow->valid));
+  }
+  pthread_mutex_unlock(&bus_locks[iic]);
+}
 
+i2c_shadow_stats_t i2c_shadow_stats(uint8_t address, iic_index_t iic) {
+  pthread_mutex_lock(&bus_locks[iic]);
+  shadow_t *shadow = find_shadow(iic, address);
+  i2c_shadow_stats_t stats = shadow != NULL ? shadow->stats : (i2c_shadow_stats_t){0};
+  pthread_mutex_unlock(&bus_locks[iic]);
+  return stats;
 }
@@ -1,6 +1,7 @@
 #ifndef I2C_H_
 #define I2C_H_
 #include <libpynq.h>
+#include <stddef.h>
 
 
 /**
@@ -43,6 +44,105 @@ bool i2c_write8(uint8_t adress, uint16_t reg, uint8_t a, iic_index_t iic);
  */
 bool i2c_write16(uint8_t adress, uint16_t reg, uint16_t a, iic_index_t iic);
 
+/**
+ * @brief reads 2 byte from I2C, most significant byte first.
+ * @param address The I2C device adress.
+ * @param reg The I2C register to read.
+ * @param a The pointer where to write data.
+ * @param iic The IIC to us (IIC0 or IIC1).
+ */
 bool i2c_read16_inv(uint8_t address, uint16_t reg, uint16_t *a, iic_index_t iic);
 
+/**
+ * @brief writes 2 byte to I2C, most significant byte first.
+ * @param address The I2C device adress.
+ * @param reg The I2C register to write.
+ * @param a The data to write.
+ * @param iic The IIC to us (IIC0 or IIC1).
+ */
+bool i2c_write16_inv(uint8_t address, uint16_t reg, uint16_t a, iic_index_t iic);
+
+/* Layout of the data passed to i2c_read_burst and i2c_write_burst */
+#define I2C_BYTES 0x000     // bytes are passed as is
+#define I2C_WORDS_BE 0x100  // data is an array of uint16_t, most significant byte first on the bus
+#define I2C_WORDS_LE 0x200  // data is an array of uint16_t, least significant byte first on the bus
+/* Command bits OR-ed into the register, for devices that only auto increment when asked to (e.g. TCS3472) */
+#define I2C_INCREMENT(command_bits) ((command_bits) & 0xFF)
+
+/**
+ * @brief writes length bytes to consecutive registers in a single I2C transaction.
+ * @param address The I2C device adress.
+ * @param reg The first I2C register to write.
+ * @param data The data to write, bytes or uint16_t words depending on flags.
+ * @param length The amount of bytes to write, even for words.
+ * @param flags I2C_BYTES, I2C_WORDS_BE or I2C_WORDS_LE, optionally OR-ed with I2C_INCREMENT().
+ * @param iic The IIC to us (IIC0 or IIC1).
+ */
+bool i2c_write_burst(uint8_t address, uint16_t reg, const void *data, uint16_t length, uint16_t flags, iic_index_t iic);
+
+/**
+ * @brief reads length bytes from consecutive registers in a single I2C transaction.
+ * @param address The I2C device adress.
+ * @param reg The first I2C register to read.
+ * @param data The buffer to read into, bytes or uint16_t words depending on flags. [out]
+ * @param length The amount of bytes to read, even for words.
+ * @param flags I2C_BYTES, I2C_WORDS_BE or I2C_WORDS_LE, optionally OR-ed with I2C_INCREMENT().
+ * @param iic The IIC to us (IIC0 or IIC1).
+ */
+bool i2c_read_burst(uint8_t address, uint16_t reg, void *data, uint16_t length, uint16_t flags, iic_index_t iic);
+
+/**
+ * @brief Amount of I2C transactions done on a bus since startup.
+ */
+uint32_t i2c_transaction_count(iic_index_t iic);
+
+/**
+ * @brief Time spent in I2C transactions on a bus since startup, for utilisation figures.
+ */
+uint64_t i2c_busy_usec(iic_index_t iic);
+
+/* Register shadows: a copy of the registers of a device that only this process changes */
+#define I2C_SHADOW_DEVICES 8      // shadowed devices per bus
+#define I2C_SHADOW_MAX_BANKS 2    // bank select registers per device
+
+typedef struct {
+  uint8_t register_mask;  // bits of the register byte that pick the register, the rest are command bits
+  /* Registers that change what the others mean (e.g. a page select). While one of them is not known to be 0 the
+   * other registers bypass the shadow. */
+  const uint8_t *banks;
+  size_t bank_count;
+  /* Registers the device changes by itself, or where writing the same value again has an effect */
+  const uint8_t *volatile_registers;
+  size_t volatile_count;
+} i2c_shadow_config_t;
+
+typedef struct {
+  uint32_t read_hits;      // reads served from the shadow
+  uint32_t read_misses;    // reads that went to the bus
+  uint32_t writes_elided;  // writes that would not have changed anything
+  uint32_t writes;         // writes that went to the bus
+} i2c_shadow_stats_t;
+
+/**
+ * @brief Starts shadowing the registers of the device at address. Multi-byte transfers are assumed to auto
+ * increment. Nothing is cached until it is read or written.
+ * @return 0 if successful, 1 when all I2C_SHADOW_DEVICES shadows of the bus are in use
+ */
+bool i2c_shadow_enable(uint8_t address, const i2c_shadow_config_t *config, iic_index_t iic);
+
+/**
+ * @brief Stops shadowing the device at address, e.g. before it is reset or moves to another address.
+ */
+void i2c_shadow_disable(uint8_t address, iic_index_t iic);
+
+/**
+ * @brief Forgets every cached register of the device at address, the next accesses go to the bus again.
+ */
+void i2c_shadow_invalidate(uint8_t address, iic_index_t iic);
+
+/**
+ * @brief Hit counts of the shadow of the device at address, all 0 if it is not shadowed.
+ */
+i2c_shadow_stats_t i2c_shadow_stats(uint8_t address, iic_index_t iic);
+
 #endif
@@ -0,0 +1,170 @@
+#include "i2c_async.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "i2c.h"
+
+/*
+ * Bounded multi-producer queue (Vyukov): every slot carries a sequence number that tells producers and the
+ * worker whose turn it is, so submitting never takes a lock. The semaphore only wakes the worker up.
+ */
+typedef struct {
+  _Atomic size_t sequence;
+  i2c_transfer_t *transfer;
+} slot_t;
+
+typedef struct {
+  slot_t slots[I2C_ASYNC_QUEUE_LENGTH];
+  _Atomic size_t head;  // next slot to fill
+  size_t tail;          // next slot to execute, only touched by the worker
+  sem_t pending;
+  pthread_t worker;
+  atomic_bool started;
+  atomic_bool running;
+} bus_queue_t;
+
+static bus_queue_t queues[NUM_IICS];
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool enqueue(bus_queue_t *queue, i2c_transfer_t *transfer) {
+  size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  slot_t *slot;
+  while (true) {
+    slot = &queue->slots[pos & (I2C_ASYNC_QUEUE_LENGTH - 1)];
+    size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1, memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return 1;  // full
+    } else {
+      pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    }
+  }
+  slot->transfer = transfer;
+  atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+  return 0;
+}
+
+static i2c_transfer_t *dequeue(bus_queue_t *queue) {
+  slot_t *slot = &queue->slots[queue->tail & (I2C_ASYNC_QUEUE_LENGTH - 1)];
+  if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != queue->tail + 1) {
+    return NULL;
+  }
+  i2c_transfer_t *transfer = slot->transfer;
+  atomic_store_explicit(&slot->sequence, queue->tail + I2C_ASYNC_QUEUE_LENGTH, memory_order_release);
+  queue->tail++;
+  return transfer;
+}
+
+static void execute(iic_index_t iic, i2c_transfer_t *transfer) {
+  bool err;
+  if (transfer->op == I2C_TRANSFER_READ) {
+    err = i2c_read_burst(transfer->address, transfer->reg, transfer->data, transfer->length, transfer->flags, iic);
+  } else {
+    err = i2c_write_burst(transfer->address, transfer->reg, transfer->data, transfer->length, transfer->flags, iic);
+  }
+  /* A waiter may let the transfer go as soon as its state flips, so nothing touches it after that */
+  if (transfer->done != NULL) {
+    transfer->done(transfer, err);
+  }
+  atomic_store_explicit(&transfer->state, err ? I2C_TRANSFER_FAILED : I2C_TRANSFER_DONE, memory_order_release);
+}
+
+static void *worker(void *arg) {
+  iic_index_t iic = (iic_index_t)(intptr_t)arg;
+  bus_queue_t *queue = &queues[iic];
+  while (true) {
+    sem_wait(&queue->pending);
+    /* A wake-up may belong to a slot that is still being filled, so drain whatever is ready */
+    i2c_transfer_t *transfer;
+    while ((transfer = dequeue(queue)) != NULL) {
+      execute(iic, transfer);
+    }
+    if (!atomic_load(&queue->running)) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+static bool start(iic_index_t iic) {
+  bus_queue_t *queue = &queues[iic];
+  pthread_mutex_lock(&start_lock);
+  bool err = 0;
+  if (!atomic_load(&queue->started)) {
+    for (size_t i = 0; i < I2C_ASYNC_QUEUE_LENGTH; ++i) {
+      atomic_init(&queue->slots[i].sequence, i);
+    }
+    atomic_init(&queue->head, 0);
+    queue->tail = 0;
+    sem_init(&queue->pending, 0, 0);
+    atomic_store(&queue->running, true);
+    err = pthread_create(&queue->worker, NULL, worker, (void *)(intptr_t)iic) != 0;
+    if (err) {
+      sem_destroy(&queue->pending);
+    } else {
+      atomic_store(&queue->started, true);
+    }
+  }
+  pthread_mutex_unlock(&start_lock);
+  return err;
+}
+
+bool i2c_async_submit(iic_index_t iic, i2c_transfer_t *transfer) {
+  if (iic > 1 || iic < 0) {
+    fprintf(stderr, "[ERROR] Wrong IIC number: %d\n", iic);
+    return 1;
+  }
+  bus_queue_t *queue = &queues[iic];
+  if (!atomic_load(&queue->started) && start(iic)) {
+    fprintf(stderr, "[ERROR] Could not start the IIC%d worker\n", iic);
+    return 1;
+  }
+  i2c_transfer_state_t state = atomic_load(&transfer->state);
+  if (state == I2C_TRANSFER_PENDING ||
+      !atomic_compare_exchange_strong(&transfer->state, &state, I2C_TRANSFER_PENDING)) {
+    return 1;
+  }
+  if (enqueue(queue, transfer)) {
+    atomic_store(&transfer->state, I2C_TRANSFER_FAILED);
+    return 1;
+  }
+  sem_post(&queue->pending);
+  return 0;
+}
+
+bool i2c_transfer_done(i2c_transfer_t *transfer) {
+  i2c_transfer_state_t state = atomic_load_explicit(&transfer->state, memory_order_acquire);
+  return state == I2C_TRANSFER_DONE || state == I2C_TRANSFER_FAILED;
+}
+
+bool i2c_transfer_wait(i2c_transfer_t *transfer) {
+  if (atomic_load(&transfer->state) == I2C_TRANSFER_IDLE) {
+    return 1;
+  }
+  while (!i2c_transfer_done(transfer)) {
+    usleep(I2C_ASYNC_WAIT_US);
+  }
+  return atomic_load(&transfer->state) == I2C_TRANSFER_FAILED;
+}
+
+void i2c_async_stop(iic_index_t iic) {
+  bus_queue_t *queue = &queues[iic];
+  pthread_mutex_lock(&start_lock);
+  if (atomic_load(&queue->started)) {
+    atomic_store(&queue->running, false);
+    sem_post(&queue->pending);
+    pthread_join(queue->worker, NULL);
+    sem_destroy(&queue->pending);
+    atomic_store(&queue->started, false);
+  }
+  pthread_mutex_unlock(&start_lock);
+}
@@ -0,0 +1,52 @@
+#ifndef I2C_ASYNC_H_
+#define I2C_ASYNC_H_
+#include <libpynq.h>
+#include <stdatomic.h>
+
+/* Transfers that can wait for a bus worker at the same time, per bus. Has to be a power of two. */
+#define I2C_ASYNC_QUEUE_LENGTH 32
+/* How often i2c_transfer_wait looks at a transfer */
+#define I2C_ASYNC_WAIT_US 20
+
+typedef enum { I2C_TRANSFER_READ, I2C_TRANSFER_WRITE } i2c_transfer_op_t;
+
+typedef enum { I2C_TRANSFER_IDLE, I2C_TRANSFER_PENDING, I2C_TRANSFER_DONE, I2C_TRANSFER_FAILED } i2c_transfer_state_t;
+
+typedef struct i2c_transfer {
+  i2c_transfer_op_t op;
+  uint8_t address;
+  uint16_t reg;
+  void *data;  // has to stay valid until the transfer is done
+  uint16_t length;
+  uint16_t flags;  // as for i2c_read_burst and i2c_write_burst
+  /* Optional, called on the bus worker thread with the outcome, before the transfer counts as done, so it may still
+   * use the transfer. Keep it short, it holds up the bus. */
+  void (*done)(struct i2c_transfer *transfer, bool err);
+  void *context;  // free for the caller, e.g. for done
+  _Atomic i2c_transfer_state_t state;
+} i2c_transfer_t;
+
+/**
+ * @brief Queues a transfer for the worker thread of the bus, which is started on first use.
+ * Transfers on one bus are executed in the order they were submitted, sync calls from i2c.h are still allowed.
+ * @return 0 if successful, 1 if the queue is full or the transfer is still pending
+ */
+bool i2c_async_submit(iic_index_t iic, i2c_transfer_t *transfer);
+
+/**
+ * @return true once the transfer has been executed, successful or not
+ */
+bool i2c_transfer_done(i2c_transfer_t *transfer);
+
+/**
+ * @brief Blocks until the transfer has been executed.
+ * @return 0 if successful, 1 on error
+ */
+bool i2c_transfer_wait(i2c_transfer_t *transfer);
+
+/**
+ * @brief Finishes the queued transfers and stops the worker of the bus.
+ */
+void i2c_async_stop(iic_index_t iic);
+
+#endif
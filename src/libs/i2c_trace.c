@@ -0,0 +1,134 @@
+#include "i2c_trace.h"
+
+#include <stdio.h>
+
+#include "measurements.h"
+
+/*
+ * Every slot carries a sequence number: odd while a producer fills it, 2 * (position + 1) once it holds the record
+ * of that position. Producers claim positions with one fetch_add, readers copy a slot and keep it only when the
+ * sequence was complete and did not change meanwhile.
+ */
+typedef struct {
+  _Atomic uint32_t sequence;
+  i2c_trace_record_t record;
+} trace_slot_t;
+
+atomic_bool i2c_tracing;
+static trace_slot_t ring[I2C_TRACE_LENGTH];
+static _Atomic uint32_t head;
+static _Atomic uint32_t histograms[NUM_IICS][128][I2C_TRACE_BUCKETS];
+
+void i2c_trace_enable(bool enable) { atomic_store(&i2c_tracing, enable); }
+
+void i2c_trace_reset(void) {
+  atomic_store(&head, 0);
+  for (size_t i = 0; i < I2C_TRACE_LENGTH; ++i) {
+    atomic_store(&ring[i].sequence, 0);
+  }
+  for (size_t iic = 0; iic < NUM_IICS; ++iic) {
+    for (size_t address = 0; address < 128; ++address) {
+      for (size_t bucket = 0; bucket < I2C_TRACE_BUCKETS; ++bucket) {
+        atomic_store_explicit(&histograms[iic][address][bucket], 0, memory_order_relaxed);
+      }
+    }
+  }
+}
+
+static size_t bucket_of(uint32_t duration_us) {
+  size_t bucket = duration_us < 2 ? 0 : 31 - __builtin_clz(duration_us);
+  return bucket < I2C_TRACE_BUCKETS ? bucket : I2C_TRACE_BUCKETS - 1;
+}
+
+void i2c_trace_record(iic_index_t iic, uint8_t address, uint8_t reg, uint16_t length, bool write, uint64_t start_us,
+                      uint32_t duration_us, bool err) {
+  uint32_t position = atomic_fetch_add_explicit(&head, 1, memory_order_relaxed);
+  trace_slot_t *slot = &ring[position & (I2C_TRACE_LENGTH - 1)];
+  atomic_store_explicit(&slot->sequence, 2 * position + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot->record = (i2c_trace_record_t){.start_us = start_us,
+                                      .duration_us = duration_us,
+                                      .length = length,
+                                      .iic = iic,
+                                      .address = address & 0x7F,
+                                      .reg = reg,
+                                      .write = write,
+                                      .err = err};
+  atomic_store_explicit(&slot->sequence, 2 * position + 2, memory_order_release);
+  atomic_fetch_add_explicit(&histograms[iic][address & 0x7F][bucket_of(duration_us)], 1, memory_order_relaxed);
+}
+
+size_t i2c_trace_snapshot(i2c_trace_record_t *records, size_t max) {
+  uint32_t end = atomic_load_explicit(&head, memory_order_acquire);
+  uint32_t begin = end > I2C_TRACE_LENGTH ? end - I2C_TRACE_LENGTH : 0;
+  if (end - begin > max) {
+    begin = end - max;
+  }
+  size_t count = 0;
+  for (uint32_t position = begin; position != end; ++position) {
+    trace_slot_t *slot = &ring[position & (I2C_TRACE_LENGTH - 1)];
+    uint32_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    if (sequence != 2 * position + 2) {
+      continue;  // still being written, or already overwritten by a newer position
+    }
+    records[count] = slot->record;
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) == sequence) {
+      count++;
+    }
+  }
+  return count;
+}
+
+void i2c_trace_histogram(iic_index_t iic, uint8_t address, uint32_t buckets[I2C_TRACE_BUCKETS]) {
+  for (size_t bucket = 0; bucket < I2C_TRACE_BUCKETS; ++bucket) {
+    buckets[bucket] = atomic_load_explicit(&histograms[iic][address & 0x7F][bucket], memory_order_relaxed);
+  }
+}
+
+bool i2c_trace_dump(const char *path) {
+  static i2c_trace_record_t records[I2C_TRACE_LENGTH];
+  size_t count = i2c_trace_snapshot(records, I2C_TRACE_LENGTH);
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    ERROR("Could not open %s", path);
+    return 1;
+  }
+
+  fprintf(f, "start_us,iic,address,register,length,op,duration_us,result\n");
+  for (size_t i = 0; i < count; ++i) {
+    const i2c_trace_record_t *r = &records[i];
+    fprintf(f, "%llu,%u,0x%02X,0x%02X,%u,%s,%u,%s\n", (unsigned long long)r->start_us, r->iic, r->address, r->reg,
+            r->length, r->write ? "write" : "read", r->duration_us, r->err ? "error" : "ok");
+  }
+
+  fprintf(f, "\niic,address");
+  for (size_t bucket = 0; bucket + 1 < I2C_TRACE_BUCKETS; ++bucket) {
+    fprintf(f, ",<%uus", 2u << bucket);
+  }
+  fprintf(f, ",>=%uus", 1u << (I2C_TRACE_BUCKETS - 1));
+  fprintf(f, "\n");
+  for (iic_index_t iic = IIC0; iic < NUM_IICS; ++iic) {
+    for (uint8_t address = 0; address < 128; ++address) {
+      uint32_t buckets[I2C_TRACE_BUCKETS], total = 0;
+      i2c_trace_histogram(iic, address, buckets);
+      for (size_t bucket = 0; bucket < I2C_TRACE_BUCKETS; ++bucket) {
+        total += buckets[bucket];
+      }
+      if (total == 0) {
+        continue;
+      }
+      fprintf(f, "%d,0x%02X", iic, address);
+      for (size_t bucket = 0; bucket < I2C_TRACE_BUCKETS; ++bucket) {
+        fprintf(f, ",%u", buckets[bucket]);
+      }
+      fprintf(f, "\n");
+    }
+  }
+
+  if (fclose(f) != 0) {
+    ERROR("Could not write %s", path);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef I2C_TRACE_H_
+#define I2C_TRACE_H_
+#include <libpynq.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define I2C_TRACE_LENGTH 4096  // transactions kept, power of two
+#define I2C_TRACE_BUCKETS 16   // latency buckets: 0-1 us, 2-3 us, 4-7 us ... the last one open ended
+
+typedef struct {
+  uint64_t start_us;
+  uint32_t duration_us;
+  uint16_t length;
+  uint8_t iic;
+  uint8_t address;
+  uint8_t reg;
+  bool write;
+  bool err;
+} i2c_trace_record_t;
+
+/* Read on every transaction, only i2c_trace_enable changes it */
+extern atomic_bool i2c_tracing;
+
+/**
+ * @brief Whether transactions are being traced, a single relaxed load so the disabled path costs one branch.
+ */
+static inline bool i2c_trace_enabled(void) {
+  return __builtin_expect(atomic_load_explicit(&i2c_tracing, memory_order_relaxed), 0);
+}
+
+/**
+ * @brief Starts or stops tracing. The ring and the histograms keep what was recorded so far.
+ */
+void i2c_trace_enable(bool enable);
+
+/**
+ * @brief Forgets all recorded transactions and empties the histograms.
+ */
+void i2c_trace_reset(void);
+
+/**
+ * @brief Adds a transaction to the ring and to the histogram of its device. Safe from any thread.
+ */
+void i2c_trace_record(iic_index_t iic, uint8_t address, uint8_t reg, uint16_t length, bool write, uint64_t start_us,
+                      uint32_t duration_us, bool err);
+
+/**
+ * @brief Copies the last transactions, oldest first. Records being written at the same time are skipped.
+ * @return The amount of records copied, at most max
+ */
+size_t i2c_trace_snapshot(i2c_trace_record_t *records, size_t max);
+
+/**
+ * @brief Latency histogram of the device at address, bucket i counts transactions of 2^i up to 2^(i+1) - 1 us.
+ */
+void i2c_trace_histogram(iic_index_t iic, uint8_t address, uint32_t buckets[I2C_TRACE_BUCKETS]);
+
+/**
+ * @brief Writes the ring as CSV, followed by the histogram of every device that was seen.
+ * @return 0 if successful, 1 on error
+ */
+bool i2c_trace_dump(const char *path);
+
+#endif
@@ -0,0 +1,125 @@
+#include "json_writer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static const int64_t decimal_scale = 100;  // 10^JSON_DECIMALS
+_Static_assert(JSON_DECIMALS == 2, "decimal_scale is 10^JSON_DECIMALS");
+
+static void put(json_writer_t *writer, char c) {
+  if (writer->length < writer->size) {
+    writer->buffer[writer->length] = c;
+  }
+  writer->length++;
+}
+
+static void put_string(json_writer_t *writer, const char *string) {
+  while (*string != '\0') {
+    put(writer, *string++);
+  }
+}
+
+static void put_unsigned(json_writer_t *writer, uint64_t value) {
+  char digits[20];
+  size_t count = 0;
+  do {
+    digits[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  while (count > 0) {
+    put(writer, digits[--count]);
+  }
+}
+
+static void put_escaped(json_writer_t *writer, const char *string) {
+  static const char hex[] = "0123456789abcdef";
+  put(writer, '"');
+  for (; *string != '\0'; ++string) {
+    unsigned char c = *string;
+    if (c == '"' || c == '\\') {
+      put(writer, '\\');
+      put(writer, c);
+    } else if (c < 0x20) {
+      put_string(writer, "\\u00");
+      put(writer, hex[c >> 4]);
+      put(writer, hex[c & 0x0F]);
+    } else {
+      put(writer, c);
+    }
+  }
+  put(writer, '"');
+}
+
+static void put_key(json_writer_t *writer, const char *key) {
+  if (!writer->first) {
+    put(writer, ',');
+  }
+  writer->first = false;
+  put_escaped(writer, key);
+  put(writer, ':');
+}
+
+void json_begin(json_writer_t *writer, char *buffer, size_t size) {
+  *writer = (json_writer_t){.buffer = buffer, .size = size, .length = 0, .first = true};
+  put(writer, '{');
+}
+
+void json_add_int(json_writer_t *writer, const char *key, int64_t value) {
+  put_key(writer, key);
+  if (value < 0) {
+    put(writer, '-');
+  }
+  put_unsigned(writer, value < 0 ? -(uint64_t)value : (uint64_t)value);
+}
+
+void json_add_number(json_writer_t *writer, const char *key, double value) {
+  if (!isfinite(value)) {
+    put_key(writer, key);
+    put_string(writer, "null");
+    return;
+  }
+  /* Beyond this the scaled value does not fit, positions and states never get there */
+  if (fabs(value) >= 1e15) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.0f", value);
+    put_key(writer, key);
+    put_string(writer, text);
+    return;
+  }
+  int64_t scaled = llround(value * decimal_scale);
+  uint64_t magnitude = scaled < 0 ? -(uint64_t)scaled : (uint64_t)scaled;
+  put_key(writer, key);
+  if (scaled < 0) {
+    put(writer, '-');
+  }
+  put_unsigned(writer, magnitude / decimal_scale);
+  uint64_t fraction = magnitude % decimal_scale;
+  if (fraction == 0) {
+    return;
+  }
+  put(writer, '.');
+  int64_t digit = decimal_scale / 10;
+  while (fraction != 0) {
+    put(writer, '0' + fraction / digit);
+    fraction %= digit;
+    digit /= 10;
+  }
+}
+
+void json_add_string(json_writer_t *writer, const char *key, const char *value) {
+  put_key(writer, key);
+  put_escaped(writer, value);
+}
+
+size_t json_end(json_writer_t *writer) {
+  put(writer, '}');
+  if (writer->length >= writer->size) {
+    if (writer->size > 0) {
+      writer->buffer[0] = '\0';
+    }
+    return 0;
+  }
+  writer->buffer[writer->length] = '\0';
+  return writer->length;
+}
@@ -0,0 +1,43 @@
+#ifndef JSON_WRITER_H_
+#define JSON_WRITER_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define JSON_DECIMALS 2  // numbers are written with at most this many decimals, trailing zeros left out
+
+/* Writes one flat JSON object into a buffer of the caller, nothing is allocated */
+typedef struct {
+  char *buffer;
+  size_t size;
+  size_t length;  // what was written, or would have been when it does not fit
+  bool first;     // no member written yet
+} json_writer_t;
+
+/**
+ * @brief Starts an object in buffer.
+ */
+void json_begin(json_writer_t *writer, char *buffer, size_t size);
+
+/**
+ * @brief Adds a number, with JSON_DECIMALS decimals at most. Numbers that are not finite become null, like cJSON does.
+ */
+void json_add_number(json_writer_t *writer, const char *key, double value);
+
+/**
+ * @brief Adds an integer.
+ */
+void json_add_int(json_writer_t *writer, const char *key, int64_t value);
+
+/**
+ * @brief Adds a string, escaped where JSON needs it.
+ */
+void json_add_string(json_writer_t *writer, const char *key, const char *value);
+
+/**
+ * @brief Closes the object and terminates the string.
+ * @return The length of the JSON, 0 if it did not fit in the buffer
+ */
+size_t json_end(json_writer_t *writer);
+
+#endif
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <time.h>
 
 char name[10];
 
@@ -25,6 +26,12 @@ uint32_t get_period(uint8_t pin, uint8_t level) {
   return (end.tv_sec - start.tv_sec) * 1000 * 1000 + (end.tv_usec - start.tv_usec);
 }
 
+uint64_t get_time_usec(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 * 1000 + now.tv_nsec / 1000;
+}
+
 // https://math.stackexchange.com/questions/106700/incremental-averaging
 double incremental_mean(double new_value, double running_mean, size_t count) {
   if (count < 2) {
@@ -10,6 +10,12 @@ extern char name[10];
 
 uint32_t get_period(uint8_t pin, uint8_t level);
 
+/**
+ * @brief Monotonic clock used for deadlines and timestamps.
+ * @return Microseconds since an arbitrary fixed point.
+ */
+uint64_t get_time_usec(void);
+
 double incremental_mean(double new_value, double running_mean, size_t count);
 
 int map(int x, int in_min, int in_max, int out_min, int out_max);
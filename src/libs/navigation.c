@@ -10,6 +10,7 @@
 #include "movement.h"
 #include "VL53L0X.h"
 #include "comms.h"
+#include "sensor_manager.h"
 #include "src/libs/vtypes.h"
 
 // Initialization of global variables for the movement
@@ -140,8 +141,16 @@ float navig_get_current_heading(void) {
   return current_heading;
 }
 
+bool navig_can(uint32_t needed) { return (sensor_manager_capabilities() & needed) == needed; }
+
 bool killSwitchScan(position_t *pos, position_t *tPos, tcs3472_t *down_looking) {
   printf("Killswitch\n");
+  /* Without the ground in sight the rover could drive into a crater */
+  if (!sensor_health_usable(&down_looking->health)) {
+    LOG("Downward color sensor unavailable, stopping");
+    m_stop();
+    return true;
+  }
 
 
   // if (!stepper_steps_done()) {
@@ -163,10 +172,37 @@ bool killSwitchScan(position_t *pos, position_t *tPos, tcs3472_t *down_looking)
   // } else {
   //   killSwitchScan(pos, tPos, down_looking);
   // }
+  /* The IIC1 worker reads the sensor, so the steppers are watched while a conversion runs */
+  tcs3472_sampler_t sampler;
+  bool sampling = !tcs3472_sampler_start(&sampler, down_looking);
+  if (!sampling) {
+    ERROR("Could not sample in the background, reading the color sensor blocking");
+  }
   while (!stepper_steps_done()) {
+    color_t color;
+    if (!sensor_health_usable(&down_looking->health)) {
+      LOG("Downward color sensor lost, stopping");
+      if (sampling) {
+        tcs3472_sampler_stop(&sampler);
+      }
+      m_stop();
+      return true;
+    }
+    if (sampling) {
+      if (!tcs3472_sampler_poll(&sampler)) {
+        sleep_msec(1);
+        continue;
+      }
+      color = color_classify(down_looking->calibration, down_looking->c, down_looking->r, down_looking->g, down_looking->b);
+    } else {
+      color = tcs3472_determine_color(down_looking);
+    }
     printf("Scanning color\n");
-    if (tcs3472_determine_color(down_looking) == BLACK) {
+    if (color == BLACK) {
       LOG("BLACK ON THE BOTTOM");
+      if (sampling) {
+        tcs3472_sampler_stop(&sampler);
+      }
       int16_t stepsL = 0, stepsR = 0;
       stepper_get_steps(&stepsL, &stepsR);
       m_stop();
@@ -186,6 +222,9 @@ bool killSwitchScan(position_t *pos, position_t *tPos, tcs3472_t *down_looking)
     }
   }
 
+  if (sampling) {
+    tcs3472_sampler_stop(&sampler);
+  }
   pos->x = tPos->x;
   pos->y = tPos->y;
   return false;
@@ -201,6 +240,16 @@ obstacle_t avoidBorderOrCrater(position_t *pos, tcs3472_t *forward_looking) {
   return obstacle;
 }
 
+/* Unknown while the sensor is quarantined, it shares its address with distance sensors that are readdressed */
+static color_t front_color(tcs3472_t *forward_looking) {
+  if (!sensor_health_claim(&forward_looking->health)) {
+    return COLOR_COUNT;
+  }
+  color_t color = tcs3472_determine_color(forward_looking);
+  sensor_health_release(&forward_looking->health);
+  return color;
+}
+
 obstacle_t scanBorderCrater(position_t *pos, tcs3472_t *forward_looking) {
   obstacle_t obstacle;
 
@@ -209,16 +258,75 @@ obstacle_t scanBorderCrater(position_t *pos, tcs3472_t *forward_looking) {
   obstacle.y = pos->y + 6 * sin(rads);
 
   obstacle.type = WALL;
-  obstacle.color = tcs3472_determine_color(forward_looking);
+  obstacle.color = front_color(forward_looking);
   return obstacle;
 }
 
+static void set_distance_budget(vl53l0x_t **distance_sensors, uint32_t budget_us) {
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    if (sensor_health_usable(&distance_sensors[i]->health) && vl53l0x_set_timing_budget_us(distance_sensors[i], budget_us)) {
+      ERROR("Could not set timing budget of sensor %zu", i);
+    }
+  }
+}
+
+/* Ranges with all usable sensors at the same time, values are left untouched on error or for quarantined sensors */
+static void read_all_distances(vl53l0x_t **distance_sensors, uint16_t *low, uint16_t *middle, uint16_t *high) {
+  uint16_t *ranges[VL53L0X_SENSOR_COUNT] = {[VL53L0X_LOW] = low, [VL53L0X_MIDDLE] = middle, [VL53L0X_HIGH] = high};
+  vl53l0x_t *group[VL53L0X_SENSOR_COUNT];
+  size_t index[VL53L0X_SENSOR_COUNT], count = 0;
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    if (sensor_health_claim(&distance_sensors[i]->health)) {
+      group[count] = distance_sensors[i];
+      index[count++] = i;
+    }
+  }
+  vl53l0x_group_reading_t reading;
+  bool err = count == 0 || vl53l0x_group_read_mean(group, count, &reading);
+  for (size_t i = 0; i < count; ++i) {
+    sensor_health_release(&group[i]->health);
+  }
+  if (err) {
+    ERROR("Could not read distance sensors");
+    return;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    *ranges[index[i]] = reading.range[i];
+  }
+}
+
+/* The sensor sweeps look through, the low one unless it is quarantined */
+static vl53l0x_t *scan_sensor(vl53l0x_t **distance_sensors) {
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    if (sensor_health_usable(&distance_sensors[i]->health)) {
+      return distance_sensors[i];
+    }
+  }
+  return NULL;
+}
+
+/* Out of range while the scanner is quarantined, so the sweep does not take the gap for an obstacle */
+static uint16_t scan_range(vl53l0x_t *scanner) {
+  uint16_t range = UINT16_MAX;
+  if (sensor_health_claim(&scanner->health)) {
+    vl53l0x_read_mean_range(scanner, &range);
+    sensor_health_release(&scanner->health);
+  }
+  return range;
+}
+
 obstacle_t scanScope(position_t *pos, vl53l0x_t **distance_sensors, tcs3472_t *forward_looking, tcs3472_t *down){
 
   obstacle_t obstacle = {pos->x, pos->y, COLOR_COUNT, NONE};  
 
   uint16_t distance[14] = {0};
-  uint16_t distance_low;
+
+  vl53l0x_t *scanner = scan_sensor(distance_sensors);
+  if (scanner == NULL) {
+    LOG("No distance sensor available, not scanning");
+    return obstacle;
+  }
+  set_distance_budget(distance_sensors, SCAN_TIMING_BUDGET_US);
 
   m_turn_degrees(60, left);                              //turn 30 deg left
   pos->di = direction(&pos->di, 60.0);    //update orientation
@@ -226,8 +334,7 @@ obstacle_t scanScope(position_t *pos, vl53l0x_t **distance_sensors, tcs3472_t *f
     sleep_msec(100);
   }
   for(int i = 0; i < 12; i++){                           //repreats previous process
-    vl53l0x_read_mean_range(distance_sensors[VL53L0X_LOW], &distance_low);
-    distance[i] = distance_low;
+    distance[i] = scan_range(scanner);
     position_t tPos = {pos->x, pos->y, 0.0};
     m_turn_degrees(10, right);
     killSwitchScan(pos, &tPos, down);   
@@ -244,8 +351,7 @@ obstacle_t scanScope(position_t *pos, vl53l0x_t **distance_sensors, tcs3472_t *f
     }
   }
 
-  vl53l0x_read_mean_range(distance_sensors[VL53L0X_LOW], &distance_low);
-  distance[12] = distance_low;
+  distance[12] = scan_range(scanner);
 
   m_turn_degrees(60, left);                              //repeat process to original position
   pos->di = direction(&pos->di, 60.0);
@@ -268,10 +374,14 @@ obstacle_t scanHillOrRock(position_t *pos, vl53l0x_t **distance_sensors, tcs3472
   printf("Moving towards hill\n");
   obstacle_t obstacle = {pos->x, pos->y, COLOR_COUNT, NONE};
 
+  /* Telling hills from rocks takes all three heights */
+  if (!navig_can(NAV_RANGE_ALL)) {
+    LOG("Not all distance sensors available, not approaching");
+    return obstacle;
+  }
   uint16_t distance_low = 8910, distance_middle = 8910, distance_high = 8910;
-  vl53l0x_read_mean_range(distance_sensors[VL53L0X_LOW], &distance_low);
-  vl53l0x_read_mean_range(distance_sensors[VL53L0X_MIDDLE], &distance_middle);
-  vl53l0x_read_mean_range(distance_sensors[VL53L0X_HIGH], &distance_high);
+  set_distance_budget(distance_sensors, APPROACH_TIMING_BUDGET_US);
+  read_all_distances(distance_sensors, &distance_low, &distance_middle, &distance_high);
 
   LOG("Distance to high obstacle: %d \n", distance_high);
   LOG("Distance to middle obstacle: %d \n", distance_middle);
@@ -301,9 +411,7 @@ obstacle_t scanHillOrRock(position_t *pos, vl53l0x_t **distance_sensors, tcs3472
       
       pos->x=  tPos.x;
       pos->y = tPos.y;
-      vl53l0x_read_mean_range(distance_sensors[VL53L0X_LOW], &distance_low);
-      vl53l0x_read_mean_range(distance_sensors[VL53L0X_MIDDLE], &distance_middle);
-      vl53l0x_read_mean_range(distance_sensors[VL53L0X_HIGH], &distance_high);
+      read_all_distances(distance_sensors, &distance_low, &distance_middle, &distance_high);
 
       LOG("Distance to high obstacle: %d \n", distance_high);
       LOG("Distance to middle obstacle: %d \n", distance_middle);
@@ -326,7 +434,7 @@ obstacle_t scanHillOrRock(position_t *pos, vl53l0x_t **distance_sensors, tcs3472
     float rads = pos->di * pi / 180;
     obstacle.x = pos->x + 6 * cos(rads);
     obstacle.y = pos->y + 6 * sin(rads);       //set the coordinates of the obstacle
-    color_t c = tcs3472_determine_color(forward_looking);
+    color_t c = front_color(forward_looking);
     LOG("front color: %d", c);
     obstacle.color = c;
   }
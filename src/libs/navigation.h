@@ -19,6 +19,19 @@ typedef struct {
 
 typedef enum { NAVIG_NONE, NAVIG_TURNING, NAVIG_MOVING } navig_movement_t;
 
+/* What navigation can do with the sensors that work now, the rover registers its sensors with these */
+#define NAV_RANGE_LOW 0x01
+#define NAV_RANGE_MIDDLE 0x02
+#define NAV_RANGE_HIGH 0x04
+#define NAV_RANGE_ALL (NAV_RANGE_LOW | NAV_RANGE_MIDDLE | NAV_RANGE_HIGH)
+#define NAV_COLOR_FRONT 0x08
+#define NAV_COLOR_DOWN 0x10
+
+/**
+ * @brief Whether all sensors behind the needed capabilities are usable, see sensor_manager_capabilities.
+ */
+bool navig_can(uint32_t needed);
+
 /**
  * @brief Initialises motors.
  */
@@ -0,0 +1,201 @@
+#include "publisher.h"
+
+#include <math.h>
+#include <string.h>
+
+void publisher_init(publisher_t *publisher, const publisher_config_t *config, uint64_t now_us) {
+  memset(publisher, 0, sizeof(*publisher));
+  publisher->config = *config;
+  for (size_t class = 0; class < PUBLISH_CLASSES; ++class) {
+    publisher->tokens[class] = config->burst[class];
+  }
+  publisher->refill_us = now_us;
+}
+
+void publisher_reset(publisher_t *publisher) { publisher->started = false; }
+
+static double quantise(const publisher_t *publisher, double value) {
+  double resolution = publisher->config.resolution;
+  if (value == NONE || resolution <= 0) {
+    return value;
+  }
+  return round(value / resolution) * resolution;
+}
+
+static bool unclassified(obstacle_t obstacle) { return obstacle.type == NO_OBSTACLE || obstacle.type == NONE; }
+
+static publish_class_t classify(const publisher_t *publisher, obstacle_t obstacle, robot_t robot) {
+  bool at_robot = obstacle.x == NONE || (obstacle.x == robot.x && obstacle.y == robot.y);
+  if (!unclassified(obstacle) || !at_robot) {
+    return PUBLISH_OBSTACLE;
+  }
+  bool driving = robot.status == IDLE || robot.status == MOVING;
+  if (!driving || !publisher->started || robot.status != publisher->robot.status) {
+    return PUBLISH_STATE;
+  }
+  return PUBLISH_POSITION;
+}
+
+static void refill(publisher_t *publisher, uint64_t now_us) {
+  double seconds = now_us > publisher->refill_us ? (now_us - publisher->refill_us) / 1e6 : 0;
+  publisher->refill_us = now_us > publisher->refill_us ? now_us : publisher->refill_us;
+  for (size_t class = 0; class < PUBLISH_CLASSES; ++class) {
+    double tokens = publisher->tokens[class] + publisher->config.rate[class] * seconds;
+    publisher->tokens[class] = fmin(tokens, publisher->config.burst[class]);
+  }
+}
+
+/* A message may go while anything is left, the next ones wait until what it took more is paid back */
+static bool affordable(const publisher_t *publisher, publish_class_t class) {
+  return publisher->config.rate[class] == 0 || publisher->tokens[class] > 0;
+}
+
+/* A classified obstacle covers a point of the same type and color, any obstacle a scan point */
+static bool covers(const publisher_t *publisher, double x, double y, obs_types type, color_t color, obstacle_t obstacle) {
+  bool same = unclassified(obstacle) || (obstacle.type == type && obstacle.color == color);
+  return same && hypot(obstacle.x - x, obstacle.y - y) < publisher->config.merge_distance;
+}
+
+/*
+ * A point is known when one close to it with at least as much information was reported, or waits to be. A waiting
+ * point that is dropped stops covering the points around it.
+ */
+static bool known(const publisher_t *publisher, obstacle_t obstacle) {
+  size_t count = publisher->remembered < PUBLISHER_MEMORY ? publisher->remembered : PUBLISHER_MEMORY;
+  for (size_t i = 0; i < count; ++i) {
+    const publisher_point_t *point = &publisher->memory[i];
+    if (covers(publisher, point->x, point->y, point->type, point->color, obstacle)) {
+      return true;
+    }
+  }
+  for (size_t i = 0; i < publisher->pending_count; ++i) {
+    const obstacle_t *point = &publisher->pending[(publisher->pending_head + i) % PUBLISHER_PENDING];
+    if (covers(publisher, point->x, point->y, point->type, point->color, obstacle)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void remember(publisher_t *publisher, obstacle_t obstacle) {
+  publisher->memory[publisher->remembered++ % PUBLISHER_MEMORY] =
+      (publisher_point_t){.x = obstacle.x, .y = obstacle.y, .type = obstacle.type, .color = obstacle.color};
+}
+
+static uint8_t changed(const publisher_t *publisher, obstacle_t obstacle, robot_t robot) {
+  uint8_t fields = 0;
+  fields |= robot.x != publisher->robot.x ? TELEMETRY_FIELD_ROBOT_X : 0;
+  fields |= robot.y != publisher->robot.y ? TELEMETRY_FIELD_ROBOT_Y : 0;
+  fields |= robot.status != publisher->robot.status ? TELEMETRY_FIELD_ROBOT_STATUS : 0;
+  fields |= obstacle.x != publisher->obstacle.x ? TELEMETRY_FIELD_OBSTACLE_X : 0;
+  fields |= obstacle.y != publisher->obstacle.y ? TELEMETRY_FIELD_OBSTACLE_Y : 0;
+  fields |= obstacle.type != publisher->obstacle.type ? TELEMETRY_FIELD_OBSTACLE_TYPE : 0;
+  fields |= obstacle.color != publisher->obstacle.color ? TELEMETRY_FIELD_OBSTACLE_COLOR : 0;
+  return fields;
+}
+
+/* Fills in the update and counts it as sent, unless the receiver knows all of it already */
+static bool prepare(publisher_t *publisher, publish_class_t class, obstacle_t obstacle, robot_t robot, uint64_t now_us,
+                    publish_update_t *update) {
+  robot.x = quantise(publisher, robot.x);
+  robot.y = quantise(publisher, robot.y);
+  obstacle.x = quantise(publisher, obstacle.x);
+  obstacle.y = quantise(publisher, obstacle.y);
+  uint8_t fields = publisher->started ? changed(publisher, obstacle, robot) : TELEMETRY_FIELDS_ALL;
+  bool keyframe = !publisher->started || now_us - publisher->keyframe_us >= publisher->config.keyframe_ms * 1000ull;
+  if (fields == 0 && !keyframe) {
+    publisher->stats.unchanged++;
+    return false;
+  }
+  if (keyframe) {
+    publisher->keyframe_us = now_us;
+    publisher->stats.keyframes++;
+  }
+  *update = (publish_update_t){.class = class,
+                               .fields = keyframe || !publisher->config.deltas ? TELEMETRY_FIELDS_ALL : fields,
+                               .robot = robot,
+                               .obstacle = obstacle};
+  publisher->started = true;
+  publisher->robot = robot;
+  publisher->obstacle = obstacle;
+  publisher->stats.sent[class]++;
+  return true;
+}
+
+/* An obstacle point is only reported once it went, so one that never does is offered again */
+static bool prepare_obstacle(publisher_t *publisher, obstacle_t obstacle, robot_t robot, uint64_t now_us,
+                             publish_update_t *update) {
+  if (!prepare(publisher, PUBLISH_OBSTACLE, obstacle, robot, now_us, update)) {
+    return false;
+  }
+  remember(publisher, obstacle);
+  return true;
+}
+
+/* Drops the oldest waiting scan point, classified obstacles are never dropped */
+static bool shed(publisher_t *publisher) {
+  for (size_t i = 0; i < publisher->pending_count; ++i) {
+    if (!unclassified(publisher->pending[(publisher->pending_head + i) % PUBLISHER_PENDING])) {
+      continue;
+    }
+    for (size_t j = i + 1; j < publisher->pending_count; ++j) {
+      publisher->pending[(publisher->pending_head + j - 1) % PUBLISHER_PENDING] =
+          publisher->pending[(publisher->pending_head + j) % PUBLISHER_PENDING];
+    }
+    publisher->pending_count--;
+    publisher->stats.dropped++;
+    return true;
+  }
+  return false;
+}
+
+bool publisher_offer(publisher_t *publisher, obstacle_t obstacle, robot_t robot, uint64_t now_us, publish_update_t *update) {
+  refill(publisher, now_us);
+  publish_class_t class = classify(publisher, obstacle, robot);
+  if (class == PUBLISH_OBSTACLE) {
+    if (known(publisher, obstacle)) {
+      publisher->stats.merged++;
+      return false;
+    }
+    if (publisher->pending_count > 0 || !affordable(publisher, class)) {
+      if (publisher->pending_count == PUBLISHER_PENDING && !shed(publisher)) {
+        if (unclassified(obstacle)) {
+          publisher->stats.dropped++;
+          return false;
+        }
+        /* Only classified obstacles are waiting, the map needs this one more than the budget does */
+        publisher->stats.overdrawn++;
+        return prepare_obstacle(publisher, obstacle, robot, now_us, update);
+      }
+      publisher->pending[(publisher->pending_head + publisher->pending_count++) % PUBLISHER_PENDING] = obstacle;
+      publisher->stats.queued++;
+      return false;
+    }
+    return prepare_obstacle(publisher, obstacle, robot, now_us, update);
+  } else if (class == PUBLISH_POSITION && !affordable(publisher, class)) {
+    publisher->stats.deferred++;
+    return false;
+  }
+  return prepare(publisher, class, obstacle, robot, now_us, update);
+}
+
+bool publisher_pending(publisher_t *publisher, uint64_t now_us, publish_update_t *update) {
+  refill(publisher, now_us);
+  while (publisher->pending_count > 0 && affordable(publisher, PUBLISH_OBSTACLE)) {
+    obstacle_t obstacle = publisher->pending[publisher->pending_head];
+    publisher->pending_head = (publisher->pending_head + 1) % PUBLISHER_PENDING;
+    publisher->pending_count--;
+    /* The robot has moved on since, going back to where it was would only confuse the map */
+    if (prepare_obstacle(publisher, obstacle, publisher->robot, now_us, update)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void publisher_charge(publisher_t *publisher, const publish_update_t *update, size_t bytes) {
+  publisher->stats.bytes[update->class] += bytes;
+  if (publisher->config.rate[update->class] != 0) {
+    publisher->tokens[update->class] -= bytes;
+  }
+}
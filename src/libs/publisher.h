@@ -0,0 +1,116 @@
+#ifndef PUBLISHER_H_
+#define PUBLISHER_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "telemetry.h"
+#include "vtypes.h"
+
+#define PUBLISHER_MEMORY 64  // obstacle points remembered for merging, the oldest are forgotten first
+#define PUBLISHER_PENDING 8  // obstacle points waiting for their budget
+
+/*
+ * Decides which robot and obstacle updates go to the bridge and which fields they carry. Every update is a snapshot
+ * of robot and obstacle as before, the publisher only leaves out what the receiver knows already:
+ *  - updates in which nothing changed after rounding to the resolution,
+ *  - with deltas, the fields that did not change since the last update,
+ *  - obstacle points close to one that was reported already or waits to be,
+ *  - position updates over their byte budget, the next one carries the change.
+ * Obstacle points over their budget wait instead. When too many wait, the oldest scan point is dropped; classified
+ * obstacles are never dropped, they go over the budget if nothing else is left to drop. A dropped point was never
+ * reported, so the next one at its spot goes again. Time is passed in, so a recorded mission can be replayed.
+ */
+
+typedef enum {
+  PUBLISH_STATE,     // the robot status changed, or is not IDLE or MOVING
+  PUBLISH_POSITION,  // the robot moved, nothing was found
+  PUBLISH_OBSTACLE,  // a point a scan saw, or a classified obstacle
+  PUBLISH_CLASSES,
+} publish_class_t;
+
+typedef struct {
+  double resolution;  // cm, positions are rounded to this before they are compared and sent
+  double merge_distance;  // cm, obstacle points closer than this to a reported one are not reported again
+  uint32_t rate[PUBLISH_CLASSES];   // bytes per second, 0 for no limit
+  uint32_t burst[PUBLISH_CLASSES];  // bytes that may go at once after a quiet time
+  uint32_t keyframe_ms;  // all fields go again after this long, so a receiver that lost an update catches up
+  bool deltas;           // the receiver keeps the last snapshot, so unchanged fields can be left out
+} publisher_config_t;
+
+#define PUBLISHER_DEFAULTS                                                                                      \
+  {                                                                                                             \
+    .resolution = 1.0, .merge_distance = 5.0, .rate = {[PUBLISH_POSITION] = 40, [PUBLISH_OBSTACLE] = 200},     \
+    .burst = {[PUBLISH_POSITION] = 300, [PUBLISH_OBSTACLE] = 1000}, .keyframe_ms = 5000, .deltas = false        \
+  }
+
+typedef struct {
+  publish_class_t class;
+  uint8_t fields;  // TELEMETRY_FIELD_* to send, all of them without deltas
+  robot_t robot;   // rounded to the resolution
+  obstacle_t obstacle;
+} publish_update_t;
+
+typedef struct {
+  uint32_t sent[PUBLISH_CLASSES];
+  uint32_t bytes[PUBLISH_CLASSES];
+  uint32_t unchanged;  // updates left out because the receiver knows them
+  uint32_t merged;     // obstacle points close to a reported one
+  uint32_t deferred;   // position updates over their budget
+  uint32_t queued;     // obstacle points that waited for their budget
+  uint32_t dropped;    // scan points left out because too many obstacle points were waiting
+  uint32_t overdrawn;  // classified obstacles sent over the budget because only classified ones were waiting
+  uint32_t keyframes;
+} publisher_stats_t;
+
+typedef struct {
+  double x, y;
+  obs_types type;
+  color_t color;
+} publisher_point_t;
+
+typedef struct {
+  publisher_config_t config;
+  bool started;  // an update was sent since the last reset
+  robot_t robot;  // as last sent
+  obstacle_t obstacle;
+  uint64_t keyframe_us;
+  double tokens[PUBLISH_CLASSES];  // bytes that may go, negative after a message larger than what was left
+  uint64_t refill_us;
+  publisher_point_t memory[PUBLISHER_MEMORY];
+  size_t remembered;
+  obstacle_t pending[PUBLISHER_PENDING];
+  size_t pending_head;
+  size_t pending_count;
+  publisher_stats_t stats;
+} publisher_t;
+
+/**
+ * @brief Starts with full budgets and without anything sent.
+ */
+void publisher_init(publisher_t *publisher, const publisher_config_t *config, uint64_t now_us);
+
+/**
+ * @brief The receiver lost what was sent, the next update carries all fields. Reported obstacles stay reported.
+ */
+void publisher_reset(publisher_t *publisher);
+
+/**
+ * @brief Offers the current robot and obstacle. If it is to go now, it counts as sent.
+ * @param update Filled in with what to send.
+ * @return true if update has to be sent now, followed by publisher_charge
+ */
+bool publisher_offer(publisher_t *publisher, obstacle_t obstacle, robot_t robot, uint64_t now_us, publish_update_t *update);
+
+/**
+ * @brief Takes the oldest waiting obstacle point once its budget allows, with the robot as last sent.
+ * @return true if update has to be sent now, followed by publisher_charge
+ */
+bool publisher_pending(publisher_t *publisher, uint64_t now_us, publish_update_t *update);
+
+/**
+ * @brief Takes the bytes an update needed on the wire from the budget of its class.
+ */
+void publisher_charge(publisher_t *publisher, const publish_update_t *update, size_t bytes);
+
+#endif
@@ -0,0 +1,88 @@
+#include "scheduler.h"
+
+#include <assert.h>
+#include <pthread.h>
+
+#include "measurements.h"
+
+typedef struct {
+  iic_index_t iic;
+  sensor_job_t *jobs;
+  size_t count;
+} lane_t;
+
+/* Runs the jobs of one bus in order */
+static void *run_lane(void *arg) {
+  lane_t *lane = arg;
+  for (size_t i = 0; i < lane->count; ++i) {
+    if (lane->jobs[i].iic == lane->iic) {
+      lane->jobs[i].err = lane->jobs[i].run(lane->jobs[i].arg);
+    }
+  }
+  return NULL;
+}
+
+bool scheduler_run(sensor_job_t *jobs, size_t count) {
+  lane_t lanes[NUM_IICS];
+  pthread_t threads[NUM_IICS];
+  bool threaded[NUM_IICS] = {false};
+  bool used[NUM_IICS] = {false};
+  for (size_t i = 0; i < count; ++i) {
+    used[jobs[i].iic] = true;
+  }
+
+  /* The calling thread takes the first bus with work, every other bus gets a thread */
+  iic_index_t own = NUM_IICS;
+  for (iic_index_t iic = 0; iic < NUM_IICS; ++iic) {
+    if (!used[iic]) {
+      continue;
+    }
+    lanes[iic] = (lane_t){.iic = iic, .jobs = jobs, .count = count};
+    if (own == NUM_IICS) {
+      own = iic;
+    } else if (pthread_create(&threads[iic], NULL, run_lane, &lanes[iic]) == 0) {
+      threaded[iic] = true;
+    } else {
+      ERROR("Could not start a thread for IIC%d, running its jobs after the others", iic);
+    }
+  }
+  if (own != NUM_IICS) {
+    run_lane(&lanes[own]);
+  }
+  for (iic_index_t iic = 0; iic < NUM_IICS; ++iic) {
+    if (threaded[iic]) {
+      pthread_join(threads[iic], NULL);
+    } else if (used[iic] && iic != own) {
+      run_lane(&lanes[iic]);
+    }
+  }
+
+  bool err = 0;
+  for (size_t i = 0; i < count; ++i) {
+    err |= jobs[i].err;
+  }
+  return err;
+}
+
+static bool read_color(void *arg) {
+  color_read_t *read = arg;
+  read->color = tcs3472_determine_color(read->sensor);
+  return read->sensor->conversions_used == 0;
+}
+
+sensor_job_t scheduler_color_job(color_read_t *read) {
+  return (sensor_job_t){.iic = read->sensor->iic, .run = read_color, .arg = read};
+}
+
+static bool read_distances(void *arg) {
+  distance_read_t *read = arg;
+  return vl53l0x_group_read_mean(read->sensors, read->count, &read->reading);
+}
+
+sensor_job_t scheduler_distance_job(distance_read_t *read) {
+  /* The job runs on the lane of one bus, a group spread over both would race the other lane */
+  for (size_t i = 1; i < read->count; ++i) {
+    assert(read->sensors[i]->iic == read->sensors[0]->iic);
+  }
+  return (sensor_job_t){.iic = read->sensors[0]->iic, .run = read_distances, .arg = read};
+}
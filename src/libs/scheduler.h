@@ -0,0 +1,45 @@
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+#include <libpynq.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "TCS3472.h"
+#include "VL53L0X.h"
+
+/* A piece of sensor work that only talks to devices on one bus */
+typedef struct {
+  iic_index_t iic;
+  bool (*run)(void *arg);  // 0 if successful, 1 on error
+  void *arg;
+  bool err;  // [out]
+} sensor_job_t;
+
+typedef struct {
+  tcs3472_t *sensor;
+  color_t color;  // [out]
+} color_read_t;
+
+typedef struct {
+  vl53l0x_t **sensors;  // all on the same bus
+  size_t count;
+  vl53l0x_group_reading_t reading;  // [out] mean of VL53L0X_READING_COUNT group reads, offsets applied
+} distance_read_t;
+
+/**
+ * @brief Runs the jobs, the ones on different buses at the same time. Jobs on one bus run in the order given.
+ * @return 0 if every job succeeded, 1 otherwise
+ */
+bool scheduler_run(sensor_job_t *jobs, size_t count);
+
+/**
+ * @brief Job that determines the color seen by read->sensor.
+ */
+sensor_job_t scheduler_color_job(color_read_t *read);
+
+/**
+ * @brief Job that ranges with read->sensors as one group. The sensors must share a bus, make a job per bus otherwise.
+ */
+sensor_job_t scheduler_distance_job(distance_read_t *read);
+
+#endif
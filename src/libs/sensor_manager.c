@@ -0,0 +1,135 @@
+#include "sensor_manager.h"
+
+#include <pthread.h>
+
+#include "measurements.h"
+
+typedef struct {
+  const char *name;
+  sensor_health_t *health;
+  bool (*recover)(void *device);
+  void *device;
+  uint32_t capabilities;
+  uint64_t next_probe_us;  // 0 while the sensor is usable
+  uint32_t interval_ms;
+  _Atomic uint32_t probes;
+  _Atomic uint32_t recoveries;
+} entry_t;
+
+/* Entries are only added before the manager starts, after that the thread and the readers just look */
+static entry_t entries[SENSOR_MANAGER_MAX];
+static size_t entry_count;
+static pthread_t thread;
+static atomic_bool running;
+
+void sensor_health_record(sensor_health_t *health, bool err) {
+  if (!err) {
+    atomic_store_explicit(&health->consecutive_errors, 0, memory_order_relaxed);
+    atomic_store_explicit(&health->last_good_us, get_time_usec(), memory_order_relaxed);
+    return;
+  }
+  atomic_fetch_add_explicit(&health->errors, 1, memory_order_relaxed);
+  if (atomic_fetch_add_explicit(&health->consecutive_errors, 1, memory_order_relaxed) + 1 >= SENSOR_MAX_ERRORS) {
+    sensor_health_quarantine(health);
+  }
+}
+
+void sensor_health_quarantine(sensor_health_t *health) {
+  atomic_store_explicit(&health->quarantined, true, memory_order_release);
+}
+
+void sensor_health_withdraw(sensor_health_t *health) {
+  atomic_store(&health->quarantined, true);
+  while (atomic_load(&health->readers) > 0) {
+    sleep_msec(1);
+  }
+}
+
+size_t sensor_manager_add(const char *name, sensor_health_t *health, bool (*recover)(void *device), void *device,
+                          uint32_t capabilities) {
+  if (entry_count == SENSOR_MANAGER_MAX || atomic_load(&running)) {
+    ERROR("Cannot add sensor %s", name);
+    return SENSOR_MANAGER_MAX;
+  }
+  entries[entry_count] = (entry_t){.name = name,
+                                   .health = health,
+                                   .recover = recover,
+                                   .device = device,
+                                   .capabilities = capabilities,
+                                   .interval_ms = SENSOR_PROBE_MIN_MS};
+  return entry_count++;
+}
+
+static void probe(entry_t *entry, uint64_t now) {
+  if (entry->next_probe_us == 0) {
+    LOG("Sensor %s quarantined after %u errors", entry->name, atomic_load(&entry->health->consecutive_errors));
+    entry->interval_ms = SENSOR_PROBE_MIN_MS;
+    entry->next_probe_us = now + entry->interval_ms * 1000;
+    return;
+  }
+  if (now < entry->next_probe_us) {
+    return;
+  }
+  atomic_fetch_add(&entry->probes, 1);
+  if (entry->recover(entry->device)) {
+    entry->interval_ms = entry->interval_ms * 2 < SENSOR_PROBE_MAX_MS ? entry->interval_ms * 2 : SENSOR_PROBE_MAX_MS;
+    entry->next_probe_us = get_time_usec() + entry->interval_ms * 1000;
+    return;
+  }
+  atomic_fetch_add(&entry->recoveries, 1);
+  entry->next_probe_us = 0;
+  atomic_store_explicit(&entry->health->consecutive_errors, 0, memory_order_relaxed);
+  atomic_store_explicit(&entry->health->last_good_us, get_time_usec(), memory_order_relaxed);
+  atomic_store_explicit(&entry->health->quarantined, false, memory_order_release);
+  LOG("Sensor %s is back", entry->name);
+}
+
+static void *manager_main(void *arg) {
+  (void)arg;
+  while (atomic_load(&running)) {
+    for (size_t i = 0; i < entry_count; ++i) {
+      if (!sensor_health_usable(entries[i].health)) {
+        probe(&entries[i], get_time_usec());
+      }
+    }
+    sleep_msec(SENSOR_MANAGER_PERIOD_MS);
+  }
+  return NULL;
+}
+
+bool sensor_manager_start(void) {
+  atomic_store(&running, true);
+  if (pthread_create(&thread, NULL, manager_main, NULL) != 0) {
+    atomic_store(&running, false);
+    ERROR("Could not start the sensor manager");
+    return 1;
+  }
+  return 0;
+}
+
+void sensor_manager_stop(void) {
+  if (atomic_exchange(&running, false)) {
+    pthread_join(thread, NULL);
+  }
+  entry_count = 0;
+}
+
+uint32_t sensor_manager_capabilities(void) {
+  uint32_t capabilities = 0;
+  for (size_t i = 0; i < entry_count; ++i) {
+    if (sensor_health_usable(entries[i].health)) {
+      capabilities |= entries[i].capabilities;
+    }
+  }
+  return capabilities;
+}
+
+sensor_stats_t sensor_manager_stats(size_t id) {
+  sensor_health_t *health = entries[id].health;
+  return (sensor_stats_t){.quarantined = !sensor_health_usable(health),
+                          .consecutive_errors = atomic_load(&health->consecutive_errors),
+                          .errors = atomic_load(&health->errors),
+                          .last_good_us = atomic_load(&health->last_good_us),
+                          .probes = atomic_load(&entries[id].probes),
+                          .recoveries = atomic_load(&entries[id].recoveries)};
+}
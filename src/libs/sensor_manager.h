@@ -0,0 +1,105 @@
+#ifndef SENSOR_MANAGER_H_
+#define SENSOR_MANAGER_H_
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SENSOR_MAX_ERRORS 3          // consecutive failed reads before a sensor is quarantined
+#define SENSOR_MANAGER_MAX 8         // sensors the manager keeps track of
+#define SENSOR_MANAGER_PERIOD_MS 20  // how often the manager looks at the quarantined sensors
+#define SENSOR_PROBE_MIN_MS 100      // first re-probe after a sensor is quarantined
+#define SENSOR_PROBE_MAX_MS 5000     // re-probes of a sensor that stays away back off up to this
+
+/* Kept by every driver and updated on each read, so it is safe to look at from any thread */
+typedef struct {
+  _Atomic uint32_t consecutive_errors;
+  _Atomic uint32_t errors;
+  _Atomic uint64_t last_good_us;  // see get_time_usec(), 0 before the first good read
+  atomic_bool quarantined;        // not to be used until the manager brought it back
+  atomic_uint readers;            // reads going on now, see sensor_health_claim
+} sensor_health_t;
+
+typedef struct {
+  bool quarantined;
+  uint32_t consecutive_errors;
+  uint32_t errors;
+  uint64_t last_good_us;
+  uint32_t probes;      // recovery attempts
+  uint32_t recoveries;  // successful ones
+} sensor_stats_t;
+
+/**
+ * @brief Counts a read of the sensor, SENSOR_MAX_ERRORS failures in a row quarantine it.
+ */
+void sensor_health_record(sensor_health_t *health, bool err);
+
+/**
+ * @brief Takes the sensor out of use right away, e.g. when it did not come up. The manager re-probes it.
+ */
+void sensor_health_quarantine(sensor_health_t *health);
+
+/**
+ * @return true if the sensor may be read
+ */
+static inline bool sensor_health_usable(sensor_health_t *health) {
+  return !atomic_load_explicit(&health->quarantined, memory_order_acquire);
+}
+
+/**
+ * @brief Marks a read of the sensor as going on, unless it is quarantined. Reads that take a while claim the sensor,
+ * so it is not reset from under them, see sensor_health_withdraw.
+ * @return true if the sensor may be read, followed by sensor_health_release once the read is done
+ */
+static inline bool sensor_health_claim(sensor_health_t *health) {
+  atomic_fetch_add(&health->readers, 1);
+  if (atomic_load(&health->quarantined)) {
+    atomic_fetch_sub(&health->readers, 1);
+    return false;
+  }
+  return true;
+}
+
+static inline void sensor_health_release(sensor_health_t *health) { atomic_fetch_sub(&health->readers, 1); }
+
+/**
+ * @brief Quarantines the sensor and waits until the reads that claimed it are done, so it can be reset.
+ */
+void sensor_health_withdraw(sensor_health_t *health);
+
+/**
+ * @brief Registers a sensor. Once it is quarantined the manager calls recover(device) in the background, first
+ * after SENSOR_PROBE_MIN_MS and then with doubling intervals up to SENSOR_PROBE_MAX_MS, until it returns 0.
+ * @param name For the log.
+ * @param health The health record of the sensor, updated by its driver.
+ * @param recover Probes and re-initialises the device, 0 if it works again. Only ever called while the sensor is
+ * quarantined, so nothing else uses the device at the same time.
+ * @param device Passed to recover.
+ * @param capabilities What the rover can do with this sensor, sensor_manager_capabilities combines them.
+ * @return The id of the sensor, SENSOR_MANAGER_MAX if there is no room
+ */
+size_t sensor_manager_add(const char *name, sensor_health_t *health, bool (*recover)(void *device), void *device,
+                          uint32_t capabilities);
+
+/**
+ * @brief Starts the background thread that brings quarantined sensors back.
+ * @return 0 if successful, 1 on error
+ */
+bool sensor_manager_start(void);
+
+/**
+ * @brief Stops the background thread and forgets all sensors.
+ */
+void sensor_manager_stop(void);
+
+/**
+ * @return The capabilities of all sensors that are usable now
+ */
+uint32_t sensor_manager_capabilities(void);
+
+/**
+ * @brief Health and recovery counters of a registered sensor.
+ */
+sensor_stats_t sensor_manager_stats(size_t id);
+
+#endif
@@ -0,0 +1,121 @@
+#include "sensor_recovery.h"
+
+#include <string.h>
+
+#include "i2c.h"
+#include "measurements.h"
+#include "sensor_manager.h"
+#include "src/settings.h"
+#include "timeline.h"
+
+/* Set once before the sensor manager starts, only its thread uses them after that */
+static vl53l0x_t **distance_sensors;
+static tcs3472_t **color_sensors;
+
+bool shares_bus_with_distance(iic_index_t iic, size_t distance_count) {
+  for (size_t i = 0; i < distance_count; ++i) {
+    if (distance_sensor_buses[i] == iic) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void sensor_recovery_init(vl53l0x_t **distance, tcs3472_t **color) {
+  distance_sensors = distance;
+  color_sensors = color;
+}
+
+/* Brings up a sensor that answers on its address again, with its timing budget and ranging */
+static bool restart_distance_sensor(vl53l0x_t *sensor) {
+  if (vl53l0x_reinit(sensor)) {
+    return 1;
+  }
+  // One that never came up was not ranging yet
+  return !sensor->continuous && vl53l0x_start_continuous(sensor, 0);
+}
+
+typedef struct {
+  size_t index[VL53L0X_SENSOR_COUNT];    // of the sensor in each slot
+  bool restarted[VL53L0X_SENSOR_COUNT];  // by sensor index
+} readdressed_t;
+
+/* A sensor that was moved back forgot its tuning and mode as well */
+static void restart_moved(size_t slot, bool err, void *arg) {
+  readdressed_t *readdressed = arg;
+  size_t index = readdressed->index[slot];
+  if (err) {
+    ERROR("Could not move distance sensor %zu back to 0x%02x", index, distance_sensors[index]->address);
+    return;
+  }
+  readdressed->restarted[index] = !restart_distance_sensor(distance_sensors[index]);
+}
+
+/*
+ * Gives quarantined distance sensors that do not answer on their address their address back, with the forward
+ * color sensor held in reset and without its register shadow if it shares their bus. Everything that is reset is
+ * withdrawn first, so no read is going on. A sensor that is still in use but does not answer either may be on the
+ * default address too, so nothing is moved until it is quarantined as well. Sensors that do not answer at all stay
+ * in reset, out of the way of the color sensor.
+ * @param restarted Set for the sensors that were moved and initialised again. [out]
+ * @return 0 if no sensor is lost or all lost ones were moved back, 1 otherwise
+ */
+static bool readdress_distance_sensors(bool *restarted) {
+  vl53l0x_slot_t slots[VL53L0X_SENSOR_COUNT];
+  readdressed_t readdressed = {0};
+  size_t count = 0;
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    vl53l0x_t *sensor = distance_sensors[i];
+    if (!vl53l0x_wait_ready(sensor->address, 0, sensor->iic)) {
+      continue;
+    }
+    if (sensor_health_usable(&sensor->health)) {
+      return 1;
+    }
+    readdressed.index[count] = i;
+    slots[count++] = (vl53l0x_slot_t){.xshut_pin = distance_sensor_x_pins[i], .address = sensor->address, .iic = sensor->iic};
+  }
+  if (count == 0) {
+    return 0;
+  }
+  size_t phase = timeline_begin("distance readdress");
+  for (size_t i = 0; i < count; ++i) {
+    sensor_health_withdraw(&distance_sensors[readdressed.index[i]]->health);
+  }
+  tcs3472_t *color = color_sensors[FORWARD_LOOKING];
+  bool shared = shares_bus_with_distance(color->iic, VL53L0X_SENSOR_COUNT);
+  if (shared) {
+    sensor_health_withdraw(&color->health);
+    gpio_set_level(COLOR_SENSOR_X_PIN, GPIO_LEVEL_LOW);
+    /* Its shadow would answer for the distance sensors booting on its address, tcs3472_reinit sets it up again */
+    i2c_shadow_disable(TCS3472_ADDR, color->iic);
+  }
+  bool err = vl53l0x_assign_addresses(slots, count, restart_moved, &readdressed);
+  if (shared) {
+    gpio_set_level(COLOR_SENSOR_X_PIN, GPIO_LEVEL_HIGH);
+  }
+  timeline_end(phase);
+  memcpy(restarted, readdressed.restarted, sizeof(readdressed.restarted));
+  return err;
+}
+
+bool sensor_recovery_distance(void *device) {
+  vl53l0x_t *sensor = device;
+  bool restarted[VL53L0X_SENSOR_COUNT] = {false};
+  readdress_distance_sensors(restarted);
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    if (distance_sensors[i] == sensor && restarted[i]) {
+      return 0;
+    }
+  }
+  return restart_distance_sensor(sensor);
+}
+
+bool sensor_recovery_color(void *device) {
+  tcs3472_t *sensor = device;
+  if (sensor == color_sensors[FORWARD_LOOKING]) {
+    bool restarted[VL53L0X_SENSOR_COUNT];
+    readdress_distance_sensors(restarted);
+  }
+  return tcs3472_reinit(sensor);
+}
@@ -0,0 +1,42 @@
+#ifndef SENSOR_RECOVERY_H_
+#define SENSOR_RECOVERY_H_
+#include <libpynq.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "TCS3472.h"
+#include "VL53L0X.h"
+
+/*
+ * Brings the rover's sensors back for the sensor manager. A brown-out resets distance sensors to the default
+ * address, which the forward color sensor also uses, so bringing one back can take the forward color sensor out of
+ * use for a moment. The XSHUT pins and buses are the ones in settings.h.
+ */
+
+/**
+ * @return true if a color sensor on iic shares the default address with one of the first distance_count sensors
+ */
+bool shares_bus_with_distance(iic_index_t iic, size_t distance_count);
+
+/**
+ * @brief Sets the sensors to bring back, before the sensor manager starts.
+ * @param distance VL53L0X_SENSOR_COUNT sensors, by their index in settings.h.
+ * @param color The FORWARD_LOOKING and DOWN_LOOKING sensors.
+ */
+void sensor_recovery_init(vl53l0x_t **distance, tcs3472_t **color);
+
+/**
+ * @brief Recovers a distance sensor for sensor_manager_add. Quarantined sensors that lost their address get it back
+ * first, each of them initialised again at once.
+ * @return 0 if the sensor ranges again, 1 otherwise
+ */
+bool sensor_recovery_distance(void *device);
+
+/**
+ * @brief Recovers a color sensor for sensor_manager_add. For the forward one, distance sensors that lost their
+ * address get it back first, they would answer for it otherwise.
+ * @return 0 if the sensor is enabled again, 1 otherwise
+ */
+bool sensor_recovery_color(void *device);
+
+#endif
@@ -0,0 +1,189 @@
+#include "telemetry.h"
+
+#include <math.h>
+#include <string.h>
+
+uint16_t telemetry_crc16(const uint8_t *data, size_t length) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < length; ++i) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static void put16(uint8_t *buffer, uint16_t value) {
+  buffer[0] = value & 0xFF;
+  buffer[1] = value >> 8;
+}
+
+static uint16_t get16(const uint8_t *buffer) { return buffer[0] | (uint16_t)buffer[1] << 8; }
+
+/* Where every TELEMETRY_FIELD_* is in an encoded status, by bit */
+#define TELEMETRY_FIELD_COUNT 7
+static const uint8_t field_offsets[TELEMETRY_FIELD_COUNT] = {0, 2, 4, 5, 7, 9, 10};
+static const uint8_t field_sizes[TELEMETRY_FIELD_COUNT] = {2, 2, 1, 2, 2, 1, 1};
+
+size_t telemetry_encode(uint8_t *buffer, uint8_t type, uint8_t sequence, const uint8_t *payload, uint8_t length) {
+  if (length > TELEMETRY_MAX_PAYLOAD) {
+    return 0;
+  }
+  buffer[0] = TELEMETRY_SYNC;
+  buffer[1] = TELEMETRY_VERSION;
+  buffer[2] = type;
+  buffer[3] = sequence;
+  buffer[4] = length;
+  memcpy(buffer + TELEMETRY_HEADER_SIZE, payload, length);
+  put16(buffer + TELEMETRY_HEADER_SIZE + length, telemetry_crc16(buffer + 1, TELEMETRY_HEADER_SIZE - 1 + length));
+  return TELEMETRY_HEADER_SIZE + length + TELEMETRY_CRC_SIZE;
+}
+
+static void put_status(uint8_t *payload, const telemetry_status_t *status) {
+  put16(payload, status->robot_x);
+  put16(payload + 2, status->robot_y);
+  payload[4] = status->robot_status;
+  put16(payload + 5, status->obstacle_x);
+  put16(payload + 7, status->obstacle_y);
+  payload[9] = status->obstacle_type;
+  payload[10] = status->obstacle_color;
+}
+
+static void get_status(const uint8_t *payload, telemetry_status_t *status) {
+  status->robot_x = get16(payload);
+  status->robot_y = get16(payload + 2);
+  status->robot_status = payload[4];
+  status->obstacle_x = get16(payload + 5);
+  status->obstacle_y = get16(payload + 7);
+  status->obstacle_type = payload[9];
+  status->obstacle_color = payload[10];
+}
+
+size_t telemetry_encode_status(uint8_t *buffer, uint8_t sequence, const telemetry_status_t *status) {
+  uint8_t payload[TELEMETRY_STATUS_SIZE];
+  put_status(payload, status);
+  return telemetry_encode(buffer, TELEMETRY_STATUS, sequence, payload, sizeof(payload));
+}
+
+bool telemetry_decode_status(const telemetry_frame_t *frame, telemetry_status_t *status) {
+  if (frame->type != TELEMETRY_STATUS || frame->length < TELEMETRY_STATUS_SIZE) {
+    return 1;
+  }
+  get_status(frame->payload, status);
+  return 0;
+}
+
+size_t telemetry_encode_delta(uint8_t *buffer, uint8_t sequence, uint8_t fields, const telemetry_status_t *status) {
+  uint8_t full[TELEMETRY_STATUS_SIZE];
+  put_status(full, status);
+  uint8_t payload[1 + TELEMETRY_STATUS_SIZE];
+  uint8_t length = 0;
+  payload[length++] = fields & TELEMETRY_FIELDS_ALL;
+  for (size_t field = 0; field < TELEMETRY_FIELD_COUNT; ++field) {
+    if (fields & (1 << field)) {
+      memcpy(payload + length, full + field_offsets[field], field_sizes[field]);
+      length += field_sizes[field];
+    }
+  }
+  return telemetry_encode(buffer, TELEMETRY_DELTA, sequence, payload, length);
+}
+
+bool telemetry_apply(const telemetry_frame_t *frame, telemetry_status_t *status) {
+  if (frame->type == TELEMETRY_STATUS) {
+    return telemetry_decode_status(frame, status);
+  }
+  if (frame->type != TELEMETRY_DELTA || frame->length < 1) {
+    return 1;
+  }
+  uint8_t fields = frame->payload[0];
+  size_t length = 1;
+  for (size_t field = 0; field < TELEMETRY_FIELD_COUNT; ++field) {
+    length += fields & (1 << field) ? field_sizes[field] : 0;
+  }
+  if (frame->length < length) {
+    return 1;
+  }
+  /* Present fields go over the current ones in encoded form */
+  uint8_t full[TELEMETRY_STATUS_SIZE];
+  put_status(full, status);
+  const uint8_t *value = frame->payload + 1;
+  for (size_t field = 0; field < TELEMETRY_FIELD_COUNT; ++field) {
+    if (fields & (1 << field)) {
+      memcpy(full + field_offsets[field], value, field_sizes[field]);
+      value += field_sizes[field];
+    }
+  }
+  get_status(full, status);
+  return 0;
+}
+
+int16_t telemetry_position(double value, double none) {
+  if (value == none) {
+    return TELEMETRY_NONE_POSITION;
+  }
+  double scaled = round(value * TELEMETRY_POSITION_SCALE);
+  if (scaled >= INT16_MAX) {
+    return INT16_MAX;
+  }
+  if (scaled <= INT16_MIN + 1) {
+    return INT16_MIN + 1;
+  }
+  return scaled;
+}
+
+void telemetry_decoder_reset(telemetry_decoder_t *decoder) { decoder->received = 0; }
+
+/* Drops the first count buffered bytes */
+static void discard(telemetry_decoder_t *decoder, size_t count) {
+  memmove(decoder->buffer, decoder->buffer + count, decoder->received - count);
+  decoder->received -= count;
+}
+
+bool telemetry_decoder_push(telemetry_decoder_t *decoder, uint8_t byte, telemetry_frame_t *frame) {
+  decoder->buffer[decoder->received++] = byte;
+  while (decoder->received > 0) {
+    uint8_t *buffer = decoder->buffer;
+    if (buffer[0] != TELEMETRY_SYNC) {
+      size_t count = 1;
+      while (count < decoder->received && buffer[count] != TELEMETRY_SYNC) {
+        count++;
+      }
+      decoder->skipped += count;
+      discard(decoder, count);
+      continue;
+    }
+    if (decoder->received < TELEMETRY_HEADER_SIZE) {
+      return false;
+    }
+    uint8_t length = buffer[4];
+    if (buffer[1] != TELEMETRY_VERSION || length > TELEMETRY_MAX_PAYLOAD) {
+      decoder->bad_frames++;
+      discard(decoder, 1);
+      continue;
+    }
+    size_t size = TELEMETRY_HEADER_SIZE + length + TELEMETRY_CRC_SIZE;
+    if (decoder->received < size) {
+      return false;
+    }
+    if (get16(buffer + TELEMETRY_HEADER_SIZE + length) != telemetry_crc16(buffer + 1, TELEMETRY_HEADER_SIZE - 1 + length)) {
+      decoder->crc_errors++;
+      discard(decoder, 1);
+      continue;
+    }
+
+    frame->type = buffer[2];
+    frame->sequence = buffer[3];
+    frame->length = length;
+    memcpy(frame->payload, buffer + TELEMETRY_HEADER_SIZE, length);
+    if (decoder->synced) {
+      decoder->lost += (uint8_t)(frame->sequence - decoder->next_sequence);
+    }
+    decoder->synced = true;
+    decoder->next_sequence = frame->sequence + 1;
+    decoder->frames++;
+    discard(decoder, size);
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,130 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Binary frames for the UART link to the ESP32 bridge. Only depends on the C library, so the bridge can build the
+ * same file. All fields are little endian:
+ *
+ *   sync | version | type | sequence | length | payload (length bytes) | CRC-16 of version..payload
+ *
+ * The CRC is CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF).
+ */
+
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_SYNC 0xA5
+#define TELEMETRY_HEADER_SIZE 5
+#define TELEMETRY_CRC_SIZE 2
+#define TELEMETRY_MAX_PAYLOAD 32
+#define TELEMETRY_MAX_FRAME (TELEMETRY_HEADER_SIZE + TELEMETRY_MAX_PAYLOAD + TELEMETRY_CRC_SIZE)
+
+#define TELEMETRY_POSITION_SCALE 10  // positions go over the wire in tenths of a centimetre
+#define TELEMETRY_NONE_POSITION INT16_MIN
+#define TELEMETRY_NONE_BYTE 0xFF
+
+#define TELEMETRY_PROTO_DELTA 2  // "proto" of a bridge that keeps the last status and applies TELEMETRY_DELTA frames
+
+typedef enum {
+  TELEMETRY_STATUS = 1,  // telemetry_status_t
+  TELEMETRY_DELTA = 2,   // a byte of TELEMETRY_FIELD_* bits, then only those fields in telemetry_status_t order
+} telemetry_type_t;
+
+/* Fields of a status, in the order they are encoded */
+#define TELEMETRY_FIELD_ROBOT_X 0x01
+#define TELEMETRY_FIELD_ROBOT_Y 0x02
+#define TELEMETRY_FIELD_ROBOT_STATUS 0x04
+#define TELEMETRY_FIELD_OBSTACLE_X 0x08
+#define TELEMETRY_FIELD_OBSTACLE_Y 0x10
+#define TELEMETRY_FIELD_OBSTACLE_TYPE 0x20
+#define TELEMETRY_FIELD_OBSTACLE_COLOR 0x40
+#define TELEMETRY_FIELDS_ALL 0x7F
+
+/* Robot and obstacle as sent, values that are not set are TELEMETRY_NONE_* */
+typedef struct {
+  int16_t robot_x, robot_y;
+  uint8_t robot_status;
+  int16_t obstacle_x, obstacle_y;
+  uint8_t obstacle_type;
+  uint8_t obstacle_color;
+} telemetry_status_t;
+
+#define TELEMETRY_STATUS_SIZE 11
+
+typedef struct {
+  uint8_t type;
+  uint8_t sequence;
+  uint8_t length;
+  uint8_t payload[TELEMETRY_MAX_PAYLOAD];
+} telemetry_frame_t;
+
+/* Holds what arrived of the current frame, a bad frame is searched again for a sync after its first byte */
+typedef struct {
+  uint8_t buffer[TELEMETRY_MAX_FRAME];
+  size_t received;
+  bool synced;  // a frame was received before, so the next sequence number is known
+  uint8_t next_sequence;
+  uint32_t frames;
+  uint32_t crc_errors;
+  uint32_t bad_frames;  // unknown version or too long
+  uint32_t skipped;     // bytes thrown away while looking for a frame
+  uint32_t lost;        // frames missing according to the sequence numbers
+} telemetry_decoder_t;
+
+/**
+ * @return The CRC-16/CCITT-FALSE of data
+ */
+uint16_t telemetry_crc16(const uint8_t *data, size_t length);
+
+/**
+ * @brief Frames a payload.
+ * @param buffer At least TELEMETRY_HEADER_SIZE + length + TELEMETRY_CRC_SIZE bytes.
+ * @return The size of the frame, 0 if the payload is longer than TELEMETRY_MAX_PAYLOAD
+ */
+size_t telemetry_encode(uint8_t *buffer, uint8_t type, uint8_t sequence, const uint8_t *payload, uint8_t length);
+
+/**
+ * @brief Frames a status record.
+ * @param buffer At least TELEMETRY_MAX_FRAME bytes.
+ * @return The size of the frame
+ */
+size_t telemetry_encode_status(uint8_t *buffer, uint8_t sequence, const telemetry_status_t *status);
+
+/**
+ * @brief Reads the status record out of a frame.
+ * @return 0 if successful, 1 if it is not a status frame
+ */
+bool telemetry_decode_status(const telemetry_frame_t *frame, telemetry_status_t *status);
+
+/**
+ * @brief Frames only the given fields of a status record.
+ * @param buffer At least TELEMETRY_MAX_FRAME bytes.
+ * @return The size of the frame
+ */
+size_t telemetry_encode_delta(uint8_t *buffer, uint8_t sequence, uint8_t fields, const telemetry_status_t *status);
+
+/**
+ * @brief Updates the fields a status or delta frame carries, and leaves the others as they are.
+ * @return 0 if successful, 1 if it is neither or too short for its fields
+ */
+bool telemetry_apply(const telemetry_frame_t *frame, telemetry_status_t *status);
+
+/**
+ * @brief Converts a position to what goes over the wire, none stays none and the rest saturates.
+ */
+int16_t telemetry_position(double value, double none);
+
+/**
+ * @brief Starts looking for the next frame, keeps the counters.
+ */
+void telemetry_decoder_reset(telemetry_decoder_t *decoder);
+
+/**
+ * @brief Feeds one received byte to the decoder, which drops bytes until the next sync and frames with a bad CRC.
+ * @param frame Filled in once a whole frame arrived.
+ * @return true if frame holds a new frame
+ */
+bool telemetry_decoder_push(telemetry_decoder_t *decoder, uint8_t byte, telemetry_frame_t *frame);
+
+#endif
@@ -0,0 +1,59 @@
+#include "timeline.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "measurements.h"
+
+static timeline_phase_t phases[TIMELINE_MAX_PHASES];
+static size_t phase_count = 0;
+static uint64_t origin_us = 0;
+static pthread_mutex_t timeline_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void timeline_reset(void) {
+  pthread_mutex_lock(&timeline_lock);
+  phase_count = 0;
+  origin_us = get_time_usec();
+  pthread_mutex_unlock(&timeline_lock);
+}
+
+size_t timeline_begin(const char *fmt, ...) {
+  pthread_mutex_lock(&timeline_lock);
+  size_t phase = phase_count;
+  if (phase < TIMELINE_MAX_PHASES) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(phases[phase].name, TIMELINE_NAME_LENGTH, fmt, args);
+    va_end(args);
+    phases[phase].start_us = get_time_usec();
+    phases[phase].end_us = 0;
+    phase_count++;
+  }
+  pthread_mutex_unlock(&timeline_lock);
+  return phase;
+}
+
+void timeline_end(size_t phase) {
+  if (phase >= TIMELINE_MAX_PHASES) {
+    return;
+  }
+  pthread_mutex_lock(&timeline_lock);
+  phases[phase].end_us = get_time_usec();
+  pthread_mutex_unlock(&timeline_lock);
+}
+
+void timeline_print(void) {
+  pthread_mutex_lock(&timeline_lock);
+  fprintf(stderr, "%s: [TIMELINE] %-28s %9s %9s %9s\n", name, "phase", "start", "end", "took");
+  for (size_t i = 0; i < phase_count; ++i) {
+    const timeline_phase_t *p = &phases[i];
+    if (p->end_us == 0) {
+      fprintf(stderr, "%s: [TIMELINE] %-28s %9.1f %9s %9s\n", name, p->name, (p->start_us - origin_us) / 1000.0, "-", "-");
+      continue;
+    }
+    fprintf(stderr, "%s: [TIMELINE] %-28s %9.1f %9.1f %9.1f\n", name, p->name, (p->start_us - origin_us) / 1000.0,
+            (p->end_us - origin_us) / 1000.0, (p->end_us - p->start_us) / 1000.0);
+  }
+  pthread_mutex_unlock(&timeline_lock);
+}
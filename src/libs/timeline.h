@@ -0,0 +1,38 @@
+#ifndef TIMELINE_H_
+#define TIMELINE_H_
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMELINE_MAX_PHASES 32
+
+#define TIMELINE_NAME_LENGTH 32
+
+typedef struct {
+  char name[TIMELINE_NAME_LENGTH];
+  uint64_t start_us;
+  uint64_t end_us;
+} timeline_phase_t;
+
+/**
+ * @brief Resets the timeline, all phases are reported relative to this moment.
+ */
+void timeline_reset(void);
+
+/**
+ * @brief Marks the start of a phase. Can be called from any thread.
+ * @param fmt printf-like name of the phase, cut off at TIMELINE_NAME_LENGTH.
+ * @return The phase to pass to timeline_end, or TIMELINE_MAX_PHASES if the timeline is full.
+ */
+size_t timeline_begin(const char *fmt, ...);
+
+/**
+ * @brief Marks the end of a phase started with timeline_begin.
+ */
+void timeline_end(size_t phase);
+
+/**
+ * @brief Prints every phase with its start, end and duration in milliseconds.
+ */
+void timeline_print(void);
+
+#endif
@@ -0,0 +1,132 @@
+#include "uart_rx.h"
+
+#include <libpynq.h>
+#include <string.h>
+
+#include "measurements.h"
+
+void uart_rx_init(uart_rx_t *rx, uart_rx_format_t format) {
+  memset(rx, 0, sizeof(*rx));
+  rx->format = format;
+}
+
+void uart_rx_set_format(uart_rx_t *rx, uart_rx_format_t format) {
+  rx->format = format;
+  rx->received = 0;
+  telemetry_decoder_reset(&rx->frames);
+}
+
+void uart_rx_on_json(uart_rx_t *rx, uart_rx_json_handler_t handler, void *arg) {
+  rx->on_json = handler;
+  rx->json_arg = arg;
+}
+
+bool uart_rx_on_frame(uart_rx_t *rx, uint8_t type, uart_rx_frame_handler_t handler, void *arg) {
+  if (type >= UART_RX_MAX_TYPES) {
+    return 1;
+  }
+  rx->on_frame[type] = handler;
+  rx->frame_arg[type] = arg;
+  return 0;
+}
+
+/* Drops the first count buffered bytes */
+static void discard(uart_rx_t *rx, size_t count) {
+  memmove(rx->buffer, rx->buffer + count, rx->received - count);
+  rx->received -= count;
+}
+
+/* Looks for a whole JSON message at the start of the buffer, and throws away what cannot be the start of one */
+static bool parse_json(uart_rx_t *rx) {
+  while (rx->received >= UART_RX_PREFIX) {
+    uint8_t *buffer = rx->buffer;
+    uint32_t length = buffer[0] | buffer[1] << 8 | buffer[2] << 16 | (uint32_t)buffer[3] << 24;
+    bool valid = length >= 2 && length <= UART_RX_MAX_JSON;
+    valid = valid && (rx->received == UART_RX_PREFIX || buffer[UART_RX_PREFIX] == '{');
+    valid = valid && (rx->received < UART_RX_PREFIX + length || buffer[UART_RX_PREFIX + length - 1] == '}');
+    if (!valid) {
+      rx->stats.invalid += !rx->resyncing;
+      rx->resyncing = true;
+      rx->stats.skipped++;
+      discard(rx, 1);
+      continue;
+    }
+    if (rx->received < UART_RX_PREFIX + length) {
+      return false;
+    }
+    /* Bytes after the message are left over from a resync, they are parsed next time */
+    uint8_t next = buffer[UART_RX_PREFIX + length];
+    buffer[UART_RX_PREFIX + length] = '\0';
+    rx->stats.messages++;
+    if (rx->on_json != NULL) {
+      rx->on_json((const char *)buffer + UART_RX_PREFIX, length, rx->json_arg);
+    }
+    buffer[UART_RX_PREFIX + length] = next;
+    discard(rx, UART_RX_PREFIX + length);
+    rx->resyncing = false;
+    return true;
+  }
+  return false;
+}
+
+static bool push(uart_rx_t *rx, uint8_t byte) {
+  if (rx->format == UART_RX_FRAMES) {
+    telemetry_frame_t frame;
+    if (!telemetry_decoder_push(&rx->frames, byte, &frame)) {
+      return false;
+    }
+    rx->stats.messages++;
+    if (frame.type < UART_RX_MAX_TYPES && rx->on_frame[frame.type] != NULL) {
+      rx->on_frame[frame.type](&frame, rx->frame_arg[frame.type]);
+    }
+    return true;
+  }
+  rx->buffer[rx->received++] = byte;
+  return parse_json(rx);
+}
+
+/* A whole message may be left over from the resync that dispatched the one before */
+static bool parse_left_over(uart_rx_t *rx) { return rx->format == UART_RX_JSON && parse_json(rx); }
+
+size_t uart_rx_feed(uart_rx_t *rx, const uint8_t *data, size_t length) {
+  if (parse_left_over(rx)) {
+    return 0;
+  }
+  if (length > 0) {
+    rx->last_byte_us = get_time_usec();
+  }
+  for (size_t i = 0; i < length; ++i) {
+    if (push(rx, data[i])) {
+      return i + 1;
+    }
+  }
+  return length;
+}
+
+bool uart_rx_expire(uart_rx_t *rx, uint64_t now_us) {
+  bool partial = rx->format == UART_RX_FRAMES ? rx->frames.received > 0 : rx->received > 0;
+  if (!partial || now_us - rx->last_byte_us < UART_RX_TIMEOUT_MS * 1000ull) {
+    return false;
+  }
+  rx->stats.timeouts++;
+  rx->received = 0;
+  telemetry_decoder_reset(&rx->frames);
+  return true;
+}
+
+bool uart_rx_poll(uart_rx_t *rx, const int uart) {
+  if (parse_left_over(rx)) {
+    return true;
+  }
+  if (!uart_has_data(uart)) {
+    uart_rx_expire(rx, get_time_usec());
+    return false;
+  }
+  rx->last_byte_us = get_time_usec();
+  while (uart_has_data(uart)) {
+    if (push(rx, uart_recv(uart))) {
+      return true;
+    }
+  }
+  return false;
+}
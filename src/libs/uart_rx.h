@@ -0,0 +1,82 @@
+#ifndef UART_RX_H_
+#define UART_RX_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "telemetry.h"
+
+#define UART_RX_MAX_JSON 256   // longest JSON message accepted, longer lengths are taken for corruption
+#define UART_RX_PREFIX 4       // JSON comes behind its length as 4 little endian bytes
+#define UART_RX_TIMEOUT_MS 50  // a message that stops arriving for this long is dropped
+#define UART_RX_MAX_TYPES 8    // frame types that can have a handler
+
+typedef enum { UART_RX_JSON, UART_RX_FRAMES } uart_rx_format_t;
+
+/* Called with a whole JSON message, which is NUL terminated */
+typedef void (*uart_rx_json_handler_t)(const char *json, size_t length, void *arg);
+/* Called with a whole telemetry frame */
+typedef void (*uart_rx_frame_handler_t)(const telemetry_frame_t *frame, void *arg);
+
+typedef struct {
+  uint32_t messages;  // dispatched, also those without a handler
+  uint32_t invalid;   // times the parser lost track: an impossible length, or not shaped like a JSON object
+  uint32_t skipped;   // bytes thrown away to find the next message
+  uint32_t timeouts;  // partial messages dropped after UART_RX_TIMEOUT_MS
+} uart_rx_stats_t;
+
+/*
+ * Receive state of one link, owned by the caller. Bytes can be fed in any split, a message is dispatched as soon as
+ * its last byte arrives. After corruption the parser moves on one byte at a time until something valid lines up.
+ */
+typedef struct {
+  uart_rx_format_t format;
+  uint8_t buffer[UART_RX_PREFIX + UART_RX_MAX_JSON + 1];  // room for the NUL
+  size_t received;
+  bool resyncing;  // throwing away bytes since the last message
+  telemetry_decoder_t frames;
+  uint64_t last_byte_us;
+  uart_rx_json_handler_t on_json;
+  void *json_arg;
+  uart_rx_frame_handler_t on_frame[UART_RX_MAX_TYPES];
+  void *frame_arg[UART_RX_MAX_TYPES];
+  uart_rx_stats_t stats;
+} uart_rx_t;
+
+/**
+ * @brief Starts without handlers and without anything received.
+ */
+void uart_rx_init(uart_rx_t *rx, uart_rx_format_t format);
+
+/**
+ * @brief Switches to the other format, whatever was partially received is dropped.
+ */
+void uart_rx_set_format(uart_rx_t *rx, uart_rx_format_t format);
+
+void uart_rx_on_json(uart_rx_t *rx, uart_rx_json_handler_t handler, void *arg);
+
+/**
+ * @return 0 if successful, 1 if type is UART_RX_MAX_TYPES or more
+ */
+bool uart_rx_on_frame(uart_rx_t *rx, uint8_t type, uart_rx_frame_handler_t handler, void *arg);
+
+/**
+ * @brief Parses bytes until a message was dispatched, so the caller can switch formats in between.
+ * A message left over from a resync is dispatched first, without consuming anything.
+ * @return The bytes consumed, less than length if a message was dispatched before the end
+ */
+size_t uart_rx_feed(uart_rx_t *rx, const uint8_t *data, size_t length);
+
+/**
+ * @brief Drops a partial message when no byte came for UART_RX_TIMEOUT_MS before now_us.
+ * @return true if something was dropped
+ */
+bool uart_rx_expire(uart_rx_t *rx, uint64_t now_us);
+
+/**
+ * @brief Feeds what the UART has received without waiting, up to the first whole message.
+ * @return true if a message was dispatched
+ */
+bool uart_rx_poll(uart_rx_t *rx, const int uart);
+
+#endif
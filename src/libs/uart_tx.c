@@ -0,0 +1,235 @@
+#include "uart_tx.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "measurements.h"
+
+typedef enum { CURRENT_NONE, CURRENT_RING, CURRENT_LATEST } current_t;
+
+/*
+ * Messages that are never dropped go into the ring, each behind a 2 byte length. The replaceable ones use two slots:
+ * the one being sent and the newest one waiting, which a newer message overwrites. Only whole messages are started,
+ * so the bytes of two messages never mix on the wire.
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t queued;   // wakes the drain thread
+  pthread_cond_t drained;  // wakes senders waiting for room and uart_tx_flush
+  const uart_tx_port_t *port;
+  bool initialised;
+  bool background;
+  bool running;
+  pthread_t thread;
+  uint8_t ring[UART_TX_RING_SIZE];
+  size_t head;  // only ever increases, position modulo the size
+  size_t tail;
+  uint8_t latest[2][UART_TX_MAX_MESSAGE];
+  size_t latest_length[2];
+  size_t sending;  // slot of the replaceable message on the wire
+  bool pending;    // the other slot waits to be sent
+  current_t current;
+  size_t remaining;  // bytes left of the message on the wire
+  size_t offset;     // next byte in the sending slot
+  uart_tx_stats_t stats;
+} tx_t;
+
+static const uart_tx_port_t uartlite = {.has_space = uart_has_space, .send = uart_send};
+
+static tx_t txs[NUM_UARTS] = {
+    [0 ... NUM_UARTS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER,
+                             .queued = PTHREAD_COND_INITIALIZER,
+                             .drained = PTHREAD_COND_INITIALIZER,
+                             .port = &uartlite}};
+
+static size_t depth(const tx_t *tx) {
+  size_t bytes = tx->head - tx->tail;
+  if (tx->pending) {
+    bytes += tx->latest_length[1 - tx->sending];
+  }
+  if (tx->current == CURRENT_LATEST) {
+    bytes += tx->remaining;
+  }
+  return bytes;
+}
+
+static size_t pump(const int uart, tx_t *tx) {
+  bool moved = false;
+  while (tx->port->has_space(uart)) {
+    if (tx->current == CURRENT_NONE) {
+      if (tx->head != tx->tail) {
+        tx->remaining = tx->ring[tx->tail % UART_TX_RING_SIZE] | tx->ring[(tx->tail + 1) % UART_TX_RING_SIZE] << 8;
+        tx->tail += 2;
+        tx->current = CURRENT_RING;
+      } else if (tx->pending) {
+        tx->sending = 1 - tx->sending;
+        tx->pending = false;
+        tx->offset = 0;
+        tx->remaining = tx->latest_length[tx->sending];
+        tx->current = CURRENT_LATEST;
+      } else {
+        break;
+      }
+    }
+    uint8_t byte = tx->current == CURRENT_RING ? tx->ring[tx->tail++ % UART_TX_RING_SIZE] : tx->latest[tx->sending][tx->offset++];
+    tx->port->send(uart, byte);
+    tx->stats.bytes++;
+    moved = true;
+    if (--tx->remaining == 0) {
+      tx->current = CURRENT_NONE;
+    }
+  }
+  if (moved) {
+    pthread_cond_broadcast(&tx->drained);
+  }
+  return depth(tx);
+}
+
+static void *drain(void *arg) {
+  const int uart = (intptr_t)arg;
+  tx_t *tx = &txs[uart];
+  pthread_mutex_lock(&tx->lock);
+  while (true) {
+    if (pump(uart, tx) == 0) {
+      if (!tx->running) {
+        break;
+      }
+      pthread_cond_wait(&tx->queued, &tx->lock);
+      continue;
+    }
+    /* The FIFO is full, come back before it runs dry */
+    pthread_mutex_unlock(&tx->lock);
+    usleep(UART_TX_POLL_US);
+    pthread_mutex_lock(&tx->lock);
+  }
+  pthread_mutex_unlock(&tx->lock);
+  return NULL;
+}
+
+bool uart_tx_init(const int uart, bool background) {
+  if (!(uart >= UART0 && uart < NUM_UARTS)) {
+    ERROR("Invalid UART %d", uart);
+    return 1;
+  }
+  tx_t *tx = &txs[uart];
+  pthread_mutex_lock(&tx->lock);
+  tx->head = tx->tail = 0;
+  tx->pending = false;
+  tx->current = CURRENT_NONE;
+  tx->stats = (uart_tx_stats_t){0};
+  tx->background = background;
+  tx->running = true;
+  tx->initialised = true;
+  bool err = background && pthread_create(&tx->thread, NULL, drain, (void *)(intptr_t)uart) != 0;
+  if (err) {
+    tx->initialised = false;
+    tx->running = false;
+    ERROR("Could not start the UART%d drain thread", uart);
+  }
+  pthread_mutex_unlock(&tx->lock);
+  return err;
+}
+
+void uart_tx_destroy(const int uart) {
+  tx_t *tx = &txs[uart];
+  uart_tx_flush(uart);
+  pthread_mutex_lock(&tx->lock);
+  bool joining = tx->initialised && tx->background;
+  tx->running = false;
+  tx->initialised = false;
+  pthread_cond_signal(&tx->queued);
+  pthread_mutex_unlock(&tx->lock);
+  if (joining) {
+    pthread_join(tx->thread, NULL);
+  }
+}
+
+void uart_tx_set_port(const int uart, const uart_tx_port_t *port) { txs[uart].port = port == NULL ? &uartlite : port; }
+
+bool uart_tx_send(const int uart, const uint8_t *data, size_t length, uart_tx_policy_t policy) {
+  tx_t *tx = &txs[uart];
+  if (length == 0) {
+    return 0;
+  }
+  if (policy == UART_TX_REPLACE ? length > UART_TX_MAX_MESSAGE : length + 2 > UART_TX_RING_SIZE) {
+    ERROR("Message of %zu bytes is too long", length);
+    return 1;
+  }
+  pthread_mutex_lock(&tx->lock);
+  if (!tx->initialised) {
+    pthread_mutex_unlock(&tx->lock);
+    for (size_t i = 0; i < length; i++) {
+      while (!tx->port->has_space(uart)) {
+      }
+      tx->port->send(uart, data[i]);
+    }
+    return 0;
+  }
+
+  if (policy == UART_TX_REPLACE) {
+    size_t slot = 1 - tx->sending;
+    tx->stats.replaced += tx->pending;
+    memcpy(tx->latest[slot], data, length);
+    tx->latest_length[slot] = length;
+    tx->pending = true;
+  } else {
+    bool waited = false;
+    while (UART_TX_RING_SIZE - (tx->head - tx->tail) < length + 2) {
+      waited = true;
+      if (tx->background) {
+        pthread_cond_wait(&tx->drained, &tx->lock);
+      } else if (pump(uart, tx) != 0) {
+        pthread_mutex_unlock(&tx->lock);
+        usleep(UART_TX_POLL_US);
+        pthread_mutex_lock(&tx->lock);
+      }
+    }
+    tx->stats.waits += waited;
+    tx->ring[tx->head++ % UART_TX_RING_SIZE] = length & 0xFF;
+    tx->ring[tx->head++ % UART_TX_RING_SIZE] = length >> 8;
+    for (size_t i = 0; i < length; i++) {
+      tx->ring[tx->head++ % UART_TX_RING_SIZE] = data[i];
+    }
+  }
+  tx->stats.messages++;
+  size_t bytes = depth(tx);
+  if (bytes > tx->stats.max_depth) {
+    tx->stats.max_depth = bytes;
+  }
+  pthread_cond_signal(&tx->queued);
+  pthread_mutex_unlock(&tx->lock);
+  return 0;
+}
+
+size_t uart_tx_pump(const int uart) {
+  tx_t *tx = &txs[uart];
+  pthread_mutex_lock(&tx->lock);
+  size_t bytes = tx->initialised ? pump(uart, tx) : 0;
+  pthread_mutex_unlock(&tx->lock);
+  return bytes;
+}
+
+void uart_tx_flush(const int uart) {
+  tx_t *tx = &txs[uart];
+  pthread_mutex_lock(&tx->lock);
+  while (tx->initialised && depth(tx) != 0) {
+    if (tx->background) {
+      pthread_cond_wait(&tx->drained, &tx->lock);
+    } else if (pump(uart, tx) != 0) {
+      pthread_mutex_unlock(&tx->lock);
+      usleep(UART_TX_POLL_US);
+      pthread_mutex_lock(&tx->lock);
+    }
+  }
+  pthread_mutex_unlock(&tx->lock);
+}
+
+uart_tx_stats_t uart_tx_stats(const int uart) {
+  tx_t *tx = &txs[uart];
+  pthread_mutex_lock(&tx->lock);
+  uart_tx_stats_t stats = tx->stats;
+  stats.depth = depth(tx);
+  pthread_mutex_unlock(&tx->lock);
+  return stats;
+}
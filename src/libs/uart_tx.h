@@ -0,0 +1,70 @@
+#ifndef UART_TX_H_
+#define UART_TX_H_
+#include <libpynq.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define UART_TX_RING_SIZE 2048    // bytes of messages that are never dropped, per UART
+#define UART_TX_MAX_MESSAGE 264   // longest message, a JSON_BUFFER_SIZE message with its length prefix
+#define UART_TX_FIFO_DEPTH 16     // of the uartlite
+#define UART_TX_POLL_US 500       // the 16 byte FIFO takes ~1.4 ms to drain at 115200 baud, so it never runs dry
+
+typedef enum {
+  UART_TX_KEEP,     // never dropped, the sender waits when the ring is full
+  UART_TX_REPLACE,  // only the newest one waiting is sent, e.g. position updates
+} uart_tx_policy_t;
+
+typedef struct {
+  size_t depth;      // bytes queued now, the replaceable message included
+  size_t max_depth;  // most bytes that were ever queued
+  uint32_t messages;
+  uint32_t replaced;  // replaceable messages dropped for a newer one
+  uint32_t waits;     // sends that had to wait for room in the ring
+  uint64_t bytes;     // handed to the FIFO
+} uart_tx_stats_t;
+
+/* Where the bytes go, the uartlite FIFO unless replaced for testing */
+typedef struct {
+  bool (*has_space)(const int uart);
+  void (*send)(const int uart, const uint8_t data);
+} uart_tx_port_t;
+
+/**
+ * @brief Starts queueing sends on an initialised UART.
+ * @param background Drain the queue on a thread, otherwise uart_tx_pump has to be called regularly.
+ * @return 0 if successful, 1 on error
+ */
+bool uart_tx_init(const int uart, bool background);
+
+/**
+ * @brief Sends what is still queued and stops the drain thread.
+ */
+void uart_tx_destroy(const int uart);
+
+/**
+ * @brief Replaces the uartlite, before uart_tx_init. NULL puts the uartlite back.
+ */
+void uart_tx_set_port(const int uart, const uart_tx_port_t *port);
+
+/**
+ * @brief Queues a whole message, which goes out without other messages in between. Messages of each policy keep their
+ * order, UART_TX_KEEP ones go first. Without uart_tx_init the message is sent right away.
+ * @return 0 if successful, 1 if the message is longer than the ring or UART_TX_MAX_MESSAGE for UART_TX_REPLACE
+ */
+bool uart_tx_send(const int uart, const uint8_t *data, size_t length, uart_tx_policy_t policy);
+
+/**
+ * @brief Fills the FIFO from the queue without waiting.
+ * @return The bytes still queued
+ */
+size_t uart_tx_pump(const int uart);
+
+/**
+ * @brief Waits until everything queued is in the FIFO.
+ */
+void uart_tx_flush(const int uart);
+
+uart_tx_stats_t uart_tx_stats(const int uart);
+
+#endif
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <libpynq.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stepper.h>
 #include <string.h>
@@ -8,10 +9,19 @@
 #include "buttons.h"
 #include "libs/TCS3472.h"
 #include "libs/VL53L0X.h"
+#include "libs/calibration.h"
 #include "libs/comms.h"
+#include "libs/i2c.h"
+#include "libs/i2c_async.h"
+#include "libs/i2c_trace.h"
 #include "libs/measurements.h"
 #include "libs/movement.h"
 #include "libs/navigation.h"
+#include "libs/scheduler.h"
+#include "libs/sensor_manager.h"
+#include "libs/sensor_recovery.h"
+#include "libs/timeline.h"
+#include "libs/uart_tx.h"
 #include "settings.h"
 #include "src/libs/TCS3472.h"
 #include "src/libs/vtypes.h"
@@ -42,23 +52,52 @@ void setup_pins(void) {
 
   iic_init(IIC0);
   iic_init(IIC1);
+#ifdef I2C_TRACE
+  i2c_trace_enable(true);
+#endif
 
   uart_init(UART0);
   uart_reset_fifos(UART0);
-  sleep_msec(1000);
+  // Telemetry goes out in the background, the navigation thread does not wait for the UART
+  uart_tx_init(UART0, true);
 
   for (size_t i = 0; i < sizeof(distance_sensor_x_pins); ++i) {
     gpio_set_direction(distance_sensor_x_pins[i], GPIO_DIR_OUTPUT);
     gpio_set_level(distance_sensor_x_pins[i], GPIO_LEVEL_LOW);
   }
 
+#ifdef VL53L0X_USE_INTERRUPT
+  gpio_interrupt_init();
+#endif
+
   gpio_set_direction(COLOR_SENSOR_X_PIN, GPIO_DIR_OUTPUT);
   gpio_set_level(COLOR_SENSOR_X_PIN, GPIO_LEVEL_LOW);
 
-  sleep_msec(SLEEP_TIME);
+  // Keep the sensors in reset long enough to actually power down
+  sleep_msec(XSHUT_HOLD_MS);
 }
 
 void cleanup_pin(void) {
+  uart_tx_stats_t tx = uart_tx_stats(UART0);
+  LOG("UART0: %u messages, %llu bytes, %zu queued at most, %u replaced, %u waits", tx.messages,
+      (unsigned long long)tx.bytes, tx.max_depth, tx.replaced, tx.waits);
+  uart_tx_destroy(UART0);
+  publisher_stats_t sent = send_stats();
+  LOG("Telemetry: %u state, %u position, %u obstacle updates in %u bytes, %u unchanged, %u merged, %u deferred, "
+      "%u dropped, %u over the budget",
+      sent.sent[PUBLISH_STATE], sent.sent[PUBLISH_POSITION], sent.sent[PUBLISH_OBSTACLE],
+      sent.bytes[PUBLISH_STATE] + sent.bytes[PUBLISH_POSITION] + sent.bytes[PUBLISH_OBSTACLE], sent.unchanged,
+      sent.merged, sent.deferred, sent.dropped, sent.overdrawn);
+  i2c_async_stop(IIC0);
+  i2c_async_stop(IIC1);
+  if (i2c_trace_enabled() && !i2c_trace_dump(I2C_TRACE_PATH)) {
+    LOG("I2C trace written to %s", I2C_TRACE_PATH);
+  }
+  for (iic_index_t iic = IIC0; iic < NUM_IICS; ++iic) {
+    iic_stats_t stats = iic_get_stats(iic);
+    LOG("IIC%d: %u spins, %u backoffs, %u timeouts, %u recoveries", iic, stats.spins, stats.backoffs, stats.timeouts,
+        stats.recoveries);
+  }
   for (size_t i = 0; i < sizeof(distance_sensor_x_pins); ++i) {
     gpio_set_level(distance_sensor_x_pins[i], GPIO_LEVEL_LOW);
   }
@@ -67,35 +106,6 @@ void cleanup_pin(void) {
   }
 }
 
-vl53l0x_t **init_distance_sensors(size_t count) {
-  assert(sizeof(distance_sensor_x_pins) <= count);
-  vl53l0x_t **sensors = malloc(sizeof(**sensors) * count);
-  memset(sensors, 0, count);
-  for (size_t i = 0; i < count; ++i) {
-    uint8_t fail_counter = 0;
-    gpio_set_level(distance_sensor_x_pins[i], GPIO_LEVEL_HIGH);
-    sleep_msec(SLEEP_TIME);
-    sensors[i] = vl53l0x_init();
-    if (sensors[i] == NULL) {
-      sleep_msec(SLEEP_TIME);
-      ERROR("Could not initialise sensor %zu on pin %d", i, distance_sensor_x_pins[i]);
-      exit(1);
-    }
-    LOG("Sensor %d on pin %d initialised", i, distance_sensor_x_pins[i]);
-    sleep_msec(SLEEP_TIME);
-    fail_counter = 0;
-    while (vl53l0x_change_address(sensors[i], INITIAL_ADDRESS - i)) {
-      if (fail_counter >= MAX_FAILS) {
-        ERROR("Could not change address of big BOTTOM to 0x32");
-        exit(1);
-      }
-      sleep_msec(SLEEP_TIME);
-    }
-    LOG("Address changed for sensor %d to %d", i, INITIAL_ADDRESS - i);
-  }
-  return sensors;
-}
-
 void destroy_distance_sensors(vl53l0x_t **sensors) {
   if (sensors == NULL) {
     return;
@@ -106,36 +116,175 @@ void destroy_distance_sensors(vl53l0x_t **sensors) {
   free(sensors);
 }
 
-tcs3472_t **init_color_sensors(size_t count) {
-  tcs3472_t **sensors = malloc(sizeof(**sensors) * count);  // Possible BUG
-  memset(sensors, 0, count);
+typedef struct {
+  size_t index;
+  uint8_t address;
+  iic_index_t iic;
+  vl53l0x_t *sensor;
+} distance_job_t;
+
+typedef struct {
+  size_t index;
+  tcs3472_t *sensor;
+} color_job_t;
+
+/* Everything after readdressing only talks to the sensor's own address, so it can run next to other work */
+void *init_distance_sensor(void *arg) {
+  distance_job_t *job = arg;
+  size_t phase = timeline_begin("distance %zu init", job->index);
+  job->sensor = vl53l0x_init_at(job->address, job->iic);
+  if (job->sensor == NULL) {
+    ERROR("Could not initialise distance sensor %zu on pin %d", job->index, distance_sensor_x_pins[job->index]);
+    timeline_end(phase);
+    return NULL;
+  }
+#ifdef VL53L0X_USE_INTERRUPT
+  vl53l0x_use_interrupt(job->sensor, distance_sensor_gpio1_pins[job->index]);
+#endif
+  if (vl53l0x_start_continuous(job->sensor, 0)) {
+    ERROR("Could not start continuous ranging on sensor %zu", job->index);
+    vl53l0x_destroy(job->sensor);
+    job->sensor = NULL;
+    timeline_end(phase);
+    return NULL;
+  }
+  LOG("Distance sensor %zu initialised on 0x%02x", job->index, job->address);
+  timeline_end(phase);
+  return NULL;
+}
+
+void *init_color_sensor(void *arg) {
+  color_job_t *job = arg;
+  iic_index_t iic = color_sensor_buses[job->index];
+  size_t phase = timeline_begin("color %zu init (IIC%d)", job->index, iic);
 
-  for (size_t i = 0; i < count; ++i) {
-    uint8_t fail_counter = 0;
-    if (IIC0 + i == IIC0) {
-      gpio_set_level(COLOR_SENSOR_X_PIN, GPIO_LEVEL_HIGH);
-      sleep_msec(SLEEP_TIME);
+  uint64_t deadline = get_time_usec() + SENSOR_BOOT_TIMEOUT_MS * 1000;
+  while ((job->sensor = tcs3472_init(iic)) == NULL && get_time_usec() < deadline) {
+    sleep_msec(1);
+  }
+  if (job->sensor == NULL) {
+    ERROR("Could not initialise color sensor %zu on IIC %d", job->index, iic);
+    timeline_end(phase);
+    return NULL;
+  }
+  uint8_t fail_counter = 0;
+  while (tcs3472_enable(job->sensor)) {
+    if (++fail_counter >= MAX_FAILS) {
+      ERROR("Could not enable color sensor %zu on IIC %d", job->index, iic);
+      tcs3472_destroy(job->sensor);
+      job->sensor = NULL;
+      timeline_end(phase);
+      return NULL;
     }
-    sensors[i] = tcs3472_init(IIC0 + i);
-    if (sensors[i] == NULL) {
-      sleep_msec(SLEEP_TIME);
-      ERROR("Could not initialise sensor %zu on IIC %d", i, i + IIC0);
-      exit(1);
+    sleep_msec(1);
+  }
+  LOG("Color sensor %zu enabled on IIC %d", job->index, iic);
+  timeline_end(phase);
+  return NULL;
+}
+
+typedef struct {
+  distance_job_t *jobs;
+  pthread_t *threads;
+  bool *started;
+} distance_start_t;
+
+/* Runs as soon as a distance sensor has its own address, while the next one is still being moved */
+static void start_distance_sensor(size_t index, bool err, void *arg) {
+  distance_start_t *start = arg;
+  if (err) {
+    ERROR("Could not move distance sensor %zu on pin %d to 0x%02x", index, distance_sensor_x_pins[index],
+          start->jobs[index].address);
+    return;
+  }
+  LOG("Address changed for sensor %zu to 0x%02x", index, start->jobs[index].address);
+  start->started[index] = pthread_create(&start->threads[index], NULL, init_distance_sensor, &start->jobs[index]) == 0;
+}
+
+/*
+ * Brings up all sensors, overlapping what does not depend on each other:
+ *  - color sensors on a bus without distance sensors start right away
+ *  - distance sensors all boot on the default address, so they are released from XSHUT one by one,
+ *    but each one is initialised in its own thread as soon as it has its final address
+ *  - color sensors sharing the default address on a bus are enabled once all distance sensors moved away
+ */
+void init_sensors(vl53l0x_t ***distance_sensors, size_t distance_count, tcs3472_t ***color_sensors, size_t color_count) {
+  assert(distance_count <= sizeof(distance_sensor_x_pins));
+  // NULL terminated for the destroy functions
+  vl53l0x_t **distance = calloc(distance_count + 1, sizeof(*distance));
+  tcs3472_t **color = calloc(color_count + 1, sizeof(*color));
+  distance_job_t distance_jobs[distance_count];
+  color_job_t color_jobs[color_count];
+  pthread_t distance_threads[distance_count];
+  pthread_t color_threads[color_count];
+  size_t sensors_phase = timeline_begin("sensors");
+
+  assert(distance_count <= sizeof(distance_sensor_buses) / sizeof(distance_sensor_buses[0]));
+  assert(color_count <= sizeof(color_sensor_buses) / sizeof(color_sensor_buses[0]));
+  bool deferred[color_count];
+  for (size_t i = 0; i < color_count; ++i) {
+    color_jobs[i] = (color_job_t){.index = i, .sensor = NULL};
+    deferred[i] = shares_bus_with_distance(color_sensor_buses[i], distance_count);
+    if (!deferred[i]) {
+      if (i == FORWARD_LOOKING) {
+        gpio_set_level(COLOR_SENSOR_X_PIN, GPIO_LEVEL_HIGH);
+      }
+      pthread_create(&color_threads[i], NULL, init_color_sensor, &color_jobs[i]);
     }
-    LOG("Sensor %d on pin %d initialised", i, COLOR_SENSOR_X_PIN);
-    sleep_msec(SLEEP_TIME);
-    fail_counter = 0;
-    while (tcs3472_enable(sensors[i])) {
-      if (fail_counter >= MAX_FAILS) {
-        ERROR("Could not enable sensor %d on IIC0 %d and pin %d", i, IIC0 + i, COLOR_SENSOR_X_PIN);
-        exit(1);
+  }
+
+  size_t phase = timeline_begin("distance readdress");
+  vl53l0x_slot_t slots[distance_count];
+  for (size_t i = 0; i < distance_count; ++i) {
+    distance_jobs[i] = (distance_job_t){
+        .index = i, .address = INITIAL_ADDRESS - i, .iic = distance_sensor_buses[i], .sensor = NULL};
+    slots[i] = (vl53l0x_slot_t){
+        .xshut_pin = distance_sensor_x_pins[i], .address = distance_jobs[i].address, .iic = distance_jobs[i].iic};
+  }
+  bool started[distance_count];
+  memset(started, 0, sizeof(started));
+  distance_start_t start = {.jobs = distance_jobs, .threads = distance_threads, .started = started};
+  vl53l0x_assign_addresses(slots, distance_count, start_distance_sensor, &start);
+  timeline_end(phase);
+
+  for (size_t i = 0; i < color_count; ++i) {
+    if (deferred[i]) {
+      if (i == FORWARD_LOOKING) {
+        gpio_set_level(COLOR_SENSOR_X_PIN, GPIO_LEVEL_HIGH);
       }
-      sleep_msec(SLEEP_TIME);
+      init_color_sensor(&color_jobs[i]);
+    }
+  }
+
+  /* Sensors that did not come up start out quarantined, the sensor manager keeps trying to bring them up */
+  for (size_t i = 0; i < distance_count; ++i) {
+    if (started[i]) {
+      pthread_join(distance_threads[i], NULL);
+    }
+    distance[i] = distance_jobs[i].sensor;
+    if (distance[i] == NULL) {
+      distance[i] = vl53l0x_create(distance_jobs[i].address, distance_jobs[i].iic);
+#ifdef VL53L0X_USE_INTERRUPT
+      vl53l0x_use_interrupt(distance[i], distance_sensor_gpio1_pins[i]);
+#endif
+      sensor_health_quarantine(&distance[i]->health);
     }
-    LOG("Sensor %d enabled on IIC %d", i, IIC0 + i);
   }
-  return sensors;
+  for (size_t i = 0; i < color_count; ++i) {
+    if (!deferred[i]) {
+      pthread_join(color_threads[i], NULL);
+    }
+    color[i] = color_jobs[i].sensor;
+    if (color[i] == NULL) {
+      color[i] = tcs3472_create(color_sensor_buses[i]);
+      sensor_health_quarantine(&color[i]->health);
+    }
+  }
+  timeline_end(sensors_phase);
+  *distance_sensors = distance;
+  *color_sensors = color;
 }
+
 void destroy_color_sensors(tcs3472_t **sensors) {
   if (sensors == NULL) {
     return;
@@ -146,30 +295,89 @@ void destroy_color_sensors(tcs3472_t **sensors) {
   free(sensors);
 }
 
+static size_t managed_ids[VL53L0X_SENSOR_COUNT + 2];
+static const char *const sensor_names[] = {"distance low", "distance middle", "distance high", "color front", "color down"};
+static const uint32_t sensor_capabilities[] = {NAV_RANGE_LOW, NAV_RANGE_MIDDLE, NAV_RANGE_HIGH, NAV_COLOR_FRONT, NAV_COLOR_DOWN};
+_Static_assert(VL53L0X_LOW == 0 && VL53L0X_MIDDLE == 1 && VL53L0X_HIGH == 2 && VL53L0X_SENSOR_COUNT == 3,
+               "sensor_names and sensor_capabilities list the distance sensors in this order");
+_Static_assert(FORWARD_LOOKING == 0 && DOWN_LOOKING == 1, "sensor_names and sensor_capabilities list the color sensors in this order");
+
+static void start_sensor_manager(vl53l0x_t **distance, tcs3472_t **color) {
+  sensor_recovery_init(distance, color);
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT; ++i) {
+    managed_ids[i] = sensor_manager_add(sensor_names[i], &distance[i]->health, sensor_recovery_distance, distance[i],
+                                        sensor_capabilities[i]);
+  }
+  for (size_t i = 0; i < 2; ++i) {
+    managed_ids[VL53L0X_SENSOR_COUNT + i] =
+        sensor_manager_add(sensor_names[VL53L0X_SENSOR_COUNT + i], &color[i]->health, sensor_recovery_color, color[i],
+                           sensor_capabilities[VL53L0X_SENSOR_COUNT + i]);
+  }
+  if (sensor_manager_start()) {
+    ERROR("Quarantined sensors will not come back");
+  }
+}
+
+static void stop_sensor_manager(void) {
+  for (size_t i = 0; i < VL53L0X_SENSOR_COUNT + 2; ++i) {
+    sensor_stats_t stats = sensor_manager_stats(managed_ids[i]);
+    LOG("Sensor %s: %u errors, %u probes, %u recoveries%s", sensor_names[i], stats.errors, stats.probes,
+        stats.recoveries, stats.quarantined ? ", quarantined" : "");
+  }
+  sensor_manager_stop();
+}
+
 ////////
 
 int main(void) {
+  timeline_reset();
+  size_t phase = timeline_begin("pynq init");
   pynq_init();
   buttons_init();
   switches_init();
   get_name();
+  timeline_end(phase);
+
+  phase = timeline_begin("pins");
   setup_pins();
+  timeline_end(phase);
 
+  phase = timeline_begin("steppers");
   stepper_init();
   stepper_enable();
   stepper_set_speed(STEPPER_SPEED, STEPPER_SPEED);
-
-  vl53l0x_t **distance_sensors = init_distance_sensors(3);
-  tcs3472_t **color_sensors = init_color_sensors(2);
+  timeline_end(phase);
+
+  vl53l0x_t **distance_sensors = NULL;
+  tcs3472_t **color_sensors = NULL;
+  init_sensors(&distance_sensors, VL53L0X_SENSOR_COUNT, &color_sensors, 2);
+  start_sensor_manager(distance_sensors, color_sensors);
+
+  // Color sensors keep pointing into the store
+  static calibration_store_t calibration;
+  phase = timeline_begin("calibration load");
+  bool calibrated = !calibration_load(CALIBRATION_PATH, &calibration) &&
+                    !calibration_is_stale(&calibration, CALIBRATION_MAX_AGE_S) &&
+                    !calibration_apply(&calibration, distance_sensors, VL53L0X_SENSOR_COUNT, color_sensors, 2);
+  timeline_end(phase);
+  timeline_print();
 
   // send_ready_message(name);
   send_ready_status();
   LOG("READY!\nWAITING TO START");
   while (!recv_start_status() && !should_die());
-  LOG("CALIBRATING SENSORS");
 
   if (!should_die()) {
-    vl53l0x_calibration_dance(distance_sensors, VL53L0X_SENSOR_COUNT, CALIBRATION_MATRIX);
+    if (calibrated) {
+      LOG("Using calibration from %s", CALIBRATION_PATH);
+    } else if (!navig_can(NAV_RANGE_ALL)) {
+      LOG("Not all distance sensors available, running uncalibrated");
+    } else {
+      LOG("CALIBRATING SENSORS");
+      vl53l0x_calibration_dance(distance_sensors, VL53L0X_SENSOR_COUNT, CALIBRATION_MATRIX);
+      calibration_capture(&calibration, distance_sensors, VL53L0X_SENSOR_COUNT, color_sensors, 2);
+      calibration_save(CALIBRATION_PATH, &calibration);
+    }
     m_turn_degrees(90, left);
   }
   position_t pos = {0.0, 0.0, 90.0};
@@ -184,14 +392,25 @@ int main(void) {
   obstacle.color = COLOR_COUNT;
 
   while (!should_die()) {  // exploration should work as follows:
+    // Driving blind could take the rover over a border or into a crater
+    if (!navig_can(NAV_COLOR_DOWN)) {
+      LOG("Waiting for the downward color sensor");
+      sleep_msec(SENSOR_PROBE_MIN_MS);
+      continue;
+    }
     robot_t robot = {obstacle.x, obstacle.y, IDLE};
     send_msg(obstacle, robot);
 
     LOG("Sending complete!\nType: %d\nColor: %s\nx: %f, y: %f\n", obstacle.type, COLOR_NAME((size_t)obstacle.color), obstacle.x,
         obstacle.y);
 
-    color_t front = tcs3472_determine_color(color_sensors[FORWARD_LOOKING]);
-    color_t down = tcs3472_determine_color(color_sensors[DOWN_LOOKING]);
+    /* Both conversions run at the same time when the sensors are on different buses */
+    color_read_t front_read = {.sensor = color_sensors[FORWARD_LOOKING], .color = COLOR_COUNT};
+    color_read_t down_read = {.sensor = color_sensors[DOWN_LOOKING]};
+    sensor_job_t color_jobs[] = {scheduler_color_job(&down_read), scheduler_color_job(&front_read)};
+    scheduler_run(color_jobs, navig_can(NAV_COLOR_FRONT) ? 2 : 1);
+    color_t front = front_read.color;
+    color_t down = down_read.color;
     LOG("Downwards color %s", COLOR_NAME(down));
     LOG("Front color %s", COLOR_NAME(front));
 
@@ -232,6 +451,7 @@ int main(void) {
 
   stepper_reset();
 
+  stop_sensor_manager();
   destroy_color_sensors(color_sensors);
   destroy_distance_sensors(distance_sensors);
   cleanup_pin();
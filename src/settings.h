@@ -3,27 +3,77 @@
 #include <libpynq.h>
 #include <stdint.h>
 
+#include "libs/color_classifier.h"
+
 #define DEBUG
 
 #define FORWARD_LOOKING 0
 #define DOWN_LOOKING 1
 
 static const uint8_t distance_sensor_x_pins[] = {IO_AR6, IO_AR7, IO_AR8};
+/*
+ * Which AXI IIC controller every sensor is wired to, sensors on different buses are read at the same time.
+ * A TCS3472 has a fixed address, so one per bus. Distance sensors boot on that same address, so a color sensor
+ * sharing a bus with them is brought up after they moved away and needs an XSHUT pin (only the forward one has).
+ */
+static const iic_index_t distance_sensor_buses[] = {IIC0, IIC0, IIC0};
+static const iic_index_t color_sensor_buses[] = {IIC0, IIC1};  // by FORWARD_LOOKING and DOWN_LOOKING
+// GPIO1 (new sample ready) lines of the distance sensors, define VL53L0X_USE_INTERRUPT once they are wired
+// #define VL53L0X_USE_INTERRUPT
+static const uint8_t distance_sensor_gpio1_pins[] = {IO_AR11, IO_AR12, IO_AR13};
 #define COLOR_SENSOR_X_PIN IO_AR10
 
 typedef enum { VL53L0X_LOW, VL53L0X_MIDDLE, VL53L0X_HIGH, VL53L0X_SENSOR_COUNT } VL53L0X_SENOSR_NAMES;
+// Every distance sensor has an XSHUT pin, a bus, a GPIO1 pin and an offset, add them together
+_Static_assert(sizeof(distance_sensor_x_pins) == VL53L0X_SENSOR_COUNT, "one XSHUT pin per distance sensor");
+_Static_assert(sizeof(distance_sensor_buses) / sizeof(distance_sensor_buses[0]) == VL53L0X_SENSOR_COUNT,
+               "one bus per distance sensor");
+_Static_assert(sizeof(distance_sensor_gpio1_pins) == VL53L0X_SENSOR_COUNT, "one GPIO1 pin per distance sensor");
 
 static const float CALIBRATION_MATRIX[] = {50, 70, 100, 150, 200, 0}; // SHOULD BE ZERO TERMINATED
 #define MEASUREMENT_COUNT 5
+#define CALIBRATION_PATH "/home/student/.calibration"  // next to /home/student/.name
+#define CALIBRATION_MAX_AGE_S (7 * 24 * 3600)         // older calibrations are redone
 
 #define MAX_FAILS 16
 #define INITIAL_ADDRESS 0x69
+// mm, by sensor index (address INITIAL_ADDRESS - index). The high sensor is accurate but has a setback because of
+// the robot angle. Overridden by the calibration store.
+static const int16_t distance_sensor_offsets[] = {5, -10, -45};
+_Static_assert(sizeof(distance_sensor_offsets) / sizeof(distance_sensor_offsets[0]) == VL53L0X_SENSOR_COUNT,
+               "one offset per distance sensor");
+// Record every I2C transaction and write them with latency histograms to I2C_TRACE_PATH on shutdown
+// #define I2C_TRACE
+#define I2C_TRACE_PATH "/home/student/i2c_trace.csv"
+// Write every robot and obstacle update to TELEMETRY_RECORD_PATH, publisher_bench replays the file
+// #define TELEMETRY_RECORD
+#define TELEMETRY_RECORD_PATH "/home/student/telemetry.csv"
 #define SLEEP_TIME 50
+#define XSHUT_HOLD_MS 2             // how long sensors are kept in reset before bring-up
+#define SENSOR_BOOT_TIMEOUT_MS 100  // deadline for a sensor to answer after leaving reset
+
+#define TCS3472_READING_COUNT 1             // fresh conversions averaged per color decision
+#define TCS3472_INTEGRATION_TIME_US 470400  // ATIME 60, color thresholds are tuned for this
+#define TCS3472_TIMEOUT_MARGIN_US 20000
 
-#define BLACK_TRESHOLD 1600
-#define WHITE_TRESHOLD 16000
-#define TRESHHOLD 0.5
-#define TCS3472_READING_COUNT 12
+// Color thresholds in raw counts at TCS3472_INTEGRATION_TIME_US, indexed by FORWARD_LOOKING and DOWN_LOOKING
+static const color_calibration_t COLOR_CALIBRATION[] = {
+    {
+        .mode = COLOR_MODE_THRESHOLDS,
+        .black_below = 1500,
+        .white_above = 5340,
+        .band_count = 3,
+        .bands = {{10, 25, RED}, {90, 100, GREEN}, {175, 200, BLUE}},
+        .fallback = WHITE,
+        .brightness_shift = 4,
+    },
+    {
+        .mode = COLOR_MODE_THRESHOLDS,
+        .black_below = 4500,
+        .fallback = WHITE,
+        .brightness_shift = 4,
+    },
+};
 
 #define MAX_DISTANCE_TO_OBSTACLE 4000  // mm (To be tested) // FIX THING IN navig_start_moving
 #define MIN_DISTANCE_TO_OBSTACLE 50    // mm (To be tested)
@@ -34,6 +84,8 @@ static const float CALIBRATION_MATRIX[] = {50, 70, 100, 150, 200, 0}; // SHOULD
 #define OBST_SCAN_ANGLE 15  // Degrees turned in each step (To be tested)
 
 #define VL53L0X_READING_COUNT 5
+#define SCAN_TIMING_BUDGET_US 20000       // fast sweeps in scanScope
+#define APPROACH_TIMING_BUDGET_US 200000  // accurate readings while approaching in scanHillOrRock
 
 #define STEPPER_SPEED 50000
 